@@ -0,0 +1,1311 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+#include "bench.h"
+
+//------------------------------------------------------------------------------
+//                                  BENCH
+//------------------------------------------------------------------------------
+//
+//  Checks the RFC 6238 Appendix B test vectors, measures each stage of
+//  calculating a code separately, and compares the OpenSSL libcrypto and
+//  built-in SHA digest implementations (see libtotp_sha.cpp) as well as
+//  the totp programs themselves, both per code and per process:
+//
+//  RFC 6238: every Appendix B vector is checked using each digest
+//  implementation (plain and with midstates) and each batch kernel.
+//  Any failure makes bench exit with EXIT_FAILURE (after the rest of
+//  the benchmark has run), so "make benchmark" fails too.
+//
+//  Per stage: for each digest, on BENCH_LINES synthetic input lines:
+//  finding the lines (memchr, as totp does), parsing them (which is
+//  mostly the base32 decode), parsing them when the SECRET has Google
+//  Authenticator style blanks every 4 characters (so the difference is
+//  the cost of skipping them), and precomputing the midstates; then for
+//  6 to 10 digits: the dynamic truncation and decimal formatting.
+//
+//  Per code: the time taken to calculate one code for each digest using
+//  OpenSSL's one-shot HMAC() (as the original totp.c did), and libtotp's
+//  own HMAC using each digest implementation, both plain and with the
+//  precomputed midstates.
+//
+//  Per process: the average wall clock time it takes to run each of the
+//  given totp executables (default "./totp", "./totp-builtin" and the
+//  original "./totp-c", i.e. the OpenSSL, "make totp-builtin" and the
+//  "make totp-c" builds) on the given input file (default "stdin.txt"),
+//  i.e. the latency a program which spawns totp once per login would
+//  see, dominated by process startup.
+//
+//  End to end: the lines per second each of the same programs achieves
+//  on synthetic input files of 1K, 10K, ... up to 'max' secrets (default
+//  BENCH_MAX_SECRETS; -m 10000000 for 10M), the digests and 6/7/8 digits
+//  cycling from line to line. Regressions between totp.c and totp.cpp
+//  show up here. The files are written to the current directory and
+//  removed again afterwards.
+//
+//  Resync: how long totp_resync takes to search BENCH_RESYNC counters
+//  either side for two consecutive codes at the far end of the window
+//  (i.e. the worst case, short of no match at all), for each digest,
+//  with one thread and with one per CPU.
+//
+//  Replay cache: verifications per second using totp_verify_once with
+//  one shared replay cache, and the cache's own checks per second, for
+//  1, 2, 4, ... BENCH_THREADS threads, every thread trying every one of
+//  BENCH_USERS secrets' codes: exactly one try of each must be accepted
+//  and all the others rejected as replays, or bench fails.
+//
+//  Allocations: the number of heap and secure memory allocations the
+//  first totp program reports (via --stats) when it's run by itself,
+//  with --batch and with --threads, on synthetic input of BENCH_ALLOCS
+//  and of ten times as many secrets, both memory mapped and piped. Once
+//  it's warmed up, a bulk run must not allocate anything at all, so if
+//  the larger input needs any more allocations than the smaller one,
+//  bench fails. (Skipped if the program has no --stats.)
+//
+//  Usage:  bench [-n count] [-m max] [input-file [totp-program ...]]
+//
+//------------------------------------------------------------------------------
+
+#define BENCH_CODES     200000      // (codes per per-code measurement)
+#define BENCH_SPAWNS    200         // (default runs per program)
+#define BENCH_LINES     100000      // (lines per per-stage measurement)
+#define BENCH_MAX_SECRETS 1000000   // (default largest end to end input)
+#define BENCH_MIN_SECS  0.5         // (end to end: repeat runs until...)
+#define BENCH_FILE      "bench.tmp" // (end to end synthetic input file)
+#define BENCH_RESYNC    10000       // (resync: counters either side)
+#define BENCH_USERS     100000      // (replay cache: distinct secrets)
+#define BENCH_THREADS   16          // (replay cache: most threads)
+#define BENCH_TIME      1700000000  // (replay cache: time verified at)
+#define BENCH_ALLOCS    100000      // (allocations: smaller input's secrets)
+#define BENCH_STATS     "bench.stats"   // (allocations: --stats=FILE)
+#define BENCH_CTRS      "bench.ctrs"    // (counter log recovery checks)
+
+#ifdef _WIN32
+  #define BENCH_PROGS   { ".\\totp.exe", ".\\totp-builtin.exe", ".\\totp-c.exe" }
+#else
+  #include <sys/wait.h>             // (need waitpid)
+  #include <fcntl.h>                // (need open)
+  #define BENCH_PROGS   { "./totp", "./totp-builtin", "./totp-c" }
+#endif
+
+static const char* bench_secrets[ TOTP_NUM_DIGESTS ] =
+{
+    "SHA1:GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ:8",
+    "SHA256:GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZA:8",
+    "SHA512:GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNA:8",
+};
+
+// RFC 6238 Appendix B: the codes for each of the above secrets (whose
+// keys are the RFC's "1234567890..." seeds) at each of these times...
+
+static const struct { int64_t time; uint32_t codes[ TOTP_NUM_DIGESTS ]; } rfc6238[] =
+{
+    {          59LL, { 94287082, 46119246, 90693936 }},
+    {  1111111109LL, {  7081804, 68084774, 25091201 }},
+    {  1111111111LL, { 14050471, 67062674, 99943326 }},
+    {  1234567890LL, { 89005924, 91819424, 93441116 }},
+    {  2000000000LL, { 69279037, 90698825, 38618901 }},
+    { 20000000000LL, { 65353130, 77737706, 47863826 }},
+};
+
+#define RFC6238_VECTORS  (sizeof( rfc6238 ) / sizeof( rfc6238[0] ))
+
+static volatile uint32_t g_sink;    // (so codes aren't optimized away)
+
+//---------------------------------------------------------------------
+//                              now
+//---------------------------------------------------------------------
+
+static double now()                 // (seconds, monotonic)
+{
+#ifdef _WIN32
+    LARGE_INTEGER  freq, count;
+
+    QueryPerformanceFrequency( &freq );
+    QueryPerformanceCounter( &count );
+    return (double) count.QuadPart / (double) freq.QuadPart;
+#else
+    struct timespec  ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+//---------------------------------------------------------------------
+//                           bench_hotp
+//---------------------------------------------------------------------
+
+static void bench_hotp( const char* label, const totp_secret* s )
+{
+    double    start, secs;
+    uint32_t  i;
+
+    start = now();
+
+    for (i=0; i < BENCH_CODES; i++)
+        g_sink += totp_hotp( s, i );
+
+    secs = now() - start;
+
+    printf( "  %-8s %-24s %8.1f ns/code\n", totp_digest_name( s->digest ),
+        label, secs * 1e9 / BENCH_CODES );
+}
+
+#ifndef TOTP_BUILTIN_SHA
+
+//---------------------------------------------------------------------
+//                         bench_openssl_hmac
+//---------------------------------------------------------------------
+
+static void bench_openssl_hmac( const totp_secret* s )
+{
+    const EVP_MD*  digest = EVP_get_digestbyname( totp_digest_name( s->digest ));
+    uint8_t        hmac[ EVP_MAX_MD_SIZE ];
+    unsigned int   hmacsize;
+    uint8_t        msg[8];
+    size_t         keylen;
+    double         start, secs;
+    uint32_t       i;
+    int            b;
+
+    keylen = s->key_len <= s->md->block_size ? s->key_len : s->md->hash_size;
+
+    start = now();
+
+    for (i=0; i < BENCH_CODES; i++)
+    {
+        for (b=0; b < 8; b++)
+            msg[ 7 - b ] = (uint8_t) ((uint64_t) i >> (8 * b));
+
+        HMAC( digest, s->k0, (int) keylen, msg, sizeof( msg ), hmac, &hmacsize );
+        g_sink += (uint32_t) (totp_truncate( hmac, hmacsize ) % totp_pow10[ s->digits ]);
+    }
+
+    secs = now() - start;
+
+    printf( "  %-8s %-24s %8.1f ns/code\n", totp_digest_name( s->digest ),
+        "openssl HMAC()", secs * 1e9 / BENCH_CODES );
+}
+
+#endif // !TOTP_BUILTIN_SHA
+
+//---------------------------------------------------------------------
+//                           bench_codes
+//---------------------------------------------------------------------
+
+static void bench_codes()
+{
+    totp_secret  s;
+    char         label[ 64 ];
+    int          d, m, plain;
+
+    struct { const char* name; const totp_md* mds; } backends[] =
+    {
+#ifndef TOTP_BUILTIN_SHA
+        { "openssl", totp_openssl_mds },
+#endif
+        { "builtin", totp_builtin_mds },
+    };
+
+    printf( "Per code (%d codes each):\n\n", BENCH_CODES );
+
+    for (d=0; d < TOTP_NUM_DIGESTS; d++)
+    {
+        if (totp_parse( &s, bench_secrets[d] ) != TOTP_OK)
+            continue;
+
+#ifndef TOTP_BUILTIN_SHA
+        bench_openssl_hmac( &s );
+#endif
+        for (m=0; m < (int) (sizeof( backends ) / sizeof( backends[0] )); m++)
+        {
+            // (simply point the secret at the other digest implementation)
+
+            s.md = &backends[m].mds[d];
+
+            for (plain=1; plain >= 0; plain--)
+            {
+                s.flags &= ~TOTP_F_MIDSTATE;
+
+                if (!plain)
+                    totp_precompute( &s );
+
+                if (m)
+                    snprintf( label, sizeof( label ), "%s (%s) %s", backends[m].name,
+                        totp_builtin_impl( d ), plain ? "plain" : "midstate" );
+                else
+                    snprintf( label, sizeof( label ), "%s %s", backends[m].name,
+                        plain ? "plain" : "midstate" );
+
+                bench_hotp( label, &s );
+            }
+        }
+
+        totp_wipe( &s );
+        printf( "\n" );
+    }
+}
+
+//---------------------------------------------------------------------
+//                          check_rfc6238
+//---------------------------------------------------------------------
+//
+//  Check every RFC 6238 Appendix B vector using each digest implementation
+//  (plain and midstate) and each batch kernel. Returns the number of
+//  methods which failed any of the vectors (0 = all OK).
+//
+//---------------------------------------------------------------------
+
+static int check_rfc6238()
+{
+    totp_secret         secrets[ TOTP_NUM_DIGESTS * RFC6238_VECTORS ];
+    const totp_secret*  ptrs[ TOTP_NUM_DIGESTS * RFC6238_VECTORS ];
+    uint64_t            counters[ TOTP_NUM_DIGESTS * RFC6238_VECTORS ];
+    uint32_t            codes[ TOTP_NUM_DIGESTS * RFC6238_VECTORS ];
+    char                label[ 64 ];
+    const char*         kernel;
+    const char*         saved = totp_batch_kernel();
+    size_t              v, n;
+    int                 d, m, plain, k, bad, failed = 0, methods = 0;
+
+    struct { const char* name; const totp_md* mds; } backends[] =
+    {
+#ifndef TOTP_BUILTIN_SHA
+        { "openssl", totp_openssl_mds },
+#endif
+        { "builtin", totp_builtin_mds },
+    };
+
+    printf( "RFC 6238 Appendix B (%d vectors):\n\n", (int) (TOTP_NUM_DIGESTS * RFC6238_VECTORS) );
+
+    for (n=0, d=0; d < TOTP_NUM_DIGESTS; d++)
+    {
+        for (v=0; v < RFC6238_VECTORS; v++, n++)
+        {
+            if (totp_parse( &secrets[n], bench_secrets[d] ) != TOTP_OK)
+            {
+                printf( "  could not parse \"%s\"\n\n", bench_secrets[d] );
+                return 1;
+            }
+
+            ptrs[n]     = &secrets[n];
+            counters[n] = totp_counter( &secrets[n], rfc6238[v].time );
+        }
+    }
+
+    // One code at a time: each digest implementation, plain and midstate
+
+    for (m=0; m < (int) (sizeof( backends ) / sizeof( backends[0] )); m++)
+    {
+        for (plain=1; plain >= 0; plain--, methods++)
+        {
+            for (bad=0, n=0, d=0; d < TOTP_NUM_DIGESTS; d++)
+            {
+                for (v=0; v < RFC6238_VECTORS; v++, n++)
+                {
+                    secrets[n].md     = &backends[m].mds[d];
+                    secrets[n].flags &= ~TOTP_F_MIDSTATE;
+
+                    if (!plain)
+                        totp_precompute( &secrets[n] );
+
+                    if (totp_generate( &secrets[n], rfc6238[v].time ) != rfc6238[v].codes[d])
+                        bad++;
+                }
+            }
+
+            snprintf( label, sizeof( label ), "%s %s", backends[m].name, plain ? "plain" : "midstate" );
+            printf( "  %-32s %s\n", label, bad ? "FAILED" : "OK" );
+            failed += bad ? 1 : 0;
+        }
+    }
+
+    // Each batch kernel (on the midstates last precomputed above)
+
+    for (k=0; (kernel = totp_batch_kernels( k )) != NULL; k++, methods++)
+    {
+        totp_set_batch_kernel( kernel );
+        totp_hotp_batch( ptrs, counters, codes, n );
+
+        for (bad=0, n=0, d=0; d < TOTP_NUM_DIGESTS; d++)
+            for (v=0; v < RFC6238_VECTORS; v++, n++)
+                if (codes[n] != rfc6238[v].codes[d])
+                    bad++;
+
+        snprintf( label, sizeof( label ), "batch %s", kernel );
+        printf( "  %-32s %s\n", label, bad ? "FAILED" : "OK" );
+        failed += bad ? 1 : 0;
+    }
+
+    totp_set_batch_kernel( saved );
+
+    for (n=0; n < TOTP_NUM_DIGESTS * RFC6238_VECTORS; n++)
+        totp_wipe( &secrets[n] );
+
+    printf( "\n  %d of %d methods OK\n\n", methods - failed, methods );
+
+    return failed;
+}
+
+//---------------------------------------------------------------------
+//                          check_rfc8439
+//---------------------------------------------------------------------
+//
+//  Check the sealed stores' ChaCha20-Poly1305 against the RFC 8439
+//  section 2.8.2 AEAD vector (sealing it, opening it, and refusing to
+//  open it with its tag damaged) using each implementation, and the
+//  built-in Poly1305 on its own against the section 2.5.2 vector.
+//  Returns the number of checks which failed (0 = all OK).
+//
+//---------------------------------------------------------------------
+
+static const char  rfc8439_plain[] = "Ladies and Gentlemen of the class of '99: "
+                                     "If I could offer you only one tip for the future, sunscreen would be it.";
+
+static const char  rfc8439_aad[]    = "50515253c0c1c2c3c4c5c6c7";
+static const char  rfc8439_key[]    = "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f";
+static const char  rfc8439_nonce[]  = "070000004041424344454647";
+static const char  rfc8439_cipher[] = "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+                                      "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+                                      "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+                                      "3ff4def08e4b7a9de576d26586cec64b6116";
+static const char  rfc8439_tag[]    = "1ae10b594f09e26a7e902ecbd0600691";
+
+static const char  rfc8439_mac_key[] = "85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b";
+static const char  rfc8439_mac_msg[] = "Cryptographic Forum Research Group";
+static const char  rfc8439_mac[]     = "a8061dc1305136c6c22b8baf0c0127a9";
+
+static size_t unhex( const char* hex, uint8_t* out )
+{
+    size_t  n;
+
+    for (n=0; hex[0] && hex[1]; hex += 2, n++)
+        sscanf( hex, "%2hhx", &out[n] );
+
+    return n;
+}
+
+static int check_rfc8439()
+{
+    typedef void (*seal_fn)( const uint8_t*, const uint8_t*, const void*, size_t, uint8_t*, size_t, uint8_t* );
+    typedef bool (*open_fn)( const uint8_t*, const uint8_t*, const void*, size_t, uint8_t*, size_t, const uint8_t* );
+
+    struct { const char* name; seal_fn seal; open_fn open; } backends[] =
+    {
+#ifndef TOTP_BUILTIN_SHA
+        { "openssl", totp_aead_seal, totp_aead_open },
+#endif
+        { "builtin", totp_builtin_aead_seal, totp_builtin_aead_open },
+    };
+
+    uint8_t  key[ TOTP_AEAD_KEY ], nonce[ TOTP_AEAD_NONCE ], aad[ 16 ];
+    uint8_t  cipher[ sizeof( rfc8439_plain ) ], data[ sizeof( rfc8439_plain ) ];
+    uint8_t  tag[ TOTP_AEAD_TAG ], expect[ TOTP_AEAD_TAG ];
+    size_t   aad_len, len = sizeof( rfc8439_plain ) - 1;
+    char     label[ 64 ];
+    int      m, bad, failed = 0, methods = 0;
+
+    printf( "RFC 8439 ChaCha20-Poly1305:\n\n" );
+
+    unhex( rfc8439_key, key );
+    unhex( rfc8439_nonce, nonce );
+    unhex( rfc8439_cipher, cipher );
+    unhex( rfc8439_tag, expect );
+    aad_len = unhex( rfc8439_aad, aad );
+
+    for (m=0; m < (int) (sizeof( backends ) / sizeof( backends[0] )); m++, methods++)
+    {
+        memcpy( data, rfc8439_plain, len );
+        backends[m].seal( key, nonce, aad, aad_len, data, len, tag );
+
+        bad = memcmp( data, cipher, len ) != 0 || memcmp( tag, expect, sizeof( tag )) != 0;
+
+        if (!backends[m].open( key, nonce, aad, aad_len, data, len, tag ) || memcmp( data, rfc8439_plain, len ) != 0)
+            bad++;
+
+        memcpy( data, cipher, len );
+        tag[ sizeof( tag ) - 1 ] ^= 1;
+
+        if (backends[m].open( key, nonce, aad, aad_len, data, len, tag ))
+            bad++;
+
+        snprintf( label, sizeof( label ), "%s AEAD (2.8.2)", backends[m].name );
+        printf( "  %-32s %s\n", label, bad ? "FAILED" : "OK" );
+        failed += bad ? 1 : 0;
+    }
+
+    unhex( rfc8439_mac_key, key );
+    unhex( rfc8439_mac, expect );
+    totp_builtin_poly1305( key, rfc8439_mac_msg, sizeof( rfc8439_mac_msg ) - 1, tag );
+
+    bad = memcmp( tag, expect, sizeof( tag )) != 0;
+    printf( "  %-32s %s\n", "builtin Poly1305 (2.5.2)", bad ? "FAILED" : "OK" );
+    failed += bad ? 1 : 0;
+    methods++;
+
+    printf( "\n  %d of %d methods OK\n\n", methods - failed, methods );
+
+    return failed;
+}
+
+//---------------------------------------------------------------------
+//                          bench_stages
+//---------------------------------------------------------------------
+
+static void print_stage( int digest, const char* label, double secs, double count, const char* per )
+{
+    printf( "  %-8s %-24s %8.1f ns/%s\n", totp_digest_name( digest ), label, secs * 1e9 / count, per );
+}
+
+static void bench_stages()
+{
+    static const size_t  maxline = TOTP_MAX_HASH * 2 + 64;
+
+    totp_secret  s;
+    uint8_t      hmac[ TOTP_MAX_HASH ];
+    char         label[ 64 ], code[ TOTP_MAX_DIGITS ];
+    char*        lines[2];
+    size_t       size[2], len, i, n;
+    const char*  p;
+    const char*  end;
+    double       start;
+    int          d, b, digits;
+
+    printf( "Per stage (%d lines or %d codes each):\n\n", BENCH_LINES, BENCH_CODES );
+
+    lines[0] = (char*) malloc( BENCH_LINES * maxline );
+    lines[1] = (char*) malloc( BENCH_LINES * maxline );
+
+    if (!lines[0] || !lines[1])
+    {
+        printf( "  (out of memory)\n\n" );
+        free( lines[0] );
+        free( lines[1] );
+        return;
+    }
+
+    for (d=0; d < TOTP_NUM_DIGESTS; d++)
+    {
+        // The same lines, without and with blanks in the SECRET
+
+        for (b=0; b < 2; b++)
+        {
+            g_rng = BENCH_SEED;
+
+            for (size[b]=0, i=0; i < BENCH_LINES; i++)
+                size[b] += make_line( lines[b] + size[b], d,
+                    TOTP_MIN_DIGITS + (int) (i % 3), b != 0, i );
+        }
+
+        // Line read: finding each line, as totp does
+
+        start = now();
+
+        for (n=0, p = lines[0], end = p + size[0]; p < end; p++, n++)
+            p = (const char*) memchr( p, '\n', (size_t) (end - p) );
+
+        g_sink += (uint32_t) n;
+        print_stage( d, "line read", now() - start, BENCH_LINES, "line" );
+
+        // Parse: base32 decode (and the rest of the line), then with blanks
+
+        for (b=0; b < 2; b++)
+        {
+            start = now();
+
+            for (p = lines[b], end = p + size[b]; p < end; p += len + 1)
+            {
+                len = (size_t) ((const char*) memchr( p, '\n', (size_t) (end - p) ) - p);
+
+                if (totp_parse_line( &s, p, len ) == TOTP_OK)
+                    g_sink += s.k0[0];
+            }
+
+            print_stage( d, b ? "parse (with blanks)" : "parse (base32 decode)",
+                now() - start, BENCH_LINES, "line" );
+        }
+
+        // Midstates (two compression function calls)
+
+        start = now();
+
+        for (i=0; i < BENCH_LINES; i++)
+        {
+            s.flags &= ~TOTP_F_MIDSTATE;
+            totp_precompute( &s );
+        }
+
+        g_sink += (uint32_t) s.flags;
+        print_stage( d, "precompute midstates", now() - start, BENCH_LINES, "line" );
+
+        // Dynamic truncation and formatting, per number of digits
+
+        memset( hmac, 0x5A, sizeof( hmac ));
+
+        for (digits = TOTP_MIN_DIGITS; digits <= TOTP_MAX_DIGITS; digits++)
+        {
+            start = now();
+
+            for (i=0; i < BENCH_CODES; i++)
+            {
+                hmac[ totp_hash_size( d ) - 1 ] = (uint8_t) i;  // (offset varies)
+                hmac[ i % 16 ] ^= (uint8_t) i;
+                g_sink += (uint32_t) (totp_truncate( hmac, totp_hash_size( d )) % totp_pow10[ digits ]);
+            }
+
+            snprintf( label, sizeof( label ), "truncate %d digits", digits );
+            print_stage( d, label, now() - start, BENCH_CODES, "code" );
+
+            start = now();
+
+            for (i=0; i < BENCH_CODES; i++)
+            {
+                uint32_t  c = (uint32_t) ((uint32_t) (i * 2654435761U) % totp_pow10[ digits ]);
+                int       j;
+
+                for (j = digits; j > 0; j--, c /= 10)   // (as totp's put_code)
+                    code[ j-1 ] = (char) ('0' + c % 10);
+
+                g_sink += (uint32_t) code[0];
+            }
+
+            snprintf( label, sizeof( label ), "format %d digits", digits );
+            print_stage( d, label, now() - start, BENCH_CODES, "code" );
+        }
+
+        totp_wipe( &s );
+        printf( "\n" );
+    }
+
+    free( lines[0] );
+    free( lines[1] );
+}
+
+//---------------------------------------------------------------------
+//                           run_program
+//---------------------------------------------------------------------
+//
+//  Run the program once (with the given arguments, if any) with stdin
+//  redirected from the input file and stdout/stderr discarded. Returns
+//  false if it couldn't be run. If 'piped', the input is instead fed
+//  to it through a pipe (so it can't simply be memory mapped; POSIX
+//  only, the file is used as is on Windows).
+//
+//---------------------------------------------------------------------
+
+static bool run_program( const char* prog, const char* const* args, const char* input, bool piped )
+{
+#ifdef _WIN32
+    SECURITY_ATTRIBUTES  sa  = { sizeof( sa ), NULL, TRUE };
+    STARTUPINFOA         si;
+    PROCESS_INFORMATION  pi;
+    HANDLE               hIn, hNul;
+    char                 cmd[ 512 ];
+    BOOL                 ok;
+
+    hIn  = CreateFileA( input, GENERIC_READ, FILE_SHARE_READ, &sa, OPEN_EXISTING, 0, NULL );
+    hNul = CreateFileA( "NUL", GENERIC_WRITE, FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, NULL );
+
+    memset( &si, 0, sizeof( si ));
+    si.cb         = sizeof( si );
+    si.dwFlags    = STARTF_USESTDHANDLES;
+    si.hStdInput  = hIn;
+    si.hStdOutput = hNul;
+    si.hStdError  = hNul;
+
+    snprintf( cmd, sizeof( cmd ), "\"%s\"", prog );
+
+    for (; args && *args; args++)
+        snprintf( cmd + strlen( cmd ), sizeof( cmd ) - strlen( cmd ), " %s", *args );
+
+    (void) piped;
+
+    if ((ok = CreateProcessA( NULL, cmd, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi )))
+    {
+        WaitForSingleObject( pi.hProcess, INFINITE );
+        CloseHandle( pi.hProcess );
+        CloseHandle( pi.hThread );
+    }
+
+    CloseHandle( hIn );
+    CloseHandle( hNul );
+
+    return ok ? true : false;
+#else
+    const char*  argv[ 16 ];
+    pid_t        pid;
+    int          status, fd, n, p[2];
+    char         buf[ 64*1024 ];
+    ssize_t      len;
+
+    if (access( prog, X_OK ) != 0)
+        return false;
+
+    for (argv[ n=0 ] = prog; args && *args && n < 14; args++)
+        argv[ ++n ] = *args;
+
+    argv[ ++n ] = NULL;
+
+    if ((pid = fork()) < 0)
+        return false;
+
+    if (pid == 0)
+    {
+        if ((fd = open( input, O_RDONLY )) >= 0)
+        {
+            // (piped: a child of our own copies the file into the pipe)
+
+            if (piped && pipe( p ) == 0)
+            {
+                if (fork() == 0)
+                {
+                    close( p[0] );
+
+                    while ((len = read( fd, buf, sizeof( buf ))) > 0)
+                        if (write( p[1], buf, len ) != len)
+                            break;
+
+                    _exit( 0 );
+                }
+
+                close( fd ), close( p[1] );
+                fd = p[0];
+            }
+
+            dup2( fd, 0 );
+        }
+        if ((fd = open( "/dev/null", O_WRONLY )) >= 0)
+            dup2( fd, 1 ), dup2( fd, 2 );
+
+        execv( prog, (char* const*) argv );
+        _exit( 127 );
+    }
+
+    return waitpid( pid, &status, 0 ) == pid
+        && WIFEXITED( status ) && WEXITSTATUS( status ) != 127;
+#endif
+}
+
+//---------------------------------------------------------------------
+//                          bench_startup
+//---------------------------------------------------------------------
+
+static void bench_startup( const char* const* progs, int nprogs, const char* input, int count )
+{
+    double  start, secs;
+    int     p, i;
+
+    printf( "Per process (%d runs each, input \"%s\"):\n\n", count, input );
+
+    for (p=0; p < nprogs; p++)
+    {
+        if (!run_program( progs[p], NULL, input, false ))   // (also warms the cache)
+        {
+            printf( "  %-32s (could not be run)\n", progs[p] );
+            continue;
+        }
+
+        start = now();
+
+        for (i=0; i < count; i++)
+            run_program( progs[p], NULL, input, false );
+
+        secs = now() - start;
+
+        printf( "  %-32s %8.3f ms/run\n", progs[p], secs * 1e3 / count );
+    }
+
+    printf( "\n" );
+}
+
+//---------------------------------------------------------------------
+//                         bench_end_to_end
+//---------------------------------------------------------------------
+
+static bool write_synthetic( size_t count )
+{
+    char    line[ SYNTHETIC_MAX ];
+    FILE*   f;
+    size_t  i;
+    bool    ok;
+
+    if (!(f = fopen( BENCH_FILE, "wb" )))
+        return false;
+
+    g_rng = BENCH_SEED;
+
+    for (ok = true, i=0; ok && i < count; i++)
+        ok = fwrite( line, make_synthetic( line, i ), 1, f ) == 1;
+
+    return (fclose( f ) == 0) && ok;
+}
+
+static void bench_end_to_end( const char* const* progs, int nprogs, size_t max )
+{
+    double  start, secs;
+    size_t  count;
+    int     p, runs;
+
+    printf( "End to end (synthetic input, all digests, 6/7/8 digits):\n\n" );
+
+    for (count = 1000; count <= max; count *= 10)
+    {
+        if (!write_synthetic( count ))
+        {
+            printf( "  could not write \"%s\": %s\n", BENCH_FILE, strerror( errno ));
+            break;
+        }
+
+        for (p=0; p < nprogs; p++)
+        {
+            if (!run_program( progs[p], NULL, BENCH_FILE, false ))  // (also warms the cache)
+            {
+                printf( "  %-32s %8lu secrets: (could not be run)\n", progs[p], (unsigned long) count );
+                continue;
+            }
+
+            start = now();
+            runs  = 0;
+
+            do
+                run_program( progs[p], NULL, BENCH_FILE, false ), runs++;
+            while ((secs = now() - start) < BENCH_MIN_SECS);
+
+            printf( "  %-32s %8lu secrets: %12.0f lines/sec\n", progs[p],
+                (unsigned long) count, (double) count * runs / secs );
+        }
+
+        printf( "\n" );
+    }
+
+    remove( BENCH_FILE );
+}
+
+//---------------------------------------------------------------------
+//                          bench_allocs
+//---------------------------------------------------------------------
+
+// Run the program with --stats and return its "heap" and "secure"
+// allocation counts (false if it couldn't be run or has no --stats)...
+
+static bool count_allocs( const char* prog, const char* mode, bool piped,
+                          unsigned long long* heap, unsigned long long* secure )
+{
+    const char*  args[ 4 ];
+    char         line[ 256 ];
+    FILE*        f;
+    int          n = 0, found = 0;
+
+    args[ n++ ] = "--stats=" BENCH_STATS;
+    if (strcmp( mode, "--threads" ) == 0)
+        args[ n++ ] = mode, args[ n++ ] = "4";
+    else if (*mode)
+        args[ n++ ] = mode;
+    args[ n ] = NULL;
+
+    remove( BENCH_STATS );
+
+    if (!run_program( prog, args, BENCH_FILE, piped ) || !(f = fopen( BENCH_STATS, "r" )))
+        return false;
+
+    while (fgets( line, sizeof( line ), f ))
+    {
+        if (sscanf( line, " heap %llu", heap ) == 1)
+            found |= 1;
+        else if (sscanf( line, " secure %llu", secure ) == 1)
+            found |= 2;
+    }
+
+    fclose( f );
+    remove( BENCH_STATS );
+
+    return found == 3;
+}
+
+static int bench_allocs( const char* prog )
+{
+    static const char*  modes[] = { "", "--batch", "--threads" };
+
+    unsigned long long  heap[2][3][2], secure[2][3][2];
+    bool                ok = true;
+    int                 failed = 0, size, m, piped;
+
+    printf( "Allocations (%s --stats, %d vs. %d secrets):\n\n", prog, BENCH_ALLOCS, BENCH_ALLOCS * 10 );
+
+    for (size=0; ok && size < 2; size++)
+    {
+        if (!write_synthetic( size ? BENCH_ALLOCS * 10 : BENCH_ALLOCS ))
+        {
+            printf( "  could not write \"%s\": %s\n\n", BENCH_FILE, strerror( errno ));
+            return 0;
+        }
+
+        for (m=0; ok && m < 3; m++)
+            for (piped=0; ok && piped < 2; piped++)
+                ok = count_allocs( prog, modes[m], piped != 0,
+                    &heap[ size ][m][ piped ], &secure[ size ][m][ piped ] );
+    }
+
+    remove( BENCH_FILE );
+
+    if (!ok)
+    {
+        printf( "  (could not be run, or has no --stats)\n\n" );
+        return 0;
+    }
+
+    for (m=0; m < 3; m++)
+    {
+        for (piped=0; piped < 2; piped++)
+        {
+            bool  grew = heap[1][m][ piped ] > heap[0][m][ piped ]
+                      || secure[1][m][ piped ] > secure[0][m][ piped ];
+
+            printf( "  %-10s %-7s heap %4llu vs. %4llu, secure %4llu vs. %4llu  %s\n",
+                *modes[m] ? modes[m] : "(lines)", piped ? "piped" : "mapped",
+                heap[0][m][ piped ], heap[1][m][ piped ],
+                secure[0][m][ piped ], secure[1][m][ piped ], grew ? "FAILED" : "OK" );
+
+            failed += grew;
+        }
+    }
+
+    printf( "\n" );
+
+    return failed;
+}
+
+//---------------------------------------------------------------------
+//                          check_counters
+//---------------------------------------------------------------------
+//
+//  The HOTP counter log's crash recovery: a log whose last record was
+//  only partly written must still open, with just that record dropped,
+//  but one with a corrupt record anywhere before its end must not open
+//  at all (EINVAL), since truncating it there would roll back counters
+//  (and so accept codes already used). Returns the number of cases
+//  which failed.
+//
+//---------------------------------------------------------------------
+
+#define CTRS_HDR        16          // (log header size)
+#define CTRS_REC        17          // (record size, for name "a")
+#define CTRS_RECS       5           // (records written: counters 1 to 5)
+
+static bool write_file( const char* path, const char* data, size_t len )
+{
+    FILE*  f;
+    bool   ok;
+
+    if (!(f = fopen( path, "wb" )))
+        return false;
+
+    ok = fwrite( data, 1, len, f ) == len;
+
+    return (fclose( f ) == 0) && ok;
+}
+
+static int check_counters()
+{
+    static const struct
+    {
+        const char*  label;         // (what's wrong with the log)
+        int          rec;           // (record damaged, or -1 = none)
+        int          at;            // (byte damaged, or -n to cut n bytes)
+        uint64_t     expect;        // (counter after opening, or 0 = EINVAL)
+    }
+    cases[] =
+    {
+        { "intact",                     -1, 0,  CTRS_RECS     },
+        { "last record cut short",      4, -5,  CTRS_RECS - 1 },
+        { "last record's header cut",   4, -14, CTRS_RECS - 1 },
+        { "last record's checksum bad", 4, 12,  CTRS_RECS - 1 },
+        { "middle record's checksum",   2, 12,  0 },
+        { "middle record's counter",    2, 0,   0 },
+        { "middle record's length",     2, 9,   0 },
+        { "first record's name",        0, 16,  0 },
+    };
+
+    totp_counters*  c;
+    char            log[ CTRS_HDR + CTRS_REC * CTRS_RECS ];
+    size_t          len, i;
+    uint64_t        n;
+    FILE*           f;
+    int             failed = 0;
+    bool            ok;
+
+    printf( "HOTP counter log recovery:\n\n" );
+
+    remove( BENCH_CTRS );
+
+    for (ok = (c = totp_counters_open( BENCH_CTRS )) != NULL, n=1; ok && n <= CTRS_RECS; n++)
+        ok = totp_counters_advance( c, "a", 1, n ) == TOTP_OK && totp_counters_commit( c ) == TOTP_OK;
+
+    if (c && totp_counters_close( c ) != TOTP_OK)
+        ok = false;
+
+    if (ok && (f = fopen( BENCH_CTRS, "rb" )))
+    {
+        ok = fread( log, 1, sizeof( log ), f ) == sizeof( log ) && fgetc( f ) == EOF;
+        fclose( f );
+    }
+
+    if (!ok)
+    {
+        printf( "  FAILED: cannot write the log\n\n" );
+        remove( BENCH_CTRS );
+        return 1;
+    }
+
+    for (i=0; i < sizeof( cases ) / sizeof( cases[0] ); i++)
+    {
+        char  damaged[ sizeof( log ) ];
+
+        memcpy( damaged, log, len = sizeof( log ));
+
+        if (cases[i].at < 0)
+            len += cases[i].at;
+        else if (cases[i].rec >= 0)
+            damaged[ CTRS_HDR + cases[i].rec * CTRS_REC + cases[i].at ] ^= 0x40;
+
+        errno = 0;
+
+        if (!write_file( BENCH_CTRS, damaged, len ))
+            c = NULL, n = (uint64_t) -1;
+        else if ((c = totp_counters_open( BENCH_CTRS )) != NULL)
+            n = totp_counters_get( c, "a", 1 );
+        else
+            n = errno == EINVAL ? 0 : (uint64_t) -1;
+
+        printf( "  %-28s %s", cases[i].label, c ? "opened" : "refused" );
+
+        if (n != cases[i].expect)
+        {
+            printf( "  FAILED: expected %s", cases[i].expect ? "counter" : "EINVAL" );
+            failed++;
+        }
+        else if (c)
+            printf( ", counter %lu", (unsigned long) n );
+
+        printf( "\n" );
+        totp_counters_close( c );
+    }
+
+    printf( "\n" );
+    remove( BENCH_CTRS );
+
+    return failed;
+}
+
+//---------------------------------------------------------------------
+//                          bench_resync
+//---------------------------------------------------------------------
+
+static int bench_resync()
+{
+    static const unsigned  threads[] = { 1, 0 };
+
+    totp_secret  s;
+    uint32_t     codes[2];
+    uint64_t     counter = 1000000;
+    int64_t      drift;
+    double       start, secs;
+    int          d, t, rc, failed = 0;
+
+    printf( "Resync (+/- %d counters, two codes at the far end):\n\n", BENCH_RESYNC );
+
+    for (d=0; d < TOTP_NUM_DIGESTS; d++)
+    {
+        totp_parse( &s, bench_secrets[d] );
+        totp_precompute( &s );
+
+        codes[0] = totp_hotp( &s, counter - BENCH_RESYNC );
+        codes[1] = totp_hotp( &s, counter - BENCH_RESYNC + 1 );
+
+        for (t=0; t < 2; t++)
+        {
+            start = now();
+            rc    = totp_resync( &s, counter, BENCH_RESYNC, BENCH_RESYNC, codes, 2, threads[t], &drift );
+            secs  = now() - start;
+
+            printf( "  %-8s %-24s %8.2f ms", totp_digest_name( d ),
+                threads[t] ? "1 thread" : "1 thread per CPU", secs * 1e3 );
+
+            if (rc != TOTP_OK || drift != -BENCH_RESYNC)
+            {
+                printf( "  FAILED" );
+                failed++;
+            }
+
+            printf( "\n" );
+        }
+
+        totp_wipe( &s );
+    }
+
+    printf( "\n" );
+
+    return failed;
+}
+
+//---------------------------------------------------------------------
+//                          bench_replay
+//---------------------------------------------------------------------
+
+struct replay_job
+{
+    const totp_secret*  users;      // (BENCH_USERS secrets)
+    const uint32_t*     codes;      // (their codes at BENCH_TIME)
+    totp_replay*        cache;      // (shared by all threads)
+    size_t              first;      // (user this thread starts with)
+    bool                once;       // (totp_verify_once, else just check)
+    size_t              accepted;   // (TOTP_OK)
+    size_t              replays;    // (TOTP_SKIP)
+    size_t              errors;     // (anything else)
+};
+
+TOTP_THREAD_PROC( replay_thread )
+{
+    replay_job*  j = (replay_job*) arg;
+    size_t       i, n;
+    int          rc;
+
+    for (n=0, i = j->first; n < BENCH_USERS; n++, i = (i + 1) % BENCH_USERS)
+    {
+        if (j->once)
+            rc = totp_verify_once( &j->users[i], j->cache, j->codes[i], BENCH_TIME, 1, NULL );
+        else
+            rc = totp_replay_check( j->cache, i, BENCH_TIME / 30, BENCH_TIME + 60, BENCH_TIME );
+
+        if      (rc == TOTP_OK)   j->accepted++;
+        else if (rc == TOTP_SKIP) j->replays++;
+        else                      j->errors++;
+    }
+
+    TOTP_THREAD_RETURN;
+}
+
+static const int64_t  g_replay_times[] =   // (cache checked at each)
+{
+    BENCH_TIME,
+    2147483748,                     // (just past 2038)
+    3000000000LL,                   // (2065)
+};
+
+static int bench_replay()
+{
+    static const size_t  maxline = TOTP_MAX_HASH * 2 + 64;
+
+    totp_secret*    users  = (totp_secret*) calloc( BENCH_USERS, sizeof( totp_secret ));
+    uint32_t*       codes  = (uint32_t*) malloc( BENCH_USERS * sizeof( uint32_t ));
+    char*           lines  = (char*) malloc( BENCH_USERS * maxline );
+    replay_job      jobs[ BENCH_THREADS ];
+    totp_thread_t   threads[ BENCH_THREADS ];
+    size_t          accepted, replays, errors, i;
+    double          start, secs;
+    int             once, nthreads, t, failed = 0;
+
+    printf( "Replay cache (%d secrets, every thread trying every code):\n\n", BENCH_USERS );
+
+    if (!users || !codes || !lines)
+    {
+        printf( "  (out of memory)\n\n" );
+        free( users );
+        free( codes );
+        free( lines );
+        return 0;
+    }
+
+    g_rng = BENCH_SEED;
+
+    for (i=0; i < BENCH_USERS; i++)
+    {
+        char*  line = lines + i * maxline;
+
+        line[ make_line( line, (int) (i % TOTP_NUM_DIGESTS), TOTP_DEF_DIGITS, false, i ) - 1 ] = 0;
+        totp_parse( &users[i], line );
+        totp_precompute( &users[i] );
+        codes[i] = totp_generate( &users[i], BENCH_TIME );
+    }
+
+    for (once = 1; once >= 0; once--)
+    {
+        for (nthreads = 1; nthreads <= BENCH_THREADS; nthreads *= 2)
+        {
+            totp_replay*  cache = totp_replay_create( BENCH_USERS, 3 * 30 );
+
+            if (!cache)
+            {
+                printf( "  (out of memory)\n" );
+                break;
+            }
+
+            for (t=0; t < nthreads; t++)
+            {
+                memset( &jobs[t], 0, sizeof( jobs[t] ));
+                jobs[t].users = users;
+                jobs[t].codes = codes;
+                jobs[t].cache = cache;
+                jobs[t].first = (size_t) t * BENCH_USERS / nthreads;
+                jobs[t].once  = once != 0;
+            }
+
+            start = now();
+
+            for (t=0; t < nthreads; t++)
+                if (!thread_create( &threads[t], replay_thread, &jobs[t] ))
+                    replay_thread( &jobs[t] ), threads[t] = 0;
+
+            for (t=0; t < nthreads; t++)
+                if (threads[t])
+                    thread_join( threads[t] );
+
+            secs = now() - start;
+
+            for (accepted = replays = errors = 0, t=0; t < nthreads; t++)
+            {
+                accepted += jobs[t].accepted;
+                replays  += jobs[t].replays;
+                errors   += jobs[t].errors;
+            }
+
+            printf( "  %-20s %2d thread%s %12.0f /sec", once ? "totp_verify_once" : "totp_replay_check",
+                nthreads, nthreads == 1 ? ": " : "s:", (double) BENCH_USERS * nthreads / secs );
+
+            if (accepted != BENCH_USERS || replays != (size_t) BENCH_USERS * (nthreads - 1) || errors)
+            {
+                printf( "  FAILED: %lu accepted, %lu replays, %lu errors",
+                    (unsigned long) accepted, (unsigned long) replays, (unsigned long) errors );
+                failed++;
+            }
+
+            printf( "\n" );
+            totp_replay_destroy( cache );
+        }
+
+        printf( "\n" );
+    }
+
+    // A fresh cache must work the same at any time, before 2038 or after
+    // (when the low 32 bits of the time have their top bit set)...
+
+    for (t=0; t < (int) (sizeof( g_replay_times ) / sizeof( g_replay_times[0] )); t++)
+    {
+        totp_replay*  cache = totp_replay_create( BENCH_USERS, 3 * 30 );
+        int64_t       at    = g_replay_times[t];
+        uint32_t      code  = totp_generate( &users[0], at );
+        int           first, again;
+
+        if (!cache)
+            break;
+
+        first = totp_verify_once( &users[0], cache, code, at, 1, NULL );
+        again = totp_verify_once( &users[0], cache, code, at, 1, NULL );
+
+        printf( "  at_time %-12lld first %-10s again %s", (long long) at,
+            first == TOTP_OK ? "accepted," : "REFUSED,", again == TOTP_SKIP ? "replay" : "ACCEPTED" );
+
+        if (first != TOTP_OK || again != TOTP_SKIP)
+        {
+            printf( "  FAILED" );
+            failed++;
+        }
+
+        printf( "\n" );
+        totp_replay_destroy( cache );
+    }
+
+    printf( "\n" );
+
+    for (i=0; i < BENCH_USERS; i++)
+        totp_wipe( &users[i] );
+
+    free( users );
+    free( codes );
+    free( lines );
+
+    return failed;
+}
+
+//---------------------------------------------------------------------
+//                              main
+//---------------------------------------------------------------------
+
+int main( int argc, char* argv[] )
+{
+    static const char*  default_progs[]  = BENCH_PROGS;
+
+    const char*   input  = "stdin.txt";
+    const char* const* progs = default_progs;
+    int           nprogs = (int) (sizeof( default_progs ) / sizeof( default_progs[0] ));
+    int           count  = BENCH_SPAWNS;
+    size_t        max    = BENCH_MAX_SECRETS;
+    int           argi   = 1;
+    int           failed, replay_failed, allocs_failed;
+
+    while (argi + 1 < argc && argv[ argi ][0] == '-')
+    {
+        if      (strcmp( argv[ argi ], "-n" ) == 0) count = atoi( argv[ argi + 1 ] );
+        else if (strcmp( argv[ argi ], "-m" ) == 0) max   = strtoul( argv[ argi + 1 ], NULL, 10 );
+        else break;
+
+        argi += 2;
+    }
+
+    if (argi < argc)
+        input = argv[ argi++ ];
+
+    printf( "\nFish's TOTP bench, version " VERSION_STR ", sha = %s\n\n", totp_sha_backend() );
+
+    failed = check_rfc6238();
+    failed += check_rfc8439();
+
+    bench_stages();
+    bench_codes();
+
+    failed += check_counters();
+    failed += bench_resync();
+
+    if (argi < argc)
+    {
+        progs  = (const char* const*) &argv[ argi ];
+        nprogs = argc - argi;
+    }
+
+    bench_startup( progs, nprogs, input, count );
+    bench_end_to_end( progs, nprogs, max );
+
+    if ((allocs_failed = bench_allocs( progs[0] )) != 0)
+        printf( "ERROR: %d run(s) allocated more for more input!\n", allocs_failed );
+
+    if ((replay_failed = bench_replay()) != 0)
+        printf( "ERROR: %d replay cache run(s) FAILED!\n", replay_failed );
+
+    if (failed)
+        printf( "ERROR: %d method(s) FAILED the RFC 6238 test vectors!\n", failed );
+
+    failed += replay_failed + allocs_failed;
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
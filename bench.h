@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////////////////////////
+// bench.h: the synthetic secrets shared by 'bench' and 'totpload', so
+// that both (and totpd, given totpload --write's file) always agree
+// on exactly which secrets the Nth synthetic line holds.
+//
+// NOT part of the public interface!
+///////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#define BENCH_SEED      0x9E3779B97F4A7C15ULL   // (random64's first state)
+
+static uint64_t g_rng = BENCH_SEED;
+
+//---------------------------------------------------------------------
+//                            random64
+//---------------------------------------------------------------------
+
+static uint64_t random64_r( uint64_t* x )   // (xorshift64*; same every run)
+{
+    *x ^= *x >> 12;
+    *x ^= *x << 25;
+    *x ^= *x >> 27;
+
+    return *x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t random64()
+{
+    return random64_r( &g_rng );
+}
+
+//---------------------------------------------------------------------
+//                           make_line
+//---------------------------------------------------------------------
+//
+//  Format one synthetic input line: a random key as long as the digest's
+//  hash, base32 encoded (with a blank every 4 characters if 'blanks'),
+//  the digits and a label. Returns its length (including the newline).
+//
+//---------------------------------------------------------------------
+
+static size_t make_line( char* p, int digest, int digits, bool blanks, size_t n )
+{
+    static const char  alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+
+    uint8_t   key[ TOTP_MAX_HASH ];
+    size_t    len = totp_hash_size( digest ), i, c, chars;
+    uint32_t  bits = 0;
+    int       nbits = 0;
+    char*     start = p;
+
+    for (i=0; i < len; i++)
+        key[i] = (uint8_t) random64();
+
+    p += sprintf( p, "%s:", totp_digest_name( digest ));
+
+    for (i=0, c=0, chars = (len * 8 + 4) / 5; c < chars; c++)
+    {
+        if (nbits < 5)
+        {
+            bits = (bits << 8) | (i < len ? key[ i++ ] : 0);
+            nbits += 8;
+        }
+
+        nbits -= 5;
+
+        if (blanks && c && !(c % 4))
+            *p++ = ' ';
+
+        *p++ = alphabet[ (bits >> nbits) & 31 ];
+    }
+
+    p += sprintf( p, ":%d  acct%lu@example.com\n", digits, (unsigned long) n );
+
+    return (size_t) (p - start);
+}
+
+// The Nth line of a synthetic input file (the digests and 6/7/8 digits
+// cycling from line to line), made in order starting from BENCH_SEED...
+
+#define SYNTHETIC_MAX   (TOTP_MAX_HASH * 2 + 64)    // (longest line)
+
+static size_t make_synthetic( char* p, size_t n )
+{
+    return make_line( p, (int) (n % TOTP_NUM_DIGESTS),
+        TOTP_MIN_DIGITS + (int) (n / TOTP_NUM_DIGESTS % 3), false, n );
+}
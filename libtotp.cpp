@@ -0,0 +1,956 @@
+// Copyright (C) Chris Webb <chris@arachsys.com>
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+//------------------------------------------------------------------------------
+//                                 LIBTOTP
+//------------------------------------------------------------------------------
+//
+//  The TOTP engine proper: parsing of the "shared secret" input line,
+//  base32 decoding of the SECRET, HMAC calculation and extraction of the
+//  resulting verification code. (Refer to totp.cpp for a description of
+//  the "shared secret" input line format.)
+//
+//  Rather than calling OpenSSL's one-shot HMAC() function for each code
+//  (which must look up the digest and set up a brand new HMAC context each
+//  time), HMAC (RFC 2104) is done here directly using the low-level SHA
+//  functions (see libtotp_sha.cpp), whose contexts are plain structures
+//  and thus never need to be allocated. The digest is resolved and the
+//  key padded to the digest's block size once when the secret is parsed,
+//  so a parsed secret can then be used over and over again at no
+//  additional setup cost.
+
+//------------------------------------------------------------------------------
+
+#define SEP_CHAR        ':'         // colon
+
+#define BASE32_BITS     5           // (because 2**5 = 32, Duh!)
+
+// Each character's base32 value ("ABCDEFGHIJKLMNOPQRSTUVWXYZ234567",
+// or lowercase), or -1 if it's not a base32 character at all...
+
+#define XX  -1
+
+static const int8_t base32_val[256] =
+{
+    XX,XX,XX,XX,XX,XX,XX,XX, XX,XX,XX,XX,XX,XX,XX,XX,  XX,XX,XX,XX,XX,XX,XX,XX, XX,XX,XX,XX,XX,XX,XX,XX,
+    XX,XX,XX,XX,XX,XX,XX,XX, XX,XX,XX,XX,XX,XX,XX,XX,  XX,XX,26,27,28,29,30,31, XX,XX,XX,XX,XX,XX,XX,XX,
+    XX, 0, 1, 2, 3, 4, 5, 6,  7, 8, 9,10,11,12,13,14,  15,16,17,18,19,20,21,22, 23,24,25,XX,XX,XX,XX,XX,
+    XX, 0, 1, 2, 3, 4, 5, 6,  7, 8, 9,10,11,12,13,14,  15,16,17,18,19,20,21,22, 23,24,25,XX,XX,XX,XX,XX,
+    XX,XX,XX,XX,XX,XX,XX,XX, XX,XX,XX,XX,XX,XX,XX,XX,  XX,XX,XX,XX,XX,XX,XX,XX, XX,XX,XX,XX,XX,XX,XX,XX,
+    XX,XX,XX,XX,XX,XX,XX,XX, XX,XX,XX,XX,XX,XX,XX,XX,  XX,XX,XX,XX,XX,XX,XX,XX, XX,XX,XX,XX,XX,XX,XX,XX,
+    XX,XX,XX,XX,XX,XX,XX,XX, XX,XX,XX,XX,XX,XX,XX,XX,  XX,XX,XX,XX,XX,XX,XX,XX, XX,XX,XX,XX,XX,XX,XX,XX,
+    XX,XX,XX,XX,XX,XX,XX,XX, XX,XX,XX,XX,XX,XX,XX,XX,  XX,XX,XX,XX,XX,XX,XX,XX, XX,XX,XX,XX,XX,XX,XX,XX,
+};
+
+#undef XX
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || (defined( _M_IX86_FP ) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define BASE32_SSE2   1           // (SSE2 fast path; x64 always has it)
+#else
+  #define BASE32_SSE2   0
+#endif
+
+#define HMAC_IPAD       0x36        // (RFC 2104 inner padding byte)
+#define HMAC_OPAD       0x5c        // (RFC 2104 outer padding byte)
+
+// Modulus for each number of DIGITS...
+
+const uint64_t totp_pow10[ TOTP_MAX_DIGITS + 1 ] =
+{
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+    1000000000, 10000000000ULL
+};
+
+//---------------------------------------------------------------------
+//                         is_comment_char
+//---------------------------------------------------------------------
+
+static bool is_comment_char( char c )
+{
+    return (0
+            || c == '*'     // asterisk
+            || c == '#'     // number sign, pound sign, or hash tag
+            || c == ';'     // semi-colon
+            );
+}
+
+//---------------------------------------------------------------------
+//                         totp_digest_name
+//---------------------------------------------------------------------
+
+TOTP_API const char* totp_digest_name( int digest )
+{
+    if (digest < 0 || digest >= TOTP_NUM_DIGESTS)
+        return NULL;
+    return totp_mds[ digest ].name;
+}
+
+//---------------------------------------------------------------------
+//                          totp_hash_size
+//---------------------------------------------------------------------
+
+TOTP_API size_t totp_hash_size( int digest )
+{
+    if (digest < 0 || digest >= TOTP_NUM_DIGESTS)
+        return 0;
+    return totp_mds[ digest ].hash_size;
+}
+
+//---------------------------------------------------------------------
+//                          totp_block_size
+//---------------------------------------------------------------------
+
+TOTP_API size_t totp_block_size( int digest )
+{
+    if (digest < 0 || digest >= TOTP_NUM_DIGESTS)
+        return 0;
+    return totp_mds[ digest ].block_size;
+}
+
+//---------------------------------------------------------------------
+//                         base32_decode16
+//---------------------------------------------------------------------
+//
+//  SIMD fast path: decode 16 base32 characters into 10 bytes at once,
+//  provided ALL of them are base32 characters (else returns false and
+//  the caller decodes them one at a time instead, which is also what
+//  happens when they're interspersed with blanks). Each character is
+//  range checked (A-Z, a-z or 2-7) and converted to its 5-bit value
+//  a whole vector at a time, then adjacent values are merged: 5+5 bits
+//  into 10 in each 16-bit lane, 10+10 into 20 in each 32-bit lane, and
+//  two 20-bit lanes into each group of 5 output bytes.
+//
+//---------------------------------------------------------------------
+
+#if BASE32_SSE2
+
+static inline bool base32_decode16( const char* in, uint8_t* out )
+{
+    __m128i   c, upper, lower, digit, v;
+    uint32_t  u[4];
+    int       i;
+
+    c = _mm_loadu_si128( (const __m128i*) in );
+
+    // (bytes >= 0x80 are negative, so fail every range check)
+
+    upper = _mm_and_si128( _mm_cmpgt_epi8( c, _mm_set1_epi8( 'A' - 1 )),
+                           _mm_cmplt_epi8( c, _mm_set1_epi8( 'Z' + 1 )));
+    lower = _mm_and_si128( _mm_cmpgt_epi8( c, _mm_set1_epi8( 'a' - 1 )),
+                           _mm_cmplt_epi8( c, _mm_set1_epi8( 'z' + 1 )));
+    digit = _mm_and_si128( _mm_cmpgt_epi8( c, _mm_set1_epi8( '2' - 1 )),
+                           _mm_cmplt_epi8( c, _mm_set1_epi8( '7' + 1 )));
+
+    if (_mm_movemask_epi8( _mm_or_si128( _mm_or_si128( upper, lower ), digit )) != 0xffff)
+        return false;
+
+    v = _mm_or_si128( _mm_or_si128(
+            _mm_and_si128( upper, _mm_sub_epi8( c, _mm_set1_epi8( 'A' ))),
+            _mm_and_si128( lower, _mm_sub_epi8( c, _mm_set1_epi8( 'a' )))),
+            _mm_and_si128( digit, _mm_sub_epi8( c, _mm_set1_epi8( '2' - 26 ))));
+
+    // (even character is the low byte, so it's the high order bits)
+
+    v = _mm_or_si128( _mm_slli_epi16( _mm_and_si128( v, _mm_set1_epi16( 0x00ff )), 5 ),
+                      _mm_srli_epi16( v, 8 ));
+    v = _mm_madd_epi16( v, _mm_set1_epi32( 0x00010400 ));
+
+    _mm_storeu_si128( (__m128i*) u, v );
+
+    for (i=0; i < 2; i++, out += 5)
+    {
+        uint64_t  x = ((uint64_t) u[ i*2 ] << 20) | u[ i*2 + 1 ];
+
+        out[0] = (uint8_t) (x >> 32);
+        out[1] = (uint8_t) (x >> 24);
+        out[2] = (uint8_t) (x >> 16);
+        out[3] = (uint8_t) (x >>  8);
+        out[4] = (uint8_t) (x      );
+    }
+
+    return true;
+}
+
+#endif // BASE32_SSE2
+
+//---------------------------------------------------------------------
+//                          Line scanning
+//---------------------------------------------------------------------
+//
+//  The input line is scanned via a small cursor which knows where the
+//  line ends (so it needn't be NUL terminated, e.g. when it's part of a
+//  memory mapped file), and which, for totp_parse_line, skips over any
+//  blanks wherever they appear, just as if they'd been removed first.
+//
+//---------------------------------------------------------------------
+
+struct scan
+{
+    const char*  p;                 // (current position)
+    const char*  end;               // (end of line)
+    bool         blanks;            // (skip blanks everywhere)
+
+    const char*  secret_end;        // (where the SECRET stopped)
+    const char*  error_at;          // (where the invalid field is)
+    const char*  error;             // (what's wrong with it)
+};
+
+static inline int scan_peek( scan* sc )
+{
+    if (sc->blanks)
+        while (sc->p < sc->end && isspace( (unsigned char) *sc->p ))
+            ++sc->p;
+
+    return sc->p < sc->end ? (unsigned char) *sc->p : EOF;
+}
+
+// Consume 'word' (case insensitive) if that's what's next...
+
+static bool scan_word( scan* sc, const char* word )
+{
+    const char*  save = sc->p;
+
+    for (; *word; word++, sc->p++)
+    {
+        if (tolower( scan_peek( sc )) != *word)
+        {
+            sc->p = save;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Consume an optionally signed decimal number (like strtoull, which
+// also saturates on overflow, and, if there are no digits at all,
+// consumes nothing and returns zero)...
+
+static uint64_t scan_number( scan* sc, bool* neg )
+{
+    const char*  save = sc->p;
+    uint64_t     num  = 0;
+    bool         any  = false;
+    int          c;
+
+    *neg = false;
+
+    while (sc->p < sc->end && isspace( (unsigned char) *sc->p ))
+        ++sc->p;
+
+    if ((c = scan_peek( sc )) == '+' || c == '-')
+        *neg = (c == '-'), ++sc->p;
+
+    for (; (c = scan_peek( sc )) >= '0' && c <= '9'; sc->p++, any = true)
+        num = (num > (UINT64_MAX - 9) / 10) ? UINT64_MAX : num * 10 + (c - '0');
+
+    if (!any)
+        sc->p = save, *neg = false;
+
+    return num;
+}
+
+static unsigned long scan_ulong( scan* sc )
+{
+    bool      neg;
+    uint64_t  num = scan_number( sc, &neg );
+
+    if (num > ULONG_MAX)
+        num = ULONG_MAX;
+
+    return neg ? (unsigned long) -num : (unsigned long) num;
+}
+
+static uint64_t scan_uint64( scan* sc )
+{
+    bool      neg;
+    uint64_t  num = scan_number( sc, &neg );
+
+    return neg ? (uint64_t) -num : num;
+}
+
+static int64_t scan_int64( scan* sc )
+{
+    bool      neg;
+    uint64_t  num = scan_number( sc, &neg );
+
+    if (neg)
+        return num > (uint64_t) INT64_MAX ? INT64_MIN : -(int64_t) num;
+
+    return num > (uint64_t) INT64_MAX ? INT64_MAX : (int64_t) num;
+}
+
+//---------------------------------------------------------------------
+//                            key_flush
+//---------------------------------------------------------------------
+
+// Hash the key bytes accumulated so far (the key being too long to be
+// used as is) and empty the buffer...
+
+static void key_flush( const totp_md* md, totp_hash_ctx* ctx, bool* hashing,
+                       uint8_t* buf, size_t* buf_len )
+{
+    if (!*hashing)
+        md->init( ctx ), *hashing = true;
+
+    md->update( ctx, buf, *buf_len );
+    *buf_len = 0;
+}
+
+//---------------------------------------------------------------------
+//                              parse
+//---------------------------------------------------------------------
+
+static int parse( totp_secret* s, scan* sc )
+{
+    const totp_md*  md;
+    const char*     digits_at;
+    const char*     interval_at;
+    int             c, v;
+
+    totp_hash_ctx   ctx;
+
+    size_t          buf_len;
+    uint32_t        accum_bits;
+    uint32_t        secret_num;
+    unsigned long   digits;
+    bool            hashing;
+
+    uint8_t         buf[ TOTP_MAX_BLOCK + 16 ];     // (+ fast path room)
+
+    memset( s, 0, sizeof( *s ));
+
+    while (sc->p < sc->end && isspace( (unsigned char) *sc->p ))
+        ++sc->p;
+
+    if ((c = scan_peek( sc )) == EOF || is_comment_char( (char) c ))
+        return TOTP_SKIP;
+
+    // Extract the TEST option, if specified...
+
+    if (scan_word( sc, "test:" ))
+        s->flags |= TOTP_F_TEST;
+
+    // Extract the requested DIGEST function to be used...
+
+         if (scan_word( sc, "sha1:"   )) s->digest = TOTP_SHA1;
+    else if (scan_word( sc, "sha256:" )) s->digest = TOTP_SHA256;
+    else if (scan_word( sc, "sha512:" )) s->digest = TOTP_SHA512;
+    else     /* use default "sha1:" */   s->digest = TOTP_SHA1;
+
+    s->md = md = &totp_mds[ s->digest ];
+
+    //-----------------------------------------------------------------
+    // Now extract the SECRET string, and convert it from its base32
+    // character format to its binary equivalent value in 'buf'...
+    //
+    // Keys longer than the digest's block size must first be hashed
+    // (RFC 2104), so should 'buf' ever fill up we simply start hashing
+    // it instead, thereby allowing SECRETs of any length to be handled
+    // without ever having to allocate any memory. ('buf' has room for
+    // a few bytes more than a block, so the fast path never has to
+    // worry about exactly where the block boundary falls.)
+    //-----------------------------------------------------------------
+
+    scan_peek( sc );
+    sc->secret_end = sc->p;     // (in case it's empty)
+
+    hashing = false;
+
+    for (accum_bits=0, secret_num=0, buf_len=0;;)
+    {
+#if BASE32_SSE2
+        // 16 characters at a time, whenever we're on a byte boundary
+        // (i.e. after every 8 characters) and they're all base32...
+
+        if (accum_bits == 0 && sc->end - sc->p >= 16)
+        {
+            if (buf_len >= md->block_size)
+                key_flush( md, &ctx, &hashing, buf, &buf_len );
+
+            if (base32_decode16( sc->p, buf + buf_len ))
+            {
+                buf_len    += 10;
+                s->key_len += 10;
+                sc->p      += 16;
+                continue;
+            }
+        }
+#endif
+        // Ensure the next character to be processed is still one
+        // of the SECRET value's base32 characters...
+
+        if ((c = scan_peek( sc )) == EOF || (v = base32_val[c]) < 0)
+            break; // (either SEP_CHAR or end of SECRET string)
+
+        sc->p++;
+
+        // Add its 5-bit binary equivalent to our running total...
+
+        secret_num = (uint32_t) ((secret_num << BASE32_BITS) | v);
+        accum_bits += BASE32_BITS;
+
+        // When we have enough bits, save another byte...
+
+        if (accum_bits >= BITS_PER_BYTE)
+        {
+            if (buf_len >= md->block_size)
+                key_flush( md, &ctx, &hashing, buf, &buf_len );
+
+            accum_bits -= BITS_PER_BYTE;
+            buf[ buf_len++ ] = (uint8_t) (secret_num >> accum_bits);
+            s->key_len++;
+        }
+    }
+
+    sc->secret_end = sc->p;
+
+    // 'k0' = key padded with zeros to the digest's block size...
+
+    if (hashing || buf_len > md->block_size)
+    {
+        key_flush( md, &ctx, &hashing, buf, &buf_len );
+        md->final( &ctx, s->k0 );
+        totp_cleanse( &ctx, sizeof( ctx ));
+    }
+    else
+        memcpy( s->k0, buf, buf_len );
+
+    totp_cleanse( buf, sizeof( buf ));
+
+    // Extract other i/p parameters: DIGITS, INTERVAL and OFFSET...
+
+    digits      = TOTP_DEF_DIGITS;
+    s->interval = TOTP_DEF_INTERVAL;
+    s->offset   = TOTP_DEF_OFFSET;
+
+    digits_at = interval_at = sc->p;
+
+    if (scan_peek( sc ) == SEP_CHAR) sc->p++, digits_at   = sc->p, digits      = scan_ulong(  sc );
+    if (scan_peek( sc ) == SEP_CHAR) sc->p++, interval_at = sc->p, s->interval = scan_uint64( sc );
+    if (scan_peek( sc ) == SEP_CHAR) sc->p++,                      s->offset   = scan_int64(  sc );
+
+    // Whatever remains is the label (skip past preceding blanks)...
+
+    while (sc->p < sc->end && *sc->p == ' ')
+        ++sc->p;
+
+    scan_peek( sc );
+
+    if (sc->blanks)     // (no trailing blanks either)
+        while (sc->end > sc->p && isspace( (unsigned char) sc->end[-1] ))
+            --sc->end;
+
+    s->label     = sc->p;
+    s->label_len = sc->end - sc->p;
+
+    // Don't bother unless *ALL* of our parameters are valid!
+
+         if (s->key_len == 0)                                                sc->error = "no base32 SECRET",  sc->error_at = sc->secret_end;
+    else if (digits < TOTP_MIN_DIGITS || digits > TOTP_MAX_DIGITS)           sc->error = "invalid DIGITS",    sc->error_at = digits_at;
+    else if (s->interval == 0)                                               sc->error = "invalid INTERVAL",  sc->error_at = interval_at;
+
+    if (sc->error)
+    {
+        totp_wipe( s );
+        return TOTP_EINVAL;
+    }
+
+    s->digits = (uint8_t) digits;
+    s->engine = totp_engine_for( s->digest, s->digits );
+
+    return TOTP_OK;
+}
+
+//---------------------------------------------------------------------
+//                        totp_base32_decode
+//---------------------------------------------------------------------
+
+size_t totp_base32_decode( const char* in, size_t len, uint8_t* out )
+{
+    const char*  end = in + len;
+    uint8_t*     o   = out;
+    uint32_t     accum_bits, secret_num;
+    int          v;
+
+    for (accum_bits=0, secret_num=0; in < end;)
+    {
+#if BASE32_SSE2
+        if (accum_bits == 0 && end - in >= 16 && base32_decode16( in, o ))
+        {
+            in += 16;
+            o  += 10;
+            continue;
+        }
+#endif
+        if ((v = base32_val[ (unsigned char) *in++ ]) < 0)
+            return (size_t) -1;
+
+        secret_num = (uint32_t) ((secret_num << BASE32_BITS) | v);
+        accum_bits += BASE32_BITS;
+
+        if (accum_bits >= BITS_PER_BYTE)
+        {
+            accum_bits -= BITS_PER_BYTE;
+            *o++ = (uint8_t) (secret_num >> accum_bits);
+        }
+    }
+
+    return o - out;
+}
+
+//---------------------------------------------------------------------
+//                          totp_key_init
+//---------------------------------------------------------------------
+
+void totp_key_init( totp_secret* s, int digest, const uint8_t* key, size_t len )
+{
+    const totp_md*  md = &totp_mds[ digest ];
+    totp_hash_ctx   ctx;
+
+    s->digest  = (uint8_t) digest;
+    s->md      = md;
+    s->key_len = (uint32_t) len;
+
+    if (len > md->block_size)       // (RFC 2104: hash it first)
+    {
+        md->init( &ctx );
+        md->update( &ctx, key, len );
+        md->final( &ctx, s->k0 );
+        totp_cleanse( &ctx, sizeof( ctx ));
+    }
+    else
+        memcpy( s->k0, key, len );
+}
+
+//---------------------------------------------------------------------
+//                            totp_parse
+//---------------------------------------------------------------------
+
+TOTP_API int totp_parse( totp_secret* s, const char* line )
+{
+    scan  sc;
+
+    while (isspace( (unsigned char) *line ))
+        ++line;
+
+    memset( &sc, 0, sizeof( sc ));
+
+    sc.p      = line;
+    sc.end    = line + strcspn( line, "\r\n" );
+    sc.blanks = false;
+
+    return parse( s, &sc );
+}
+
+//---------------------------------------------------------------------
+//                          totp_parse_line
+//---------------------------------------------------------------------
+
+TOTP_API int totp_parse_line( totp_secret* s, const char* line, size_t len )
+{
+    return totp_parse_diag( s, line, len, NULL );
+}
+
+//---------------------------------------------------------------------
+//                          totp_parse_diag
+//---------------------------------------------------------------------
+
+TOTP_API int totp_parse_diag( totp_secret* s, const char* line, size_t len, totp_diag* diag )
+{
+    scan  sc;
+    int   rc;
+
+    memset( &sc, 0, sizeof( sc ));
+
+    sc.p      = line;
+    sc.end    = line + len;
+    sc.blanks = true;
+
+    rc = parse( s, &sc );
+
+    if (diag)
+    {
+        diag->secret_end = sc.secret_end ? (size_t) (sc.secret_end - line) : 0;
+        diag->error_at   = sc.error_at   ? (size_t) (sc.error_at   - line) : 0;
+        diag->error      = sc.error;
+    }
+
+    return rc;
+}
+
+//---------------------------------------------------------------------
+//                         midstate helpers
+//---------------------------------------------------------------------
+
+static void* mid_state( const totp_secret* s, int which )
+{
+    if (s->md->word_size == 4)
+        return (void*) s->mid.w32[ which ];
+    return (void*) s->mid.w64[ which ];
+}
+
+// Store the digest's chaining state as its (big-endian) hash value...
+
+void totp_state_to_hash( const totp_md* md, const void* state, uint8_t* hash )
+{
+    size_t  i;
+
+    if (md->word_size == 4)
+    {
+        const uint32_t* w = (const uint32_t*) state;
+
+        for (i=0; i < md->hash_size; i++)
+            hash[i] = (uint8_t) (w[ i / 4 ] >> (8 * (3 - (i % 4))));
+    }
+    else
+    {
+        const uint64_t* w = (const uint64_t*) state;
+
+        for (i=0; i < md->hash_size; i++)
+            hash[i] = (uint8_t) (w[ i / 8 ] >> (8 * (7 - (i % 8))));
+    }
+}
+
+//---------------------------------------------------------------------
+//                          totp_precompute
+//---------------------------------------------------------------------
+
+TOTP_API void totp_precompute( totp_secret* s )
+{
+    const totp_md*  md = s->md;
+    uint32_t        i;
+    uint8_t         pad[ TOTP_MAX_BLOCK ];
+
+    for (i=0; i < md->block_size; i++)
+        pad[i] = s->k0[i] ^ HMAC_IPAD;
+
+    md->iv       ( mid_state( s, 0 ));
+    md->compress ( mid_state( s, 0 ), pad );
+
+    for (i=0; i < md->block_size; i++)
+        pad[i] = s->k0[i] ^ HMAC_OPAD;
+
+    md->iv       ( mid_state( s, 1 ));
+    md->compress ( mid_state( s, 1 ), pad );
+
+    totp_cleanse( pad, sizeof( pad ));
+
+    s->flags |= TOTP_F_MIDSTATE;
+}
+
+//---------------------------------------------------------------------
+//                           totp_counter
+//---------------------------------------------------------------------
+
+TOTP_API uint64_t totp_counter( const totp_secret* s, int64_t at_time )
+{
+    // NOTE: when the "TEST:" option was specified, then OFFSET
+    // is the exact time() value to be used for testing.
+
+    if (s->flags & TOTP_F_TEST)
+        return (uint64_t) s->offset / s->interval;
+
+    return (uint64_t) (at_time - s->offset) / s->interval;
+}
+
+//---------------------------------------------------------------------
+//                           totp_truncate
+//---------------------------------------------------------------------
+
+uint32_t totp_truncate( const uint8_t* hmac, size_t hmacsize )
+{
+    //-----------------------------------------------------------------
+    //              OKAY, THIS IS WEIRD!
+    //-----------------------------------------------------------------
+
+    uint8_t   rrr;      // random 0-15 value from rightmost nibble of hmac
+
+    uint32_t  hbyte;    // one of the 4 consecutive right-to-left hmac bytes
+
+    uint32_t  index;    // (used to index into hmac)
+
+    uint32_t  shift;    // (work; shifts hbyte into position
+                        //  to accumulate extracted hmac bytes
+                        //  into 4-byte 32-bit big-endian value)
+    uint32_t  code;
+    uint32_t  i;
+
+    // Extract verification code from the generated hash...
+
+    code = 0;
+
+    rrr = hmac[ hmacsize - 1 ];  // (rightmost hmac byte)
+    rrr &= 0x0f;                 // (rightmost nibble)
+
+    for (i=0; i < 4; i++)
+    {
+        index = (3 - i);                // 3, 2, 1, 0
+        shift = (BITS_PER_BYTE * i);    // 0, 8, 16, 24
+
+        hbyte = hmac[ rrr + index ];    // (extract next byte)
+        hbyte <<= shift;                // (shift into position)
+        code += hbyte;                  // (accumulate here)
+    }
+
+    return code & 0x7fffffff;   // (must always be signed >= 0;
+                                // code value is now big-endian)
+}
+
+//---------------------------------------------------------------------
+//                             totp_hotp
+//---------------------------------------------------------------------
+
+TOTP_API uint32_t totp_hotp( const totp_secret* s, uint64_t counter )
+{
+    const totp_md*  md = s->md;
+    totp_hash_ctx   ctx;
+    uint32_t        i;
+    uint8_t         msg[8];
+    uint8_t         pad[ TOTP_MAX_BLOCK ];
+    uint8_t         hmac[ TOTP_MAX_HASH ];
+
+    //-----------------------------------------------------------------
+    // If the HMAC midstates have been precomputed, then all that
+    // remains to be done is to compress the (padded) message using
+    // the inner state, and then the resulting (padded) inner hash
+    // using the outer state: just two compressions per code, which
+    // the secret's engine does (see libtotp_engine.cpp).
+    //-----------------------------------------------------------------
+
+    if (s->flags & TOTP_F_MIDSTATE)
+        return s->engine->hotp( s, counter );
+
+    //-----------------------------------------------------------------
+    // Otherwise, use time-based interval as message to be hashed...
+    //
+    // Note: We cannot directly use the 8-byte 64-bit 'counter'
+    // variable value itself since the value thus inputted to
+    // the hashing algorithm would then vary depending on the
+    // endianess of the system we were running on. Therefore
+    // to ensure consistency, we always convert the value to
+    // big-endian format in 'msg[8]'.
+    //-----------------------------------------------------------------
+
+    for (i=0; i < (uint32_t) sizeof( msg ); i++)
+        msg[ (sizeof( msg )-1) - i ] = (uint8_t) (counter >> (8 * i));
+
+    //-----------------------------------------------------------------
+    // Calculate the HMAC (Hash-Based Message Authentication Code):
+    //
+    //    H( (K0 ^ opad) || H( (K0 ^ ipad) || msg ))
+    //
+    // which is the resulting verification code we're to produce,
+    // using our shared SECRET and the counter (time interval number).
+    //-----------------------------------------------------------------
+
+    for (i=0; i < md->block_size; i++)
+        pad[i] = s->k0[i] ^ HMAC_IPAD;
+
+    md->init   ( &ctx );
+    md->update ( &ctx, pad, md->block_size );
+    md->update ( &ctx, msg, sizeof( msg ));
+    md->final  ( &ctx, hmac );
+
+    for (i=0; i < md->block_size; i++)
+        pad[i] = s->k0[i] ^ HMAC_OPAD;
+
+    md->init   ( &ctx );
+    md->update ( &ctx, pad, md->block_size );
+    md->update ( &ctx, hmac, md->hash_size );
+    md->final  ( &ctx, hmac );
+
+    totp_cleanse( pad, sizeof( pad ));
+
+    // Return the rightmost number of desired digits of the code...
+
+    return (uint32_t) (totp_truncate( hmac, md->hash_size ) % totp_pow10[ s->digits ]);
+}
+
+//---------------------------------------------------------------------
+//                           totp_generate
+//---------------------------------------------------------------------
+
+TOTP_API uint32_t totp_generate( const totp_secret* s, int64_t at_time )
+{
+    return totp_hotp( s, totp_counter( s, at_time ));
+}
+
+//---------------------------------------------------------------------
+//                            totp_verify
+//---------------------------------------------------------------------
+
+TOTP_API int totp_verify( const totp_secret* s, uint32_t code,
+                          int64_t at_time, unsigned window, int* drift )
+{
+    uint32_t  (*hotp)( const totp_secret* s, uint64_t counter );
+    uint64_t  counter = totp_counter( s, at_time );
+    unsigned  i;
+
+    // (straight to the secret's engine, if it can be used)
+
+    hotp = (s->flags & TOTP_F_MIDSTATE) ? s->engine->hotp : totp_hotp;
+
+    // Try the current time step first, then work outwards (but never
+    // before the first one: the counter mustn't wrap)...
+
+    for (i=0; i <= window; i++)
+    {
+        if (i <= counter && hotp( s, counter - i ) == code)
+        {
+            if (drift) *drift = -(int) i;
+            return 1;
+        }
+
+        if (i && hotp( s, counter + i ) == code)
+        {
+            if (drift) *drift = (int) i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+//---------------------------------------------------------------------
+//                         totp_cpu_features
+//---------------------------------------------------------------------
+
+#if TOTP_X86
+
+static void cpuid( int leaf, int subleaf, unsigned regs[4] )
+{
+#ifdef _MSC_VER
+    __cpuidex( (int*) regs, leaf, subleaf );
+#else
+    __asm__ __volatile__ ( "cpuid"
+        : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+        : "a" (leaf), "c" (subleaf) );
+#endif
+}
+
+static uint64_t xgetbv( unsigned index )
+{
+#ifdef _MSC_VER
+    return _xgetbv( index );
+#else
+    unsigned lo, hi;
+    __asm__ __volatile__ ( "xgetbv" : "=a" (lo), "=d" (hi) : "c" (index) );
+    return ((uint64_t) hi << 32) | lo;
+#endif
+}
+
+#endif // TOTP_X86
+
+unsigned totp_cpu_features()
+{
+    static volatile int  detected  = 0;
+    static unsigned      features  = 0;
+
+    if (!detected)
+    {
+        unsigned  found = 0;
+
+#if TOTP_X86
+        unsigned  regs[4];
+        unsigned  ecx1;
+        uint64_t  xcr0  = 0;
+
+        cpuid( 0, 0, regs );
+
+        if (regs[0] >= 7)
+        {
+            cpuid( 1, 0, regs );
+            ecx1 = regs[2];
+
+            // (the OS must also be saving the YMM/ZMM registers!)
+
+            if (ecx1 & (1 << 27))               // (OSXSAVE)
+                xcr0 = xgetbv( 0 );
+
+            cpuid( 7, 0, regs );
+
+            if ((xcr0 & 0x06) == 0x06 && (regs[1] & (1 << 5)))
+                found |= TOTP_CPU_AVX2;
+
+            if ((xcr0 & 0xe6) == 0xe6 && (regs[1] & (1 << 16)))
+                found |= TOTP_CPU_AVX512;
+
+            // (SHA extensions, which also need SSSE3 and SSE4.1)
+
+            if ((regs[1] & (1 << 29)) && (ecx1 & (1 << 9)) && (ecx1 & (1 << 19)))
+                found |= TOTP_CPU_SHANI;
+        }
+
+#elif TOTP_ARM64 && defined( _WIN32 )
+
+        if (IsProcessorFeaturePresent( PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE ))
+            found |= TOTP_CPU_ARMV8_SHA1 | TOTP_CPU_ARMV8_SHA2;
+
+#elif TOTP_ARM64 && defined( __linux__ )
+
+        unsigned long  hwcap = getauxval( AT_HWCAP );
+
+        if (hwcap & HWCAP_SHA1) found |= TOTP_CPU_ARMV8_SHA1;
+        if (hwcap & HWCAP_SHA2) found |= TOTP_CPU_ARMV8_SHA2;
+
+#elif TOTP_ARM64 && defined( __APPLE__ )
+
+        found |= TOTP_CPU_ARMV8_SHA1 | TOTP_CPU_ARMV8_SHA2;   // (always)
+#endif
+
+        features = found;
+        detected = 1;
+    }
+
+    return features;
+}
+
+//---------------------------------------------------------------------
+//                           totp_cleanse
+//---------------------------------------------------------------------
+
+// Calling memset through a volatile function pointer (the same trick
+// OpenSSL's OPENSSL_cleanse uses) means the compiler can't know what is
+// being called and thus can't optimize the call away, while still being
+// as fast as memset.
+
+static void* (* volatile cleanse_memset)( void*, int, size_t ) = memset;
+
+TOTP_API void totp_cleanse( void* p, size_t len )
+{
+    cleanse_memset( p, 0, len );
+}
+
+//---------------------------------------------------------------------
+//                             totp_wipe
+//---------------------------------------------------------------------
+
+TOTP_API void totp_wipe( totp_secret* s )
+{
+    totp_cleanse( s, sizeof( *s ));
+}
+
+////////////////////////////////////////////////////////////////////////////////
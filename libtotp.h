@@ -0,0 +1,411 @@
+///////////////////////////////////////////////////////////////////////
+// libtotp.h: public interface to the TOTP/HOTP engine used by the
+// 'totp' utility, for linking TOTP code generation and verification
+// directly into other programs (e.g. authentication services).
+///////////////////////////////////////////////////////////////////////
+//
+//  Usage:
+//
+//      totp_secret  s;
+//
+//      if (totp_parse( &s, "sha256:ABCDEFGHIJKLMNOP:8" ) == TOTP_OK)
+//      {
+//          code = totp_generate( &s, time( NULL ));
+//          ok   = totp_verify( &s, code, time( NULL ), 1, &drift );
+//      }
+//      totp_wipe( &s );
+//
+//  A parsed totp_secret is a self-contained, fixed size object which
+//  may be freely copied, placed in arrays, etc. The digest is resolved
+//  and the key pre-padded to the digest's block size once at parse time,
+//  so generating or verifying codes for the same secret again and again
+//  never allocates any memory nor looks up anything.
+//
+///////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined( _WIN32 ) && defined( TOTP_DLL )
+  #ifdef TOTP_BUILD
+    #define TOTP_API  __declspec( dllexport )
+  #else
+    #define TOTP_API  __declspec( dllimport )
+  #endif
+#elif defined( __GNUC__ )
+  #define TOTP_API  __attribute__(( visibility( "default" )))
+#else
+  #define TOTP_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------
+//                          Constants
+//---------------------------------------------------------------------
+
+#define TOTP_MAX_BLOCK      128     // (largest digest block size: sha512)
+#define TOTP_MAX_HASH       64      // (largest digest hash size:  sha512)
+
+#define TOTP_DEF_DIGITS     6       // (default output digits) (Google Authenticator)
+#define TOTP_DEF_INTERVAL   30      // (default time interval) (Google Authenticator)
+#define TOTP_DEF_OFFSET     0       // (default time offset)   (Google Authenticator)
+
+#define TOTP_MIN_DIGITS     6       // (minimum supported DIGITS)
+#define TOTP_MAX_DIGITS     10      // (maximum supported DIGITS)
+
+typedef enum totp_digest
+{
+    TOTP_SHA1   = 0,
+    TOTP_SHA256 = 1,
+    TOTP_SHA512 = 2,
+
+    TOTP_NUM_DIGESTS                // (number of supported digests)
+}
+totp_digest;
+
+// totp_parse return codes...
+
+#define TOTP_OK             0       // (secret successfully parsed)
+#define TOTP_SKIP           1       // (blank or comment line; ignore)
+#define TOTP_EINVAL        -1       // (invalid SECRET, DIGITS or INTERVAL)
+#define TOTP_EIO           -2       // (store file I/O error; see errno)
+
+// totp_secret flags...
+
+#define TOTP_F_TEST         0x01    // ("TEST:" option: OFFSET is exact time)
+#define TOTP_F_MIDSTATE     0x02    // (HMAC midstates precomputed)
+
+//---------------------------------------------------------------------
+//                          totp_secret
+//---------------------------------------------------------------------
+
+struct totp_md;                     // (digest implementation; opaque)
+struct totp_engine;                 // (code calculation; opaque)
+
+typedef struct totp_secret
+{
+    const struct totp_md*  md;      // (resolved once by totp_parse)
+    const struct totp_engine*  engine;  // (likewise, for digest + DIGITS)
+
+    const char*  label;             // (trailing text following the
+                                    //  parameters, pointing into the
+                                    //  line passed to totp_parse)
+    size_t       label_len;         // (length of label, excluding any
+                                    //  trailing newline)
+
+    int64_t      offset;            // (OFFSET, or exact time if TEST)
+    uint64_t     interval;          // (INTERVAL, i.e. the time step)
+
+    uint32_t     key_len;           // (decoded SECRET length in bytes)
+    uint8_t      digest;            // (totp_digest)
+    uint8_t      digits;            // (DIGITS)
+    uint8_t      flags;             // (TOTP_F_xxx flags)
+
+    uint8_t      k0[ TOTP_MAX_BLOCK ];  // (key padded to the digest's
+                                        //  block size, as per RFC 2104)
+    union
+    {
+        uint32_t  w32[2][8];        // (sha1/sha256 inner/outer states)
+        uint64_t  w64[2][8];        // (sha512 inner/outer states)
+    }
+    mid;                            // (see totp_precompute)
+#ifdef __cplusplus
+
+    // C++ convenience wrappers...
+
+    inline uint32_t generate( int64_t at_time ) const;
+    inline bool     verify( uint32_t code, int64_t at_time,
+                            unsigned window, int* drift = 0 ) const;
+#endif
+}
+totp_secret;
+
+//---------------------------------------------------------------------
+//                          Functions
+//---------------------------------------------------------------------
+
+// Parse "[*#;][TEST:][DIGEST:]SECRET[:DIGITS[:INTERVAL[:OFFSET]]][text]"
+// (see totp.cpp for a complete description of the input line format)
+
+TOTP_API int          totp_parse( totp_secret* s, const char* line );
+
+// Same, but for a line of exactly 'len' bytes, which needn't be NUL
+// terminated (e.g. part of a memory mapped file), and ignoring blanks
+// ANYWHERE within it (i.e. "AB CD : 8" is the same as "ABCD:8"), which
+// is how the totp utility itself has always treated its input. The
+// label then excludes leading and trailing blanks, but may still have
+// embedded ones, which it's up to the caller to ignore if need be.
+
+TOTP_API int          totp_parse_line( totp_secret* s, const char* line, size_t len );
+
+// Same, but also says where in the line the SECRET stopped, and if the
+// line was rejected (TOTP_EINVAL), why and where (offsets into 'line')...
+
+typedef struct totp_diag
+{
+    size_t       secret_end;        // (offset just past the SECRET)
+    size_t       error_at;          // (offset of the invalid field)
+    const char*  error;             // (what's wrong with it, or NULL)
+}
+totp_diag;
+
+TOTP_API int          totp_parse_diag( totp_secret* s, const char* line, size_t len, totp_diag* diag );
+
+// Precompute and save the secret's HMAC inner and outer midstates,
+// i.e. the digest's state after hashing the (K0 ^ ipad) and (K0 ^ opad)
+// blocks, which never change for a given secret. Each code thereafter
+// then costs only the two final compressions instead of four.
+
+TOTP_API void         totp_precompute( totp_secret* s );
+
+// Counter value (time step number) for the given time...
+
+TOTP_API uint64_t     totp_counter( const totp_secret* s, int64_t at_time );
+
+// RFC 4226 HOTP code for the given counter value...
+
+TOTP_API uint32_t     totp_hotp( const totp_secret* s, uint64_t counter );
+
+// RFC 6238 TOTP code for the given time...
+
+TOTP_API uint32_t     totp_generate( const totp_secret* s, int64_t at_time );
+
+// Check code against the time steps within +/- window of the given
+// time. Returns non-zero if matched, optionally also returning the
+// matching time step's drift (-window ... 0 ... +window).
+
+TOTP_API int          totp_verify( const totp_secret* s, uint32_t code,
+                                   int64_t at_time, unsigned window,
+                                   int* drift );
+
+// Batch versions of totp_hotp and totp_generate, calculating the codes
+// for many secrets at once using the best available multi-buffer (SIMD)
+// kernel. Secrets must have been precomputed (see totp_precompute) to
+// benefit. The secrets may use any mixture of digests.
+
+TOTP_API void         totp_hotp_batch( const totp_secret* const* secrets,
+                                       const uint64_t* counters,
+                                       uint32_t* codes, size_t n );
+
+TOTP_API void         totp_generate_batch( const totp_secret* const* secrets,
+                                           int64_t at_time,
+                                           uint32_t* codes, size_t n );
+
+// Codes for 'n' consecutive counter values (time steps) of the same
+// secret, starting with 'counter': i.e. the same as calling totp_hotp
+// for counter, counter+1, ... but keying the HMAC only once, and using
+// the multi-buffer kernels for many counters at once.
+
+TOTP_API void         totp_hotp_range( const totp_secret* s, uint64_t counter,
+                                       uint32_t* codes, size_t n );
+
+// Resynchronisation (RFC 4226 section 7.4): search the counters from
+// counter - behind to counter + ahead for the 'ncodes' (1 to 4) given
+// consecutive codes (two or more make a false match over a large window
+// much less likely), the search being split between 'threads' threads
+// (0 = one per CPU), keying the HMAC only once. Returns TOTP_OK and the
+// drift of the nearest match (its first code's counter minus 'counter',
+// i.e. what to add to that secret's counter or time step from now on),
+// or TOTP_SKIP if not found. The search stops as soon as no nearer match
+// is possible.
+
+TOTP_API int          totp_resync( const totp_secret* s, uint64_t counter,
+                                   uint64_t behind, uint64_t ahead,
+                                   const uint32_t* codes, size_t ncodes,
+                                   unsigned threads, int64_t* drift );
+
+// Names of the batch kernels available on this CPU (i = 0, 1, ...
+// until NULL is returned; "scalar" is always available), the name of
+// the kernel currently being used, and override of which one to use.
+
+TOTP_API const char*  totp_batch_kernels( int i );
+TOTP_API const char*  totp_batch_kernel( void );
+TOTP_API int          totp_set_batch_kernel( const char* name );
+
+// Precompiled secret stores: a file of already parsed secrets which is
+// memory mapped and used directly, without any parsing (or any startup
+// cost proportional to the number of secrets it holds). Secrets are
+// added one at a time to a new store (which replaces any existing file)
+// and the store is then finished, which writes its name index. Each
+// secret's name is its label without any leading comment characters or
+// blanks. The secrets returned by totp_store_get are just like those
+// returned by totp_parse (and must be wiped the same way), except that
+// their label points into the store, so is only valid until it's closed.
+//
+// A store may also be sealed, i.e. its secrets (but not their labels)
+// encrypted, under a key derived from a passphrase: totp_store_seal must
+// then be called before the first secret is added. A sealed store must
+// be unlocked with the same passphrase (which is slow, by design, so is
+// best done just once) before its secrets can be got: until then, or if
+// the passphrase is wrong, totp_store_get fails. Each secret is only
+// decrypted when it's first got, and is then cached in locked memory.
+
+#define TOTP_STORE_MIDSTATES    0x01    // (also store HMAC midstates)
+#define TOTP_STORE_SEALED       0x02    // (secrets encrypted; see above)
+#define TOTP_STORE_NOTFOUND     ((size_t) -1)
+
+typedef struct totp_store_writer  totp_store_writer;  // (opaque)
+typedef struct totp_store         totp_store;         // (opaque)
+
+TOTP_API totp_store_writer*  totp_store_create( const char* path, unsigned flags );
+TOTP_API int          totp_store_add( totp_store_writer* w, const totp_secret* s );
+TOTP_API int          totp_store_seal( totp_store_writer* w, const char* pass, size_t len );
+TOTP_API int          totp_store_finish( totp_store_writer* w );
+
+TOTP_API totp_store*  totp_store_open( const char* path );
+TOTP_API int          totp_store_locked( const totp_store* st );
+TOTP_API int          totp_store_unlock( totp_store* st, const char* pass, size_t len );
+TOTP_API size_t       totp_store_count( const totp_store* st );
+TOTP_API int          totp_store_get( const totp_store* st, size_t i, totp_secret* s );
+TOTP_API size_t       totp_store_find( const totp_store* st, const char* name, size_t len );
+TOTP_API void         totp_store_close( totp_store* st );
+
+// A name (e.g. a secret's label) less any leading comment characters or
+// blanks, or trailing blanks, i.e. the name a store finds it by, and the
+// hash of a name its index is by (e.g. for callers' own indexes)...
+
+TOTP_API void         totp_name( const char** name, size_t* len );
+TOTP_API uint32_t     totp_name_hash( const char* name, size_t len );
+
+// HOTP (RFC 4226) counters: the next counter to be used for each secret,
+// by name (as for stores), kept in an append-only log file. Counters only
+// ever move forward: advancing one to a counter which isn't ahead of its
+// current one returns TOTP_SKIP (e.g. a replayed code). Advances become
+// durable once totp_counters_commit returns, and concurrent commits (from
+// any number of threads) share the same write and fsync. The log is
+// compacted in the background once it's grown large enough. A counter
+// which has never been advanced is 0.
+
+typedef struct totp_counters  totp_counters;    // (opaque)
+
+TOTP_API totp_counters*  totp_counters_open( const char* path );
+TOTP_API uint64_t     totp_counters_get( totp_counters* c, const char* name, size_t len );
+TOTP_API int          totp_counters_advance( totp_counters* c, const char* name, size_t len,
+                                             uint64_t counter );
+TOTP_API int          totp_counters_commit( totp_counters* c );
+TOTP_API int          totp_counters_close( totp_counters* c );
+
+// Replay cache (RFC 6238 section 5.2): remembers which codes have already
+// been accepted, until they can no longer be accepted anyway. It's safe
+// to use from any number of threads at once (without any lock), holds up
+// to 'max_entries' codes accepted within any 'max_lifetime' seconds, and
+// never needs cleaning up: expired entries are simply reused. Checking a
+// secret's (id, counter) which expires at 'expires' returns TOTP_OK the
+// first time, TOTP_SKIP for a replay (or when it has already expired),
+// TOTP_EINVAL if it would outlive 'max_lifetime', or TOTP_EIO if the
+// cache is full (i.e. 'max_entries' was too small). totp_verify_once is
+// totp_verify with the replay check: a secret's id is then its name (as
+// for stores), and a wrong code is TOTP_EINVAL.
+
+typedef struct totp_replay  totp_replay;        // (opaque)
+
+TOTP_API totp_replay* totp_replay_create( size_t max_entries, int64_t max_lifetime );
+TOTP_API int          totp_replay_check( totp_replay* r, uint64_t id, uint64_t counter,
+                                         int64_t expires, int64_t at_time );
+TOTP_API int          totp_verify_once( const totp_secret* s, totp_replay* r, uint32_t code,
+                                        int64_t at_time, unsigned window, int* drift );
+TOTP_API void         totp_replay_destroy( totp_replay* r );
+
+// Importer: secrets from enrolment data as it's usually handed out,
+// i.e. "otpauth://totp/LABEL?secret=SECRET&..." (or hotp) Key Uri Format
+// URIs, and Google Authenticator "otpauth-migration://offline?data=..."
+// export payloads (each any number of secrets), one per line. Any other
+// line is parsed by totp_parse_line, so files may mix all three. Each
+// line is given to totp_import_line, which returns TOTP_OK, TOTP_SKIP (a
+// blank or comment line) or TOTP_EINVAL (a malformed line). Its secrets
+// are then got from totp_import_next, one per call, until it returns
+// TOTP_SKIP, or TOTP_EINVAL for one which isn't valid (skip it and carry
+// on), totp_import_error saying why. A secret's label is then the URI's
+// (percent decoded) label, prefixed with its issuer and ':' unless it
+// already has one, and is only valid until the next call. An HOTP one
+// (an otpauth://hotp/ URI, or a payload's HOTP entry) is made just like
+// a TOTP one, so totp_import_counter must be asked whether each secret
+// is, in which case it returns TOTP_OK and its counter (the next one to
+// be used, e.g. for totp_counters_advance), else TOTP_SKIP.
+
+typedef struct totp_import  totp_import;        // (opaque)
+
+TOTP_API totp_import* totp_import_create( void );
+TOTP_API int          totp_import_line( totp_import* im, const char* line, size_t len );
+TOTP_API int          totp_import_next( totp_import* im, totp_secret* s );
+TOTP_API int          totp_import_counter( const totp_import* im, uint64_t* counter );
+TOTP_API const char*  totp_import_error( const totp_import* im );
+TOTP_API void         totp_import_destroy( totp_import* im );
+
+// Secret table: many secrets kept in memory at once (e.g. by a daemon)
+// in far less room than as totp_secrets, namely their midstates (so not
+// their keys), a small header and their labels, grouped by digest. Each
+// secret added (which needn't have been precomputed) is then numbered 0
+// to count-1, and totp_table_get gets it back as a precomputed secret
+// (whose label is valid until the table is destroyed). totp_table_add
+// returns TOTP_SKIP if there's a secret by that name already (as for
+// stores), TOTP_EINVAL if the table is full, or TOTP_EIO (see errno),
+// and once they've all been added, totp_table_trim frees any slack.
+// totp_table_generate is totp_generate_batch for secrets which[0..n-1]
+// (or 0 to n-1 if NULL), and totp_table_memory reports the memory used.
+
+typedef struct totp_table  totp_table;          // (opaque)
+
+typedef struct totp_table_mem
+{
+    size_t   count;                 // (number of secrets)
+    size_t   keys;                  // (bytes of midstates)
+    size_t   headers;               // (bytes of headers and parameters)
+    size_t   labels;                // (bytes of labels)
+    size_t   index;                 // (bytes of name index)
+    size_t   total;                 // (all of the above, and the table)
+}
+totp_table_mem;
+
+#define TOTP_TABLE_NOTFOUND  ((size_t) -1)
+
+TOTP_API totp_table*  totp_table_create( size_t expected );
+TOTP_API int          totp_table_add( totp_table* t, const totp_secret* s );
+TOTP_API void         totp_table_trim( totp_table* t );
+TOTP_API size_t       totp_table_count( const totp_table* t );
+TOTP_API int          totp_table_get( const totp_table* t, size_t i, totp_secret* s );
+TOTP_API size_t       totp_table_find( const totp_table* t, const char* name, size_t len );
+TOTP_API void         totp_table_generate( const totp_table* t, const size_t* which, size_t n,
+                                           int64_t at_time, uint32_t* codes );
+TOTP_API void         totp_table_memory( const totp_table* t, totp_table_mem* mem );
+TOTP_API void         totp_table_destroy( totp_table* t );
+
+// Securely erase a secret once no longer needed...
+
+TOTP_API void         totp_wipe( totp_secret* s );
+
+// Securely erase any other memory (which the compiler isn't allowed to
+// optimize away), e.g. copies of input lines...
+
+TOTP_API void         totp_cleanse( void* p, size_t len );
+
+// Miscellaneous...
+
+TOTP_API const char*  totp_digest_name( int digest );
+TOTP_API size_t       totp_hash_size( int digest );
+TOTP_API size_t       totp_block_size( int digest );
+
+// Which SHA implementation the library was built with: "openssl", or
+// "built-in (...)" listing which instructions each digest is using...
+
+TOTP_API const char*  totp_sha_backend( void );
+
+#ifdef __cplusplus
+} // extern "C"
+
+inline uint32_t totp_secret::generate( int64_t at_time ) const
+{
+    return totp_generate( this, at_time );
+}
+
+inline bool totp_secret::verify( uint32_t code, int64_t at_time,
+                                 unsigned window, int* drift ) const
+{
+    return totp_verify( this, code, at_time, window, drift ) != 0;
+}
+#endif
@@ -0,0 +1,579 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+#ifdef _WIN32
+  #include <bcrypt.h>               // (need BCryptGenRandom)
+  #ifdef _MSC_VER
+    #pragma comment( lib, "bcrypt.lib" )
+  #endif
+#endif
+
+//------------------------------------------------------------------------------
+//                        SEALED STORE CRYPTOGRAPHY
+//------------------------------------------------------------------------------
+//
+//  What sealed (encrypted) stores need (see libtotp_store.cpp): the
+//  ChaCha20-Poly1305 AEAD (RFC 8439) each record is sealed with, the
+//  PBKDF2-HMAC-SHA256 (RFC 8018) its key is derived from the passphrase
+//  with, and random bytes for the key's salt.
+//
+//  As for the digests, the AEAD is OpenSSL's libcrypto (whose ChaCha20
+//  and Poly1305 use the CPU's SIMD instructions) by default, or our own
+//  portable C implementation if built with TOTP_BUILTIN_SHA (which, like
+//  the built-in digests, is always there, so bench can check it too). Both
+//  are of course identical, so either can open stores sealed by the other. The
+//  PBKDF2 is always our own, done with the SHA-256 compression function
+//  directly (two per round, from the passphrase's HMAC midstates).
+//
+//------------------------------------------------------------------------------
+
+static inline uint32_t load_le32( const uint8_t* p )
+{
+    return ((uint32_t) p[0]      ) | ((uint32_t) p[1] <<  8)
+         | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline void store_le32( uint8_t* p, uint32_t w )
+{
+    p[0] = (uint8_t) (w      );
+    p[1] = (uint8_t) (w >>  8);
+    p[2] = (uint8_t) (w >> 16);
+    p[3] = (uint8_t) (w >> 24);
+}
+
+//---------------------------------------------------------------------
+//                            ChaCha20
+//---------------------------------------------------------------------
+
+#define ROTL32( x, n )      (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define QUARTER( a, b, c, d )                                         \
+    a += b;  d ^= a;  d = ROTL32( d, 16 );                            \
+    c += d;  b ^= c;  b = ROTL32( b, 12 );                            \
+    a += b;  d ^= a;  d = ROTL32( d,  8 );                            \
+    c += d;  b ^= c;  b = ROTL32( b,  7 )
+
+// One 64 byte block of key stream...
+
+static void chacha20_block( const uint32_t* in, uint8_t* out )
+{
+    uint32_t  x[16];
+    int       i;
+
+    memcpy( x, in, sizeof( x ));
+
+    for (i=0; i < 10; i++)
+    {
+        QUARTER( x[0], x[4], x[ 8], x[12] );
+        QUARTER( x[1], x[5], x[ 9], x[13] );
+        QUARTER( x[2], x[6], x[10], x[14] );
+        QUARTER( x[3], x[7], x[11], x[15] );
+
+        QUARTER( x[0], x[5], x[10], x[15] );
+        QUARTER( x[1], x[6], x[11], x[12] );
+        QUARTER( x[2], x[7], x[ 8], x[13] );
+        QUARTER( x[3], x[4], x[ 9], x[14] );
+    }
+
+    for (i=0; i < 16; i++)
+        store_le32( out + i*4, x[i] + in[i] );
+
+    totp_cleanse( x, sizeof( x ));
+}
+
+static void chacha20_init( uint32_t* st, const uint8_t* key, const uint8_t* nonce, uint32_t counter )
+{
+    int  i;
+
+    st[0] = 0x61707865, st[1] = 0x3320646e;     // ("expand 32-byte k")
+    st[2] = 0x79622d32, st[3] = 0x6b206574;
+
+    for (i=0; i < 8; i++)
+        st[ 4 + i ] = load_le32( key + i*4 );
+
+    st[12] = counter;
+
+    for (i=0; i < 3; i++)
+        st[ 13 + i ] = load_le32( nonce + i*4 );
+}
+
+// XOR 'len' bytes of key stream (from block 1 on) into 'data'...
+
+static void chacha20_xor( uint32_t* st, uint8_t* data, size_t len )
+{
+    uint8_t  ks[64];
+    size_t   i, n;
+
+    for (; len; len -= n, data += n)
+    {
+        chacha20_block( st, ks );
+        st[12]++;
+
+        for (i=0, n = len < 64 ? len : 64; i < n; i++)
+            data[i] ^= ks[i];
+    }
+
+    totp_cleanse( ks, sizeof( ks ));
+}
+
+//---------------------------------------------------------------------
+//                            Poly1305
+//---------------------------------------------------------------------
+//
+//  In 26-bit limbs (i.e. "poly1305-donna-32"), so that every product
+//  fits in 64 bits, without needing any 128-bit arithmetic.
+//
+//---------------------------------------------------------------------
+
+struct poly1305
+{
+    uint32_t  r[5];                 // (clamped 'r', in 26-bit limbs)
+    uint32_t  h[5];                 // (accumulator)
+    uint32_t  pad[4];               // ('s')
+    uint8_t   buf[16];              // (partial block)
+    size_t    num;                  // (bytes in buf)
+};
+
+#define LIMB    0x3ffffff
+
+static void poly1305_init( poly1305* p, const uint8_t* key )
+{
+    p->r[0] = (load_le32( key +  0 )     ) & 0x3ffffff;
+    p->r[1] = (load_le32( key +  3 ) >> 2) & 0x3ffff03;
+    p->r[2] = (load_le32( key +  6 ) >> 4) & 0x3ffc0ff;
+    p->r[3] = (load_le32( key +  9 ) >> 6) & 0x3f03fff;
+    p->r[4] = (load_le32( key + 12 ) >> 8) & 0x00fffff;
+
+    memset( p->h, 0, sizeof( p->h ));
+
+    p->pad[0] = load_le32( key + 16 );
+    p->pad[1] = load_le32( key + 20 );
+    p->pad[2] = load_le32( key + 24 );
+    p->pad[3] = load_le32( key + 28 );
+
+    p->num = 0;
+}
+
+static void poly1305_blocks( poly1305* p, const uint8_t* m, size_t len, uint32_t hibit )
+{
+    const uint32_t  r0 = p->r[0], r1 = p->r[1], r2 = p->r[2], r3 = p->r[3], r4 = p->r[4];
+    const uint32_t  s1 = r1 * 5,  s2 = r2 * 5,  s3 = r3 * 5,  s4 = r4 * 5;
+
+    uint32_t  h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], h3 = p->h[3], h4 = p->h[4];
+    uint64_t  d0, d1, d2, d3, d4;
+    uint32_t  c;
+
+    for (; len >= 16; len -= 16, m += 16)
+    {
+        h0 += (load_le32( m +  0 )     ) & LIMB;
+        h1 += (load_le32( m +  3 ) >> 2) & LIMB;
+        h2 += (load_le32( m +  6 ) >> 4) & LIMB;
+        h3 += (load_le32( m +  9 ) >> 6) & LIMB;
+        h4 += (load_le32( m + 12 ) >> 8) | hibit;
+
+        d0 = (uint64_t) h0*r0 + (uint64_t) h1*s4 + (uint64_t) h2*s3 + (uint64_t) h3*s2 + (uint64_t) h4*s1;
+        d1 = (uint64_t) h0*r1 + (uint64_t) h1*r0 + (uint64_t) h2*s4 + (uint64_t) h3*s3 + (uint64_t) h4*s2;
+        d2 = (uint64_t) h0*r2 + (uint64_t) h1*r1 + (uint64_t) h2*r0 + (uint64_t) h3*s4 + (uint64_t) h4*s3;
+        d3 = (uint64_t) h0*r3 + (uint64_t) h1*r2 + (uint64_t) h2*r1 + (uint64_t) h3*r0 + (uint64_t) h4*s4;
+        d4 = (uint64_t) h0*r4 + (uint64_t) h1*r3 + (uint64_t) h2*r2 + (uint64_t) h3*r1 + (uint64_t) h4*r0;
+
+                  c = (uint32_t) (d0 >> 26);  h0 = (uint32_t) d0 & LIMB;
+        d1 += c;  c = (uint32_t) (d1 >> 26);  h1 = (uint32_t) d1 & LIMB;
+        d2 += c;  c = (uint32_t) (d2 >> 26);  h2 = (uint32_t) d2 & LIMB;
+        d3 += c;  c = (uint32_t) (d3 >> 26);  h3 = (uint32_t) d3 & LIMB;
+        d4 += c;  c = (uint32_t) (d4 >> 26);  h4 = (uint32_t) d4 & LIMB;
+        h0 += c * 5;  c = h0 >> 26;  h0 &= LIMB;
+        h1 += c;
+    }
+
+    p->h[0] = h0, p->h[1] = h1, p->h[2] = h2, p->h[3] = h3, p->h[4] = h4;
+}
+
+static void poly1305_update( poly1305* p, const uint8_t* m, size_t len )
+{
+    size_t  n;
+
+    if (p->num)
+    {
+        n = 16 - p->num < len ? 16 - p->num : len;
+        memcpy( p->buf + p->num, m, n );
+        p->num += n, m += n, len -= n;
+
+        if (p->num < 16)
+            return;
+
+        poly1305_blocks( p, p->buf, 16, 1 << 24 );
+        p->num = 0;
+    }
+
+    poly1305_blocks( p, m, len & ~(size_t) 15, 1 << 24 );
+
+    if ((n = len & 15) != 0)
+        memcpy( p->buf, m + len - n, p->num = n );
+}
+
+static void poly1305_pad16( poly1305* p )   // (AEAD: zero pad to a block)
+{
+    static const uint8_t  zeros[16] = { 0 };
+
+    if (p->num)
+        poly1305_update( p, zeros, 16 - p->num );
+}
+
+static void poly1305_final( poly1305* p, uint8_t* tag )
+{
+    uint32_t  h0, h1, h2, h3, h4, g0, g1, g2, g3, g4, c, mask;
+    uint64_t  f;
+
+    if (p->num)     // (the last partial block: "1" then zeros, no hibit)
+    {
+        p->buf[ p->num++ ] = 1;
+        memset( p->buf + p->num, 0, 16 - p->num );
+        poly1305_blocks( p, p->buf, 16, 0 );
+    }
+
+    h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], h3 = p->h[3], h4 = p->h[4];
+
+                 c = h1 >> 26;  h1 &= LIMB;
+    h2 += c;     c = h2 >> 26;  h2 &= LIMB;
+    h3 += c;     c = h3 >> 26;  h3 &= LIMB;
+    h4 += c;     c = h4 >> 26;  h4 &= LIMB;
+    h0 += c * 5; c = h0 >> 26;  h0 &= LIMB;
+    h1 += c;
+
+    // h - p (i.e. h + 5 - 2^130), used instead if it isn't negative...
+
+    g0 = h0 + 5; c = g0 >> 26;  g0 &= LIMB;
+    g1 = h1 + c; c = g1 >> 26;  g1 &= LIMB;
+    g2 = h2 + c; c = g2 >> 26;  g2 &= LIMB;
+    g3 = h3 + c; c = g3 >> 26;  g3 &= LIMB;
+    g4 = h4 + c - (1 << 26);
+
+    mask = (g4 >> 31) - 1;
+    g0 &= mask, g1 &= mask, g2 &= mask, g3 &= mask, g4 &= mask;
+    mask = ~mask;
+    h0 = (h0 & mask) | g0;
+    h1 = (h1 & mask) | g1;
+    h2 = (h2 & mask) | g2;
+    h3 = (h3 & mask) | g3;
+    h4 = (h4 & mask) | g4;
+
+    // (h + s) mod 2^128...
+
+    h0 = (h0      ) | (h1 << 26);
+    h1 = (h1 >>  6) | (h2 << 20);
+    h2 = (h2 >> 12) | (h3 << 14);
+    h3 = (h3 >> 18) | (h4 <<  8);
+
+    f = (uint64_t) h0 + p->pad[0];              store_le32( tag +  0, (uint32_t) f );
+    f = (uint64_t) h1 + p->pad[1] + (f >> 32);  store_le32( tag +  4, (uint32_t) f );
+    f = (uint64_t) h2 + p->pad[2] + (f >> 32);  store_le32( tag +  8, (uint32_t) f );
+    f = (uint64_t) h3 + p->pad[3] + (f >> 32);  store_le32( tag + 12, (uint32_t) f );
+
+    totp_cleanse( p, sizeof( *p ));
+}
+
+void totp_builtin_poly1305( const uint8_t* key, const void* msg, size_t len, uint8_t* tag )
+{
+    poly1305  p;
+
+    poly1305_init( &p, key );
+    poly1305_update( &p, (const uint8_t*) msg, len );
+    poly1305_final( &p, tag );
+}
+
+//---------------------------------------------------------------------
+//                        ChaCha20-Poly1305
+//---------------------------------------------------------------------
+
+// The tag of the AAD and ciphertext (RFC 8439 section 2.8), using the
+// one time Poly1305 key from ChaCha20 block 0 (leaving the state at
+// block 1, for the data)...
+
+static void aead_tag( uint32_t* st, const void* aad, size_t aad_len,
+                      const uint8_t* data, size_t len, uint8_t* tag )
+{
+    poly1305  p;
+    uint8_t   block[64];
+    uint8_t   lens[16];
+
+    chacha20_block( st, block );
+    st[12]++;
+
+    poly1305_init( &p, block );
+    totp_cleanse( block, sizeof( block ));
+
+    poly1305_update( &p, (const uint8_t*) aad, aad_len );
+    poly1305_pad16( &p );
+    poly1305_update( &p, data, len );
+    poly1305_pad16( &p );
+
+    store_le32( lens +  0, (uint32_t) aad_len ), store_le32( lens +  4, (uint32_t) ((uint64_t) aad_len >> 32) );
+    store_le32( lens +  8, (uint32_t) len     ), store_le32( lens + 12, (uint32_t) ((uint64_t) len     >> 32) );
+
+    poly1305_update( &p, lens, sizeof( lens ));
+    poly1305_final( &p, tag );
+}
+
+void totp_builtin_aead_seal( const uint8_t* key, const uint8_t* nonce, const void* aad, size_t aad_len,
+                             uint8_t* data, size_t len, uint8_t* tag )
+{
+    uint32_t  st[16];
+    uint32_t  mac[16];
+
+    chacha20_init( st, key, nonce, 0 );
+    memcpy( mac, st, sizeof( mac ));
+
+    st[12] = 1;
+    chacha20_xor( st, data, len );
+
+    aead_tag( mac, aad, aad_len, data, len, tag );
+
+    totp_cleanse( st, sizeof( st ));
+    totp_cleanse( mac, sizeof( mac ));
+}
+
+bool totp_builtin_aead_open( const uint8_t* key, const uint8_t* nonce, const void* aad, size_t aad_len,
+                             uint8_t* data, size_t len, const uint8_t* tag )
+{
+    uint32_t  st[16];
+    uint8_t   expect[ TOTP_AEAD_TAG ];
+    uint8_t   diff = 0;
+    size_t    i;
+
+    chacha20_init( st, key, nonce, 0 );
+    aead_tag( st, aad, aad_len, data, len, expect );
+
+    for (i=0; i < TOTP_AEAD_TAG; i++)   // (constant time)
+        diff |= expect[i] ^ tag[i];
+
+    if (!diff)
+        chacha20_xor( st, data, len );  // (already at block 1)
+
+    totp_cleanse( st, sizeof( st ));
+
+    return !diff;
+}
+
+#ifdef TOTP_BUILTIN_SHA
+
+void totp_aead_seal( const uint8_t* key, const uint8_t* nonce, const void* aad, size_t aad_len,
+                     uint8_t* data, size_t len, uint8_t* tag )
+{
+    totp_builtin_aead_seal( key, nonce, aad, aad_len, data, len, tag );
+}
+
+bool totp_aead_open( const uint8_t* key, const uint8_t* nonce, const void* aad, size_t aad_len,
+                     uint8_t* data, size_t len, const uint8_t* tag )
+{
+    return totp_builtin_aead_open( key, nonce, aad, aad_len, data, len, tag );
+}
+
+#else // (OpenSSL libcrypto)
+
+//---------------------------------------------------------------------
+//                   ChaCha20-Poly1305 (OpenSSL)
+//---------------------------------------------------------------------
+
+static bool aead_run( bool seal, const uint8_t* key, const uint8_t* nonce, const void* aad,
+                      size_t aad_len, uint8_t* data, size_t len, uint8_t* tag )
+{
+    EVP_CIPHER_CTX*  ctx;
+    int              n;
+    bool             ok;
+
+    if (!(ctx = EVP_CIPHER_CTX_new()))
+        return false;
+
+    ok = 1
+        && EVP_CipherInit_ex( ctx, EVP_chacha20_poly1305(), NULL, NULL, NULL, seal ) > 0
+        && EVP_CIPHER_CTX_ctrl( ctx, EVP_CTRL_AEAD_SET_IVLEN, TOTP_AEAD_NONCE, NULL ) > 0
+        && EVP_CipherInit_ex( ctx, NULL, NULL, key, nonce, seal ) > 0
+        && (seal || EVP_CIPHER_CTX_ctrl( ctx, EVP_CTRL_AEAD_SET_TAG, TOTP_AEAD_TAG, tag ) > 0)
+        && (!aad_len || EVP_CipherUpdate( ctx, NULL, &n, (const uint8_t*) aad, (int) aad_len ) > 0)
+        && (!len     || EVP_CipherUpdate( ctx, data, &n, data, (int) len ) > 0)
+        && EVP_CipherFinal_ex( ctx, data + len, &n ) > 0
+        && (!seal || EVP_CIPHER_CTX_ctrl( ctx, EVP_CTRL_AEAD_GET_TAG, TOTP_AEAD_TAG, tag ) > 0);
+
+    EVP_CIPHER_CTX_free( ctx );     // (which cleanses it)
+
+    if (!ok && !seal)
+        totp_cleanse( data, len );  // (never leave a forgery's plaintext)
+
+    return ok;
+}
+
+void totp_aead_seal( const uint8_t* key, const uint8_t* nonce, const void* aad, size_t aad_len,
+                     uint8_t* data, size_t len, uint8_t* tag )
+{
+    if (!aead_run( true, key, nonce, aad, aad_len, data, len, tag ))
+        memset( tag, 0, TOTP_AEAD_TAG );    // (so it can never be opened)
+}
+
+bool totp_aead_open( const uint8_t* key, const uint8_t* nonce, const void* aad, size_t aad_len,
+                     uint8_t* data, size_t len, const uint8_t* tag )
+{
+    return aead_run( false, key, nonce, aad, aad_len, data, len, (uint8_t*) tag );
+}
+
+#endif
+
+//---------------------------------------------------------------------
+//                       PBKDF2-HMAC-SHA256
+//---------------------------------------------------------------------
+//
+//  The passphrase is made into a secret (i.e. an HMAC key) whose
+//  midstates are precomputed, so every round after the first is just
+//  two compressions of a single prebuilt block (the previous round's
+//  32 byte result, padded): the same as a TOTP code's HMAC.
+//
+//---------------------------------------------------------------------
+
+void totp_pbkdf2( const char* pass, size_t pass_len, const uint8_t* salt, size_t salt_len,
+                  uint32_t rounds, uint8_t* key, size_t key_len )
+{
+    const totp_md*  md = &totp_mds[ TOTP_SHA256 ];
+
+    totp_secret     s;
+    totp_hash_ctx   ctx;
+    uint8_t         ipad[64], opad[64], inner[64], outer[64];
+    uint8_t         t[32], cnt[4];
+    uint32_t        st[8];
+    uint32_t        block, r;
+    size_t          i, n;
+
+    memset( &s, 0, sizeof( s ));
+    s.md     = md;
+    s.digest = TOTP_SHA256;
+
+    if (pass_len > md->block_size)
+    {
+        md->init   ( &ctx );
+        md->update ( &ctx, pass, pass_len );
+        md->final  ( &ctx, s.k0 );
+    }
+    else
+        memcpy( s.k0, pass, pass_len );
+
+    totp_precompute( &s );
+
+    for (i=0; i < 64; i++)
+    {
+        ipad[i] = s.k0[i] ^ 0x36;
+        opad[i] = s.k0[i] ^ 0x5c;
+    }
+
+    // The two final blocks: the 32 byte hash, padded (as if after the
+    // block of key pad), whose hash is only ever replaced...
+
+    memset( inner, 0, sizeof( inner ));
+    inner[32] = 0x80;
+    inner[62] = (uint8_t) (((64 + 32) * 8) >> 8);
+    inner[63] = (uint8_t) (((64 + 32) * 8)     );
+    memcpy( outer, inner, sizeof( outer ));
+
+    for (block=1; key_len; block++, key += n, key_len -= n)
+    {
+        // U1 = HMAC( pass, salt || INT( block ))...
+
+        cnt[0] = (uint8_t) (block >> 24), cnt[1] = (uint8_t) (block >> 16);
+        cnt[2] = (uint8_t) (block >>  8), cnt[3] = (uint8_t) (block      );
+
+        md->init   ( &ctx );
+        md->update ( &ctx, ipad, 64 );
+        md->update ( &ctx, salt, salt_len );
+        md->update ( &ctx, cnt, 4 );
+        md->final  ( &ctx, inner );
+
+        md->init   ( &ctx );
+        md->update ( &ctx, opad, 64 );
+        md->update ( &ctx, inner, 32 );
+        md->final  ( &ctx, inner );
+
+        memcpy( t, inner, 32 );
+
+        // Then each Un = HMAC( pass, Un-1 ), XORed into T...
+
+        for (r=1; r < rounds; r++)
+        {
+            memcpy( st, s.mid.w32[0], sizeof( st ));
+            md->compress( st, inner );
+            totp_state_to_hash( md, st, outer );
+
+            memcpy( st, s.mid.w32[1], sizeof( st ));
+            md->compress( st, outer );
+            totp_state_to_hash( md, st, inner );
+
+            for (i=0; i < 32; i++)
+                t[i] ^= inner[i];
+        }
+
+        n = key_len < 32 ? key_len : 32;
+        memcpy( key, t, n );
+    }
+
+    totp_cleanse( &ctx,  sizeof( ctx   ));
+    totp_cleanse( ipad,  sizeof( ipad  ));
+    totp_cleanse( opad,  sizeof( opad  ));
+    totp_cleanse( inner, sizeof( inner ));
+    totp_cleanse( outer, sizeof( outer ));
+    totp_cleanse( t,     sizeof( t     ));
+    totp_cleanse( st,    sizeof( st    ));
+    totp_wipe( &s );
+}
+
+//---------------------------------------------------------------------
+//                           totp_random
+//---------------------------------------------------------------------
+
+bool totp_random( void* buf, size_t len )
+{
+#ifdef _WIN32
+    return BCryptGenRandom( NULL, (PUCHAR) buf, (ULONG) len, BCRYPT_USE_SYSTEM_PREFERRED_RNG ) == 0;
+#else
+    uint8_t*  p = (uint8_t*) buf;
+    ssize_t   n;
+    int       fd;
+
+    if ((fd = open( "/dev/urandom", O_RDONLY )) < 0)
+        return false;
+
+    for (; len; p += n, len -= n)
+    {
+        if ((n = read( fd, p, len )) <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                n = 0;
+                continue;
+            }
+            close( fd );
+            return false;
+        }
+    }
+
+    close( fd );
+    return true;
+#endif
+}
@@ -0,0 +1,121 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+//------------------------------------------------------------------------------
+//                      ARMv8 crypto extension SHA
+//------------------------------------------------------------------------------
+//
+//  SHA-1 and SHA-256 block compression functions for the built-in digests
+//  (see libtotp_sha.cpp) using the ARMv8 crypto extension instructions.
+//  This file must be compiled with them enabled (e.g. gcc -march=armv8-a
+//  +crypto); it is only ever called when the CPU is known to support them
+//  (see totp_cpu_features).
+//
+//------------------------------------------------------------------------------
+
+#if TOTP_ARM64
+
+#include <arm_neon.h>
+
+//---------------------------------------------------------------------
+//                      totp_sha1_block_armv8
+//---------------------------------------------------------------------
+
+void totp_sha1_block_armv8( uint32_t* state, const uint8_t* block )
+{
+    static const uint32_t k[4] = { 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
+
+    uint32x4_t  abcd, abcd_save, m[4], wk;
+    uint32_t    e0, e0_save, e1;
+    int         g;
+
+    abcd      = vld1q_u32( state );
+    e0        = state[4];
+    abcd_save = abcd;
+    e0_save   = e0;
+
+    for (g=0; g < 4; g++)
+        m[g] = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( block + g*16 )));
+
+    for (g=0; g < 20; g++)
+    {
+        wk = vaddq_u32( m[ g & 3 ], vdupq_n_u32( k[ g / 5 ] ));
+        e1 = vsha1h_u32( vgetq_lane_u32( abcd, 0 ));
+
+        if      (g <  5) abcd = vsha1cq_u32( abcd, e0, wk );
+        else if (g < 10) abcd = vsha1pq_u32( abcd, e0, wk );
+        else if (g < 15) abcd = vsha1mq_u32( abcd, e0, wk );
+        else             abcd = vsha1pq_u32( abcd, e0, wk );
+
+        e0 = e1;
+
+        // Message schedule for group g+4 (replaces group g's words)...
+
+        if (g < 16)
+            m[ g & 3 ] = vsha1su1q_u32( vsha1su0q_u32( m[ g & 3 ], m[ (g+1) & 3 ], m[ (g+2) & 3 ] ),
+                                        m[ (g+3) & 3 ] );
+    }
+
+    abcd = vaddq_u32( abcd, abcd_save );
+
+    vst1q_u32( state, abcd );
+    state[4] = e0 + e0_save;
+}
+
+//---------------------------------------------------------------------
+//                     totp_sha256_block_armv8
+//---------------------------------------------------------------------
+
+void totp_sha256_block_armv8( uint32_t* state, const uint8_t* block )
+{
+    uint32x4_t  st0, st1, st0_save, st1_save, tmp, wk, m[4];
+    int         g;
+
+    st0      = vld1q_u32( &state[0] );
+    st1      = vld1q_u32( &state[4] );
+    st0_save = st0;
+    st1_save = st1;
+
+    for (g=0; g < 4; g++)
+        m[g] = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( block + g*16 )));
+
+    for (g=0; g < 16; g++)
+    {
+        wk  = vaddq_u32( m[ g & 3 ], vld1q_u32( &totp_sha256_k[ g*4 ] ));
+        tmp = st0;
+        st0 = vsha256hq_u32( st0, st1, wk );
+        st1 = vsha256h2q_u32( st1, tmp, wk );
+
+        // Message schedule for group g+4 (replaces group g's words)...
+
+        if (g < 12)
+            m[ g & 3 ] = vsha256su1q_u32( vsha256su0q_u32( m[ g & 3 ], m[ (g+1) & 3 ] ),
+                                          m[ (g+2) & 3 ], m[ (g+3) & 3 ] );
+    }
+
+    vst1q_u32( &state[0], vaddq_u32( st0, st0_save ));
+    vst1q_u32( &state[4], vaddq_u32( st1, st1_save ));
+}
+
+#endif // TOTP_ARM64
@@ -0,0 +1,91 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+//------------------------------------------------------------------------------
+//                          AVX2 multi-buffer kernel
+//------------------------------------------------------------------------------
+//
+//  8 lanes of SHA-1/SHA-256 (32-bit words) or 4 lanes of SHA-512 (64-bit
+//  words) per 256-bit register. This file must be compiled with AVX2
+//  code generation enabled (e.g. gcc -mavx2); it is only ever called
+//  when the CPU is known to support AVX2 (see totp_cpu_features).
+//
+//------------------------------------------------------------------------------
+
+#if TOTP_X86
+
+#include <immintrin.h>
+
+struct avx2_32
+{
+    typedef __m256i   V;
+    typedef uint32_t  W;
+    enum { LANES = 8 };
+
+    static inline V     load   ( const W* p )   { return _mm256_load_si256( (const __m256i*) p ); }
+    static inline void  store  ( W* p, V v )    { _mm256_store_si256( (__m256i*) p, v );          }
+    static inline V     set1   ( W x )          { return _mm256_set1_epi32( (int) x );            }
+    static inline V     add    ( V a, V b )     { return _mm256_add_epi32( a, b );                }
+    static inline V     xor_   ( V a, V b )     { return _mm256_xor_si256( a, b );                }
+    static inline V     and_   ( V a, V b )     { return _mm256_and_si256( a, b );                }
+    static inline V     or_    ( V a, V b )     { return _mm256_or_si256( a, b );                 }
+    static inline V     andnot ( V a, V b )     { return _mm256_andnot_si256( a, b );             }
+
+    template <int N> static inline V shl  ( V a ) { return _mm256_slli_epi32( a, N ); }
+    template <int N> static inline V shr  ( V a ) { return _mm256_srli_epi32( a, N ); }
+    template <int N> static inline V rotr ( V a ) { return or_( shr<N>( a ), shl<32-N>( a )); }
+};
+
+struct avx2_64
+{
+    typedef __m256i   V;
+    typedef uint64_t  W;
+    enum { LANES = 4 };
+
+    static inline V     load   ( const W* p )   { return _mm256_load_si256( (const __m256i*) p ); }
+    static inline void  store  ( W* p, V v )    { _mm256_store_si256( (__m256i*) p, v );          }
+    static inline V     set1   ( W x )          { return _mm256_set1_epi64x( (long long) x );     }
+    static inline V     add    ( V a, V b )     { return _mm256_add_epi64( a, b );                }
+    static inline V     xor_   ( V a, V b )     { return _mm256_xor_si256( a, b );                }
+    static inline V     and_   ( V a, V b )     { return _mm256_and_si256( a, b );                }
+    static inline V     or_    ( V a, V b )     { return _mm256_or_si256( a, b );                 }
+    static inline V     andnot ( V a, V b )     { return _mm256_andnot_si256( a, b );             }
+
+    template <int N> static inline V shl  ( V a ) { return _mm256_slli_epi64( a, N ); }
+    template <int N> static inline V shr  ( V a ) { return _mm256_srli_epi64( a, N ); }
+    template <int N> static inline V rotr ( V a ) { return or_( shr<N>( a ), shl<64-N>( a )); }
+};
+
+#include "libtotp_mb.h"
+
+static void avx2_run( int digest, totp_mb_lanes* job )
+{
+    mb_run< avx2_32, avx2_64 >( digest, job );
+}
+
+const totp_mb_kernel totp_mb_avx2 =
+{
+    "avx2", TOTP_CPU_AVX2, { avx2_32::LANES, avx2_32::LANES, avx2_64::LANES }, avx2_run
+};
+
+#endif // TOTP_X86
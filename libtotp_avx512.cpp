@@ -0,0 +1,91 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+//------------------------------------------------------------------------------
+//                          AVX-512 multi-buffer kernel
+//------------------------------------------------------------------------------
+//
+//  16 lanes of SHA-1/SHA-256 (32-bit words) or 8 lanes of SHA-512 (64-bit
+//  words) per 512-bit register. This file must be compiled with AVX-512F
+//  code generation enabled (e.g. gcc -mavx512f); it is only ever called
+//  when the CPU is known to support AVX-512F (see totp_cpu_features).
+//
+//------------------------------------------------------------------------------
+
+#if TOTP_X86
+
+#include <immintrin.h>
+
+struct avx512_32
+{
+    typedef __m512i   V;
+    typedef uint32_t  W;
+    enum { LANES = 16 };
+
+    static inline V     load   ( const W* p )   { return _mm512_load_si512( (const __m512i*) p ); }
+    static inline void  store  ( W* p, V v )    { _mm512_store_si512( (__m512i*) p, v );          }
+    static inline V     set1   ( W x )          { return _mm512_set1_epi32( (int) x );            }
+    static inline V     add    ( V a, V b )     { return _mm512_add_epi32( a, b );                }
+    static inline V     xor_   ( V a, V b )     { return _mm512_xor_si512( a, b );                }
+    static inline V     and_   ( V a, V b )     { return _mm512_and_si512( a, b );                }
+    static inline V     or_    ( V a, V b )     { return _mm512_or_si512( a, b );                 }
+    static inline V     andnot ( V a, V b )     { return _mm512_andnot_si512( a, b );             }
+
+    template <int N> static inline V shl  ( V a ) { return _mm512_slli_epi32( a, N ); }
+    template <int N> static inline V shr  ( V a ) { return _mm512_srli_epi32( a, N ); }
+    template <int N> static inline V rotr ( V a ) { return _mm512_ror_epi32( a, N ); }
+};
+
+struct avx512_64
+{
+    typedef __m512i   V;
+    typedef uint64_t  W;
+    enum { LANES = 8 };
+
+    static inline V     load   ( const W* p )   { return _mm512_load_si512( (const __m512i*) p ); }
+    static inline void  store  ( W* p, V v )    { _mm512_store_si512( (__m512i*) p, v );          }
+    static inline V     set1   ( W x )          { return _mm512_set1_epi64( (long long) x );      }
+    static inline V     add    ( V a, V b )     { return _mm512_add_epi64( a, b );                }
+    static inline V     xor_   ( V a, V b )     { return _mm512_xor_si512( a, b );                }
+    static inline V     and_   ( V a, V b )     { return _mm512_and_si512( a, b );                }
+    static inline V     or_    ( V a, V b )     { return _mm512_or_si512( a, b );                 }
+    static inline V     andnot ( V a, V b )     { return _mm512_andnot_si512( a, b );             }
+
+    template <int N> static inline V shl  ( V a ) { return _mm512_slli_epi64( a, N ); }
+    template <int N> static inline V shr  ( V a ) { return _mm512_srli_epi64( a, N ); }
+    template <int N> static inline V rotr ( V a ) { return _mm512_ror_epi64( a, N ); }
+};
+
+#include "libtotp_mb.h"
+
+static void avx512_run( int digest, totp_mb_lanes* job )
+{
+    mb_run< avx512_32, avx512_64 >( digest, job );
+}
+
+const totp_mb_kernel totp_mb_avx512 =
+{
+    "avx512", TOTP_CPU_AVX512, { avx512_32::LANES, avx512_32::LANES, avx512_64::LANES }, avx512_run
+};
+
+#endif // TOTP_X86
@@ -0,0 +1,808 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+//------------------------------------------------------------------------------
+//                            HOTP COUNTER LOG
+//------------------------------------------------------------------------------
+//
+//  The next HOTP (RFC 4226) counter to be used for each secret, by name, is
+//  kept in memory (a hash table) and made durable in an append-only log file:
+//
+//      header      ctr_hdr
+//      records     ctr_rec, each followed by its name: the secret's new
+//                  counter value, with a checksum so that a record which
+//                  was only partially written (a crash) is recognized
+//
+//  When opened, the log is replayed to rebuild the table (and any partial
+//  record at its end is truncated away). Advancing a counter only queues its
+//  record; it's made durable by totp_counters_commit. Whichever committer
+//  gets there first writes (and fsyncs) everything queued so far, by every
+//  thread, while any others wait for it to finish ("group commit"), so that
+//  any number of concurrent advances share one write and one fsync.
+//
+//  Since every advance appends another record, the log is compacted by a
+//  background thread once it's both larger than COMPACT_MIN_SIZE and more
+//  than COMPACT_RATIO times the size of just the latest records: a snapshot
+//  of the table is written to a new file, the records committed to the old
+//  log meanwhile are then copied after it, and the new file is renamed over
+//  the old one. Committers only wait for that last (short) step.
+//
+//------------------------------------------------------------------------------
+
+#define CTR_MAGIC           "TOTPCTRS"  // (8 bytes; no NUL)
+#define CTR_VERSION         1           // (format version)
+#define CTR_BOM             0x01020304  // (byte order mark)
+#define CTR_MAX_NAME        1024        // (longest name)
+
+#define COMPACT_MIN_SIZE    (1024*1024) // (never compact a smaller log)
+#define COMPACT_RATIO       4           // (log size vs. live records)
+
+struct ctr_hdr
+{
+    char         magic[8];          // (CTR_MAGIC)
+    uint32_t     version;           // (CTR_VERSION)
+    uint32_t     bom;               // (CTR_BOM)
+};
+
+struct ctr_rec
+{
+    uint64_t     counter;           // (next counter to be used)
+    uint32_t     name_len;          // (length of name which follows)
+    uint32_t     check;             // (checksum of counter and name)
+};
+
+struct ctr_entry
+{
+    uint64_t     counter;           // (next counter to be used)
+    uint32_t     hash;              // (hash of name)
+    uint32_t     name_len;          // (length of name)
+    size_t       name_off;          // (offset of name within names)
+};
+
+#ifdef _WIN32
+  #include <io.h>
+  #define ctr_fsync( fd )           _commit( fd )
+  #define ctr_truncate( fd, size )  _chsize_s( fd, size )
+#else
+  #include <sys/file.h>             // (need flock)
+  #define O_BINARY                  0
+  #define ctr_fsync( fd )           fsync( fd )
+  #define ctr_truncate( fd, size )  ftruncate( fd, size )
+  #define ctr_lock( fd )            (flock( fd, LOCK_EX | LOCK_NB ) == 0)
+#endif
+
+// Only one process at a time may use a log...
+
+#ifdef _WIN32
+static bool ctr_lock( int fd )
+{
+    OVERLAPPED  ov;
+
+    memset( &ov, 0, sizeof( ov ));
+
+    return LockFileEx( (HANDLE) _get_osfhandle( fd ), LOCKFILE_EXCLUSIVE_LOCK |
+                       LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &ov ) != 0;
+}
+#endif
+
+//---------------------------------------------------------------------
+//                          totp_counters
+//---------------------------------------------------------------------
+
+struct totp_counters
+{
+    char*         path;             // (log file)
+    int           fd;               // (log file, opened for appending)
+    bool          failed;           // (a write or fsync failed)
+    bool          closing;          // (tell compaction thread to exit)
+
+    ctr_entry*    entries;          // (every counter, in order added)
+    size_t        count;            // (number of entries)
+    size_t        max;              // (size of entries array)
+    uint32_t*     slots;            // (hash table: entry number + 1)
+    size_t        nslots;           // (a power of 2; at most half full)
+    char*         names;            // (all of the entries' names)
+    size_t        names_len;        // (length of names)
+    size_t        names_size;       // (size of names buffer)
+
+    char*         queue;            // (records waiting to be written)
+    size_t        queue_len;        // (length of queued records)
+    size_t        queue_size;       // (size of queue buffer)
+
+    uint64_t      queued;           // (total bytes ever queued)
+    uint64_t      durable;          // (total bytes ever written + fsynced)
+    bool          committing;       // (a write + fsync is in progress)
+
+    uint64_t      log_size;         // (size of log file)
+    uint64_t      live_size;        // (size of just the latest records)
+    uint64_t      retry_size;       // (compaction failed; retry once this big)
+
+    totp_lock_t   lock;
+    totp_cond_t   committed;        // (a commit finished)
+    totp_cond_t   compact;          // (log might need compacting, or closing)
+    totp_thread_t compactor;        // (background compaction thread)
+};
+
+static size_t rec_size( size_t name_len )
+{
+    return sizeof( ctr_rec ) + name_len;
+}
+
+static uint32_t rec_check( uint64_t counter, const char* name, size_t len )
+{
+    uint32_t  h = totp_name_hash( name, len );
+    int       i;
+
+    for (i=0; i < 8; i++)           // (FNV-1a, continued)
+        h = (h ^ (uint8_t) (counter >> (8 * i))) * 16777619u;
+
+    return h ^ (uint32_t) len;
+}
+
+#define IO_CHUNK    0x40000000      // (largest single read or write)
+
+static bool write_all( int fd, const void* buf, size_t len )
+{
+    const char*  p = (const char*) buf;
+    ssize_t      n;
+
+    for (; len; p += n, len -= (size_t) n)
+        if ((n = write( fd, p, (unsigned) (len < IO_CHUNK ? len : IO_CHUNK) )) <= 0)
+            return false;
+
+    return true;
+}
+
+static bool read_all( int fd, void* buf, size_t len )
+{
+    char*    p = (char*) buf;
+    ssize_t  n;
+
+    for (; len; p += n, len -= (size_t) n)
+        if ((n = read( fd, p, (unsigned) (len < IO_CHUNK ? len : IO_CHUNK) )) <= 0)
+            return false;
+
+    return true;
+}
+
+//---------------------------------------------------------------------
+//                        The counters table
+//---------------------------------------------------------------------
+
+static ctr_entry* find_entry( const totp_counters* c, const char* name, size_t len, uint32_t hash )
+{
+    size_t      i;
+    ctr_entry*  e;
+
+    if (!c->nslots)
+        return NULL;
+
+    for (i = hash & (c->nslots - 1); c->slots[i]; i = (i + 1) & (c->nslots - 1))
+    {
+        e = &c->entries[ c->slots[i] - 1 ];
+
+        if (e->hash == hash && e->name_len == len && memcmp( c->names + e->name_off, name, len ) == 0)
+            return e;
+    }
+
+    return NULL;
+}
+
+static ctr_entry* add_entry( totp_counters* c, const char* name, size_t len, uint32_t hash )
+{
+    ctr_entry*  e;
+    size_t      i, n;
+
+    if (c->count >= c->max)
+    {
+        size_t  max = c->max ? c->max * 2 : 1024;
+
+        if (!(e = (ctr_entry*) realloc( c->entries, max * sizeof( ctr_entry ))))
+            return NULL;
+
+        c->entries = e;
+        c->max     = max;
+    }
+
+    if (c->names_len + len > c->names_size)
+    {
+        size_t  size = (c->names_len + len) * 2 + 64*1024;
+        char*   names;
+
+        if (!(names = (char*) realloc( c->names, size )))
+            return NULL;
+
+        c->names      = names;
+        c->names_size = size;
+    }
+
+    // (grow the hash table so it's never more than half full)
+
+    if ((c->count + 1) * 2 > c->nslots)
+    {
+        size_t     nslots = c->nslots ? c->nslots * 2 : 2048;
+        uint32_t*  slots;
+
+        if (!(slots = (uint32_t*) calloc( nslots, sizeof( uint32_t ))))
+            return NULL;
+
+        for (n=0; n < c->count; n++)
+        {
+            for (i = c->entries[n].hash & (nslots - 1); slots[i]; i = (i + 1) & (nslots - 1))
+                ;
+
+            slots[i] = (uint32_t) (n + 1);
+        }
+
+        free( c->slots );
+        c->slots  = slots;
+        c->nslots = nslots;
+    }
+
+    e = &c->entries[ c->count ];
+
+    e->counter  = 0;
+    e->hash     = hash;
+    e->name_len = (uint32_t) len;
+    e->name_off = c->names_len;
+
+    memcpy( c->names + c->names_len, name, len );
+    c->names_len += len;
+
+    for (i = hash & (c->nslots - 1); c->slots[i]; i = (i + 1) & (c->nslots - 1))
+        ;
+
+    c->slots[i] = (uint32_t) ++c->count;
+    c->live_size += rec_size( len );
+
+    return e;
+}
+
+// Format an entry's record into 'buf' (which must be big enough)...
+
+static size_t format_rec( const totp_counters* c, const ctr_entry* e, char* buf )
+{
+    ctr_rec  rec;
+
+    rec.counter  = e->counter;
+    rec.name_len = e->name_len;
+    rec.check    = rec_check( e->counter, c->names + e->name_off, e->name_len );
+
+    memcpy( buf, &rec, sizeof( rec ));
+    memcpy( buf + sizeof( rec ), c->names + e->name_off, e->name_len );
+
+    return rec_size( e->name_len );
+}
+
+//---------------------------------------------------------------------
+//                              replay
+//---------------------------------------------------------------------
+//
+//  Rebuild the table from the log, truncating any partial (or otherwise
+//  invalid) record at its very end, which can only be the result of a
+//  crash while it was being written (i.e. before it was committed). An
+//  invalid record with anything at all after it is corruption, though,
+//  and truncating there would throw away committed advances (so codes
+//  already used would be accepted again): the open fails instead.
+//
+//---------------------------------------------------------------------
+
+static bool replay( totp_counters* c )
+{
+    ctr_hdr     hdr;
+    ctr_rec     rec;
+    ctr_entry*  e;
+    char*       buf;
+    size_t      size, off;
+    int64_t     end;
+    bool        ok = true;
+
+    if ((end = lseek( c->fd, 0, SEEK_END )) < 0 || lseek( c->fd, 0, SEEK_SET ) != 0)
+        return false;
+
+    if (end == 0)   // (new log)
+    {
+        memset( &hdr, 0, sizeof( hdr ));
+        memcpy( hdr.magic, CTR_MAGIC, sizeof( hdr.magic ));
+
+        hdr.version = CTR_VERSION;
+        hdr.bom     = CTR_BOM;
+
+        c->log_size = sizeof( hdr );
+
+        return write_all( c->fd, &hdr, sizeof( hdr )) && ctr_fsync( c->fd ) == 0;
+    }
+
+    if ((uint64_t) end > (size_t) -1 || !(buf = (char*) malloc( size = (size_t) end )))
+        return errno = ENOMEM, false;
+
+    ok = read_all( c->fd, buf, size );
+
+    memcpy( &hdr, buf, size < sizeof( hdr ) ? size : sizeof( hdr ));
+
+    if (!ok || 0
+        || size < sizeof( hdr )
+        || memcmp( hdr.magic, CTR_MAGIC, sizeof( hdr.magic )) != 0
+        || hdr.version != CTR_VERSION
+        || hdr.bom     != CTR_BOM
+    )
+    {
+        free( buf );
+        return errno = ok ? EINVAL : errno, false;
+    }
+
+    for (off = sizeof( hdr ); off + sizeof( rec ) <= size; off += rec_size( rec.name_len ))
+    {
+        const char*  name = buf + off + sizeof( rec );
+        uint32_t     hash;
+
+        memcpy( &rec, buf + off, sizeof( rec ));
+
+        if (rec.name_len > size - off - sizeof( rec ) && rec.name_len <= CTR_MAX_NAME)
+            break;                  // (runs past the end: partial)
+
+        if (0
+            || rec.name_len > CTR_MAX_NAME
+            || rec.check != rec_check( rec.counter, name, rec.name_len )
+        )
+        {
+            if ((uint64_t) off + rec_size( rec.name_len ) == size)
+                break;              // (the last record: partial)
+
+            free( buf );
+            return errno = EINVAL, false;
+        }
+
+        hash = totp_name_hash( name, rec.name_len );
+
+        if (!(e = find_entry( c, name, rec.name_len, hash )) && !(e = add_entry( c, name, rec.name_len, hash )))
+        {
+            free( buf );
+            return errno = ENOMEM, false;
+        }
+
+        if (rec.counter > e->counter)
+            e->counter = rec.counter;
+    }
+
+    free( buf );
+
+    if (off < size)     // (partial record at the end)
+    {
+        if (ctr_truncate( c->fd, (long) off ) != 0 || ctr_fsync( c->fd ) != 0)
+            return false;
+    }
+
+    c->log_size = off;
+
+    return lseek( c->fd, 0, SEEK_END ) >= 0;
+}
+
+//---------------------------------------------------------------------
+//                             compact
+//---------------------------------------------------------------------
+
+static bool needs_compacting( const totp_counters* c )
+{
+    return 1
+        && c->log_size > COMPACT_MIN_SIZE
+        && c->log_size > c->live_size * COMPACT_RATIO
+        && c->log_size >= c->retry_size
+        && !c->failed;
+}
+
+static bool sync_dir( const char* path )
+{
+#ifdef _WIN32
+    (void) path;                    // (MOVEFILE_WRITE_THROUGH did it)
+    return true;
+#else
+    const char*  slash = strrchr( path, '/' );
+    char*        dir;
+    int          fd;
+    bool         ok;
+
+    if (!slash)
+        dir = strdup( "." );
+    else if ((dir = (char*) malloc( slash - path + 2 )) != NULL)
+    {
+        memcpy( dir, path, slash - path + 1 );
+        dir[ slash - path + 1 ] = 0;
+    }
+
+    if (!dir || (fd = open( dir, O_RDONLY )) < 0)
+        return free( dir ), false;
+
+    ok = fsync( fd ) == 0;
+
+    close( fd );
+    free( dir );
+
+    return ok;
+#endif
+}
+
+// (called with the lock held, which is released while the snapshot is
+// being written, and then re-obtained)
+
+static bool compact( totp_counters* c )
+{
+    ctr_hdr   hdr;
+    char*     snap;
+    char*     tmp = NULL;
+    char*     buf;
+    size_t    snap_len = sizeof( hdr ), i;
+    uint64_t  snap_end = c->log_size;   // (old log's size at snapshot)
+    uint64_t  tail;
+    int       fd = -1;
+    bool      ok;
+
+    // Snapshot the table...
+
+    if (!(snap = (char*) malloc( sizeof( hdr ) + (size_t) c->live_size )))
+        return false;
+
+    memset( &hdr, 0, sizeof( hdr ));
+    memcpy( hdr.magic, CTR_MAGIC, sizeof( hdr.magic ));
+
+    hdr.version = CTR_VERSION;
+    hdr.bom     = CTR_BOM;
+
+    memcpy( snap, &hdr, sizeof( hdr ));
+
+    for (i=0; i < c->count; i++)
+        snap_len += format_rec( c, &c->entries[i], snap + snap_len );
+
+    // ...and write it to a new file, while others carry on...
+
+    lock_release( &c->lock );
+    {
+        if ((tmp = (char*) malloc( strlen( c->path ) + 5 )) != NULL)
+        {
+            strcpy( tmp, c->path );
+            strcat( tmp, ".new" );
+
+            fd = open( tmp, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_BINARY, 0600 );
+        }
+
+        ok = fd >= 0 && ctr_lock( fd ) && write_all( fd, snap, snap_len ) && ctr_fsync( fd ) == 0;
+        free( snap );
+    }
+    lock_obtain( &c->lock );
+
+    // Then, with commits held off, copy whatever was committed to the
+    // old log meanwhile, and replace the old log with the new one...
+
+    while (c->committing)
+        cond_wait( &c->committed, &c->lock );
+
+    if (ok && (tail = c->log_size - snap_end) > 0)
+    {
+        ok = (buf = (char*) malloc( (size_t) tail )) != NULL
+            && lseek( c->fd, (long) snap_end, SEEK_SET ) == (long) snap_end
+            && read_all( c->fd, buf, (size_t) tail )
+            && write_all( fd, buf, (size_t) tail )
+            && ctr_fsync( fd ) == 0;
+
+        free( buf );
+        lseek( c->fd, 0, SEEK_END );
+    }
+
+    if (ok)
+    {
+#ifdef _WIN32
+        close( c->fd );             // (Windows can't replace an open file...)
+        close( fd );                // (...nor rename one)
+        fd = -1;
+        ok = MoveFileExA( tmp, c->path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH ) != 0;
+
+        // (the new one, or if it couldn't be moved, still the old one)
+
+        c->fd     = open( c->path, O_RDWR | O_APPEND | O_BINARY );
+        c->failed = c->fd < 0 || !ctr_lock( c->fd );
+
+        if (ok)
+            c->log_size = snap_len + (c->log_size - snap_end);
+#else
+        // (the old log is only closed, and so unlocked, once the new one,
+        //  which is already locked, has replaced it: there's never a
+        //  moment when another process could take it)
+
+        if ((ok = rename( tmp, c->path ) == 0))
+        {
+            close( c->fd );
+            c->fd       = fd;
+            c->log_size = snap_len + (c->log_size - snap_end);
+            fd          = -1;
+
+            // (the rename isn't durable until the directory is, but the
+            //  new log is in use regardless: it's simply compacted again,
+            //  syncing the directory again, once it's grown enough)
+
+            ok = sync_dir( c->path );
+            free( tmp );
+            tmp = NULL;
+        }
+#endif
+    }
+
+    if (fd >= 0)
+        close( fd );
+
+    if (!ok && tmp)
+        remove( tmp );
+
+    free( tmp );
+
+    return ok;
+}
+
+TOTP_THREAD_PROC( compactor_thread )
+{
+    totp_counters*  c = (totp_counters*) arg;
+
+    lock_obtain( &c->lock );
+
+    while (!c->closing)
+    {
+        if (needs_compacting( c ))
+        {
+            if (!compact( c ))      // (don't retry until it's doubled)
+                c->retry_size = c->log_size * 2;
+        }
+        else
+            cond_wait( &c->compact, &c->lock );
+    }
+
+    lock_release( &c->lock );
+
+    TOTP_THREAD_RETURN;
+}
+
+//---------------------------------------------------------------------
+//                        totp_counters_open
+//---------------------------------------------------------------------
+
+TOTP_API totp_counters* totp_counters_open( const char* path )
+{
+    totp_counters*  c;
+
+    if (!(c = (totp_counters*) calloc( 1, sizeof( *c ))) || !(c->path = strdup( path )))
+    {
+        free( c );
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // (it only holds counters, but nobody else has any business with it,
+    // and only one process at a time may use it)
+
+    if (0
+        || (c->fd = open( path, O_RDWR | O_CREAT | O_APPEND | O_BINARY, 0600 )) < 0
+        || !ctr_lock( c->fd )
+        || !replay( c )
+    )
+    {
+        int  err = errno;
+
+        if (c->fd >= 0)
+            close( c->fd );
+
+        free( c->entries );
+        free( c->slots );
+        free( c->names );
+        free( c->path );
+        free( c );
+
+        errno = err;
+        return NULL;
+    }
+
+    lock_init( &c->lock );
+    cond_init( &c->committed );
+    cond_init( &c->compact );
+
+    if (!thread_create( &c->compactor, compactor_thread, c ))
+    {
+        totp_counters_close( c );
+        return NULL;
+    }
+
+    return c;
+}
+
+//---------------------------------------------------------------------
+//                        totp_counters_get
+//---------------------------------------------------------------------
+
+TOTP_API uint64_t totp_counters_get( totp_counters* c, const char* name, size_t len )
+{
+    ctr_entry*  e;
+    uint64_t    counter;
+
+    totp_name( &name, &len );
+
+    lock_obtain( &c->lock );
+    {
+        e = find_entry( c, name, len, totp_name_hash( name, len ));
+        counter = e ? e->counter : 0;
+    }
+    lock_release( &c->lock );
+
+    return counter;
+}
+
+//---------------------------------------------------------------------
+//                      totp_counters_advance
+//---------------------------------------------------------------------
+
+TOTP_API int totp_counters_advance( totp_counters* c, const char* name, size_t len, uint64_t counter )
+{
+    ctr_entry*  e;
+    uint32_t    hash;
+    int         rc = TOTP_OK;
+
+    totp_name( &name, &len );
+
+    if (len > CTR_MAX_NAME)
+        return TOTP_EINVAL;
+
+    hash = totp_name_hash( name, len );
+
+    lock_obtain( &c->lock );
+
+    if (!(e = find_entry( c, name, len, hash )) && !(e = add_entry( c, name, len, hash )))
+        rc = TOTP_EIO;
+
+    else if (counter <= e->counter)
+        rc = TOTP_SKIP;             // (not ahead of it; e.g. a replay)
+
+    else if (c->queue_len + rec_size( len ) > c->queue_size)
+    {
+        size_t  size = (c->queue_len + rec_size( len )) * 2 + 64*1024;
+        char*   queue;
+
+        if (!(queue = (char*) realloc( c->queue, size )))
+            rc = TOTP_EIO;
+        else
+        {
+            c->queue      = queue;
+            c->queue_size = size;
+        }
+    }
+
+    if (rc == TOTP_OK)
+    {
+        e->counter = counter;
+
+        c->queue_len += format_rec( c, e, c->queue + c->queue_len );
+        c->queued    += rec_size( len );
+    }
+
+    lock_release( &c->lock );
+
+    return rc;
+}
+
+//---------------------------------------------------------------------
+//                      totp_counters_commit
+//---------------------------------------------------------------------
+
+TOTP_API int totp_counters_commit( totp_counters* c )
+{
+    uint64_t  target, end;
+    char*     buf;
+    size_t    len;
+    bool      ok;
+
+    lock_obtain( &c->lock );
+
+    target = c->queued;             // (everything queued so far)
+
+    while (c->durable < target && !c->failed)
+    {
+        if (c->committing)
+        {
+            cond_wait( &c->committed, &c->lock );
+            continue;
+        }
+
+        // We're the one committing: take everything queued so far
+        // (ours and everyone else's) and write it in one go...
+
+        c->committing = true;
+
+        buf = c->queue,     c->queue      = NULL;
+        len = c->queue_len, c->queue_len  = 0;
+        c->queue_size = 0;
+        end = c->queued;
+
+        lock_release( &c->lock );
+        {
+            ok = write_all( c->fd, buf, len ) && ctr_fsync( c->fd ) == 0;
+            free( buf );
+        }
+        lock_obtain( &c->lock );
+
+        if (ok)
+        {
+            c->durable   = end;
+            c->log_size += len;
+        }
+        else
+            c->failed = true;
+
+        c->committing = false;
+        cond_broadcast( &c->committed );
+
+        if (needs_compacting( c ))
+            cond_broadcast( &c->compact );
+    }
+
+    ok = !c->failed;
+
+    lock_release( &c->lock );
+
+    return ok ? TOTP_OK : TOTP_EIO;
+}
+
+//---------------------------------------------------------------------
+//                       totp_counters_close
+//---------------------------------------------------------------------
+
+TOTP_API int totp_counters_close( totp_counters* c )
+{
+    int  rc;
+
+    if (!c)
+        return TOTP_OK;
+
+    rc = totp_counters_commit( c );
+
+    lock_obtain( &c->lock );
+    {
+        c->closing = true;
+        cond_broadcast( &c->compact );
+    }
+    lock_release( &c->lock );
+
+    if (c->compactor)
+        thread_join( c->compactor );
+
+    cond_destroy( &c->compact );
+    cond_destroy( &c->committed );
+    lock_destroy( &c->lock );
+
+    if (c->fd >= 0 && close( c->fd ) != 0)
+        rc = TOTP_EIO;
+
+    free( c->queue );
+    free( c->entries );
+    free( c->slots );
+    free( c->names );
+    free( c->path );
+    free( c );
+
+    return rc;
+}
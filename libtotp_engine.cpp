@@ -0,0 +1,197 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+//------------------------------------------------------------------------------
+//                         SPECIALISED ENGINES
+//------------------------------------------------------------------------------
+//
+//  Code calculation (given precomputed midstates) specialised for each
+//  digest and number of DIGITS: the block and hash sizes, the word size
+//  and the modulus are all compile time constants, so every loop is of
+//  fixed length (and unrolled), the truncation is a plain big-endian
+//  load, and the modulus is a multiplication. Each secret is pointed at
+//  its engine once, when it's parsed (or fetched from a store), so code
+//  calculating many codes for the same secret (verification windows,
+//  ranges, resync searches) never needs to decide anything per code.
+//
+//  (The digest's compression function is still called through its
+//  totp_md, since which implementation is used is only known at run
+//  time; see libtotp_sha.cpp.)
+//
+//------------------------------------------------------------------------------
+
+template <int D> struct digest_traits;
+
+template <> struct digest_traits< TOTP_SHA1 >
+{
+    typedef uint32_t  W;
+    enum { BLOCK = 64, HASH = 20 };
+};
+
+template <> struct digest_traits< TOTP_SHA256 >
+{
+    typedef uint32_t  W;
+    enum { BLOCK = 64, HASH = 32 };
+};
+
+template <> struct digest_traits< TOTP_SHA512 >
+{
+    typedef uint64_t  W;
+    enum { BLOCK = 128, HASH = 64 };
+};
+
+// Modulus for DIGITS (10^10 doesn't fit in 32 bits, but then again
+// neither does anything the 31-bit truncation could ever produce)...
+
+template <int N> struct pow10     { static const uint64_t value = 10 * pow10< N-1 >::value; };
+template <>      struct pow10< 0 > { static const uint64_t value = 1; };
+
+//---------------------------------------------------------------------
+//                        big-endian helpers
+//---------------------------------------------------------------------
+
+static inline void store_be( uint8_t* p, uint32_t w )
+{
+    p[0] = (uint8_t) (w >> 24);
+    p[1] = (uint8_t) (w >> 16);
+    p[2] = (uint8_t) (w >>  8);
+    p[3] = (uint8_t) (w      );
+}
+
+static inline void store_be( uint8_t* p, uint64_t w )
+{
+    store_be( p,     (uint32_t) (w >> 32) );
+    store_be( p + 4, (uint32_t) (w      ) );
+}
+
+static inline uint32_t load_be32( const uint8_t* p )
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+         | ((uint32_t) p[2] <<  8) | ((uint32_t) p[3]      );
+}
+
+//---------------------------------------------------------------------
+//                           engine_run
+//---------------------------------------------------------------------
+//
+//  Codes for 'n' consecutive counter values: both final blocks are
+//  built just once, and then only the big-endian counter at the start
+//  of the inner block ever changes, each inner hash being stored
+//  directly into the start of the outer block.
+//
+//---------------------------------------------------------------------
+
+template <int D>
+static inline void final_block( uint8_t* block, size_t len )
+{
+    typedef digest_traits< D >  DT;
+
+    block[ len ] = 0x80;
+    memset( block + len + 1, 0, DT::BLOCK - len - 1 - sizeof( uint64_t ));
+    store_be( block + DT::BLOCK - sizeof( uint64_t ), (uint64_t) (DT::BLOCK + len) * BITS_PER_BYTE );
+}
+
+template <int D>
+static inline void state_to_hash( const typename digest_traits< D >::W* w, uint8_t* hash )
+{
+    typedef digest_traits< D >  DT;
+
+    for (size_t i=0; i < DT::HASH / sizeof( typename DT::W ); i++)
+        store_be( hash + i * sizeof( typename DT::W ), w[i] );
+}
+
+template <int D>
+static inline uint32_t truncate( const uint8_t* hmac )
+{
+    return load_be32( hmac + (hmac[ digest_traits< D >::HASH - 1 ] & 0x0f) ) & 0x7fffffff;
+}
+
+template <int D, int DIGITS>
+static void engine_run( const totp_secret* s, uint64_t counter, uint32_t* codes, size_t n )
+{
+    typedef digest_traits< D >      DT;
+    typedef typename DT::W          W;
+
+    void (*compress)( void* state, const uint8_t* block ) = s->md->compress;
+
+    const W*  inner = (const W*) (sizeof( W ) == 4 ? (const void*) s->mid.w32[0] : (const void*) s->mid.w64[0]);
+    const W*  outer = (const W*) (sizeof( W ) == 4 ? (const void*) s->mid.w32[1] : (const void*) s->mid.w64[1]);
+
+    W         state[8];
+    uint8_t   iblock[ DT::BLOCK ];
+    uint8_t   oblock[ DT::BLOCK ];
+    uint8_t   hmac[ DT::HASH ];
+    size_t    i;
+
+    final_block< D >( iblock, sizeof( uint64_t ));
+    final_block< D >( oblock, DT::HASH );
+
+    for (i=0; i < n; i++, counter++)
+    {
+        store_be( iblock, counter );
+
+        memcpy( state, inner, sizeof( state ));
+        compress( state, iblock );
+        state_to_hash< D >( state, oblock );
+
+        memcpy( state, outer, sizeof( state ));
+        compress( state, oblock );
+        state_to_hash< D >( state, hmac );
+
+        codes[i] = (uint32_t) (truncate< D >( hmac ) % pow10< DIGITS >::value);
+    }
+
+    totp_cleanse( state,  sizeof( state  ));
+    totp_cleanse( oblock, sizeof( oblock ));
+    totp_cleanse( hmac,   sizeof( hmac   ));
+}
+
+template <int D, int DIGITS>
+static uint32_t engine_hotp( const totp_secret* s, uint64_t counter )
+{
+    uint32_t  code;
+
+    engine_run< D, DIGITS >( s, counter, &code, 1 );
+
+    return code;
+}
+
+//---------------------------------------------------------------------
+//                         totp_engine_for
+//---------------------------------------------------------------------
+
+#define ENGINE( D, N )  { engine_hotp< D, N >, engine_run< D, N > }
+#define ENGINES( D )    { ENGINE( D, 6 ), ENGINE( D, 7 ), ENGINE( D, 8 ), ENGINE( D, 9 ), ENGINE( D, 10 ) }
+
+static const totp_engine engines[ TOTP_NUM_DIGESTS ][ TOTP_MAX_DIGITS - TOTP_MIN_DIGITS + 1 ] =
+{
+    ENGINES( TOTP_SHA1   ),
+    ENGINES( TOTP_SHA256 ),
+    ENGINES( TOTP_SHA512 ),
+};
+
+const totp_engine* totp_engine_for( int digest, int digits )
+{
+    return &engines[ digest ][ digits - TOTP_MIN_DIGITS ];
+}
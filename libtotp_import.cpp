@@ -0,0 +1,731 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+//------------------------------------------------------------------------------
+//                                 IMPORTER
+//------------------------------------------------------------------------------
+//
+//  Secrets from enrolment data in the two forms it usually arrives in,
+//  one per line, rather than in the "shared secret" line format:
+//
+//    otpauth://totp/ISSUER:ACCOUNT?secret=BASE32&issuer=ISSUER
+//        &algorithm=SHA1&digits=6&period=30
+//
+//      Key Uri Format, as encoded in authenticator QR codes (or hotp,
+//      with a 'counter' parameter, default 0, which the caller is given
+//      by totp_import_counter to seed its totp_counters with: an HOTP
+//      secret mustn't simply be used as a TOTP one). Only 'secret' is
+//      required; unknown parameters (e.g. 'image') are ignored.
+//
+//    otpauth-migration://offline?data=BASE64
+//
+//      Google Authenticator's "Transfer accounts" export: BASE64 (URL
+//      encoded) is a protobuf MigrationPayload message, whose repeated
+//      field 1 is an OtpParameters message per secret:
+//
+//          1 secret (bytes)     2 name (string)     3 issuer (string)
+//          4 algorithm (enum: 1 SHA1, 2 SHA256, 3 SHA512, 4 MD5)
+//          5 digits (enum: 1 six, 2 eight)
+//          6 type (enum: 1 HOTP, 2 TOTP)        7 counter (int64)
+//
+//  Everything is done in a single pass over the line, in place: the URI's
+//  parameters are only located, and each value is then percent decoded
+//  straight into wherever it's needed (the SECRET into a small buffer
+//  which is base32 decoded by the same SIMD decoder as totp_parse, the
+//  label into the importer's label buffer). A migration payload is decoded
+//  (percent and base64 at once) into the importer's payload buffer when
+//  its line is given, then each totp_import_next reads just the next of
+//  its OtpParameters. Nothing is allocated except that buffer, which only
+//  ever grows, so a bulk import allocates nothing per line at all, and
+//  every copy of a key is wiped as soon as it's no longer needed.
+//
+//------------------------------------------------------------------------------
+
+#define IMPORT_MAX_LABEL    1024        // (longest label, in bytes)
+#define IMPORT_MAX_SECRET   1024        // (longest URI SECRET, in characters)
+#define IMPORT_MIN_DATA     4096        // (initial payload buffer size)
+
+#define IMPORT_NONE         0           // (no more secrets in the line)
+#define IMPORT_LINE         1           // (shared secret line format)
+#define IMPORT_URI          2           // (otpauth:// URI)
+#define IMPORT_MIGRATION    3           // (otpauth-migration:// payload)
+
+struct totp_import
+{
+    int             kind;               // (IMPORT_xxx)
+    const char*     line;               // (the current line)
+    const char*     end;                // (its end, less trailing blanks)
+
+    uint8_t*        data;               // (decoded migration payload)
+    size_t          data_size;          // (size of data buffer)
+    size_t          data_len;           // (length of current payload)
+    size_t          pos;                // (offset of its next field)
+
+    bool            hotp;               // (current secret is HOTP)
+    uint64_t        counter;            // (if so, its counter)
+
+    const char*     error;              // (why TOTP_EINVAL, or NULL)
+    char            label[ IMPORT_MAX_LABEL ];  // (current secret's label)
+};
+
+//---------------------------------------------------------------------
+//                          Helpers
+//---------------------------------------------------------------------
+
+static int hex_val( int c )
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// Consume 'prefix' (case insensitive) if that's what 'p' starts with...
+
+static bool has_prefix( const char** p, const char* end, const char* prefix )
+{
+    size_t  n = strlen( prefix );
+
+    if ((size_t) (end - *p) < n || strncasecmp( *p, prefix, n ) != 0)
+        return false;
+
+    *p += n;
+    return true;
+}
+
+// Percent decode [p, end) into 'out' (room for 'size' bytes), '+' being
+// a blank if 'plus' (i.e. a query value, form encoded). Returns the
+// decoded length, or -1 if it won't fit or an escape is malformed...
+
+static size_t pct_decode( const char* p, const char* end, char* out, size_t size, bool plus )
+{
+    const char*  pct;
+    char*        o = out;
+    char*        q;
+    size_t       n;
+    int          hi, lo;
+
+    for (;;)
+    {
+        // (each run up to the next escape is copied as is)
+
+        if (!(pct = (const char*) memchr( p, '%', end - p )))
+            pct = end;
+
+        if ((n = pct - p) > size - (o - out))
+            return (size_t) -1;
+
+        memcpy( o, p, n );
+
+        if (plus)
+            for (q=o; (q = (char*) memchr( q, '+', (o + n) - q )) != NULL;)
+                *q++ = ' ';
+
+        o += n;
+
+        if ((p = pct) == end)
+            return o - out;
+
+        if (0
+            || end - p < 3 || (size_t) (o - out) >= size
+            || (hi = hex_val( p[1] )) < 0 || (lo = hex_val( p[2] )) < 0
+        )
+            return (size_t) -1;
+
+        *o++ = (char) ((hi << 4) | lo);
+        p += 3;
+    }
+}
+
+// Build the secret's label: its name, prefixed with its issuer and ':'
+// unless the name already has an issuer prefix (which is then followed
+// by optional blanks, which are dropped)...
+
+static bool make_label( totp_import* im, totp_secret* s, const char* name, size_t nlen,
+                        const char* issuer, size_t ilen )
+{
+    const char*  colon = nlen ? (const char*) memchr( name, ':', nlen ) : NULL;
+    char*        o     = im->label;
+
+    if (colon)
+    {
+        ilen   = colon - name;      // (its own prefix is the issuer)
+        issuer = name;
+        nlen  -= ilen + 1;
+        name   = colon + 1;
+    }
+
+    while (nlen && *name == ' ')
+        name++, nlen--;
+
+    if (ilen + 1 + nlen > sizeof( im->label ))
+    {
+        im->error = "label too long";
+        return false;
+    }
+
+    if (ilen)
+    {
+        memcpy( o, issuer, ilen );
+        o += ilen;
+        *o++ = ':';
+    }
+
+    if (nlen)
+        memcpy( o, name, nlen );
+
+    s->label     = im->label;
+    s->label_len = (o + nlen) - im->label;
+    return true;
+}
+
+// Finish the secret off, once its key and parameters are all known...
+
+static int make_secret( totp_import* im, totp_secret* s, unsigned long digits, uint64_t interval )
+{
+         if (s->key_len == 0)                                        im->error = "no secret";
+    else if (digits < TOTP_MIN_DIGITS || digits > TOTP_MAX_DIGITS)   im->error = "invalid digits";
+    else if (interval == 0)                                          im->error = "invalid period";
+
+    if (im->error)
+    {
+        totp_wipe( s );
+        return TOTP_EINVAL;
+    }
+
+    s->digits   = (uint8_t) digits;
+    s->interval = interval;
+    s->offset   = TOTP_DEF_OFFSET;
+    s->engine   = totp_engine_for( s->digest, s->digits );
+
+    return TOTP_OK;
+}
+
+//---------------------------------------------------------------------
+//                          otpauth:// URIs
+//---------------------------------------------------------------------
+
+// A (percent decoded) decimal parameter value, or 0 if it isn't one...
+
+static uint64_t uri_number( const char* p, const char* end )
+{
+    char      buf[ 24 ];
+    size_t    i, n;
+    uint64_t  num = 0;
+
+    if ((n = pct_decode( p, end, buf, sizeof( buf ), true )) == (size_t) -1 || n == 0)
+        return 0;
+
+    for (i=0; i < n; i++)
+    {
+        if (buf[i] < '0' || buf[i] > '9' || num > (UINT64_MAX - 9) / 10)
+            return 0;
+        num = num * 10 + (buf[i] - '0');
+    }
+
+    return num;
+}
+
+static int uri_digest( const char* p, const char* end )
+{
+    char    buf[ 8 ];
+    size_t  n = pct_decode( p, end, buf, sizeof( buf ) - 1, true );
+
+    if (n == (size_t) -1)
+        return -1;
+
+    buf[n] = 0;
+
+    if (strcasecmp( buf, "SHA1"   ) == 0) return TOTP_SHA1;
+    if (strcasecmp( buf, "SHA256" ) == 0) return TOTP_SHA256;
+    if (strcasecmp( buf, "SHA512" ) == 0) return TOTP_SHA512;
+    return -1;
+}
+
+// Decode the base32 SECRET, ignoring any padding and blanks...
+
+static bool uri_secret( totp_secret* s, const char* p, const char* end, int digest )
+{
+    char     chars[ IMPORT_MAX_SECRET ];
+    uint8_t  key[ IMPORT_MAX_SECRET * 5 / 8 + 16 ];
+    size_t   i, n, len;
+    bool     ok;
+
+    if ((n = pct_decode( p, end, chars, sizeof( chars ), true )) == (size_t) -1)
+    {
+        totp_cleanse( chars, sizeof( chars ));  // (whatever was decoded)
+        return false;
+    }
+
+    for (len=n; len && chars[ len-1 ] == '='; len--);
+
+    if (memchr( chars, ' ', len ))
+        for (i=0, n=len, len=0; i < n; i++)
+            if (chars[i] != ' ')
+                chars[ len++ ] = chars[i];
+
+    if ((ok = (n = totp_base32_decode( chars, len, key )) != (size_t) -1))
+    {
+        totp_key_init( s, digest, key, n );
+        totp_cleanse( key, n );
+    }
+
+    totp_cleanse( chars, sizeof( chars ));  // (len is less any blanks)
+    return ok;
+}
+
+static int import_uri( totp_import* im, totp_secret* s )
+{
+    const char*     p = im->line;
+    const char*     end;
+    const char*     label;
+    const char*     label_end;
+    const char*     secret     = NULL;
+    const char*     secret_end = NULL;
+    const char*     issuer     = NULL;
+    const char*     issuer_end = NULL;
+    const char*     key;
+    const char*     eq;
+    const char*     val_end;
+    unsigned long   digits   = TOTP_DEF_DIGITS;
+    uint64_t        interval = TOTP_DEF_INTERVAL;
+    uint64_t        counter  = 0;
+    int             digest   = TOTP_SHA1;
+    bool            hotp     = false;
+    char            name[ IMPORT_MAX_LABEL ];
+    char            iss[ IMPORT_MAX_LABEL ];
+    size_t          nlen, ilen = 0;
+
+    memset( s, 0, sizeof( *s ));
+
+    p += sizeof( "otpauth://" ) - 1;
+
+    if (!has_prefix( &p, im->end, "totp/" ) && !(hotp = has_prefix( &p, im->end, "hotp/" )))
+    {
+        im->error = "not a totp or hotp URI";
+        return TOTP_EINVAL;
+    }
+
+    // The label is the path, then the query's parameters follow '?'
+    // (up to any '#' fragment), separated by '&'...
+
+    if (!(end = (const char*) memchr( p, '#', im->end - p )))
+        end = im->end;
+
+    if (!(label_end = (const char*) memchr( p, '?', end - p )))
+        label_end = end;
+
+    for (label = p, p = label_end; p < end; p = val_end)
+    {
+        key = p + 1;
+
+        if (!(val_end = (const char*) memchr( key, '&', end - key )))
+            val_end = end;
+
+        if (!(eq = (const char*) memchr( key, '=', val_end - key )))
+            continue;
+
+        // (by length: 'A' is 9 long, 'C' is 7, the rest 6 by first letter)
+
+        switch ((eq - key) == 9 ? 'A' : (eq - key) == 7 ? 'C' : (eq - key) == 6 ? tolower( *key ) : 0)
+        {
+            case 's':  if (strncasecmp( key, "secret", 6 ) == 0)  secret = eq + 1, secret_end = val_end;                 break;
+            case 'i':  if (strncasecmp( key, "issuer", 6 ) == 0)  issuer = eq + 1, issuer_end = val_end;                 break;
+            case 'd':  if (strncasecmp( key, "digits", 6 ) == 0)  digits = (unsigned long) uri_number( eq + 1, val_end );  break;
+            case 'p':  if (strncasecmp( key, "period", 6 ) == 0)  interval = uri_number( eq + 1, val_end );              break;
+            case 'C':  if (strncasecmp( key, "counter", 7 ) == 0) counter  = uri_number( eq + 1, val_end );              break;
+
+            case 'A':
+                if (strncasecmp( key, "algorithm", 9 ) == 0 && (digest = uri_digest( eq + 1, val_end )) < 0)
+                {
+                    im->error = "unsupported algorithm";
+                    return TOTP_EINVAL;
+                }
+                break;
+        }
+    }
+
+    if (0
+        || (nlen = pct_decode( label, label_end, name, sizeof( name ), false )) == (size_t) -1
+        || (issuer && (ilen = pct_decode( issuer, issuer_end, iss, sizeof( iss ), true )) == (size_t) -1)
+    )
+    {
+        im->error = "invalid label or issuer";
+        return TOTP_EINVAL;
+    }
+
+    if (secret && !uri_secret( s, secret, secret_end, digest ))
+    {
+        im->error = "invalid secret";
+        return TOTP_EINVAL;
+    }
+
+    if (!make_label( im, s, name, nlen, iss, ilen ))
+    {
+        totp_wipe( s );
+        return TOTP_EINVAL;
+    }
+
+    im->hotp    = hotp;
+    im->counter = counter;
+
+    return make_secret( im, s, digits, interval );
+}
+
+//---------------------------------------------------------------------
+//                     otpauth-migration:// payloads
+//---------------------------------------------------------------------
+
+#define PB_VARINT       0           // (protobuf wire types)
+#define PB_I64          1
+#define PB_LEN          2
+#define PB_I32          5
+
+struct pb                           // (protobuf message being read)
+{
+    const uint8_t*  p;
+    const uint8_t*  end;
+};
+
+static bool pb_varint( pb* b, uint64_t* v )
+{
+    int  shift;
+
+    for (*v=0, shift=0; b->p < b->end && shift < 64; shift += 7)
+    {
+        *v |= (uint64_t) (*b->p & 0x7f) << shift;
+
+        if (!(*b->p++ & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+// The next field: its number and wire type, and its value (varint), or
+// its bytes and their length (LEN); fixed size fields are skipped...
+
+static bool pb_field( pb* b, uint32_t* field, int* type, uint64_t* v, const uint8_t** bytes )
+{
+    uint64_t  key;
+
+    if (!pb_varint( b, &key ))
+        return false;
+
+    *field = (uint32_t) (key >> 3);
+    *type  = (int) (key & 7);
+
+    switch (*type)
+    {
+        case PB_VARINT:
+            return pb_varint( b, v );
+
+        case PB_LEN:
+            if (!pb_varint( b, v ) || *v > (uint64_t) (b->end - b->p))
+                return false;
+            *bytes = b->p;
+            b->p  += *v;
+            return true;
+
+        case PB_I64:
+        case PB_I32:
+            *v = (*type == PB_I64) ? 8 : 4;
+            if (*v > (uint64_t) (b->end - b->p))
+                return false;
+            b->p += *v;
+            return true;
+    }
+
+    return false;                   // (groups are long deprecated)
+}
+
+// Percent and base64 decode the payload (standard or URL safe alphabet,
+// padding optional) into the importer's payload buffer...
+
+static bool decode_payload( totp_import* im, const char* p, const char* end )
+{
+    uint8_t*  o;
+    uint32_t  bits;
+    int       nbits, c, hi, lo;
+    size_t    need = (end - p) * 3 / 4 + 3;
+
+    if (need > im->data_size)
+    {
+        size_t    size = im->data_size ? im->data_size : IMPORT_MIN_DATA;
+        uint8_t*  data;
+
+        while (size < need)
+            size *= 2;
+
+        if (!(data = (uint8_t*) malloc( size )))
+        {
+            im->error = "out of memory";
+            return false;
+        }
+
+        if (im->data)
+        {
+            totp_cleanse( im->data, im->data_size );
+            free( im->data );
+        }
+
+        im->data      = data;
+        im->data_size = size;
+    }
+
+    for (o=im->data, bits=0, nbits=0; p < end && *p != '&' && *p != '#'; p++)
+    {
+        if ((c = (unsigned char) *p) == '%')
+        {
+            if (end - p < 3 || (hi = hex_val( p[1] )) < 0 || (lo = hex_val( p[2] )) < 0)
+                return false;
+            c = (hi << 4) | lo;
+            p += 2;
+        }
+
+             if (c >= 'A' && c <= 'Z')  c -= 'A';
+        else if (c >= 'a' && c <= 'z')  c -= 'a' - 26;
+        else if (c >= '0' && c <= '9')  c -= '0' - 52;
+        else if (c == '+' || c == '-')  c = 62;
+        else if (c == '/' || c == '_')  c = 63;
+        else if (c == '=' || c == ' ')  continue;
+        else return false;
+
+        bits   = (bits << 6) | (uint32_t) c;
+        nbits += 6;
+
+        if (nbits >= 8)
+        {
+            nbits -= 8;
+            *o++ = (uint8_t) (bits >> nbits);
+        }
+    }
+
+    im->data_len = o - im->data;
+    im->pos      = 0;
+    return true;
+}
+
+static int import_migration( totp_import* im, totp_secret* s )
+{
+    pb              payload, params;
+    const uint8_t*  bytes = NULL;
+    const uint8_t*  secret = NULL;
+    const uint8_t*  name = NULL;
+    const uint8_t*  issuer = NULL;
+    size_t          secret_len = 0, name_len = 0, issuer_len = 0;
+    uint64_t        v, algorithm = 0, digits = 0, type_enum = 0, counter = 0;
+    uint32_t        field;
+    int             type, digest;
+
+    memset( s, 0, sizeof( *s ));
+
+    // The payload's next OtpParameters (field 1), skipping its other
+    // fields (version, batch size, etc)...
+
+    payload.p   = im->data + im->pos;
+    payload.end = im->data + im->data_len;
+
+    for (;;)
+    {
+        if (payload.p >= payload.end)
+            return TOTP_SKIP;
+
+        if (!pb_field( &payload, &field, &type, &v, &bytes ))
+        {
+            im->pos   = im->data_len;
+            im->error = "malformed payload";
+            return TOTP_EINVAL;
+        }
+
+        if (field == 1 && type == PB_LEN)
+            break;
+    }
+
+    im->pos = payload.p - im->data;
+
+    params.p   = bytes;
+    params.end = bytes + v;
+
+    while (params.p < params.end)
+    {
+        if (!pb_field( &params, &field, &type, &v, &bytes ))
+        {
+            im->error = "malformed payload";
+            return TOTP_EINVAL;
+        }
+
+        switch (field * 8 + type)
+        {
+            case 1 * 8 + PB_LEN:     secret = bytes, secret_len = (size_t) v;  break;
+            case 2 * 8 + PB_LEN:     name   = bytes, name_len   = (size_t) v;  break;
+            case 3 * 8 + PB_LEN:     issuer = bytes, issuer_len = (size_t) v;  break;
+            case 4 * 8 + PB_VARINT:  algorithm = v;                            break;
+            case 5 * 8 + PB_VARINT:  digits    = v;                            break;
+            case 6 * 8 + PB_VARINT:  type_enum = v;                            break;
+            case 7 * 8 + PB_VARINT:  counter   = v;                            break;
+        }
+    }
+
+    switch (algorithm)
+    {
+        case 0: case 1:     digest = TOTP_SHA1;    break;   // (0 = unspecified)
+        case 2:             digest = TOTP_SHA256;  break;
+        case 3:             digest = TOTP_SHA512;  break;
+
+        default:
+            im->error = "unsupported algorithm";
+            return TOTP_EINVAL;
+    }
+
+    totp_key_init( s, digest, secret, secret_len );
+
+    if (!make_label( im, s, (const char*) name, name_len, (const char*) issuer, issuer_len ))
+    {
+        totp_wipe( s );
+        return TOTP_EINVAL;
+    }
+
+    im->hotp    = type_enum == 1;   // (1 HOTP; 2 TOTP, or 0 unspecified)
+    im->counter = counter;
+
+    return make_secret( im, s, digits == 2 ? 8 : digits <= 1 ? 6 : 0, TOTP_DEF_INTERVAL );
+}
+
+//---------------------------------------------------------------------
+//                          totp_import_xxx
+//---------------------------------------------------------------------
+
+TOTP_API totp_import* totp_import_create( void )
+{
+    return (totp_import*) calloc( 1, sizeof( totp_import ));
+}
+
+TOTP_API int totp_import_line( totp_import* im, const char* line, size_t len )
+{
+    const char*  end = line + len;
+    const char*  p;
+
+    if (im->data_len)               // (wipe the previous payload's keys)
+        totp_cleanse( im->data, im->data_len ), im->data_len = 0;
+
+    im->kind  = IMPORT_NONE;
+    im->error = NULL;
+
+    while (line < end && isspace( (unsigned char) *line ))
+        ++line;
+
+    while (end > line && isspace( (unsigned char) end[-1] ))
+        --end;
+
+    if (line == end || *line == '*' || *line == '#' || *line == ';')
+        return TOTP_SKIP;
+
+    im->line = p = line;
+    im->end  = end;
+
+    if (has_prefix( &p, end, "otpauth://" ))
+        im->kind = IMPORT_URI;
+    else if (!has_prefix( &p, end, "otpauth-migration://" ))
+        im->kind = IMPORT_LINE;
+    else
+    {
+        // (the payload is the 'data' parameter's value)
+
+        for (; p < end && *p != '#'; p++)
+            if ((*p == '?' || *p == '&') && end - p > 5 && strncasecmp( p + 1, "data=", 5 ) == 0)
+                break;
+
+        if (p >= end || *p == '#')
+        {
+            im->error = "no data parameter";
+            return TOTP_EINVAL;
+        }
+
+        if (!decode_payload( im, p + 6, end ))
+        {
+            im->error = im->error ? im->error : "invalid data parameter";
+            return TOTP_EINVAL;
+        }
+
+        im->kind = IMPORT_MIGRATION;
+    }
+
+    return TOTP_OK;
+}
+
+TOTP_API int totp_import_next( totp_import* im, totp_secret* s )
+{
+    totp_diag  diag;
+    int        rc;
+
+    im->error = NULL;
+    im->hotp  = false;
+
+    switch (im->kind)
+    {
+        case IMPORT_LINE:
+            im->kind = IMPORT_NONE;
+            rc = totp_parse_diag( s, im->line, im->end - im->line, &diag );
+            im->error = diag.error;
+            return rc;
+
+        case IMPORT_URI:
+            im->kind = IMPORT_NONE;
+            return import_uri( im, s );
+
+        case IMPORT_MIGRATION:
+            return import_migration( im, s );
+    }
+
+    return TOTP_SKIP;
+}
+
+TOTP_API int totp_import_counter( const totp_import* im, uint64_t* counter )
+{
+    if (!im->hotp)
+        return TOTP_SKIP;
+
+    *counter = im->counter;
+    return TOTP_OK;
+}
+
+TOTP_API const char* totp_import_error( const totp_import* im )
+{
+    return im->error;
+}
+
+TOTP_API void totp_import_destroy( totp_import* im )
+{
+    if (!im)
+        return;
+
+    if (im->data)
+    {
+        totp_cleanse( im->data, im->data_size );
+        free( im->data );
+    }
+
+    free( im );
+}
@@ -0,0 +1,266 @@
+///////////////////////////////////////////////////////////////////////
+// libtotp_int.h: libtotp internal definitions shared between the
+// library's own source files. NOT part of the public interface!
+///////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "libtotp.h"
+
+#if defined( _M_X64 ) || defined( __x86_64__ ) || defined( _M_IX86 ) || defined( __i386__ )
+  #define TOTP_X86      1           // (x86/x64: AVX2/AVX-512 kernels)
+#else
+  #define TOTP_X86      0
+#endif
+
+#if defined( _M_ARM64 ) || defined( __aarch64__ )
+  #define TOTP_ARM64    1           // (ARMv8: crypto extension SHA)
+#else
+  #define TOTP_ARM64    0
+#endif
+
+#if TOTP_ARM64 && defined( __linux__ )
+  #include <sys/auxv.h>             // (need getauxval)
+  #include <asm/hwcap.h>            // (need HWCAP_SHA1/SHA2)
+#endif
+
+#if defined( _MSC_VER )
+  #include <intrin.h>               // (need __cpuidex and _xgetbv)
+  #define TOTP_ALIGN( n )   __declspec( align( n ))
+#else
+  #define TOTP_ALIGN( n )   __attribute__(( aligned( n )))
+#endif
+
+#define BITS_PER_BYTE   CHAR_BIT    // (there are 8 bits in a byte/char)
+
+//---------------------------------------------------------------------
+//                      Digest implementations
+//---------------------------------------------------------------------
+
+struct totp_sha_ctx                 // (built-in SHA context)
+{
+    union
+    {
+        uint32_t  w32[8];
+        uint64_t  w64[8];
+    }
+    h;                              // (chaining state)
+
+    uint64_t     total;             // (total bytes hashed so far)
+    size_t       num;               // (bytes waiting in buf)
+    uint8_t      buf[ TOTP_MAX_BLOCK ];
+};
+
+union totp_hash_ctx
+{
+    totp_sha_ctx  builtin;
+#ifndef TOTP_BUILTIN_SHA
+    SHA_CTX       sha1;
+    SHA256_CTX    sha256;
+    SHA512_CTX    sha512;
+#endif
+};
+
+struct totp_md
+{
+    const char*  name;              // (digest name as used on input line)
+    size_t       block_size;        // (digest block size in bytes)
+    size_t       hash_size;         // (resulting hash size in bytes)
+
+    size_t       word_size;         // (size of each state word: 4 or 8)
+
+    void (*init)   ( totp_hash_ctx* ctx );
+    void (*update) ( totp_hash_ctx* ctx, const void* data, size_t len );
+    void (*final)  ( totp_hash_ctx* ctx, uint8_t* hash );
+
+    // Raw compression function access (for HMAC midstates)...
+
+    void (*iv)       ( void* state );
+    void (*compress) ( void* state, const uint8_t* block );
+};
+
+// The digest implementations: OpenSSL's libcrypto (the default) or our
+// own built-in ones (if built with TOTP_BUILTIN_SHA, which then doesn't
+// need libcrypto at all). The built-in ones are always available.
+
+extern const totp_md totp_builtin_mds[ TOTP_NUM_DIGESTS ];
+
+#ifdef TOTP_BUILTIN_SHA
+  #define totp_mds  totp_builtin_mds
+#else
+  extern const totp_md totp_openssl_mds[ TOTP_NUM_DIGESTS ];
+  #define totp_mds  totp_openssl_mds
+#endif
+
+extern const uint32_t totp_sha256_k[64];
+extern const uint64_t totp_sha512_k[80];
+
+// Which built-in compression function implementation is being used
+// for the given digest ("sha-ni", "armv8" or "c")...
+
+const char* totp_builtin_impl( int digest );
+
+#if TOTP_X86
+void totp_sha1_block_shani   ( uint32_t* state, const uint8_t* block );
+void totp_sha256_block_shani ( uint32_t* state, const uint8_t* block );
+#endif
+#if TOTP_ARM64
+void totp_sha1_block_armv8   ( uint32_t* state, const uint8_t* block );
+void totp_sha256_block_armv8 ( uint32_t* state, const uint8_t* block );
+#endif
+
+extern const uint64_t totp_pow10[ TOTP_MAX_DIGITS + 1 ];
+
+// Extract the dynamically truncated 31-bit code from an HMAC value...
+
+uint32_t totp_truncate( const uint8_t* hmac, size_t hmacsize );
+
+// Code calculation specialised for one digest and number of DIGITS
+// (midstates required; see libtotp_engine.cpp): one code, and codes
+// for 'n' consecutive counter values...
+
+struct totp_engine
+{
+    uint32_t (*hotp) ( const totp_secret* s, uint64_t counter );
+    void     (*run)  ( const totp_secret* s, uint64_t counter, uint32_t* codes, size_t n );
+};
+
+const totp_engine* totp_engine_for( int digest, int digits );
+
+// Store a digest's chaining state as its (big-endian) hash value...
+
+void totp_state_to_hash( const totp_md* md, const void* state, uint8_t* hash );
+
+// For importers (see libtotp_import.cpp), whose keys don't come from a
+// SECRET field: base32 decode 'len' characters (no blanks) into 'out',
+// which must have room for len * 5 / 8 bytes, returning the number of
+// bytes (or -1 if any isn't base32), and set a secret's DIGEST and key
+// (K0) from its raw key bytes, the same as totp_parse would have...
+
+size_t totp_base32_decode( const char* in, size_t len, uint8_t* out );
+void   totp_key_init( totp_secret* s, int digest, const uint8_t* key, size_t len );
+
+//---------------------------------------------------------------------
+//                      Sealed store cryptography
+//---------------------------------------------------------------------
+
+#define TOTP_AEAD_KEY       32      // (ChaCha20-Poly1305 key size)
+#define TOTP_AEAD_NONCE     12      // (its nonce size)
+#define TOTP_AEAD_TAG       16      // (its tag size)
+
+// Encrypt 'data' in place, and its tag (of it and the AAD), or check
+// the tag and decrypt it in place (false if it isn't authentic, 'data'
+// then being left undecrypted)...
+
+void totp_aead_seal( const uint8_t* key, const uint8_t* nonce, const void* aad, size_t aad_len,
+                     uint8_t* data, size_t len, uint8_t* tag );
+bool totp_aead_open( const uint8_t* key, const uint8_t* nonce, const void* aad, size_t aad_len,
+                     uint8_t* data, size_t len, const uint8_t* tag );
+
+// The same, but always our own built-in implementation (which the above
+// are if built with TOTP_BUILTIN_SHA), and its Poly1305 on its own (for
+// bench's RFC 8439 checks)...
+
+void totp_builtin_aead_seal( const uint8_t* key, const uint8_t* nonce, const void* aad, size_t aad_len,
+                             uint8_t* data, size_t len, uint8_t* tag );
+bool totp_builtin_aead_open( const uint8_t* key, const uint8_t* nonce, const void* aad, size_t aad_len,
+                             uint8_t* data, size_t len, const uint8_t* tag );
+void totp_builtin_poly1305( const uint8_t* key, const void* msg, size_t len, uint8_t* tag );
+
+// A key from a passphrase (PBKDF2-HMAC-SHA256), and random bytes...
+
+void totp_pbkdf2( const char* pass, size_t pass_len, const uint8_t* salt, size_t salt_len,
+                  uint32_t rounds, uint8_t* key, size_t key_len );
+bool totp_random( void* buf, size_t len );
+
+//---------------------------------------------------------------------
+//                         Threading helpers
+//---------------------------------------------------------------------
+
+// (the counter log's compaction thread, totp_resync's worker threads)
+
+#ifdef _WIN32
+
+typedef HANDLE              totp_thread_t;
+typedef CRITICAL_SECTION    totp_lock_t;
+typedef CONDITION_VARIABLE  totp_cond_t;
+
+#define TOTP_THREAD_PROC( name )    static DWORD WINAPI name( LPVOID arg )
+#define TOTP_THREAD_RETURN          return 0
+
+#define lock_init( l )              InitializeCriticalSection( l )
+#define lock_destroy( l )           DeleteCriticalSection( l )
+#define lock_obtain( l )            EnterCriticalSection( l )
+#define lock_release( l )           LeaveCriticalSection( l )
+
+#define cond_init( c )              InitializeConditionVariable( c )
+#define cond_destroy( c )           /* (nothing to do) */
+#define cond_wait( c, l )           SleepConditionVariableCS( c, l, INFINITE )
+#define cond_broadcast( c )         WakeAllConditionVariable( c )
+
+#define thread_create( t, proc, arg )   ((*(t) = CreateThread( NULL, 0, proc, arg, 0, NULL )) != NULL)
+#define thread_join( t )                (WaitForSingleObject( t, INFINITE ), CloseHandle( t ))
+
+#else // (POSIX)
+
+typedef pthread_t           totp_thread_t;
+typedef pthread_mutex_t     totp_lock_t;
+typedef pthread_cond_t      totp_cond_t;
+
+#define TOTP_THREAD_PROC( name )    static void* name( void* arg )
+#define TOTP_THREAD_RETURN          return NULL
+
+#define lock_init( l )              pthread_mutex_init( l, NULL )
+#define lock_destroy( l )           pthread_mutex_destroy( l )
+#define lock_obtain( l )            pthread_mutex_lock( l )
+#define lock_release( l )           pthread_mutex_unlock( l )
+
+#define cond_init( c )              pthread_cond_init( c, NULL )
+#define cond_destroy( c )           pthread_cond_destroy( c )
+#define cond_wait( c, l )           pthread_cond_wait( c, l )
+#define cond_broadcast( c )         pthread_cond_broadcast( c )
+
+#define thread_create( t, proc, arg )   (pthread_create( t, NULL, proc, arg ) == 0)
+#define thread_join( t )                pthread_join( t, NULL )
+
+#endif
+
+//---------------------------------------------------------------------
+//                      CPU feature detection
+//---------------------------------------------------------------------
+
+#define TOTP_CPU_AVX2       0x01
+#define TOTP_CPU_AVX512     0x02    // (AVX-512F)
+#define TOTP_CPU_SHANI      0x04    // (x86 SHA extensions)
+#define TOTP_CPU_ARMV8_SHA1 0x08    // (ARMv8 crypto extension SHA1)
+#define TOTP_CPU_ARMV8_SHA2 0x10    // (ARMv8 crypto extension SHA2)
+
+unsigned totp_cpu_features();
+
+//---------------------------------------------------------------------
+//                  Multi-buffer (lane parallel) kernels
+//---------------------------------------------------------------------
+
+#define TOTP_MB_MAX_LANES   16
+
+struct totp_mb_lanes                // (one HMAC per lane, same digest)
+{
+    const totp_secret*  s       [ TOTP_MB_MAX_LANES ];
+    uint64_t            counter [ TOTP_MB_MAX_LANES ];
+    uint32_t*           code    [ TOTP_MB_MAX_LANES ];
+    size_t              n;          // (number of lanes in use)
+};
+
+struct totp_mb_kernel
+{
+    const char*  name;              // (kernel name)
+    unsigned     cpu_features;      // (required TOTP_CPU_xxx features)
+    size_t       lanes[ TOTP_NUM_DIGESTS ];     // (lanes per digest)
+
+    void (*run)( int digest, totp_mb_lanes* lanes );
+};
+
+#if TOTP_X86
+extern const totp_mb_kernel totp_mb_avx2;
+extern const totp_mb_kernel totp_mb_avx512;
+#endif
@@ -0,0 +1,523 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+//------------------------------------------------------------------------------
+//                          BATCH CODE GENERATION
+//------------------------------------------------------------------------------
+//
+//  Generates codes for many secrets at once by handing them to the best
+//  available multi-buffer kernel (see libtotp_mb.h), which calculates one
+//  HMAC per vector lane. Since each kernel invocation can only process
+//  secrets using the same digest, secrets are grouped by digest as they
+//  are encountered: each digest has its own set of lanes which is passed
+//  to the kernel whenever it fills up. Any partially filled lanes left
+//  over at the end are then either passed to the kernel as well, or, if
+//  only a few remain, simply calculated one at a time by totp_hotp.
+//
+//  Secrets whose midstates weren't precomputed (see totp_precompute)
+//  are always calculated one at a time by totp_hotp.
+//
+//------------------------------------------------------------------------------
+
+static const totp_mb_kernel  scalar_kernel = { "scalar", 0, { 0, 0, 0 }, NULL };
+
+static const totp_mb_kernel* const kernels[] =
+{
+#if TOTP_X86
+    &totp_mb_avx512,
+    &totp_mb_avx2,
+#endif
+    &scalar_kernel,
+};
+
+#define NUM_KERNELS     (sizeof( kernels ) / sizeof( kernels[0] ))
+
+static const totp_mb_kernel* volatile g_kernel = NULL;
+
+//---------------------------------------------------------------------
+//                         kernel_available
+//---------------------------------------------------------------------
+
+static bool kernel_available( const totp_mb_kernel* k )
+{
+    return (totp_cpu_features() & k->cpu_features) == k->cpu_features;
+}
+
+//---------------------------------------------------------------------
+//                          select_kernel
+//---------------------------------------------------------------------
+
+static const totp_mb_kernel* select_kernel()
+{
+    const totp_mb_kernel*  k = g_kernel;
+    size_t  i;
+
+    if (!k)
+    {
+        // (kernels are listed in order of preference)
+
+        for (i=0; i < NUM_KERNELS; i++)
+            if (kernel_available( kernels[i] ))
+                break;
+
+        g_kernel = k = kernels[i];
+    }
+
+    return k;
+}
+
+//---------------------------------------------------------------------
+//                        totp_batch_kernels
+//---------------------------------------------------------------------
+
+TOTP_API const char* totp_batch_kernels( int i )
+{
+    size_t  k;
+
+    for (k=0; k < NUM_KERNELS; k++)
+        if (kernel_available( kernels[k] ) && i-- == 0)
+            return kernels[k]->name;
+
+    return NULL;
+}
+
+//---------------------------------------------------------------------
+//                         totp_batch_kernel
+//---------------------------------------------------------------------
+
+TOTP_API const char* totp_batch_kernel()
+{
+    return select_kernel()->name;
+}
+
+//---------------------------------------------------------------------
+//                       totp_set_batch_kernel
+//---------------------------------------------------------------------
+
+TOTP_API int totp_set_batch_kernel( const char* name )
+{
+    size_t  i;
+
+    for (i=0; i < NUM_KERNELS; i++)
+    {
+        if (strcasecmp( name, kernels[i]->name ) == 0 && kernel_available( kernels[i] ))
+        {
+            g_kernel = kernels[i];
+            return TOTP_OK;
+        }
+    }
+
+    return TOTP_EINVAL;
+}
+
+//---------------------------------------------------------------------
+//                           flush_lanes
+//---------------------------------------------------------------------
+
+static void flush_lanes( const totp_mb_kernel* k, int digest, totp_mb_lanes* job )
+{
+    size_t  i;
+
+    // A kernel invocation costs the same no matter how many of its
+    // lanes are actually in use, so if only a few lanes are in use,
+    // it's quicker to just calculate them one at a time instead.
+
+    if (job->n * 4 > k->lanes[ digest ])
+        k->run( digest, job );
+    else
+        for (i=0; i < job->n; i++)
+            *job->code[i] = totp_hotp( job->s[i], job->counter[i] );
+
+    job->n = 0;
+}
+
+//---------------------------------------------------------------------
+//                            hotp_batch
+//---------------------------------------------------------------------
+
+static void hotp_batch( const totp_secret* const* secrets, const uint64_t* counters,
+                        int64_t at_time, uint32_t* codes, size_t n )
+{
+    const totp_mb_kernel*  k = select_kernel();
+    const totp_secret*     s;
+
+    totp_mb_lanes  lanes[ TOTP_NUM_DIGESTS ];
+    totp_mb_lanes* job;
+    uint64_t       counter;
+    size_t         i;
+    int            d;
+
+    for (d=0; d < TOTP_NUM_DIGESTS; d++)
+        lanes[d].n = 0;
+
+    for (i=0; i < n; i++)
+    {
+        s = secrets[i];
+        counter = counters ? counters[i] : totp_counter( s, at_time );
+
+        if (!k->run || !(s->flags & TOTP_F_MIDSTATE))
+        {
+            codes[i] = totp_hotp( s, counter );
+            continue;
+        }
+
+        job = &lanes[ s->digest ];
+
+        job->s       [ job->n ] = s;
+        job->counter [ job->n ] = counter;
+        job->code    [ job->n ] = &codes[i];
+
+        if (++job->n == k->lanes[ s->digest ])
+            k->run( s->digest, job ), job->n = 0;
+    }
+
+    // Process any remaining partially filled lanes...
+
+    for (d=0; d < TOTP_NUM_DIGESTS; d++)
+        if (lanes[d].n)
+            flush_lanes( k, d, &lanes[d] );
+}
+
+//---------------------------------------------------------------------
+//                          totp_hotp_batch
+//---------------------------------------------------------------------
+
+TOTP_API void totp_hotp_batch( const totp_secret* const* secrets,
+                               const uint64_t* counters,
+                               uint32_t* codes, size_t n )
+{
+    hotp_batch( secrets, counters, 0, codes, n );
+}
+
+//---------------------------------------------------------------------
+//                        totp_generate_batch
+//---------------------------------------------------------------------
+
+TOTP_API void totp_generate_batch( const totp_secret* const* secrets,
+                                   int64_t at_time,
+                                   uint32_t* codes, size_t n )
+{
+    hotp_batch( secrets, NULL, at_time, codes, n );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//---------------------------------------------------------------------
+//                         totp_hotp_range
+//---------------------------------------------------------------------
+//
+//  Codes for 'n' consecutive counter values of the same secret. The
+//  secret is only keyed once (its midstates precomputed if need be),
+//  and then each kernel invocation calculates as many consecutive
+//  counters as it has lanes, with any left over being calculated one
+//  at a time by the secret's engine, which only ever increments the
+//  counter.
+//
+//---------------------------------------------------------------------
+
+TOTP_API void totp_hotp_range( const totp_secret* s, uint64_t counter,
+                               uint32_t* codes, size_t n )
+{
+    const totp_mb_kernel*  k = select_kernel();
+
+    totp_secret    tmp;
+    totp_mb_lanes  job;
+    size_t         lanes, i;
+
+    if (!(s->flags & TOTP_F_MIDSTATE))
+    {
+        tmp = *s;
+        totp_precompute( &tmp );
+        s = &tmp;
+    }
+
+    lanes = k->run ? k->lanes[ s->digest ] : 0;
+
+    for (; lanes && n >= lanes; n -= lanes, counter += lanes, codes += lanes)
+    {
+        for (i=0; i < lanes; i++)
+        {
+            job.s       [i] = s;
+            job.counter [i] = counter + i;
+            job.code    [i] = &codes[i];
+        }
+
+        job.n = lanes;
+        k->run( s->digest, &job );
+    }
+
+    s->engine->run( s, counter, codes, n );
+
+    if (s == &tmp)
+        totp_wipe( &tmp );
+}
+
+//---------------------------------------------------------------------
+//                           totp_resync
+//---------------------------------------------------------------------
+//
+//  RFC 4226 section 7.4 resynchronisation: search counter - behind ...
+//  counter + ahead for the given consecutive codes. The window is cut
+//  into bands of RESYNC_BAND counters either side, nearest first, which
+//  the worker threads take in turn, each one calculating its band's
+//  codes with totp_hotp_range (using the secret's midstates, which are
+//  computed just once). Once a match has been found no band further
+//  away is started, so a search stops as soon as no nearer match is
+//  possible, and its result is the same however many threads search.
+//
+//---------------------------------------------------------------------
+
+#define RESYNC_BAND         1024        // (counters per band, per side)
+#define RESYNC_MAX_CODES    4           // (most consecutive codes)
+#define RESYNC_MAX_THREADS  64          // (most worker threads)
+
+struct resync_job
+{
+    const totp_secret*  s;              // (midstates precomputed)
+    uint64_t            counter;        // (search around this counter)
+    uint64_t            behind, ahead;  // (how far either side)
+    const uint32_t*     codes;          // (the consecutive codes)
+    size_t              ncodes;         // (how many)
+
+    totp_lock_t         lock;
+    uint64_t            next;           // (next band to be searched)
+    uint64_t            bands;          // (number of bands)
+    bool                found;          // (a match has been found...)
+    int64_t             drift;          // (...this one)
+};
+
+static uint64_t resync_dist( int64_t drift )
+{
+    return drift < 0 ? (uint64_t) -drift : (uint64_t) drift;
+}
+
+// (nearer wins; if as near, behind wins, as for totp_verify)
+
+static bool resync_better( int64_t drift, bool found, int64_t best )
+{
+    return 0
+        || !found
+        || resync_dist( drift ) < resync_dist( best )
+        || (resync_dist( drift ) == resync_dist( best ) && drift < best);
+}
+
+// Search counters 'first' ... 'first + n - 1' for the codes, returning
+// the index of the match nearest to the end given by 'from_end', if any
+
+static bool resync_search( const resync_job* j, uint64_t first, size_t n,
+                           bool from_end, uint32_t* buf, size_t* at )
+{
+    size_t  i, k;
+
+    totp_hotp_range( j->s, first, buf, n + j->ncodes - 1 );
+
+    for (k=0; k < n; k++)
+    {
+        i = from_end ? n - 1 - k : k;
+
+        if (memcmp( &buf[i], j->codes, j->ncodes * sizeof( uint32_t )) == 0)
+        {
+            *at = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+TOTP_THREAD_PROC( resync_thread )
+{
+    resync_job*  j = (resync_job*) arg;
+
+    uint32_t  buf[ RESYNC_BAND + RESYNC_MAX_CODES ];
+    uint64_t  band, lo, hi;
+    int64_t   drift;
+    size_t    at;
+    bool      found;
+
+    for (;;)
+    {
+        lock_obtain( &j->lock );
+        {
+            band = j->next++;
+
+            if (0
+                || band >= j->bands
+                || (j->found && band * RESYNC_BAND > resync_dist( j->drift ))
+            )
+                band = UINT64_MAX;
+        }
+        lock_release( &j->lock );
+
+        if (band == UINT64_MAX)
+            break;
+
+        // Distances lo ... hi either side (behind, then ahead)...
+
+        lo    = band * RESYNC_BAND;
+        hi    = lo + RESYNC_BAND - 1;
+        found = false;
+        drift = 0;
+
+        if (!lo)
+            lo = 1;                 // (distance 0 is ahead's)
+
+        if (lo <= j->behind)
+        {
+            uint64_t  far = hi < j->behind ? hi : j->behind;
+
+            if (resync_search( j, j->counter - far, (size_t) (far - lo + 1), true, buf, &at ))
+            {
+                drift = -(int64_t) (far - at);
+                found = true;
+            }
+        }
+
+        lo = band * RESYNC_BAND;
+
+        if (lo <= j->ahead)
+        {
+            uint64_t  far = hi < j->ahead ? hi : j->ahead;
+
+            if (resync_search( j, j->counter + lo, (size_t) (far - lo + 1), false, buf, &at )
+                && resync_better( (int64_t) (lo + at), found, drift ))
+            {
+                drift = (int64_t) (lo + at);
+                found = true;
+            }
+        }
+
+        if (found)
+        {
+            lock_obtain( &j->lock );
+            {
+                if (resync_better( drift, j->found, j->drift ))
+                {
+                    j->drift = drift;
+                    j->found = true;
+                }
+            }
+            lock_release( &j->lock );
+        }
+    }
+
+    totp_cleanse( buf, sizeof( buf ));
+    TOTP_THREAD_RETURN;
+}
+
+static unsigned resync_cpus()
+{
+#ifdef _WIN32
+    SYSTEM_INFO  si;
+
+    GetSystemInfo( &si );
+    return (unsigned) si.dwNumberOfProcessors;
+#else
+    long  n = sysconf( _SC_NPROCESSORS_ONLN );
+
+    return n > 0 ? (unsigned) n : 1;
+#endif
+}
+
+TOTP_API int totp_resync( const totp_secret* s, uint64_t counter,
+                          uint64_t behind, uint64_t ahead,
+                          const uint32_t* codes, size_t ncodes,
+                          unsigned threads, int64_t* drift )
+{
+    totp_thread_t  t[ RESYNC_MAX_THREADS ];
+    bool           started[ RESYNC_MAX_THREADS ];
+    totp_secret    tmp;
+    resync_job     job;
+    unsigned       i;
+
+    if (ncodes < 1 || ncodes > RESYNC_MAX_CODES)
+        return TOTP_EINVAL;
+
+    // (stay within the counters there are, and drifts that fit)
+
+    if (behind > counter)
+        behind = counter;
+
+    if (behind > (uint64_t) INT64_MAX)
+        behind = (uint64_t) INT64_MAX;
+
+    if (ahead > UINT64_MAX - counter - (ncodes - 1))
+        ahead = UINT64_MAX - counter - (ncodes - 1);
+
+    if (ahead > (uint64_t) INT64_MAX)
+        ahead = (uint64_t) INT64_MAX;
+
+    // Key the HMAC just once, for every band...
+
+    if (!(s->flags & TOTP_F_MIDSTATE))
+    {
+        tmp = *s;
+        totp_precompute( &tmp );
+        s = &tmp;
+    }
+
+    memset( &job, 0, sizeof( job ));
+
+    job.s       = s;
+    job.counter = counter;
+    job.behind  = behind;
+    job.ahead   = ahead;
+    job.codes   = codes;
+    job.ncodes  = ncodes;
+    job.bands   = (behind > ahead ? behind : ahead) / RESYNC_BAND + 1;
+
+    if (!threads)
+        threads = resync_cpus();
+
+    if (threads > RESYNC_MAX_THREADS)
+        threads = RESYNC_MAX_THREADS;
+
+    if (threads > job.bands)
+        threads = (unsigned) job.bands;
+
+    lock_init( &job.lock );
+
+    // (the calling thread searches too)
+
+    for (i=1; i < threads; i++)
+        started[i] = thread_create( &t[i], resync_thread, &job );
+
+    resync_thread( &job );
+
+    for (i=1; i < threads; i++)
+        if (started[i])
+            thread_join( t[i] );
+
+    lock_destroy( &job.lock );
+
+    if (s == &tmp)
+        totp_wipe( &tmp );
+
+    if (!job.found)
+        return TOTP_SKIP;
+
+    if (drift)
+        *drift = job.drift;
+
+    return TOTP_OK;
+}
@@ -0,0 +1,337 @@
+///////////////////////////////////////////////////////////////////////
+// libtotp_mb.h: generic multi-buffer (lane parallel) HMAC kernels.
+//
+// Included by each instruction-set specific source file (e.g.
+// libtotp_avx2.cpp) AFTER defining its vector "traits" classes,
+// which supply the vector type and primitive operations used here:
+//
+//   V                  vector type (one word per lane)
+//   W                  scalar word type (uint32_t or uint64_t)
+//   LANES              number of lanes (words per vector)
+//   load, store        (aligned) load/store of LANES words
+//   set1               broadcast one word to all lanes
+//   add, xor_, and_,
+//   or_, andnot        lane-wise arithmetic/logic (andnot = ~a & b)
+//   shl<N>, shr<N>,
+//   rotr<N>            lane-wise shifts and rotate right
+//
+// NOT part of the public interface!
+///////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+//------------------------------------------------------------------------------
+//
+//  Every TOTP message is the same 8 byte big-endian counter, and every
+//  HMAC of it (given precomputed midstates; see totp_precompute) is just
+//  two compressions: the padded counter block using the inner midstate,
+//  followed by the padded inner hash block using the outer midstate.
+//  Since only the data differs, each lane of a vector register can just
+//  as easily process a different secret's HMAC at the same time.
+//
+//  Input and output is done via small transposed ("lane major") arrays,
+//  i.e. word[t][lane], so that each vector load/store is contiguous.
+//
+//------------------------------------------------------------------------------
+
+#define ROTR( x, n )    T::template rotr<n>( x )
+#define SHR( x, n )     T::template shr<n>( x )
+
+//---------------------------------------------------------------------
+//                        Round constants
+//---------------------------------------------------------------------
+
+// (see libtotp_sha.cpp: totp_sha256_k and totp_sha512_k)
+
+//---------------------------------------------------------------------
+//                      mb_sha1_compress
+//---------------------------------------------------------------------
+
+template <class T>
+static inline void mb_sha1_compress( typename T::V st[5], typename T::V w[16] )
+{
+    typedef typename T::V V;
+
+    V  a = st[0], b = st[1], c = st[2], d = st[3], e = st[4];
+    V  f, k, tmp;
+    int  t;
+
+    for (t=0; t < 80; t++)
+    {
+        if (t >= 16)
+        {
+            tmp = T::xor_( T::xor_( w[ (t+13) & 15 ], w[ (t+8) & 15 ] ),
+                           T::xor_( w[ (t+2)  & 15 ], w[ t     & 15 ] ));
+            w[ t & 15 ] = ROTR( tmp, 31 );
+        }
+
+        if (t < 20)
+        {
+            f = T::or_( T::and_( b, c ), T::andnot( b, d ));
+            k = T::set1( 0x5a827999 );
+        }
+        else if (t < 40)
+        {
+            f = T::xor_( T::xor_( b, c ), d );
+            k = T::set1( 0x6ed9eba1 );
+        }
+        else if (t < 60)
+        {
+            f = T::or_( T::and_( b, c ), T::and_( d, T::or_( b, c )));
+            k = T::set1( 0x8f1bbcdc );
+        }
+        else
+        {
+            f = T::xor_( T::xor_( b, c ), d );
+            k = T::set1( 0xca62c1d6 );
+        }
+
+        tmp = T::add( T::add( ROTR( a, 27 ), f ),
+                      T::add( T::add( e, k ), w[ t & 15 ] ));
+        e = d;
+        d = c;
+        c = ROTR( b, 2 );
+        b = a;
+        a = tmp;
+    }
+
+    st[0] = T::add( st[0], a );
+    st[1] = T::add( st[1], b );
+    st[2] = T::add( st[2], c );
+    st[3] = T::add( st[3], d );
+    st[4] = T::add( st[4], e );
+}
+
+//---------------------------------------------------------------------
+//                     mb_sha256_compress
+//---------------------------------------------------------------------
+
+template <class T>
+static inline void mb_sha256_compress( typename T::V st[8], typename T::V w[16] )
+{
+    typedef typename T::V V;
+
+    V  a = st[0], b = st[1], c = st[2], d = st[3];
+    V  e = st[4], f = st[5], g = st[6], h = st[7];
+    V  s0, s1, t1, t2;
+    int  t;
+
+    for (t=0; t < 64; t++)
+    {
+        if (t >= 16)
+        {
+            s0 = w[ (t+1) & 15 ];
+            s0 = T::xor_( T::xor_( ROTR( s0, 7 ), ROTR( s0, 18 )), SHR( s0, 3 ));
+            s1 = w[ (t+14) & 15 ];
+            s1 = T::xor_( T::xor_( ROTR( s1, 17 ), ROTR( s1, 19 )), SHR( s1, 10 ));
+            w[ t & 15 ] = T::add( T::add( w[ t & 15 ], s0 ),
+                                  T::add( w[ (t+9) & 15 ], s1 ));
+        }
+
+        s1 = T::xor_( T::xor_( ROTR( e, 6 ), ROTR( e, 11 )), ROTR( e, 25 ));
+        t1 = T::xor_( T::and_( e, f ), T::andnot( e, g ));
+        t1 = T::add( T::add( T::add( h, s1 ), t1 ),
+                     T::add( T::set1( totp_sha256_k[t] ), w[ t & 15 ] ));
+        s0 = T::xor_( T::xor_( ROTR( a, 2 ), ROTR( a, 13 )), ROTR( a, 22 ));
+        t2 = T::or_( T::and_( a, b ), T::and_( c, T::or_( a, b )));
+        t2 = T::add( s0, t2 );
+
+        h = g;
+        g = f;
+        f = e;
+        e = T::add( d, t1 );
+        d = c;
+        c = b;
+        b = a;
+        a = T::add( t1, t2 );
+    }
+
+    st[0] = T::add( st[0], a );  st[4] = T::add( st[4], e );
+    st[1] = T::add( st[1], b );  st[5] = T::add( st[5], f );
+    st[2] = T::add( st[2], c );  st[6] = T::add( st[6], g );
+    st[3] = T::add( st[3], d );  st[7] = T::add( st[7], h );
+}
+
+//---------------------------------------------------------------------
+//                     mb_sha512_compress
+//---------------------------------------------------------------------
+
+template <class T>
+static inline void mb_sha512_compress( typename T::V st[8], typename T::V w[16] )
+{
+    typedef typename T::V V;
+
+    V  a = st[0], b = st[1], c = st[2], d = st[3];
+    V  e = st[4], f = st[5], g = st[6], h = st[7];
+    V  s0, s1, t1, t2;
+    int  t;
+
+    for (t=0; t < 80; t++)
+    {
+        if (t >= 16)
+        {
+            s0 = w[ (t+1) & 15 ];
+            s0 = T::xor_( T::xor_( ROTR( s0, 1 ), ROTR( s0, 8 )), SHR( s0, 7 ));
+            s1 = w[ (t+14) & 15 ];
+            s1 = T::xor_( T::xor_( ROTR( s1, 19 ), ROTR( s1, 61 )), SHR( s1, 6 ));
+            w[ t & 15 ] = T::add( T::add( w[ t & 15 ], s0 ),
+                                  T::add( w[ (t+9) & 15 ], s1 ));
+        }
+
+        s1 = T::xor_( T::xor_( ROTR( e, 14 ), ROTR( e, 18 )), ROTR( e, 41 ));
+        t1 = T::xor_( T::and_( e, f ), T::andnot( e, g ));
+        t1 = T::add( T::add( T::add( h, s1 ), t1 ),
+                     T::add( T::set1( totp_sha512_k[t] ), w[ t & 15 ] ));
+        s0 = T::xor_( T::xor_( ROTR( a, 28 ), ROTR( a, 34 )), ROTR( a, 39 ));
+        t2 = T::or_( T::and_( a, b ), T::and_( c, T::or_( a, b )));
+        t2 = T::add( s0, t2 );
+
+        h = g;
+        g = f;
+        f = e;
+        e = T::add( d, t1 );
+        d = c;
+        c = b;
+        b = a;
+        a = T::add( t1, t2 );
+    }
+
+    st[0] = T::add( st[0], a );  st[4] = T::add( st[4], e );
+    st[1] = T::add( st[1], b );  st[5] = T::add( st[5], f );
+    st[2] = T::add( st[2], c );  st[6] = T::add( st[6], g );
+    st[3] = T::add( st[3], d );  st[7] = T::add( st[7], h );
+}
+
+//---------------------------------------------------------------------
+//                          mb_hmac
+//---------------------------------------------------------------------
+//
+//  HMAC of each lane's counter using its secret's precomputed inner and
+//  outer midstates, followed by truncation of the result to the secret's
+//  number of digits. Unused lanes (n < LANES) just duplicate lane 0.
+//
+//---------------------------------------------------------------------
+
+template <class T, int STATE_WORDS, int HASH_WORDS,
+          void (*COMPRESS)( typename T::V*, typename T::V* )>
+static inline void mb_hmac( totp_mb_lanes* job )
+{
+    typedef typename T::V  V;
+    typedef typename T::W  W;
+
+    const size_t  WBITS      = sizeof( W ) * BITS_PER_BYTE;
+    const size_t  BLOCK_SIZE = 16 * sizeof( W );
+    const W       PAD        = (W) 1 << (WBITS - 1);
+
+    TOTP_ALIGN( 64 ) W  words[ 16 ][ T::LANES ];
+
+    const totp_secret*  s;
+    const W*            mid;
+
+    V       st[ STATE_WORDS ];
+    V       w[ 16 ];
+    size_t  i, lane;
+    int     t;
+
+    uint8_t  hash[ TOTP_MAX_HASH ];
+
+    // Load each lane's inner midstate and message block (counter)...
+
+    for (lane=0; lane < T::LANES; lane++)
+    {
+        i   = lane < job->n ? lane : 0;
+        s   = job->s[i];
+        mid = sizeof( W ) == 4 ? (const W*) s->mid.w32[0] : (const W*) s->mid.w64[0];
+
+        for (t=0; t < STATE_WORDS; t++)
+            words[t][ lane ] = mid[t];
+
+        if (sizeof( W ) == 4)
+        {
+            words[ 8 ][ lane ] = (W) (job->counter[i] >> 32);
+            words[ 9 ][ lane ] = (W) (job->counter[i]);
+        }
+        else
+            words[ 8 ][ lane ] = (W) job->counter[i];
+    }
+
+    for (t=0; t < STATE_WORDS; t++)
+        st[t] = T::load( words[t] );
+
+    // Inner block: counter || 0x80 || 0... || bit length (one full
+    // block plus the 8 byte counter, since ipad was already hashed)
+
+    t = 0;
+    w[ t++ ] = T::load( words[8] );
+    if (sizeof( W ) == 4)
+        w[ t++ ] = T::load( words[9] );
+    w[ t++ ] = T::set1( PAD );
+    while (t < 15)
+        w[ t++ ] = T::set1( 0 );
+    w[ 15 ] = T::set1( (W) ((BLOCK_SIZE + 8) * BITS_PER_BYTE) );
+
+    COMPRESS( st, w );
+
+    // Outer block: inner hash || 0x80 || 0... || bit length. Note
+    // the inner hash words are simply the inner state words, which
+    // are already in the required (big-endian value) form.
+
+    for (t=0; t < HASH_WORDS; t++)
+        w[t] = st[t];
+    w[ t++ ] = T::set1( PAD );
+    while (t < 15)
+        w[ t++ ] = T::set1( 0 );
+    w[ 15 ] = T::set1( (W) ((BLOCK_SIZE + HASH_WORDS * sizeof( W )) * BITS_PER_BYTE) );
+
+    for (lane=0; lane < T::LANES; lane++)
+    {
+        s   = job->s[ lane < job->n ? lane : 0 ];
+        mid = sizeof( W ) == 4 ? (const W*) s->mid.w32[1] : (const W*) s->mid.w64[1];
+
+        for (t=0; t < STATE_WORDS; t++)
+            words[t][ lane ] = mid[t];
+    }
+
+    for (t=0; t < STATE_WORDS; t++)
+        st[t] = T::load( words[t] );
+
+    COMPRESS( st, w );
+
+    // Extract each lane's resulting HMAC and truncate it...
+
+    for (t=0; t < STATE_WORDS; t++)
+        T::store( words[t], st[t] );
+
+    for (lane=0; lane < job->n; lane++)
+    {
+        W  h[ STATE_WORDS ];
+
+        s = job->s[ lane ];
+
+        for (t=0; t < STATE_WORDS; t++)
+            h[t] = words[t][ lane ];
+
+        totp_state_to_hash( s->md, h, hash );
+
+        *job->code[ lane ] = (uint32_t) (totp_truncate( hash, s->md->hash_size )
+                                       % totp_pow10[ s->digits ]);
+    }
+}
+
+//---------------------------------------------------------------------
+//                           mb_run
+//---------------------------------------------------------------------
+
+template <class T32, class T64>
+static inline void mb_run( int digest, totp_mb_lanes* job )
+{
+    switch (digest)
+    {
+    case TOTP_SHA1:   mb_hmac< T32, 5, 5, mb_sha1_compress   <T32> >( job ); break;
+    case TOTP_SHA256: mb_hmac< T32, 8, 8, mb_sha256_compress <T32> >( job ); break;
+    case TOTP_SHA512: mb_hmac< T64, 8, 8, mb_sha512_compress <T64> >( job ); break;
+    }
+}
+
+#undef ROTR
+#undef SHR
@@ -0,0 +1,231 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+//------------------------------------------------------------------------------
+//                              REPLAY CACHE
+//------------------------------------------------------------------------------
+//
+//  RFC 6238 section 5.2: "the verifier MUST NOT accept the second attempt of
+//  the OTP after the successful validation has been issued for the first OTP".
+//  The replay cache remembers every (secret id, counter) which was accepted
+//  until its code could no longer be accepted anyway, and is shared by any
+//  number of verifying threads without any lock:
+//
+//  It's a fixed size open addressing hash table whose slots each hold (in a
+//  single 64-bit word, so they can be compare-and-swapped) a fingerprint of
+//  (id, counter) and the time (in seconds) it expires. Nothing is ever swept
+//  or removed: a slot whose time has passed is free, i.e. entries expire on
+//  their own as time moves on, like a time wheel whose ticks are seconds,
+//  so memory stays bounded by the number of codes accepted within the last
+//  lifetime. An entry is always within REPLAY_PROBES slots of its home slot,
+//  and is added by CAS-ing the first free one of those. Two threads adding
+//  the same fingerprint at the same time could both succeed (in different
+//  slots), but whichever does so last then always sees the other's entry,
+//  and reports a replay: a code can never be accepted twice, even though a
+//  race might occasionally reject both (i.e. the legitimate user's try as
+//  well as the attacker's).
+//
+//------------------------------------------------------------------------------
+
+#define REPLAY_PROBES       64          // (most slots from home slot)
+#define REPLAY_MIN_SLOTS    1024        // (smallest table)
+
+#if defined( _MSC_VER )
+  #define cas64( p, old, val )      (_InterlockedCompareExchange64( (volatile __int64*) (p), \
+                                        (__int64) (val), (__int64) (old) ) == (__int64) (old))
+#else
+  #define cas64( p, old, val )      __sync_bool_compare_and_swap( (p), (old), (val) )
+#endif
+
+// Slots: fingerprint (never 0) in the high 32 bits, and the low 32 bits
+// of the expiry time in the low 32 bits, compared modulo 2^32 with the
+// time it's checked at (right while the two are less than about 68 years
+// apart, which max_lifetime guarantees for any live entry). An empty slot
+// is 0, and never live: its "expiry" would be in the future whenever the
+// low 32 bits of now are 2^31 or more (2038 onwards, and so on).
+
+#define SLOT( fp, t )               (((uint64_t) (fp) << 32) | (uint32_t) (t))
+#define SLOT_FP( v )                ((uint32_t) ((v) >> 32))
+#define SLOT_LIVE( v, now )         ((v) && (int32_t) ((uint32_t) (v) - (uint32_t) (now)) > 0)
+
+struct totp_replay
+{
+    volatile uint64_t*  slots;          // (fingerprint + expiry, or 0)
+    size_t              mask;           // (number of slots - 1)
+    int64_t             max_lifetime;   // (longest lifetime accepted)
+};
+
+static uint64_t mix64( uint64_t x )     // (splitmix64 finalizer)
+{
+    x ^= x >> 30;  x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;  x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+
+    return x;
+}
+
+//---------------------------------------------------------------------
+//                        totp_replay_create
+//---------------------------------------------------------------------
+
+TOTP_API totp_replay* totp_replay_create( size_t max_entries, int64_t max_lifetime )
+{
+    totp_replay*  r;
+    size_t        nslots;
+
+    if (max_lifetime < 1 || !(r = (totp_replay*) calloc( 1, sizeof( *r ))))
+        return NULL;
+
+    // (no more than a quarter full, so that free slots are never far)
+
+    for (nslots = REPLAY_MIN_SLOTS; nslots / 4 < max_entries; nslots <<= 1)
+        ;
+
+    if (!(r->slots = (volatile uint64_t*) calloc( nslots, sizeof( uint64_t ))))
+    {
+        free( r );
+        return NULL;
+    }
+
+    r->mask         = nslots - 1;
+    r->max_lifetime = max_lifetime;
+
+    return r;
+}
+
+//---------------------------------------------------------------------
+//                        totp_replay_destroy
+//---------------------------------------------------------------------
+
+TOTP_API void totp_replay_destroy( totp_replay* r )
+{
+    if (!r)
+        return;
+
+    free( (void*) r->slots );
+    free( r );
+}
+
+//---------------------------------------------------------------------
+//                         totp_replay_check
+//---------------------------------------------------------------------
+
+TOTP_API int totp_replay_check( totp_replay* r, uint64_t id, uint64_t counter,
+                                int64_t expires, int64_t at_time )
+{
+    uint64_t  h, v, old;
+    uint32_t  fp;
+    size_t    home, i, n, at;
+
+    if (expires <= at_time)
+        return TOTP_SKIP;           // (already expired: can't be accepted)
+
+    if (expires - at_time > r->max_lifetime)
+        return TOTP_EINVAL;         // (longer than the cache can remember)
+
+    h    = mix64( id ^ mix64( counter + 0x9E3779B97F4A7C15ULL ));
+    home = (size_t) h & r->mask;
+
+    if (!(fp = (uint32_t) (h >> 32)))
+        fp = 1;
+
+    for (;;)
+    {
+        // Already there? Otherwise, where's the first free slot?
+
+        for (at = REPLAY_PROBES, n=0, i = home; n < REPLAY_PROBES; n++, i = (i + 1) & r->mask)
+        {
+            if (SLOT_LIVE( v = r->slots[i], at_time ))
+            {
+                if (SLOT_FP( v ) == fp)
+                    return TOTP_SKIP;   // (replay!)
+            }
+            else if (at == REPLAY_PROBES)
+            {
+                at  = n;
+                old = v;
+            }
+        }
+
+        if (at == REPLAY_PROBES)
+            return TOTP_EIO;        // (no free slot: full; fail safe)
+
+        i = (home + at) & r->mask;
+
+        if (cas64( &r->slots[i], old, SLOT( fp, expires )))
+            break;
+
+        // (someone else took it first: look again)
+    }
+
+    // Did someone else add it at the same time (in another slot)?
+
+    for (n=0; n < REPLAY_PROBES; n++)
+    {
+        v = r->slots[ (home + n) & r->mask ];
+
+        if (n != at && SLOT_FP( v ) == fp && SLOT_LIVE( v, at_time ))
+            return TOTP_SKIP;
+    }
+
+    return TOTP_OK;
+}
+
+//---------------------------------------------------------------------
+//                          totp_verify_once
+//---------------------------------------------------------------------
+
+TOTP_API int totp_verify_once( const totp_secret* s, totp_replay* r, uint32_t code,
+                               int64_t at_time, unsigned window, int* drift )
+{
+    const char*  name = s->label;
+    size_t       len  = s->label_len;
+    uint64_t     id   = 14695981039346656037ULL;    // (64-bit FNV-1a)
+    uint64_t     counter;
+    int64_t      expires;
+    int          d;
+
+    if (!totp_verify( s, code, at_time, window, &d ))
+        return TOTP_EINVAL;
+
+    if (drift)
+        *drift = d;
+
+    totp_name( &name, &len );
+
+    while (len--)
+        id = (id ^ (uint8_t) *name++) * 1099511628211ULL;
+
+    // Its code remains acceptable until its counter is more than
+    // 'window' time steps in the past...
+
+    counter = totp_counter( s, at_time ) + d;
+
+    if (s->flags & TOTP_F_TEST)
+        expires = at_time + (int64_t) (2 * window + 1) * (int64_t) s->interval;
+    else
+        expires = s->offset + (int64_t) ((counter + window + 1) * s->interval);
+
+    return totp_replay_check( r, id, counter, expires, at_time );
+}
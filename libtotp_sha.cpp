@@ -0,0 +1,538 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+//------------------------------------------------------------------------------
+//                          DIGEST IMPLEMENTATIONS
+//------------------------------------------------------------------------------
+//
+//  Two interchangeable sets of SHA-1/SHA-256/SHA-512 implementations,
+//  each described by a table of 'totp_md' structures (see libtotp_int.h):
+//
+//  OpenSSL's libcrypto low-level SHA functions (the default), and our own
+//  built-in ones. Building with TOTP_BUILTIN_SHA defined uses the built-in
+//  ones instead and then doesn't need libcrypto at all, which saves every
+//  short-lived totp process the cost of loading and initializing it.
+//
+//  The built-in compression functions are portable C, except that when the
+//  CPU has them, the x86 SHA extensions (SHA-NI) or the ARMv8 crypto SHA
+//  instructions are used instead for SHA-1 and SHA-256 (see libtotp_shani.cpp
+//  and libtotp_armv8.cpp). The choice is made once, on first use.
+//
+//------------------------------------------------------------------------------
+
+#ifndef TOTP_BUILTIN_SHA
+
+//---------------------------------------------------------------------
+//                      OpenSSL libcrypto
+//---------------------------------------------------------------------
+
+static void sha1_init     ( totp_hash_ctx* ctx )                              { SHA1_Init     ( &ctx->sha1 );              }
+static void sha1_update   ( totp_hash_ctx* ctx, const void* data, size_t len ) { SHA1_Update   ( &ctx->sha1,   data, len ); }
+static void sha1_final    ( totp_hash_ctx* ctx, uint8_t* hash )               { SHA1_Final    ( hash, &ctx->sha1 );        }
+static void sha256_init   ( totp_hash_ctx* ctx )                              { SHA256_Init   ( &ctx->sha256 );            }
+static void sha256_update ( totp_hash_ctx* ctx, const void* data, size_t len ) { SHA256_Update ( &ctx->sha256, data, len ); }
+static void sha256_final  ( totp_hash_ctx* ctx, uint8_t* hash )               { SHA256_Final  ( hash, &ctx->sha256 );      }
+static void sha512_init   ( totp_hash_ctx* ctx )                              { SHA512_Init   ( &ctx->sha512 );            }
+static void sha512_update ( totp_hash_ctx* ctx, const void* data, size_t len ) { SHA512_Update ( &ctx->sha512, data, len ); }
+static void sha512_final  ( totp_hash_ctx* ctx, uint8_t* hash )               { SHA512_Final  ( hash, &ctx->sha512 );      }
+
+// The "Transform" functions compress one block into the context's
+// chaining state ('h' values) and touch nothing else, so we only need
+// to copy the state in and out of a context to use them.
+
+static void sha1_iv( void* state )
+{
+    SHA_CTX    c;
+    uint32_t*  h = (uint32_t*) state;
+
+    SHA1_Init( &c );
+    h[0] = c.h0, h[1] = c.h1, h[2] = c.h2, h[3] = c.h3, h[4] = c.h4;
+}
+
+static void sha1_compress( void* state, const uint8_t* block )
+{
+    SHA_CTX    c;
+    uint32_t*  h = (uint32_t*) state;
+
+    c.h0 = h[0], c.h1 = h[1], c.h2 = h[2], c.h3 = h[3], c.h4 = h[4];
+    SHA1_Transform( &c, block );
+    h[0] = c.h0, h[1] = c.h1, h[2] = c.h2, h[3] = c.h3, h[4] = c.h4;
+}
+
+static void sha256_iv( void* state )
+{
+    SHA256_CTX  c;
+
+    SHA256_Init( &c );
+    memcpy( state, c.h, sizeof( c.h ));
+}
+
+static void sha256_compress( void* state, const uint8_t* block )
+{
+    SHA256_CTX  c;
+
+    memcpy( c.h, state, sizeof( c.h ));
+    SHA256_Transform( &c, block );
+    memcpy( state, c.h, sizeof( c.h ));
+}
+
+static void sha512_iv( void* state )
+{
+    SHA512_CTX  c;
+
+    SHA512_Init( &c );
+    memcpy( state, c.h, sizeof( c.h ));
+}
+
+static void sha512_compress( void* state, const uint8_t* block )
+{
+    SHA512_CTX  c;
+
+    memcpy( c.h, state, sizeof( c.h ));
+    SHA512_Transform( &c, block );
+    memcpy( state, c.h, sizeof( c.h ));
+}
+
+const totp_md totp_openssl_mds[ TOTP_NUM_DIGESTS ] =
+{
+    { "sha1",   SHA_CBLOCK,    SHA_DIGEST_LENGTH,    4, sha1_init,   sha1_update,   sha1_final,   sha1_iv,   sha1_compress   },
+    { "sha256", SHA256_CBLOCK, SHA256_DIGEST_LENGTH, 4, sha256_init, sha256_update, sha256_final, sha256_iv, sha256_compress },
+    { "sha512", SHA512_CBLOCK, SHA512_DIGEST_LENGTH, 8, sha512_init, sha512_update, sha512_final, sha512_iv, sha512_compress },
+};
+
+#endif // !TOTP_BUILTIN_SHA
+
+//---------------------------------------------------------------------
+//                    Built-in: constants
+//---------------------------------------------------------------------
+
+static const uint32_t sha1_h0[5] =
+{
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+static const uint32_t sha256_h0[8] =
+{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint64_t sha512_h0[8] =
+{
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+const uint32_t totp_sha256_k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const uint64_t totp_sha512_k[80] =
+{
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+//---------------------------------------------------------------------
+//                 Built-in: portable compression functions
+//---------------------------------------------------------------------
+
+#define ROL32( x, n )   (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR32( x, n )   (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64( x, n )   (((x) >> (n)) | ((x) << (64 - (n))))
+
+static inline uint32_t load_be32( const uint8_t* p )
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+         | ((uint32_t) p[2] <<  8) | ((uint32_t) p[3]);
+}
+
+static inline uint64_t load_be64( const uint8_t* p )
+{
+    return ((uint64_t) load_be32( p ) << 32) | load_be32( p + 4 );
+}
+
+static void sha1_block_c( uint32_t* h, const uint8_t* block )
+{
+    uint32_t  w[16];
+    uint32_t  a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    uint32_t  f, k, tmp;
+    int       t;
+
+    for (t=0; t < 16; t++)
+        w[t] = load_be32( block + t*4 );
+
+    for (t=0; t < 80; t++)
+    {
+        if (t >= 16)
+        {
+            tmp = w[ (t+13) & 15 ] ^ w[ (t+8) & 15 ] ^ w[ (t+2) & 15 ] ^ w[ t & 15 ];
+            w[ t & 15 ] = ROL32( tmp, 1 );
+        }
+
+        if      (t < 20) f = (b & c) | (~b & d),           k = 0x5a827999;
+        else if (t < 40) f = b ^ c ^ d,                    k = 0x6ed9eba1;
+        else if (t < 60) f = (b & c) | (d & (b | c)),      k = 0x8f1bbcdc;
+        else             f = b ^ c ^ d,                    k = 0xca62c1d6;
+
+        tmp = ROL32( a, 5 ) + f + e + k + w[ t & 15 ];
+        e = d;
+        d = c;
+        c = ROL32( b, 30 );
+        b = a;
+        a = tmp;
+    }
+
+    h[0] += a, h[1] += b, h[2] += c, h[3] += d, h[4] += e;
+}
+
+// SHA-256/SHA-512 rounds are unrolled 16 at a time (with the usual
+// renaming of the working variables instead of moving them around), so
+// that the message schedule ring w[] index is always a constant...
+
+#define BSIG0_32( x )   (ROR32( x,  2 ) ^ ROR32( x, 13 ) ^ ROR32( x, 22 ))
+#define BSIG1_32( x )   (ROR32( x,  6 ) ^ ROR32( x, 11 ) ^ ROR32( x, 25 ))
+#define SSIG0_32( x )   (ROR32( x,  7 ) ^ ROR32( x, 18 ) ^ ((x) >>  3))
+#define SSIG1_32( x )   (ROR32( x, 17 ) ^ ROR32( x, 19 ) ^ ((x) >> 10))
+
+#define BSIG0_64( x )   (ROR64( x, 28 ) ^ ROR64( x, 34 ) ^ ROR64( x, 39 ))
+#define BSIG1_64( x )   (ROR64( x, 14 ) ^ ROR64( x, 18 ) ^ ROR64( x, 41 ))
+#define SSIG0_64( x )   (ROR64( x,  1 ) ^ ROR64( x,  8 ) ^ ((x) >>  7))
+#define SSIG1_64( x )   (ROR64( x, 19 ) ^ ROR64( x, 61 ) ^ ((x) >>  6))
+
+#define SCHED( i, SSIG0, SSIG1 )                                        \
+                                                                        \
+    (t < 16 ? w[i] : (w[i] += SSIG0( w[ ((i)+1) & 15 ] ) + w[ ((i)+9) & 15 ]  \
+                             + SSIG1( w[ ((i)+14) & 15 ] )))
+
+#define ROUND( a, b, c, d, e, f, g, h, i, BITS, K )                     \
+                                                                        \
+    t1 = h + BSIG1_ ## BITS( e ) + ((e & f) ^ (~e & g)) + K[ t + (i) ]  \
+           + SCHED( i, SSIG0_ ## BITS, SSIG1_ ## BITS );                \
+    d += t1;                                                            \
+    h  = t1 + BSIG0_ ## BITS( a ) + ((a & b) | (c & (a | b)))
+
+#define ROUNDS16( BITS, K )                                             \
+                                                                        \
+    ROUND( a, b, c, d, e, f, g, h,  0, BITS, K );                       \
+    ROUND( h, a, b, c, d, e, f, g,  1, BITS, K );                       \
+    ROUND( g, h, a, b, c, d, e, f,  2, BITS, K );                       \
+    ROUND( f, g, h, a, b, c, d, e,  3, BITS, K );                       \
+    ROUND( e, f, g, h, a, b, c, d,  4, BITS, K );                       \
+    ROUND( d, e, f, g, h, a, b, c,  5, BITS, K );                       \
+    ROUND( c, d, e, f, g, h, a, b,  6, BITS, K );                       \
+    ROUND( b, c, d, e, f, g, h, a,  7, BITS, K );                       \
+    ROUND( a, b, c, d, e, f, g, h,  8, BITS, K );                       \
+    ROUND( h, a, b, c, d, e, f, g,  9, BITS, K );                       \
+    ROUND( g, h, a, b, c, d, e, f, 10, BITS, K );                       \
+    ROUND( f, g, h, a, b, c, d, e, 11, BITS, K );                       \
+    ROUND( e, f, g, h, a, b, c, d, 12, BITS, K );                       \
+    ROUND( d, e, f, g, h, a, b, c, 13, BITS, K );                       \
+    ROUND( c, d, e, f, g, h, a, b, 14, BITS, K );                       \
+    ROUND( b, c, d, e, f, g, h, a, 15, BITS, K )
+
+static void sha256_block_c( uint32_t* st, const uint8_t* block )
+{
+    uint32_t  w[16];
+    uint32_t  a = st[0], b = st[1], c = st[2], d = st[3];
+    uint32_t  e = st[4], f = st[5], g = st[6], h = st[7];
+    uint32_t  t1;
+    int       t;
+
+    for (t=0; t < 16; t++)
+        w[t] = load_be32( block + t*4 );
+
+    for (t=0; t < 64; t += 16)
+    {
+        ROUNDS16( 32, totp_sha256_k );
+    }
+
+    st[0] += a, st[1] += b, st[2] += c, st[3] += d;
+    st[4] += e, st[5] += f, st[6] += g, st[7] += h;
+}
+
+static void sha512_block_c( uint64_t* st, const uint8_t* block )
+{
+    uint64_t  w[16];
+    uint64_t  a = st[0], b = st[1], c = st[2], d = st[3];
+    uint64_t  e = st[4], f = st[5], g = st[6], h = st[7];
+    uint64_t  t1;
+    int       t;
+
+    for (t=0; t < 16; t++)
+        w[t] = load_be64( block + t*8 );
+
+    for (t=0; t < 80; t += 16)
+    {
+        ROUNDS16( 64, totp_sha512_k );
+    }
+
+    st[0] += a, st[1] += b, st[2] += c, st[3] += d;
+    st[4] += e, st[5] += f, st[6] += g, st[7] += h;
+}
+
+#undef ROUNDS16
+#undef ROUND
+#undef SCHED
+#undef BSIG0_32
+#undef BSIG1_32
+#undef SSIG0_32
+#undef SSIG1_32
+#undef BSIG0_64
+#undef BSIG1_64
+#undef SSIG0_64
+#undef SSIG1_64
+#undef ROL32
+#undef ROR32
+#undef ROR64
+
+//---------------------------------------------------------------------
+//                 Built-in: runtime dispatch
+//---------------------------------------------------------------------
+//
+//  Each digest's block function starts out pointing at a "resolve"
+//  function which, on first call, picks the best implementation for
+//  this CPU, replaces the pointer, and then forwards the call. (Two
+//  threads racing to do so both store the same value, so no harm.)
+//
+//---------------------------------------------------------------------
+
+typedef void (*block32_fn)( uint32_t* h, const uint8_t* block );
+
+static void sha1_resolve   ( uint32_t* h, const uint8_t* block );
+static void sha256_resolve ( uint32_t* h, const uint8_t* block );
+
+static block32_fn  sha1_block    = sha1_resolve;
+static block32_fn  sha256_block  = sha256_resolve;
+
+static const char* sha1_impl     = "c";
+static const char* sha256_impl   = "c";
+
+static void sha1_resolve( uint32_t* h, const uint8_t* block )
+{
+    unsigned    features  = totp_cpu_features();
+    block32_fn  fn        = sha1_block_c;
+
+    (void) features;
+
+#if TOTP_X86
+    if (features & TOTP_CPU_SHANI)
+        fn = totp_sha1_block_shani, sha1_impl = "sha-ni";
+#elif TOTP_ARM64
+    if (features & TOTP_CPU_ARMV8_SHA1)
+        fn = totp_sha1_block_armv8, sha1_impl = "armv8";
+#endif
+
+    sha1_block = fn;
+    fn( h, block );
+}
+
+static void sha256_resolve( uint32_t* h, const uint8_t* block )
+{
+    unsigned    features  = totp_cpu_features();
+    block32_fn  fn        = sha256_block_c;
+
+    (void) features;
+
+#if TOTP_X86
+    if (features & TOTP_CPU_SHANI)
+        fn = totp_sha256_block_shani, sha256_impl = "sha-ni";
+#elif TOTP_ARM64
+    if (features & TOTP_CPU_ARMV8_SHA2)
+        fn = totp_sha256_block_armv8, sha256_impl = "armv8";
+#endif
+
+    sha256_block = fn;
+    fn( h, block );
+}
+
+const char* totp_builtin_impl( int digest )
+{
+    uint32_t  h[8]  = {0};
+    uint8_t   block[ TOTP_MAX_BLOCK ] = {0};
+
+    // (make sure the choice has been made)
+
+    switch (digest)
+    {
+        case TOTP_SHA1:   sha1_block( h, block );   return sha1_impl;
+        case TOTP_SHA256: sha256_block( h, block ); return sha256_impl;
+        default:                                    return "c";
+    }
+}
+
+//---------------------------------------------------------------------
+//                 Built-in: init/update/final
+//---------------------------------------------------------------------
+
+static void bi_compress( size_t word_size, totp_sha_ctx* c, const uint8_t* block, int digest )
+{
+    if (word_size == 8)
+        sha512_block_c( c->h.w64, block );
+    else if (digest == TOTP_SHA1)
+        sha1_block( c->h.w32, block );
+    else
+        sha256_block( c->h.w32, block );
+}
+
+static void bi_update( int digest, totp_hash_ctx* ctx, const void* data, size_t len )
+{
+    totp_sha_ctx*   c      = &ctx->builtin;
+    const uint8_t*  p      = (const uint8_t*) data;
+    size_t          bsize  = (digest == TOTP_SHA512) ? 128 : 64;
+    size_t          wsize  = (digest == TOTP_SHA512) ?   8 :  4;
+    size_t          n;
+
+    c->total += len;
+
+    if (c->num)
+    {
+        n = bsize - c->num;
+        if (n > len)
+            n = len;
+
+        memcpy( c->buf + c->num, p, n );
+        c->num += n;
+        p      += n;
+        len    -= n;
+
+        if (c->num < bsize)
+            return;
+
+        bi_compress( wsize, c, c->buf, digest );
+        c->num = 0;
+    }
+
+    for (; len >= bsize; p += bsize, len -= bsize)
+        bi_compress( wsize, c, p, digest );
+
+    if (len)
+    {
+        memcpy( c->buf, p, len );
+        c->num = len;
+    }
+}
+
+static void bi_final( int digest, totp_hash_ctx* ctx, uint8_t* hash )
+{
+    totp_sha_ctx*   c      = &ctx->builtin;
+    const totp_md*  md     = &totp_builtin_mds[ digest ];
+    size_t          bsize  = md->block_size;
+    size_t          lsize  = (bsize == 128) ? 16 : 8;   // (length field size)
+    uint64_t        bits   = c->total * BITS_PER_BYTE;
+    int             i;
+
+    // Pad: 0x80, zeros, then the big-endian message length in bits
+
+    c->buf[ c->num++ ] = 0x80;
+
+    if (c->num > bsize - lsize)
+    {
+        memset( c->buf + c->num, 0, bsize - c->num );
+        bi_compress( md->word_size, c, c->buf, digest );
+        c->num = 0;
+    }
+
+    memset( c->buf + c->num, 0, bsize - c->num );
+
+    for (i=0; i < 8; i++)
+        c->buf[ bsize - 1 - i ] = (uint8_t) (bits >> (8 * i));
+
+    bi_compress( md->word_size, c, c->buf, digest );
+
+    totp_state_to_hash( md, &c->h, hash );
+    totp_cleanse( c, sizeof( *c ));
+}
+
+static void bi_sha1_iv   ( void* state ) { memcpy( state, sha1_h0,   sizeof( sha1_h0   )); }
+static void bi_sha256_iv ( void* state ) { memcpy( state, sha256_h0, sizeof( sha256_h0 )); }
+static void bi_sha512_iv ( void* state ) { memcpy( state, sha512_h0, sizeof( sha512_h0 )); }
+
+static void bi_sha1_init   ( totp_hash_ctx* ctx ) { ctx->builtin.total = ctx->builtin.num = 0; bi_sha1_iv   ( &ctx->builtin.h ); }
+static void bi_sha256_init ( totp_hash_ctx* ctx ) { ctx->builtin.total = ctx->builtin.num = 0; bi_sha256_iv ( &ctx->builtin.h ); }
+static void bi_sha512_init ( totp_hash_ctx* ctx ) { ctx->builtin.total = ctx->builtin.num = 0; bi_sha512_iv ( &ctx->builtin.h ); }
+
+static void bi_sha1_update   ( totp_hash_ctx* ctx, const void* data, size_t len ) { bi_update( TOTP_SHA1,   ctx, data, len ); }
+static void bi_sha256_update ( totp_hash_ctx* ctx, const void* data, size_t len ) { bi_update( TOTP_SHA256, ctx, data, len ); }
+static void bi_sha512_update ( totp_hash_ctx* ctx, const void* data, size_t len ) { bi_update( TOTP_SHA512, ctx, data, len ); }
+
+static void bi_sha1_final   ( totp_hash_ctx* ctx, uint8_t* hash ) { bi_final( TOTP_SHA1,   ctx, hash ); }
+static void bi_sha256_final ( totp_hash_ctx* ctx, uint8_t* hash ) { bi_final( TOTP_SHA256, ctx, hash ); }
+static void bi_sha512_final ( totp_hash_ctx* ctx, uint8_t* hash ) { bi_final( TOTP_SHA512, ctx, hash ); }
+
+static void bi_sha1_compress   ( void* state, const uint8_t* block ) { sha1_block   ( (uint32_t*) state, block ); }
+static void bi_sha256_compress ( void* state, const uint8_t* block ) { sha256_block ( (uint32_t*) state, block ); }
+static void bi_sha512_compress ( void* state, const uint8_t* block ) { sha512_block_c( (uint64_t*) state, block ); }
+
+const totp_md totp_builtin_mds[ TOTP_NUM_DIGESTS ] =
+{
+    { "sha1",    64, 20, 4, bi_sha1_init,   bi_sha1_update,   bi_sha1_final,   bi_sha1_iv,   bi_sha1_compress   },
+    { "sha256",  64, 32, 4, bi_sha256_init, bi_sha256_update, bi_sha256_final, bi_sha256_iv, bi_sha256_compress },
+    { "sha512", 128, 64, 8, bi_sha512_init, bi_sha512_update, bi_sha512_final, bi_sha512_iv, bi_sha512_compress },
+};
+
+//---------------------------------------------------------------------
+//                          totp_sha_backend
+//---------------------------------------------------------------------
+
+TOTP_API const char* totp_sha_backend()
+{
+#ifdef TOTP_BUILTIN_SHA
+    static char  name[ 64 ];
+
+    if (!name[0])
+        snprintf( name, sizeof( name ), "built-in (sha1: %s, sha256: %s, sha512: c)",
+            totp_builtin_impl( TOTP_SHA1 ), totp_builtin_impl( TOTP_SHA256 ));
+
+    return name;
+#else
+    return "openssl";
+#endif
+}
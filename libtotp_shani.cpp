@@ -0,0 +1,158 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+//------------------------------------------------------------------------------
+//                       x86 SHA extensions (SHA-NI)
+//------------------------------------------------------------------------------
+//
+//  SHA-1 and SHA-256 block compression functions for the built-in digests
+//  (see libtotp_sha.cpp) using the Intel SHA extensions. This file must be
+//  compiled with SHA and SSE4.1 code generation enabled (e.g. gcc -msha
+//  -msse4.1); it is only ever called when the CPU is known to support them
+//  (see totp_cpu_features). There are no SHA-512 instructions (on x86),
+//  so SHA-512 always uses the portable C version.
+//
+//  Each 4-round group's message words are kept in a ring of four vectors,
+//  m[g & 3], with the message schedule for later groups being computed
+//  a few groups ahead, the way the instructions were designed to be used.
+//
+//------------------------------------------------------------------------------
+
+#if TOTP_X86
+
+#include <immintrin.h>
+
+//---------------------------------------------------------------------
+//                      totp_sha1_block_shani
+//---------------------------------------------------------------------
+
+// One 4-round group. G is a constant, so that everything but the group's
+// instructions themselves folds away once inlined (the round function
+// selector must be an immediate anyway)...
+
+template <int G>
+static inline void sha1_group( __m128i& abcd, __m128i e[2], __m128i m[4] )
+{
+    __m128i  w = m[ G & 3 ];
+
+    if (G == 0) e[0]       = _mm_add_epi32( e[0], w );
+    else        e[ G & 1 ] = _mm_sha1nexte_epu32( e[ G & 1 ], w );
+
+    e[ (G+1) & 1 ] = abcd;
+    abcd = _mm_sha1rnds4_epu32( abcd, e[ G & 1 ], G / 5 );
+
+    // Message schedule for groups G+1, G+2 and G+3...
+
+    if (G >= 3 && G <= 18) m[ (G+1) & 3 ] = _mm_sha1msg2_epu32( m[ (G+1) & 3 ], w );
+    if (G >= 1 && G <= 16) m[ (G-1) & 3 ] = _mm_sha1msg1_epu32( m[ (G-1) & 3 ], w );
+    if (G >= 2 && G <= 17) m[ (G-2) & 3 ] = _mm_xor_si128( m[ (G-2) & 3 ], w );
+}
+
+void totp_sha1_block_shani( uint32_t* state, const uint8_t* block )
+{
+    const __m128i  mask = _mm_set_epi64x( 0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL );
+
+    __m128i  abcd, abcd_save, e0_save, e[2], m[4];
+    int      g;
+
+    abcd      = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i*) state ), 0x1b );
+    e[0]      = _mm_set_epi32( state[4], 0, 0, 0 );
+    abcd_save = abcd;
+    e0_save   = e[0];
+
+    for (g=0; g < 4; g++)
+        m[g] = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*) (block + g*16) ), mask );
+
+    sha1_group< 0>( abcd, e, m );  sha1_group< 1>( abcd, e, m );
+    sha1_group< 2>( abcd, e, m );  sha1_group< 3>( abcd, e, m );
+    sha1_group< 4>( abcd, e, m );  sha1_group< 5>( abcd, e, m );
+    sha1_group< 6>( abcd, e, m );  sha1_group< 7>( abcd, e, m );
+    sha1_group< 8>( abcd, e, m );  sha1_group< 9>( abcd, e, m );
+    sha1_group<10>( abcd, e, m );  sha1_group<11>( abcd, e, m );
+    sha1_group<12>( abcd, e, m );  sha1_group<13>( abcd, e, m );
+    sha1_group<14>( abcd, e, m );  sha1_group<15>( abcd, e, m );
+    sha1_group<16>( abcd, e, m );  sha1_group<17>( abcd, e, m );
+    sha1_group<18>( abcd, e, m );  sha1_group<19>( abcd, e, m );
+
+    e[0] = _mm_sha1nexte_epu32( e[0], e0_save );
+    abcd = _mm_shuffle_epi32( _mm_add_epi32( abcd, abcd_save ), 0x1b );
+
+    _mm_storeu_si128( (__m128i*) state, abcd );
+    state[4] = (uint32_t) _mm_extract_epi32( e[0], 3 );
+}
+
+//---------------------------------------------------------------------
+//                     totp_sha256_block_shani
+//---------------------------------------------------------------------
+
+void totp_sha256_block_shani( uint32_t* state, const uint8_t* block )
+{
+    const __m128i  mask = _mm_set_epi64x( 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL );
+
+    __m128i  st0, st1, st0_save, st1_save, tmp, msg, m[4];
+    int      g;
+
+    // The instructions want the state as ABEF and CDGH...
+
+    tmp = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i*) &state[0] ), 0xb1 );   // CDAB
+    st1 = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i*) &state[4] ), 0x1b );   // EFGH
+    st0 = _mm_alignr_epi8( tmp, st1, 8 );                                             // ABEF
+    st1 = _mm_blend_epi16( st1, tmp, 0xf0 );                                          // CDGH
+
+    st0_save = st0;
+    st1_save = st1;
+
+    for (g=0; g < 4; g++)
+        m[g] = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*) (block + g*16) ), mask );
+
+    for (g=0; g < 16; g++)
+    {
+        msg = _mm_add_epi32( m[ g & 3 ], _mm_loadu_si128( (const __m128i*) &totp_sha256_k[ g*4 ] ));
+        st1 = _mm_sha256rnds2_epu32( st1, st0, msg );
+        msg = _mm_shuffle_epi32( msg, 0x0e );
+        st0 = _mm_sha256rnds2_epu32( st0, st1, msg );
+
+        // Message schedule for group g+4 (replaces group g's words)...
+
+        if (g < 12)
+        {
+            tmp = _mm_alignr_epi8( m[ (g+3) & 3 ], m[ (g+2) & 3 ], 4 );
+            m[ g & 3 ] = _mm_add_epi32( _mm_sha256msg1_epu32( m[ g & 3 ], m[ (g+1) & 3 ] ), tmp );
+            m[ g & 3 ] = _mm_sha256msg2_epu32( m[ g & 3 ], m[ (g+3) & 3 ] );
+        }
+    }
+
+    st0 = _mm_add_epi32( st0, st0_save );
+    st1 = _mm_add_epi32( st1, st1_save );
+
+    tmp = _mm_shuffle_epi32( st0, 0x1b );                                             // FEBA
+    st1 = _mm_shuffle_epi32( st1, 0xb1 );                                             // DCHG
+    st0 = _mm_blend_epi16( tmp, st1, 0xf0 );                                          // DCBA
+    st1 = _mm_alignr_epi8( st1, tmp, 8 );                                             // HGFE
+
+    _mm_storeu_si128( (__m128i*) &state[0], st0 );
+    _mm_storeu_si128( (__m128i*) &state[4], st1 );
+}
+
+#endif // TOTP_X86
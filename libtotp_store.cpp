@@ -0,0 +1,957 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+//------------------------------------------------------------------------------
+//                          PRECOMPILED SECRET STORE
+//------------------------------------------------------------------------------
+//
+//  A store is a file of already parsed secrets (see "totp --compile") which
+//  is memory mapped and then used as is, without any parsing at all. Opening
+//  one costs the same no matter how many secrets it holds, since nothing is
+//  actually read until it's needed, and finding a secret by name is a hash
+//  table lookup. The file's layout (in the creating machine's byte order,
+//  which is checked when opened) is:
+//
+//      header      store_hdr
+//      records     'count' fixed size store_rec records, each followed
+//                  by its HMAC midstates if TOTP_STORE_MIDSTATES
+//      index       'slots' (a power of 2) store_slot entries: an open
+//                  addressing hash table of record numbers, by name
+//      labels      all of the records' labels, back to back
+//
+//  A secret's name is its label without any leading comment characters
+//  or blanks (i.e. "adam@acme.org" for the label "*adam@acme.org").
+//
+//  Note that a store contains decoded secret keys, so it must be protected
+//  just like the secrets file it was compiled from, unless it is sealed:
+//
+//------------------------------------------------------------------------------
+//                            SEALED STORES
+//------------------------------------------------------------------------------
+//
+//  A sealed store (see totp_store_seal) is the same, except that a store_seal
+//  follows the header, and each record (and its midstates) is encrypted with
+//  ChaCha20-Poly1305 (see libtotp_aead.cpp), preceded by the cleartext part of
+//  a sealed_rec: where its label is, and its tag. Only the labels (and so the
+//  index) remain in the clear. The key is derived from a passphrase using
+//  PBKDF2-HMAC-SHA256 with the store's own random salt, so every store has a
+//  different key, and each record's nonce is simply its record number. Each
+//  record's label is its additional authenticated data, so records can't be
+//  swapped around, and the headers are authenticated by the store_seal's
+//  'check' tag, which is also how a wrong passphrase is detected.
+//
+//  The passphrase is only needed (and the key derived) once per process, when
+//  the store is unlocked. Records are then only decrypted when first fetched,
+//  into a cache of locked (never swapped) memory which is excluded from core
+//  dumps and zeroed when the store is closed: one code out of millions costs
+//  one decryption (of a few hundred bytes), never the whole store's.
+//
+//------------------------------------------------------------------------------
+
+#define STORE_MAGIC     "TOTPSTOR"  // (8 bytes; no NUL)
+#define STORE_VERSION   1           // (format version)
+#define STORE_BOM       0x01020304  // (byte order mark)
+
+struct store_hdr
+{
+    char         magic[8];          // (STORE_MAGIC)
+    uint32_t     version;           // (STORE_VERSION)
+    uint32_t     bom;               // (STORE_BOM)
+    uint32_t     flags;             // (TOTP_STORE_xxx flags)
+    uint32_t     rec_size;          // (size of each record)
+    uint64_t     count;             // (number of records)
+    uint64_t     slots;             // (number of index slots)
+    uint64_t     index_off;         // (file offset of index)
+    uint64_t     labels_off;        // (file offset of labels)
+    uint64_t     labels_len;        // (total length of labels)
+};
+
+struct store_rec
+{
+    uint64_t     interval;          // (INTERVAL)
+    int64_t      offset;            // (OFFSET, or exact time if TEST)
+    uint64_t     label_off;         // (label's offset within labels)
+    uint32_t     label_len;         // (length of label)
+    uint32_t     key_len;           // (decoded SECRET length)
+    uint8_t      digest;            // (totp_digest)
+    uint8_t      digits;            // (DIGITS)
+    uint8_t      flags;             // (TOTP_F_TEST only)
+    uint8_t      reserved[5];
+
+    uint8_t      k0[ TOTP_MAX_BLOCK ];
+};
+
+struct store_seal                   // (sealed stores: right after header)
+{
+    uint8_t      salt[16];          // (PBKDF2 salt)
+    uint32_t     rounds;            // (PBKDF2 rounds)
+    uint32_t     reserved;
+    uint8_t      check[ TOTP_AEAD_TAG ];    // (tag of headers; see above)
+};
+
+struct sealed_rec                   // (then the sealed store_rec etc)
+{
+    uint64_t     label_off;         // (label's offset within labels)
+    uint32_t     label_len;         // (length of label)
+    uint32_t     reserved;
+    uint8_t      tag[ TOTP_AEAD_TAG ];      // (tag of record, and label)
+};
+
+struct store_slot
+{
+    uint32_t     hash;              // (hash of record's name)
+    uint32_t     rec;               // (record number + 1; 0 = empty)
+};
+
+#define MID_SIZE        sizeof( ((totp_secret*) 0)->mid )
+#define MAX_RECORDS     (UINT32_MAX - 1)
+
+#define KDF_ROUNDS      200000      // (PBKDF2 rounds for new sealed stores)
+#define KDF_MAX_ROUNDS  100000000   // (most we'll ever do when unlocking)
+
+struct plain_rec                    // (a record, decrypted)
+{
+    store_rec    rec;
+    uint8_t      mid[ MID_SIZE ];   // (if TOTP_STORE_MIDSTATES)
+};
+
+// A record's plain size, and size in the store...
+
+static size_t plain_size( uint32_t flags )
+{
+    return sizeof( store_rec ) + ((flags & TOTP_STORE_MIDSTATES) ? MID_SIZE : 0);
+}
+
+static size_t rec_size( uint32_t flags )
+{
+    return plain_size( flags ) + ((flags & TOTP_STORE_SEALED) ? sizeof( sealed_rec ) : 0);
+}
+
+static size_t recs_off( uint32_t flags )
+{
+    return sizeof( store_hdr ) + ((flags & TOTP_STORE_SEALED) ? sizeof( store_seal ) : 0);
+}
+
+// Record i's nonce (its number), and the headers' check nonce...
+
+static void rec_nonce( uint64_t i, uint8_t* nonce )
+{
+    int  b;
+
+    memset( nonce, 0, TOTP_AEAD_NONCE );
+
+    for (b=0; b < 8; b++)
+        nonce[b] = (uint8_t) (i >> (8 * b));
+}
+
+struct headers                      // (the check tag's additional data)
+{
+    store_hdr    hdr;
+    store_seal   seal;              // (with a zero 'check')
+};
+
+static void check_nonce( const store_hdr* hdr, const store_seal* seal,
+                         uint8_t* nonce, headers* aad )
+{
+    memset( nonce, 0xff, TOTP_AEAD_NONCE );     // (never a record's)
+
+    memcpy( &aad->hdr,  hdr,  sizeof( aad->hdr  ));
+    memcpy( &aad->seal, seal, sizeof( aad->seal ));
+    memset( aad->seal.check, 0, sizeof( aad->seal.check ));
+}
+
+//---------------------------------------------------------------------
+//                          Secret names
+//---------------------------------------------------------------------
+
+TOTP_API void totp_name( const char** name, size_t* len )
+{
+    while (*len && strchr( " \t*#;", **name ))
+        ++*name, --*len;
+
+    while (*len && isspace( (unsigned char) (*name)[ *len - 1 ] ))
+        --*len;
+}
+
+TOTP_API uint32_t totp_name_hash( const char* name, size_t len )
+{
+    uint32_t  h = 2166136261u;      // (32-bit FNV-1a)
+
+    while (len--)
+        h = (h ^ (uint8_t) *name++) * 16777619u;
+
+    return h;
+}
+
+//---------------------------------------------------------------------
+//                        totp_store_writer
+//---------------------------------------------------------------------
+
+struct totp_store_writer
+{
+    FILE*        fp;                // (store being written)
+    uint32_t     flags;             // (TOTP_STORE_xxx flags)
+    uint64_t     count;             // (records written so far)
+    bool         failed;            // (write error occurred)
+
+    uint32_t*    hashes;            // (each record's name hash)
+    size_t       maxhashes;         // (size of hashes array)
+
+    char*        labels;            // (labels so far)
+    size_t       labels_len;        // (length of labels)
+    size_t       labels_size;       // (size of labels buffer)
+
+    store_seal   seal;              // (if TOTP_STORE_SEALED)
+    uint8_t*     key;               // (its key)
+};
+
+//---------------------------------------------------------------------
+//                        totp_store_create
+//---------------------------------------------------------------------
+
+TOTP_API totp_store_writer* totp_store_create( const char* path, unsigned flags )
+{
+    totp_store_writer*  w;
+    store_hdr           hdr;
+
+    if (!(w = (totp_store_writer*) calloc( 1, sizeof( *w ))))
+        return NULL;
+
+    w->flags = flags & TOTP_STORE_MIDSTATES;
+
+#ifdef _WIN32
+    w->fp = fopen( path, "wb" );
+#else
+    {
+        int  fd;    // (it holds secrets: only we may read it)
+
+        if ((fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0600 )) >= 0)
+            if (!(w->fp = fdopen( fd, "wb" )))
+                close( fd );
+    }
+#endif
+
+    // (the real header is written once we know what's in it)
+
+    memset( &hdr, 0, sizeof( hdr ));
+
+    if (!w->fp || fwrite( &hdr, sizeof( hdr ), 1, w->fp ) != 1)
+    {
+        if (w->fp)
+            fclose( w->fp );
+        free( w );
+        return NULL;
+    }
+
+    return w;
+}
+
+//---------------------------------------------------------------------
+//                          totp_store_seal
+//---------------------------------------------------------------------
+
+TOTP_API int totp_store_seal( totp_store_writer* w, const char* pass, size_t len )
+{
+    if (w->count || (w->flags & TOTP_STORE_SEALED))
+        return TOTP_EINVAL;         // (only before the first add)
+
+    if (0
+        || w->failed
+        || !(w->key = (uint8_t*) malloc( TOTP_AEAD_KEY ))
+        || !totp_random( w->seal.salt, sizeof( w->seal.salt ))
+    )
+        return w->failed = true, TOTP_EIO;
+
+    w->seal.rounds = KDF_ROUNDS;
+    totp_pbkdf2( pass, len, w->seal.salt, sizeof( w->seal.salt ), w->seal.rounds, w->key, TOTP_AEAD_KEY );
+
+    w->flags |= TOTP_STORE_SEALED;
+
+    // (the real store_seal is written along with the real header)
+
+    if (fwrite( &w->seal, sizeof( w->seal ), 1, w->fp ) != 1)
+        return w->failed = true, TOTP_EIO;
+
+    return TOTP_OK;
+}
+
+//---------------------------------------------------------------------
+//                          totp_store_add
+//---------------------------------------------------------------------
+
+TOTP_API int totp_store_add( totp_store_writer* w, const totp_secret* s )
+{
+    plain_rec    plain;
+    sealed_rec   sealed;
+    totp_secret  tmp;
+    const char*  name;
+    size_t       len;
+    uint8_t      nonce[ TOTP_AEAD_NONCE ];
+
+    if (w->failed || w->count >= MAX_RECORDS)
+        return w->failed = true, TOTP_EIO;
+
+    // Save the label...
+
+    if (w->labels_len + s->label_len > w->labels_size)
+    {
+        size_t  size = (w->labels_len + s->label_len) * 2;
+        char*   labels;
+
+        if (size < 64*1024)
+            size = 64*1024;
+
+        if (!(labels = (char*) realloc( w->labels, size )))
+            return w->failed = true, TOTP_EIO;
+
+        w->labels      = labels;
+        w->labels_size = size;
+    }
+
+    if (w->count >= w->maxhashes)
+    {
+        size_t     max = w->maxhashes ? w->maxhashes * 2 : 4096;
+        uint32_t*  hashes;
+
+        if (!(hashes = (uint32_t*) realloc( w->hashes, max * sizeof( uint32_t ))))
+            return w->failed = true, TOTP_EIO;
+
+        w->hashes    = hashes;
+        w->maxhashes = max;
+    }
+
+    memset( &plain, 0, sizeof( plain ));
+
+    plain.rec.label_off = w->labels_len;
+    plain.rec.label_len = (uint32_t) s->label_len;
+
+    if (s->label_len)
+        memcpy( w->labels + w->labels_len, s->label, s->label_len );
+
+    w->labels_len += s->label_len;
+
+    name = s->label, len = s->label_len;
+    totp_name( &name, &len );
+    w->hashes[ w->count ] = totp_name_hash( name, len );
+
+    // Then the secret itself...
+
+    plain.rec.interval = s->interval;
+    plain.rec.offset   = s->offset;
+    plain.rec.key_len  = s->key_len;
+    plain.rec.digest   = s->digest;
+    plain.rec.digits   = s->digits;
+    plain.rec.flags    = s->flags & TOTP_F_TEST;
+
+    memcpy( plain.rec.k0, s->k0, sizeof( plain.rec.k0 ));
+
+    if (w->flags & TOTP_STORE_MIDSTATES)
+    {
+        tmp = *s;
+
+        if (!(tmp.flags & TOTP_F_MIDSTATE))
+            totp_precompute( &tmp );
+
+        memcpy( plain.mid, &tmp.mid, MID_SIZE );
+        totp_wipe( &tmp );
+    }
+
+    // (sealed: encrypted, with its label as additional data)
+
+    if (w->flags & TOTP_STORE_SEALED)
+    {
+        memset( &sealed, 0, sizeof( sealed ));
+        sealed.label_off = plain.rec.label_off;
+        sealed.label_len = plain.rec.label_len;
+
+        rec_nonce( w->count, nonce );
+        totp_aead_seal( w->key, nonce, s->label, s->label_len,
+                        (uint8_t*) &plain, plain_size( w->flags ), sealed.tag );
+
+        if (fwrite( &sealed, sizeof( sealed ), 1, w->fp ) != 1)
+            w->failed = true;
+    }
+
+    if (fwrite( &plain, plain_size( w->flags ), 1, w->fp ) != 1)
+        w->failed = true;
+
+    totp_cleanse( &plain, sizeof( plain ));
+
+    if (w->failed)
+        return TOTP_EIO;
+
+    w->count++;
+    return TOTP_OK;
+}
+
+//---------------------------------------------------------------------
+//                        totp_store_finish
+//---------------------------------------------------------------------
+
+TOTP_API int totp_store_finish( totp_store_writer* w )
+{
+    store_hdr    hdr;
+    store_slot*  index;
+    uint64_t     slots, i, j;
+
+    // Build the name index: an open addressing hash table which is
+    // never more than half full, so lookups are nearly always one or
+    // two probes...
+
+    for (slots=16; slots < w->count * 2; slots <<= 1)
+        ;
+
+    if (!(index = (store_slot*) calloc( (size_t) slots, sizeof( store_slot ))))
+        w->failed = true;
+
+    for (i=0; index && i < w->count; i++)
+    {
+        for (j = w->hashes[i] & (slots - 1); index[j].rec; j = (j + 1) & (slots - 1))
+            ;
+
+        index[j].hash = w->hashes[i];
+        index[j].rec  = (uint32_t) (i + 1);
+    }
+
+    memset( &hdr, 0, sizeof( hdr ));
+    memcpy( hdr.magic, STORE_MAGIC, sizeof( hdr.magic ));
+
+    hdr.version    = STORE_VERSION;
+    hdr.bom        = STORE_BOM;
+    hdr.flags      = w->flags;
+    hdr.rec_size   = (uint32_t) rec_size( w->flags );
+    hdr.count      = w->count;
+    hdr.slots      = slots;
+    hdr.index_off  = recs_off( w->flags ) + w->count * hdr.rec_size;
+    hdr.labels_off = hdr.index_off + slots * sizeof( store_slot );
+    hdr.labels_len = w->labels_len;
+
+    if (0
+        || w->failed
+        || fwrite( index, sizeof( store_slot ), (size_t) slots, w->fp ) != slots
+        || (w->labels_len && fwrite( w->labels, 1, w->labels_len, w->fp ) != w->labels_len)
+        || fseek( w->fp, 0, SEEK_SET ) != 0
+        || fwrite( &hdr, sizeof( hdr ), 1, w->fp ) != 1
+    )
+        w->failed = true;
+
+    if (!w->failed && (w->flags & TOTP_STORE_SEALED))
+    {
+        headers  aad;
+        uint8_t  nonce[ TOTP_AEAD_NONCE ], none[1];
+
+        check_nonce( &hdr, &w->seal, nonce, &aad );
+        totp_aead_seal( w->key, nonce, &aad, sizeof( aad ), none, 0, w->seal.check );
+
+        if (fwrite( &w->seal, sizeof( w->seal ), 1, w->fp ) != 1)
+            w->failed = true;
+    }
+
+    if (fclose( w->fp ) != 0)
+        w->failed = true;
+
+    i = w->failed;
+
+    if (w->key)
+        totp_cleanse( w->key, TOTP_AEAD_KEY );
+
+    free( index );
+    free( w->hashes );
+    free( w->labels );
+    free( w->key );
+    free( w );
+
+    return i ? TOTP_EIO : TOTP_OK;
+}
+
+//---------------------------------------------------------------------
+//                            totp_store
+//---------------------------------------------------------------------
+
+struct totp_store
+{
+    const uint8_t*     base;        // (mapped file)
+    size_t             size;        // (size of file)
+
+    const store_hdr*   hdr;         // (its header)
+    const uint8_t*     recs;        // (its records)
+    const store_slot*  index;       // (its name index)
+    const char*        labels;      // (its labels)
+    const store_seal*  seal;        // (if sealed)
+
+    uint8_t*           cache;       // (sealed: key, states, records)
+    size_t             cache_size;  // (size of cache)
+
+#ifdef _WIN32
+    HANDLE             hFile;       // (store file)
+    HANDLE             hMap;        // (file mapping object)
+#endif
+};
+
+//---------------------------------------------------------------------
+//                         totp_store_open
+//---------------------------------------------------------------------
+
+TOTP_API totp_store* totp_store_open( const char* path )
+{
+    totp_store*       st;
+    const store_hdr*  hdr;
+
+    if (!(st = (totp_store*) calloc( 1, sizeof( *st ))))
+        return NULL;
+
+#ifdef _WIN32
+    {
+        LARGE_INTEGER  size;
+
+        st->hFile = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                 OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+        if (0
+            || st->hFile == INVALID_HANDLE_VALUE
+            || !GetFileSizeEx( st->hFile, &size )
+            || !(st->hMap = CreateFileMappingA( st->hFile, NULL, PAGE_READONLY, 0, 0, NULL ))
+            || !(st->base = (const uint8_t*) MapViewOfFile( st->hMap, FILE_MAP_READ, 0, 0, 0 ))
+        )
+        {
+            totp_store_close( st );
+            errno = EIO;
+            return NULL;
+        }
+
+        st->size = (size_t) size.QuadPart;
+    }
+#else
+    {
+        struct stat  sb;
+        int          fd;
+        void*        p = MAP_FAILED;
+
+        if ((fd = open( path, O_RDONLY )) >= 0)
+        {
+            if (fstat( fd, &sb ) == 0)
+            {
+                if (sb.st_size >= (off_t) sizeof( store_hdr ))
+                    p = mmap( NULL, (size_t) sb.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+                else
+                    errno = EINVAL;
+            }
+
+            close( fd );
+        }
+
+        if (p == MAP_FAILED)
+        {
+            free( st );
+            return NULL;
+        }
+
+        st->base = (const uint8_t*) p;
+        st->size = (size_t) sb.st_size;
+    }
+#endif
+
+    if (st->size < sizeof( store_hdr ))
+    {
+        totp_store_close( st );
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Make sure it's a store we understand (this is the ONLY thing we
+    // check when opening it: each record is checked as it's used)...
+
+    hdr = (const store_hdr*) st->base;
+
+    if (0
+        || memcmp( hdr->magic, STORE_MAGIC, sizeof( hdr->magic )) != 0
+        || hdr->version    != STORE_VERSION
+        || hdr->bom        != STORE_BOM
+        || hdr->rec_size   != rec_size( hdr->flags )
+        || hdr->count      >  MAX_RECORDS
+        || hdr->slots      <= hdr->count
+        || (hdr->slots & (hdr->slots - 1)) != 0
+        || hdr->slots      >  st->size / sizeof( store_slot )
+        || hdr->index_off  != recs_off( hdr->flags ) + hdr->count * hdr->rec_size
+        || hdr->labels_off != hdr->index_off + hdr->slots * sizeof( store_slot )
+        || hdr->labels_off >  st->size
+        || hdr->labels_len >  st->size - hdr->labels_off
+    )
+    {
+        totp_store_close( st );
+        errno = EINVAL;
+        return NULL;
+    }
+
+    st->hdr    = hdr;
+    st->recs   = st->base + recs_off( hdr->flags );
+    st->index  = (const store_slot*) (st->base + hdr->index_off);
+    st->labels = (const char*)       (st->base + hdr->labels_off);
+
+    if (hdr->flags & TOTP_STORE_SEALED)
+        st->seal = (const store_seal*) (st->base + sizeof( store_hdr ));
+
+    return st;
+}
+
+//---------------------------------------------------------------------
+//                          Record cache
+//---------------------------------------------------------------------
+//
+//  A sealed store's key, and its decrypted records, are kept in one
+//  big anonymous mapping: the key (in its own locked cache line), a
+//  state byte for each record, and then each record's slot. Only the
+//  pages which are actually used ever take up any memory, and record
+//  pages are locked as their records are decrypted into them.
+//
+//  A record is decrypted by whichever thread first needs it, which
+//  then claims its slot (EMPTY to BUSY), fills it in, and publishes
+//  it (READY). Any other thread which needs it meanwhile decrypts its
+//  own copy, rather than waiting.
+//
+//---------------------------------------------------------------------
+
+#define REC_EMPTY       0
+#define REC_BUSY        1
+#define REC_READY       2
+
+#define CACHE_LINE      64
+
+#if defined( _MSC_VER )
+  #define cas8( p, old, val )       (_InterlockedCompareExchange8( (volatile char*) (p), \
+                                        (char) (val), (char) (old) ) == (char) (old))
+  #define load_acquire( p )         (*(p))          // (volatile: acquire)
+  #define store_release( p, v )     (*(p) = (v))    // (volatile: release)
+#else
+  #define cas8( p, old, val )       __sync_bool_compare_and_swap( (p), (old), (val) )
+  #define load_acquire( p )         __atomic_load_n( (p), __ATOMIC_ACQUIRE )
+  #define store_release( p, v )     __atomic_store_n( (p), (v), __ATOMIC_RELEASE )
+#endif
+
+static size_t states_size( const totp_store* st )
+{
+    return ((size_t) st->hdr->count + CACHE_LINE - 1) & ~(size_t) (CACHE_LINE - 1);
+}
+
+static volatile uint8_t* rec_state( const totp_store* st, size_t i )
+{
+    return (volatile uint8_t*) (st->cache + CACHE_LINE + i);
+}
+
+static plain_rec* cached_rec( const totp_store* st, size_t i )
+{
+    return (plain_rec*) (st->cache + CACHE_LINE + states_size( st ) + i * plain_size( st->hdr->flags ));
+}
+
+static void lock_pages( void* p, size_t len )   // (best effort)
+{
+#ifdef _WIN32
+    VirtualLock( p, len );
+#else
+    uintptr_t  page = (uintptr_t) sysconf( _SC_PAGESIZE );
+    uintptr_t  from = (uintptr_t) p & ~(page - 1);
+
+    mlock( (void*) from, ((uintptr_t) p + len) - from );
+#endif
+}
+
+static uint8_t* cache_alloc( size_t size )
+{
+#ifdef _WIN32
+    return (uint8_t*) VirtualAlloc( NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+#else
+    void*  p = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+    if (p == MAP_FAILED)
+        return NULL;
+  #ifdef MADV_DONTDUMP
+    madvise( p, size, MADV_DONTDUMP );
+  #endif
+    return (uint8_t*) p;
+#endif
+}
+
+static void cache_free( totp_store* st )
+{
+    size_t  i;
+
+    if (!st->cache)
+        return;
+
+    totp_cleanse( st->cache, CACHE_LINE );
+
+    for (i=0; i < st->hdr->count; i++)
+        if (*rec_state( st, i ) == REC_READY)
+            totp_cleanse( cached_rec( st, i ), plain_size( st->hdr->flags ));
+
+#ifdef _WIN32
+    VirtualFree( st->cache, 0, MEM_RELEASE );
+#else
+    munmap( st->cache, st->cache_size );
+#endif
+
+    st->cache = NULL;
+}
+
+//---------------------------------------------------------------------
+//                         totp_store_unlock
+//---------------------------------------------------------------------
+
+TOTP_API int totp_store_unlock( totp_store* st, const char* pass, size_t len )
+{
+    uint8_t  key[ TOTP_AEAD_KEY ];
+    uint8_t  nonce[ TOTP_AEAD_NONCE ], none[1];
+    headers  aad;
+
+    if (!st->seal || st->cache)
+        return TOTP_OK;             // (nothing to unlock)
+
+    if (st->seal->rounds == 0 || st->seal->rounds > KDF_MAX_ROUNDS)
+        return TOTP_EINVAL;
+
+    totp_pbkdf2( pass, len, st->seal->salt, sizeof( st->seal->salt ), st->seal->rounds, key, sizeof( key ));
+    check_nonce( st->hdr, st->seal, nonce, &aad );
+
+    if (!totp_aead_open( key, nonce, &aad, sizeof( aad ), none, 0, st->seal->check ))
+    {
+        totp_cleanse( key, sizeof( key ));
+        return TOTP_EINVAL;         // (wrong passphrase, or tampered with)
+    }
+
+    st->cache_size = CACHE_LINE + states_size( st ) + (size_t) st->hdr->count * plain_size( st->hdr->flags );
+
+    if (!(st->cache = cache_alloc( st->cache_size )))
+    {
+        totp_cleanse( key, sizeof( key ));
+        return TOTP_EIO;
+    }
+
+    memcpy( st->cache, key, sizeof( key ));
+    lock_pages( st->cache, CACHE_LINE );
+    totp_cleanse( key, sizeof( key ));
+
+    return TOTP_OK;
+}
+
+TOTP_API int totp_store_locked( const totp_store* st )
+{
+    return st->seal && !st->cache;
+}
+
+//---------------------------------------------------------------------
+//                         totp_store_close
+//---------------------------------------------------------------------
+
+TOTP_API void totp_store_close( totp_store* st )
+{
+    if (!st)
+        return;
+
+    cache_free( st );
+
+#ifdef _WIN32
+    if (st->base)
+        UnmapViewOfFile( st->base );
+    if (st->hMap)
+        CloseHandle( st->hMap );
+    if (st->hFile && st->hFile != INVALID_HANDLE_VALUE)
+        CloseHandle( st->hFile );
+#else
+    if (st->base)
+        munmap( (void*) st->base, st->size );
+#endif
+
+    free( st );
+}
+
+//---------------------------------------------------------------------
+//                         totp_store_count
+//---------------------------------------------------------------------
+
+TOTP_API size_t totp_store_count( const totp_store* st )
+{
+    return (size_t) st->hdr->count;
+}
+
+//---------------------------------------------------------------------
+//                          totp_store_get
+//---------------------------------------------------------------------
+
+// Where record i's label is (false if it isn't within the labels)...
+
+static bool rec_label( const totp_store* st, size_t i, const char** label, size_t* len )
+{
+    const uint8_t*  p = st->recs + i * st->hdr->rec_size;
+    uint64_t        off;
+    uint32_t        n;
+
+    if (st->seal)
+        off = ((const sealed_rec*) p)->label_off, n = ((const sealed_rec*) p)->label_len;
+    else
+        off = ((const store_rec*)  p)->label_off, n = ((const store_rec*)  p)->label_len;
+
+    if (off > st->hdr->labels_len || n > st->hdr->labels_len - off)
+        return false;
+
+    *label = st->labels + off;
+    *len   = n;
+
+    return true;
+}
+
+// The secret from a (plain) record, followed by its midstates...
+
+static int secret_from( const totp_store* st, const store_rec* rec, totp_secret* s )
+{
+    if (0
+        || rec->digest    >= TOTP_NUM_DIGESTS
+        || rec->digits    <  TOTP_MIN_DIGITS
+        || rec->digits    >  TOTP_MAX_DIGITS
+        || rec->interval  == 0
+        || rec->label_off >  st->hdr->labels_len
+        || rec->label_len >  st->hdr->labels_len - rec->label_off
+    )
+        return TOTP_EINVAL;
+
+    s->md        = &totp_mds[ rec->digest ];
+    s->label     = st->labels + rec->label_off;
+    s->label_len = rec->label_len;
+    s->offset    = rec->offset;
+    s->interval  = rec->interval;
+    s->key_len   = rec->key_len;
+    s->digest    = rec->digest;
+    s->digits    = rec->digits;
+    s->engine    = totp_engine_for( rec->digest, rec->digits );
+    s->flags     = rec->flags & TOTP_F_TEST;
+
+    memcpy( s->k0, rec->k0, sizeof( s->k0 ));
+
+    if (st->hdr->flags & TOTP_STORE_MIDSTATES)
+    {
+        memcpy( &s->mid, rec + 1, MID_SIZE );
+        s->flags |= TOTP_F_MIDSTATE;
+    }
+
+    return TOTP_OK;
+}
+
+// Decrypt sealed record i (false if it isn't authentic)...
+
+static bool open_rec( const totp_store* st, size_t i, plain_rec* plain )
+{
+    const sealed_rec*  sealed = (const sealed_rec*) (st->recs + i * st->hdr->rec_size);
+    size_t             size   = plain_size( st->hdr->flags );
+    uint8_t            nonce[ TOTP_AEAD_NONCE ];
+    const char*        label;
+    size_t             len;
+
+    if (!rec_label( st, i, &label, &len ))
+        return false;
+
+    memcpy( plain, sealed + 1, size );
+    rec_nonce( i, nonce );
+
+    if (!totp_aead_open( st->cache, nonce, label, len, (uint8_t*) plain, size, sealed->tag ))
+        return false;
+
+    return plain->rec.label_off == sealed->label_off
+        && plain->rec.label_len == sealed->label_len;
+}
+
+TOTP_API int totp_store_get( const totp_store* st, size_t i, totp_secret* s )
+{
+    plain_rec  plain;
+    int        rc;
+
+    if (i >= st->hdr->count)
+        return TOTP_EINVAL;
+
+    if (!st->seal)
+        return secret_from( st, (const store_rec*) (st->recs + i * st->hdr->rec_size), s );
+
+    // Sealed: already decrypted? Else decrypt it, and cache it...
+
+    if (!st->cache)
+    {
+        errno = EACCES;             // (not unlocked)
+        return TOTP_EIO;
+    }
+
+    if (load_acquire( rec_state( st, i )) == REC_READY)
+        return secret_from( st, &cached_rec( st, i )->rec, s );
+
+    if (!open_rec( st, i, &plain ))
+    {
+        totp_cleanse( &plain, sizeof( plain ));
+        return TOTP_EINVAL;
+    }
+
+    if (cas8( rec_state( st, i ), REC_EMPTY, REC_BUSY ))
+    {
+        memcpy( cached_rec( st, i ), &plain, plain_size( st->hdr->flags ));
+        lock_pages( cached_rec( st, i ), plain_size( st->hdr->flags ));
+        store_release( rec_state( st, i ), REC_READY );
+    }
+
+    rc = secret_from( st, &plain.rec, s );
+    totp_cleanse( &plain, sizeof( plain ));
+
+    return rc;
+}
+
+//---------------------------------------------------------------------
+//                          totp_store_find
+//---------------------------------------------------------------------
+
+TOTP_API size_t totp_store_find( const totp_store* st, const char* name, size_t len )
+{
+    const char*  rname;
+    size_t       rlen;
+    uint64_t     mask, j, n;
+    uint32_t     h;
+
+    totp_name( &name, &len );
+
+    h    = totp_name_hash( name, len );
+    mask = st->hdr->slots - 1;
+
+    // (at most every slot once: a damaged index mightn't have a free one)
+
+    for (j = h & mask, n=0; n < st->hdr->slots && st->index[j].rec; j = (j + 1) & mask, n++)
+    {
+        if (0
+            || st->index[j].hash != h
+            || st->index[j].rec  >  st->hdr->count
+            || !rec_label( st, st->index[j].rec - 1, &rname, &rlen )
+        )
+            continue;
+
+        totp_name( &rname, &rlen );
+
+        if (rlen == len && memcmp( rname, name, len ) == 0)
+            return st->index[j].rec - 1;
+    }
+
+    return TOTP_STORE_NOTFOUND;
+}
@@ -0,0 +1,554 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+
+//------------------------------------------------------------------------------
+//                              SECRET TABLE
+//------------------------------------------------------------------------------
+//
+//  Many secrets held in memory at once (e.g. by a verification daemon),
+//  as a struct of arrays rather than an array of totp_secrets, which are
+//  over 300 bytes each, nearly all of it key material that's only needed
+//  before the HMAC midstates have been precomputed:
+//
+//    keys      Each digest's secrets' midstates (inner then outer, padded
+//              to 16 bytes: 48, 64 or 128 bytes per secret), in slots of
+//              TABLE_CHUNK at a time, each chunk cache line aligned (so a
+//              SHA-256 or SHA-512 secret's midstates never straddle a cache
+//              line). Chunks never move once allocated, so the keys are
+//              never copied (nor left behind) by the table growing.
+//
+//    headers   8 bytes per secret: its key slot, digest, DIGITS, and the
+//              number of its (INTERVAL, OFFSET, flags), which are interned,
+//              since nearly all secrets share the same few.
+//
+//    labels    One pool of all of the labels, and each one's offset into it.
+//
+//    index     By name (as for stores): an open addressing hash table of
+//              secret numbers.
+//
+//  Secrets are numbered in the order they were added, and each digest's
+//  key slots are allocated in that same order, so a loop over a range of
+//  secrets (see totp_table_generate) streams through the headers and each
+//  digest's keys sequentially. A secret is got by copying its fields back
+//  into a totp_secret (midstates only; its key itself isn't kept at all),
+//  which is all that calculating or verifying its codes needs. The table
+//  isn't changed by getting or finding secrets, so any number of threads
+//  may do so at once, once all of them have been added.
+//
+//------------------------------------------------------------------------------
+
+#define TABLE_CHUNK         4096        // (key slots per chunk)
+#define TABLE_ALIGN         64          // (chunk alignment: a cache line)
+#define TABLE_MAX_PARAMS    65536       // (most distinct parameter sets)
+#define TABLE_BATCH         64          // (secrets got at a time by generate)
+
+struct table_hdr                    // (one per secret)
+{
+    uint32_t        slot;           // (its key slot in its digest's chunks)
+    uint8_t         digest;         // (totp_digest)
+    uint8_t         digits;         // (DIGITS)
+    uint16_t        params;         // (its table_params number)
+};
+
+struct table_params                 // (interned: shared by many secrets)
+{
+    uint64_t        interval;       // (INTERVAL)
+    int64_t         offset;         // (OFFSET, or exact time if TEST)
+    uint8_t         flags;          // (TOTP_F_TEST)
+};
+
+struct table_keys                   // (one digest's secrets' midstates)
+{
+    uint8_t**       chunks;         // (each TABLE_CHUNK slots, aligned)
+    size_t          nchunks;        // (number of chunks)
+    size_t          max_chunks;     // (size of chunks array)
+    size_t          count;          // (number of slots used)
+    size_t          slot_size;      // (bytes per slot)
+};
+
+struct totp_table
+{
+    table_hdr*      hdrs;           // (each secret's header)
+    uint32_t*       label_at;       // (where each secret's label ends)
+    size_t          count;          // (number of secrets)
+    size_t          max;            // (room in hdrs and label_at)
+
+    char*           labels;         // (label pool)
+    size_t          labels_size;    // (size of label pool)
+
+    table_params*   params;         // (distinct parameter sets)
+    size_t          nparams;        // (number of them)
+    size_t          max_params;     // (room in params)
+
+    uint32_t*       index;          // (by name: secret number + 1, or 0)
+    size_t          mask;           // (size of index - 1)
+
+    table_keys      keys[ TOTP_NUM_DIGESTS ];
+};
+
+//---------------------------------------------------------------------
+//                          Helpers
+//---------------------------------------------------------------------
+
+static uint8_t* chunk_alloc( size_t size )
+{
+#ifdef _WIN32
+    return (uint8_t*) _aligned_malloc( size, TABLE_ALIGN );
+#else
+    void*  p;
+    return posix_memalign( &p, TABLE_ALIGN, size ) == 0 ? (uint8_t*) p : NULL;
+#endif
+}
+
+static void chunk_free( uint8_t* p, size_t size )
+{
+    totp_cleanse( p, size );
+#ifdef _WIN32
+    _aligned_free( p );
+#else
+    free( p );
+#endif
+}
+
+static inline uint8_t* key_slot( const table_keys* k, size_t slot )
+{
+    return k->chunks[ slot / TABLE_CHUNK ] + (slot % TABLE_CHUNK) * k->slot_size;
+}
+
+static inline void* mid_state( totp_secret* s, int which )
+{
+    if (s->md->word_size == 4)
+        return s->mid.w32[ which ];
+    return s->mid.w64[ which ];
+}
+
+static void label_of( const totp_table* t, size_t i, const char** label, size_t* len )
+{
+    uint32_t  at = i ? t->label_at[ i-1 ] : 0;
+
+    *label = t->labels + at;
+    *len   = t->label_at[i] - at;
+}
+
+// Grow an array (if need be) to hold at least 'n' elements (exactly
+// 'n' to begin with, so that a table created with the right 'expected'
+// has no room to spare)...
+
+static bool grow( void** p, size_t* max, size_t n, size_t size )
+{
+    size_t  m = *max ? *max : n > 64 ? n : 64;
+    void*   q;
+
+    if (n <= *max)
+        return true;
+
+    while (m < n)
+        m *= 2;
+
+    if (!(q = realloc( *p, m * size )))
+        return false;
+
+    *p   = q;
+    *max = m;
+    return true;
+}
+
+// Make room for at least 'n' secrets' headers and label offsets...
+
+static bool reserve( totp_table* t, size_t n )
+{
+    size_t  max = t->max;
+
+    if (n <= max)
+        return true;
+
+    if (!grow( (void**) &t->hdrs, &max, n, sizeof( table_hdr )))
+        return false;
+
+    max = t->max;
+
+    if (!grow( (void**) &t->label_at, &max, n, sizeof( uint32_t )))
+        return false;
+
+    t->max = max;
+    return true;
+}
+
+// The number of the secret's (INTERVAL, OFFSET, flags), adding them if
+// they're new (searched from the most recently added, which is nearly
+// always the one, since input files tend to be runs of similar secrets)...
+
+static int intern_params( totp_table* t, const totp_secret* s )
+{
+    table_params*  p;
+    size_t         i;
+
+    for (i = t->nparams; i--;)
+    {
+        p = &t->params[i];
+
+        if (p->interval == s->interval && p->offset == s->offset && p->flags == (s->flags & TOTP_F_TEST))
+            return (int) i;
+    }
+
+    if (t->nparams >= TABLE_MAX_PARAMS || !grow( (void**) &t->params, &t->max_params, t->nparams + 1, sizeof( table_params )))
+        return -1;
+
+    p = &t->params[ t->nparams ];
+
+    p->interval = s->interval;
+    p->offset   = s->offset;
+    p->flags    = s->flags & TOTP_F_TEST;
+
+    return (int) t->nparams++;
+}
+
+// Index secret 'i' by name (returns false if there's one already)...
+
+static bool index_add( totp_table* t, size_t i )
+{
+    const char*  name;
+    const char*  n;
+    size_t       len, l, h;
+    uint32_t     x;
+
+    label_of( t, i, &name, &len );
+    totp_name( &name, &len );
+
+    for (h = totp_name_hash( name, len ) & t->mask; (x = t->index[h]) != 0; h = (h + 1) & t->mask)
+    {
+        label_of( t, x - 1, &n, &l );
+        totp_name( &n, &l );
+
+        if (l == len && memcmp( n, name, len ) == 0)
+            return false;
+    }
+
+    t->index[h] = (uint32_t) (i + 1);
+    return true;
+}
+
+// Keep the index at most 3/4 full, rebuilding it twice as large...
+
+static bool index_grow( totp_table* t, size_t n )
+{
+    uint32_t*  old = t->index;
+    size_t     size, i;
+
+    if (t->index && 4 * n <= 3 * (t->mask + 1))
+        return true;
+
+    for (size = 1024; 3 * size < 4 * n; size <<= 1)
+        ;
+
+    if (!(t->index = (uint32_t*) calloc( size, sizeof( uint32_t ))))
+    {
+        t->index = old;
+        return false;
+    }
+
+    t->mask = size - 1;
+
+    for (i=0; i < t->count; i++)
+        index_add( t, i );
+
+    free( old );
+    return true;
+}
+
+//---------------------------------------------------------------------
+//                          totp_table_create
+//---------------------------------------------------------------------
+
+TOTP_API totp_table* totp_table_create( size_t expected )
+{
+    totp_table*  t;
+    int          d;
+
+    if (!(t = (totp_table*) calloc( 1, sizeof( totp_table ))))
+        return NULL;
+
+    for (d=0; d < TOTP_NUM_DIGESTS; d++)
+        t->keys[d].slot_size = (2 * totp_mds[d].hash_size + 15) & ~(size_t) 15;
+
+    if (!reserve( t, expected ) || !index_grow( t, expected ))
+    {
+        totp_table_destroy( t );
+        return NULL;
+    }
+
+    return t;
+}
+
+//---------------------------------------------------------------------
+//                          totp_table_add
+//---------------------------------------------------------------------
+
+TOTP_API int totp_table_add( totp_table* t, const totp_secret* s )
+{
+    table_keys*   k = &t->keys[ s->digest ];
+    table_hdr*    h;
+    totp_secret   tmp;
+    uint8_t*      slot;
+    size_t        used;
+    int           params;
+
+    used = t->count ? t->label_at[ t->count - 1 ] : 0;
+
+    if ((uint64_t) used + s->label_len > UINT32_MAX || t->count >= UINT32_MAX - 1
+        || (params = intern_params( t, s )) < 0)
+    {
+        errno = E2BIG;
+        return TOTP_EINVAL;
+    }
+
+    // (make room for it everywhere first, so nothing need be undone)
+
+    if (0
+        || !reserve( t, t->count + 1 )
+        || !grow( (void**) &t->labels, &t->labels_size, used + s->label_len, 1 )
+        || !index_grow( t, t->count + 1 )
+        || !grow( (void**) &k->chunks, &k->max_chunks, k->count / TABLE_CHUNK + 1, sizeof( uint8_t* ))
+    )
+    {
+        errno = ENOMEM;
+        return TOTP_EIO;
+    }
+
+    if (k->count == k->nchunks * TABLE_CHUNK)
+    {
+        if (!(k->chunks[ k->nchunks ] = chunk_alloc( TABLE_CHUNK * k->slot_size )))
+        {
+            errno = ENOMEM;
+            return TOTP_EIO;
+        }
+        k->nchunks++;
+    }
+
+    if (s->label_len)
+        memcpy( t->labels + used, s->label, s->label_len );
+    t->label_at[ t->count ] = (uint32_t) (used + s->label_len);
+
+    if (!index_add( t, t->count ))
+        return TOTP_SKIP;           // (a secret by that name already)
+
+    // (its midstates: those it has, or else calculated now)
+
+    tmp = *s;
+
+    if (!(tmp.flags & TOTP_F_MIDSTATE))
+        totp_precompute( &tmp );
+
+    slot = key_slot( k, k->count );
+
+    memcpy( slot,                    mid_state( &tmp, 0 ), tmp.md->hash_size );
+    memcpy( slot + tmp.md->hash_size, mid_state( &tmp, 1 ), tmp.md->hash_size );
+
+    totp_wipe( &tmp );
+
+    h = &t->hdrs[ t->count++ ];
+
+    h->slot   = (uint32_t) k->count++;
+    h->digest = s->digest;
+    h->digits = s->digits;
+    h->params = (uint16_t) params;
+
+    return TOTP_OK;
+}
+
+//---------------------------------------------------------------------
+//                          totp_table_trim
+//---------------------------------------------------------------------
+//
+//  Once all of the secrets have been added: give back the room left
+//  for more (up to half of the headers and labels, as they're doubled
+//  whenever they fill up). More may still be added afterwards.
+//
+//---------------------------------------------------------------------
+
+static void trim( void** p, size_t* max, size_t n, size_t size )
+{
+    void*  q;
+
+    if (n && n < *max && (q = realloc( *p, n * size )))
+    {
+        *p   = q;
+        *max = n;
+    }
+}
+
+TOTP_API void totp_table_trim( totp_table* t )
+{
+    size_t  max = t->max;
+
+    trim( (void**) &t->hdrs, &max, t->count, sizeof( table_hdr ));
+
+    if (max == t->count)
+        trim( (void**) &t->label_at, &t->max, t->count, sizeof( uint32_t ));
+
+    trim( (void**) &t->labels, &t->labels_size, t->count ? t->label_at[ t->count - 1 ] : 0, 1 );
+    trim( (void**) &t->params, &t->max_params, t->nparams, sizeof( table_params ));
+}
+
+//---------------------------------------------------------------------
+//                    totp_table_count, get and find
+//---------------------------------------------------------------------
+
+TOTP_API size_t totp_table_count( const totp_table* t )
+{
+    return t->count;
+}
+
+TOTP_API int totp_table_get( const totp_table* t, size_t i, totp_secret* s )
+{
+    const table_hdr*     h;
+    const table_params*  p;
+    const uint8_t*       slot;
+
+    if (i >= t->count)
+        return TOTP_EINVAL;
+
+    h    = &t->hdrs[i];
+    p    = &t->params[ h->params ];
+    slot = key_slot( &t->keys[ h->digest ], h->slot );
+
+    memset( s, 0, sizeof( *s ));
+
+    s->md       = &totp_mds[ h->digest ];
+    s->engine   = totp_engine_for( h->digest, h->digits );
+    s->digest   = h->digest;
+    s->digits   = h->digits;
+    s->interval = p->interval;
+    s->offset   = p->offset;
+    s->flags    = p->flags | TOTP_F_MIDSTATE;
+
+    label_of( t, i, &s->label, &s->label_len );
+
+    memcpy( mid_state( s, 0 ), slot,                    s->md->hash_size );
+    memcpy( mid_state( s, 1 ), slot + s->md->hash_size, s->md->hash_size );
+
+    return TOTP_OK;
+}
+
+TOTP_API size_t totp_table_find( const totp_table* t, const char* name, size_t len )
+{
+    const char*  n;
+    size_t       l, h;
+    uint32_t     x;
+
+    for (h = totp_name_hash( name, len ) & t->mask; (x = t->index[h]) != 0; h = (h + 1) & t->mask)
+    {
+        label_of( t, x - 1, &n, &l );
+        totp_name( &n, &l );
+
+        if (l == len && memcmp( n, name, len ) == 0)
+            return x - 1;
+    }
+
+    return TOTP_TABLE_NOTFOUND;
+}
+
+//---------------------------------------------------------------------
+//                        totp_table_generate
+//---------------------------------------------------------------------
+//
+//  The codes at 'at_time' of secrets which[0..n-1] (or if 'which' is
+//  NULL, of secrets 0 to n-1), TABLE_BATCH secrets at a time, each
+//  group being got into a small array of totp_secrets (which stays in
+//  the L1 cache) and then calculated together by the multi-buffer
+//  kernels (see totp_generate_batch).
+//
+//---------------------------------------------------------------------
+
+TOTP_API void totp_table_generate( const totp_table* t, const size_t* which, size_t n,
+                                   int64_t at_time, uint32_t* codes )
+{
+    totp_secret         group[ TABLE_BATCH ];
+    const totp_secret*  ptrs[ TABLE_BATCH ];
+    size_t              i, m, first = 0;
+
+    for (i=0; i < TABLE_BATCH; i++)
+        ptrs[i] = &group[i];
+
+    for (; n; n -= m, first += m, codes += m)
+    {
+        m = n < TABLE_BATCH ? n : TABLE_BATCH;
+
+        for (i=0; i < m; i++)
+            totp_table_get( t, which ? which[ first + i ] : first + i, &group[i] );
+
+        totp_generate_batch( ptrs, at_time, codes, m );
+    }
+
+    totp_cleanse( group, sizeof( group ));
+}
+
+//---------------------------------------------------------------------
+//                         totp_table_memory
+//---------------------------------------------------------------------
+
+TOTP_API void totp_table_memory( const totp_table* t, totp_table_mem* mem )
+{
+    int  d;
+
+    mem->count   = t->count;
+    mem->keys    = 0;
+    mem->headers = t->max * sizeof( table_hdr ) + t->max_params * sizeof( table_params );
+    mem->labels  = t->max * sizeof( uint32_t ) + t->labels_size;
+    mem->index   = (t->mask + 1) * sizeof( uint32_t );
+
+    for (d=0; d < TOTP_NUM_DIGESTS; d++)
+        mem->keys += t->keys[d].nchunks * TABLE_CHUNK * t->keys[d].slot_size
+                   + t->keys[d].max_chunks * sizeof( uint8_t* );
+
+    mem->total = sizeof( *t ) + mem->keys + mem->headers + mem->labels + mem->index;
+}
+
+//---------------------------------------------------------------------
+//                         totp_table_destroy
+//---------------------------------------------------------------------
+
+TOTP_API void totp_table_destroy( totp_table* t )
+{
+    size_t  i;
+    int     d;
+
+    if (!t)
+        return;
+
+    for (d=0; d < TOTP_NUM_DIGESTS; d++)
+    {
+        for (i=0; i < t->keys[d].nchunks; i++)
+            chunk_free( t->keys[d].chunks[i], TABLE_CHUNK * t->keys[d].slot_size );
+
+        free( t->keys[d].chunks );
+    }
+
+    free( t->hdrs );
+    free( t->label_at );
+    free( t->labels );
+    free( t->params );
+    free( t->index );
+    free( t );
+}
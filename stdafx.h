@@ -6,20 +6,51 @@
 
 #pragma once
 
+#define OPENSSL_SUPPRESS_DEPRECATED // (we use the low-level SHA API)
+
+#ifdef _WIN32
+
 #define _CRT_SECURE_NO_WARNINGS     // (allow strerror w/o complaint)
 #include <windows.h>                // (need SetConsoleMode)
 
-#include <openssl/evp.h>            // OpenSSL EVP_MD struct
-#include <openssl/hmac.h>           // OpenSSL HMAC function
-
 typedef __int64 ssize_t;            // (missing from Windows)
 
 //efine strtoul      strtoul        // (already exists)
 #define strtoull    _strtoui64      // (Windows's name)
 #define strtoll     _strtoi64       // (Windows's name)
 #define strncasecmp _strnicmp       // (Windows's name)
+#define strcasecmp  _stricmp        // (Windows's name)
 #define time        _time64         // (want 64-bit time)
 
+#else // (POSIX)
+
+#include <unistd.h>                 // (need isatty)
+#include <strings.h>                // (need strncasecmp)
+#include <termios.h>                // (need tcsetattr)
+#include <pthread.h>                // (need pthread_create)
+#include <sched.h>                  // (need sched_yield)
+#include <fcntl.h>                  // (need open)
+#include <sys/mman.h>               // (need mmap)
+#include <sys/stat.h>               // (need fstat)
+
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef TOTP_BUILTIN_SHA            // (else we don't need OpenSSL)
+#include <openssl/evp.h>            // OpenSSL EVP_MD struct
+#include <openssl/hmac.h>           // OpenSSL HMAC function
+#include <openssl/sha.h>            // OpenSSL low-level SHA functions
+#endif
+
 // Add any additional #include headers or #define constants here...
 
-#include "Version.h"	            // our version #defines
+#include "version.h"                // our version #defines
@@ -20,19 +20,21 @@
 // IN THE SOFTWARE.
 
 #include "stdafx.h"
+#include "libtotp.h"
 
 //------------------------------------------------------------------------------
 //                                 TOTP
 //------------------------------------------------------------------------------
 //
 //  The only input is the "shared secret" line, which is read from stdin
-//  (i.e. either from the keyboard or from a file redirected to stdin).
+//  (i.e. either from the keyboard or from a file redirected to stdin),
+//  or from the file named by the --input option.
 //
-//  Note: this program is purposely written to NOT obtain any of its runtime
-//  options via command-line arguments, since: 1) each option pertains to
-//  the specific shared secret and its resulting calculated totp code, and
-//  2) the logic to parse the command line options would only unnecessarily
-//  complicate the logic for what should be a very simple program.
+//  Note: this program is purposely written to NOT obtain any of its secret
+//  related options via command-line arguments, since each option pertains
+//  to the specific shared secret and its resulting calculated totp code.
+//  The only command-line options are those which control HOW the input is
+//  processed (e.g. bulk processing of very large files); see usage() below.
 //
 //  The format of the "shared secret" input line is as follows:
 //
@@ -63,7 +65,8 @@
 //                converted to uppercase.
 //
 //   DIGITS       Is the number of decimal output digits and can be 6, 7,
-//                or 8. It defaults to the Google Authenticator value of 6.
+//                8, 9 or 10. It defaults to the Google Authenticator value
+//                of 6.
 //
 //   INTERVAL,
 //   OFFSET       Are the counter interval in seconds and the (signed) Unix
@@ -77,9 +80,9 @@
 //
 //   COMMENT...   Any trailing comment MUST start with a non-base32 character!
 //
-//  There are no command line options. The only required input is your secret,
-//  always from stdin. You can either paste it directly into the program, or
-//  redirect it from a file.
+//  There are no secret related command line options. The only required input
+//  is your secret, always from stdin. You can either paste it directly into
+//  the program, or redirect it from a file.
 //
 //  If you choose to paste it, don't forget to press the enter key afterwards.
 //  The program is line oriented, so you must end each line with a newline.
@@ -92,33 +95,103 @@
 
 #define TOTP_VERSION    VERSION_STR
 
-#define SEP_CHAR        ':'         // colon
+#if defined( _WIN64 )
+  #define TOTP_PLATFORM   "x64 Windows"
+#elif defined( _WIN32 )
+  #define TOTP_PLATFORM   "x86 Windows"
+#else
+  #define TOTP_PLATFORM   "POSIX"
+#endif
 
-static const char* base32 = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+#define BATCH_LINES     4096        // (--batch lines per batch)
+#define SELFTEST_STEPS  64          // (--selftest counters per secret)
+#define MAX_THREADS     256         // (--threads maximum)
+#define CODE_MAXLEN     16          // (code, blanks and newline; w/o label)
+#define VERIFY_WINDOW   1           // (--verify: +/- time steps accepted)
+#define MAX_WINDOW      100         // (--window maximum)
+#define HOTP_WINDOW     10          // (--hotp --verify: counters looked ahead)
+#define RESYNC_WINDOW   10000       // (--resync: counters searched either side)
+#define RESYNC_CODES    4           // (--resync: most consecutive codes)
+#define RANGE_BLOCK     4096        // (--range codes calculated at a time)
+#define WATCH_MAX_SLEEP 60000       // (--watch: longest sleep in ms)
 
-#define DEF_DIGITS      6           // (default output digits) (Google Authenticator)
-#define DEF_INTERVAL    30          // (default time interval) (Google Authenticator)
-#define DEF_OFFSET      0           // (default time offset)   (Google Authenticator)
+static bool g_bStdinKeyboard = true;
 
-#define BASE32_BITS     5           // (because 2**5 = 32, Duh!)
-#define BITS_PER_BYTE   CHAR_BIT    // (there are 8 bits in a byte/char)
-#define GETLINE_CHUNK   128         // (getline function chunk size)
+static bool g_batch     = false;    // (--batch)
+static bool g_selftest  = false;    // (--selftest)
+static bool g_watch     = false;    // (--watch)
+static bool g_import    = false;    // (--import)
+static int  g_flush     = -1;       // (--flush=; -1 = not specified)
+static int  g_format    = 0;        // (--format=)
+static int  g_threads   = 0;        // (--threads N; 0 = not specified)
+static int  g_window    = VERIFY_WINDOW;    // (--window N)
 
-static bool g_bStdinKeyboard = true;
+static const char* g_input   = NULL;    // (--input FILE; NULL = stdin)
+static const char* g_compile = NULL;    // (--compile FILE)
+static const char* g_store   = NULL;    // (--store FILE)
+static const char* g_name    = NULL;    // (--name NAME)
+static const char* g_verify  = NULL;    // (--verify CODE)
+static const char* g_resync  = NULL;    // (--resync CODE[,CODE...])
+static const char* g_hotp    = NULL;    // (--hotp FILE)
+static const char* g_audit   = NULL;    // (--audit LOG)
+static const char* g_key     = NULL;    // (--key FILE)
+
+static char*   g_pass     = NULL;   // (--key passphrase; secure memory)
+static size_t  g_pass_len = 0;      // (its length)
+
+static totp_counters*  g_counters = NULL;   // (--hotp counter log)
+
+struct span                         // (--range FROM:TO or --counters)
+{
+    bool         counters;          // (counters rather than times)
+    int64_t      from, to;          // (first and last time or counter)
+    bool         from_rel, to_rel;  // (relative to now, or current counter)
+};
+
+static span  g_span;                // (--range FROM:TO or --counters)
+static bool  g_ranges = false;      // (--range or --counters specified)
 
 //---------------------------------------------------------------------
 //                      is_keyboard_stdin
 //---------------------------------------------------------------------
 
+#ifdef _WIN32
+
 static bool is_keyboard_stdin( HANDLE hStdin )
 {
     return (g_bStdinKeyboard = (GetFileType( hStdin ) == FILE_TYPE_CHAR));
 }
 
+#else // (POSIX)
+
+static bool is_keyboard_stdin( int fd )
+{
+    return (g_bStdinKeyboard = (isatty( fd ) != 0));
+}
+
+#endif
+
+static void close_counters()
+{
+    totp_counters_close( g_counters );
+    g_counters = NULL;
+}
+
+static bool is_terminal_stdout()
+{
+#ifdef _WIN32
+    return GetFileType( GetStdHandle( STD_OUTPUT_HANDLE )) == FILE_TYPE_CHAR;
+#else
+    return isatty( STDOUT_FILENO ) != 0;
+#endif
+}
+
 //---------------------------------------------------------------------
 //                      disable_stdin_echo
 //---------------------------------------------------------------------
 
+#ifdef _WIN32
+
 static bool disable_stdin_echo()
 {
     DWORD mode;
@@ -139,381 +212,4106 @@ static bool disable_stdin_echo()
     );
 }
 
+#else // (POSIX)
+
+static struct termios g_saved_termios;
+
+static void restore_stdin_echo()
+{
+    tcsetattr( STDIN_FILENO, TCSANOW, &g_saved_termios );
+}
+
+static void restore_stdin_echo_and_exit( int sig )
+{
+    restore_stdin_echo();
+    signal( sig, SIG_DFL );
+    raise( sig );
+}
+
+static bool disable_stdin_echo()
+{
+    struct termios mode;
+
+    if (!is_keyboard_stdin( STDIN_FILENO ))
+        return true; // (presume redirected)
+
+    // It's a terminal; disable echoing, being sure to
+    // restore it again when we exit (e.g. via Ctrl+C)
+
+    if (tcgetattr( STDIN_FILENO, &g_saved_termios ) != 0)
+        return false;
+
+    atexit( restore_stdin_echo );
+    signal( SIGINT,  restore_stdin_echo_and_exit );
+    signal( SIGTERM, restore_stdin_echo_and_exit );
+
+    mode = g_saved_termios;
+    mode.c_lflag &= ~ECHO;
+
+    return tcsetattr( STDIN_FILENO, TCSANOW, &mode ) == 0;
+}
+
+#endif
+
+//---------------------------------------------------------------------
+//                          Secure memory
 //---------------------------------------------------------------------
-//                         my_getline
+//
+//  Everything which ever holds a secret (the input read buffer, and
+//  --batch/--threads chunks' copies of their lines and their parsed
+//  secrets) comes from a few large page aligned blocks allocated
+//  directly from the operating system, which are locked into memory
+//  (so they're never written to the swap file) and excluded from core
+//  dumps. Locking is best effort: it may fail if we're only allowed
+//  to lock a little memory (RLIMIT_MEMLOCK), in which case the block
+//  is simply used unlocked. Blocks are zeroed when they're freed, and
+//  any which are still allocated when we exit are zeroed then too.
+//
+//  Each chunk's lines and secrets are then carved out of such a block
+//  by a simple arena, which is zeroed and reset for each chunk rather
+//  than anything being freed, so once the first chunks have been read
+//  a bulk run never allocates (nor frees) anything at all. --stats
+//  reports how many allocations were made, so this can be checked.
+//
 //---------------------------------------------------------------------
 
-static ssize_t  my_getline( char** buf, size_t* bufsiz, FILE* f )
+#define SECURE_HDR      64          // (header size; keeps blocks aligned)
+
+struct secure_hdr                   // (precedes each secure block)
 {
-    char*   bufptr;
-    char*   p;
-    size_t  size;
-    int     c;
+    secure_hdr*  next;              // (all blocks still allocated)
+    secure_hdr*  prev;
+    size_t       size;              // (total size incl. header)
+    bool         locked;            // (locked into memory)
+};
 
-    if (0
-        || !buf
-        || !bufsiz
-        || !f
-    )
-    {
-        return EOF;
-    }
+struct mem_counts                   // (--stats)
+{
+    volatile int64_t  heap;         // (heap allocations incl. reallocs)
+    volatile int64_t  secure;       // (secure blocks allocated)
+    volatile int64_t  locked;       // (bytes locked into memory)
+    volatile int64_t  unlocked;     // (bytes which couldn't be)
+};
+
+static secure_hdr*  g_secure = NULL;    // (secure blocks, main thread only)
+static mem_counts   g_mem;              // (allocation counts)
+
+#if defined( _MSC_VER )
+  #define MEM_COUNT( v, n )         _InterlockedExchangeAdd64( &(v), (n) )
+#else
+  #define MEM_COUNT( v, n )         __sync_fetch_and_add( &(v), (n) )
+#endif
+
+// Any other memory (output buffers and the like), counted...
+
+static void* mem_alloc( size_t size )
+{
+    MEM_COUNT( g_mem.heap, 1 );
+    return malloc( size );
+}
+
+static void* mem_calloc( size_t n, size_t size )
+{
+    MEM_COUNT( g_mem.heap, 1 );
+    return calloc( n, size );
+}
+
+static void* mem_realloc( void* p, size_t size )
+{
+    MEM_COUNT( g_mem.heap, 1 );
+    return realloc( p, size );
+}
 
-    bufptr = *buf;
-    size = *bufsiz;
+// Allocate a zeroed secure block of at least 'size' bytes (NULL if
+// out of memory). Must only be called by the main thread.
 
-    if ((c = fgetc( f )) == EOF)
-        return EOF;
+static void* secure_alloc( size_t size )
+{
+    secure_hdr*  h;
+
+    size = (size + SECURE_HDR + 0xFFFF) & ~(size_t) 0xFFFF;
+
+#ifdef _WIN32
+    if (!(h = (secure_hdr*) VirtualAlloc( NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE )))
+        return NULL;
+
+    h->locked = VirtualLock( h, size ) != 0;
+#else
+    void*  p;
+
+    if ((p = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 )) == MAP_FAILED)
+        return NULL;
+
+    h = (secure_hdr*) p;
+    h->locked = mlock( p, size ) == 0;
+
+  #ifdef MADV_DONTDUMP
+    madvise( p, size, MADV_DONTDUMP );
+  #endif
+#endif
+
+    h->size = size;
+    h->prev = NULL;
+
+    if ((h->next = g_secure))
+        g_secure->prev = h;
+
+    g_secure = h;
+
+    MEM_COUNT( g_mem.secure, 1 );
+
+    if (h->locked)
+        MEM_COUNT( g_mem.locked, (int64_t) size );
+    else
+        MEM_COUNT( g_mem.unlocked, (int64_t) size );
+
+    return (char*) h + SECURE_HDR;
+}
+
+// Usable size of a secure block...
+
+static size_t secure_size( void* p )
+{
+    return ((secure_hdr*) ((char*) p - SECURE_HDR))->size - SECURE_HDR;
+}
+
+// Zero and free a secure block...
+
+static void secure_free( void* p )
+{
+    secure_hdr*  h;
+    size_t       size;
+    bool         locked;
+
+    if (!p)
+        return;
+
+    h = (secure_hdr*) ((char*) p - SECURE_HDR);
+
+    if (h->next) h->next->prev = h->prev;
+    if (h->prev) h->prev->next = h->next;
+    else         g_secure      = h->next;
+
+    size   = h->size;
+    locked = h->locked;
+
+    totp_cleanse( h, size );
+
+#ifdef _WIN32
+    if (locked)
+        VirtualUnlock( h, size );
+    VirtualFree( h, 0, MEM_RELEASE );
+#else
+    if (locked)
+        munlock( h, size );
+    munmap( h, size );
+#endif
+}
+
+// Make a secure block bigger: the contents are moved to a new one
+// (and the old one zeroed) rather than being left behind...
+
+static void* secure_realloc( void* p, size_t size )
+{
+    void*  q;
+
+    if (p && size <= secure_size( p ))
+        return p;
 
-    if (!bufptr)
+    if (!(q = secure_alloc( size )))
+        return NULL;
+
+    if (p)
     {
-        if (!(bufptr = (char*) malloc( GETLINE_CHUNK )))
-            return EOF;
-        size = GETLINE_CHUNK;
+        memcpy( q, p, secure_size( p ));
+        secure_free( p );
     }
 
-    p = bufptr;
+    return q;
+}
 
-    while (c != EOF)
-    {
-        if (1
-            && (p - bufptr + 2) > (ssize_t)size
-            && !(bufptr = (char*) realloc( bufptr, (size += GETLINE_CHUNK) ))
-        )
-            return EOF;
+// (atexit) zero whatever is still allocated...
 
-        *p++ = c;
+static void secure_exit()
+{
+    while (g_secure)
+        secure_free( (char*) g_secure + SECURE_HDR );
+}
 
-        if (c == '\n')
-            break;
+// An arena: a secure block which things are simply carved out of,
+// and which is zeroed and reused rather than anything being freed.
 
-        c = fgetc( f );
-    }
+struct arena
+{
+    char*   base;                   // (secure block, or NULL)
+    size_t  size;                   // (its usable size)
+    size_t  used;                   // (bytes handed out so far)
+};
+
+static bool arena_init( arena* a, size_t size )
+{
+    a->used = 0;
 
-    *p++ = '\0';
-    *buf = bufptr;
-    *bufsiz = size;
+    if (!(a->base = (char*) secure_alloc( size )))
+        return false;
 
-    return p - bufptr - 1;
+    a->size = secure_size( a->base );
+    return true;
 }
 
-//---------------------------------------------------------------------
-//                         is_comment_char
-//---------------------------------------------------------------------
+// 'len' bytes (8 byte aligned), or NULL if the arena is full...
+
+static void* arena_alloc( arena* a, size_t len )
+{
+    char*  p;
+
+    len = (len + 7) & ~(size_t) 7;
+
+    if (len > a->size - a->used)
+        return NULL;
+
+    p = a->base + a->used;
+    a->used += len;
+
+    return p;
+}
+
+static void arena_reset( arena* a )
+{
+    totp_cleanse( a->base, a->used );
+    a->used = 0;
+}
 
-static bool is_comment_char( char c )
+static void arena_free( arena* a )
 {
-    return (0
-            || c == '*'     // asterisk
-            || c == '#'     // number sign, pound sign, or hash tag
-            || c == ';'     // semi-colon
-            );
+    secure_free( a->base );
+    memset( a, 0, sizeof( *a ));
 }
 
 //---------------------------------------------------------------------
-//                         my_rem_blanks
+//                              Output
+//---------------------------------------------------------------------
+//
+//  All output (except --selftest's and --verify's) goes through our own
+//  OUTPUT_BLOCK sized buffer, which is written to stdout according to
+//  the --flush policy:
+//
+//    line    after every line (or chunk of lines with --batch/--threads),
+//            so each code is seen as soon as it's calculated. The default
+//            when stdout is a terminal.
+//
+//    block   whenever the buffer fills up, and whenever we're about to
+//            wait for something (more input, or --watch's next change),
+//            so that nothing is ever held back indefinitely. The default
+//            otherwise (i.e. when stdout is a file or pipe), where there
+//            would otherwise be one write system call per code.
+//
+//    end     only when the buffer fills up, and when we exit.
+//
 //---------------------------------------------------------------------
 
-static size_t my_rem_blanks( char* src )
+#define FLUSH_LINE      0
+#define FLUSH_BLOCK     1
+#define FLUSH_END       2
+
+#define FORMAT_TEXT     0           // "123456  label"
+#define FORMAT_TSV      1           // name, counter, from, to, code
+#define FORMAT_JSON     2           // (the same, as JSON lines)
+
+#define OUTPUT_BLOCK    (256*1024)  // (output buffer size)
+#define RECORD_MAXLEN   128         // (TSV/JSON line w/o name)
+
+static char    g_out[ OUTPUT_BLOCK ];
+static size_t  g_outlen = 0;
+
+static void out_flush()
 {
-    char* dst = src;
-    do
+    // (--hotp: never output a code before its counter's advance is
+    // durable, or the same code could be issued again after a crash)
+
+    if (g_outlen && g_counters && totp_counters_commit( g_counters ) != TOTP_OK)
     {
-        while (isspace( *src ))
-            ++src;
+        fprintf( stderr, "ERROR: cannot write \"%s\" - %s\n", g_hotp, strerror( errno ));
+        fflush( stderr );
+        _exit( EXIT_FAILURE );      // (and WITHOUT outputting the codes)
     }
-    while (*dst++ = *src++);
 
-    return strlen( src );
+    if (g_outlen)
+        fwrite( g_out, 1, g_outlen, stdout );
+
+    fflush( stdout );
+    g_outlen = 0;
 }
 
-//---------------------------------------------------------------------
-//                           M A I N
-//---------------------------------------------------------------------
+// Room for at least 'len' bytes more in the output buffer (flushing it
+// if need be), or NULL if there never could be (caller must write it
+// itself using out_write)...
 
-int main( void )
+static char* out_reserve( size_t len )
 {
-    char*          line;
-    char*          secret;
-    const char*    p;
+    if (g_outlen + len > sizeof( g_out ))
+        out_flush();
 
-    int64_t        offset;
-    uint64_t       clock;
-    uint64_t       interval;
+    return len <= sizeof( g_out ) ? g_out + g_outlen : NULL;
+}
 
-    size_t         key_size;
-    size_t         key_len;
-    size_t         linesize;
+static void out_commit( size_t len )
+{
+    g_outlen += len;
+}
 
-    uint32_t       i;
-    uint32_t       code;
-    uint32_t       secret_num;
-    uint32_t       accum_bits;
+static void out_write( const char* p, size_t len )
+{
+    char*  dst;
 
-    uint8_t*       hmac;
-    uint8_t*       key;
-    uint8_t        digits;
-    uint8_t        msg[8];
-    bool           test_mode;
+    if ((dst = out_reserve( len )) != NULL)
+    {
+        memcpy( dst, p, len );
+        out_commit( len );
+    }
+    else
+    {
+        out_flush();
+        fwrite( p, 1, len, stdout );
+    }
+}
 
-    unsigned int   hmacsize;
+// Where to format a line of at most 'max' bytes: directly into the
+// output buffer, or if it's a huge one, a temporary buffer instead
+// (NULL if out of memory). out_end then outputs it...
 
-    const EVP_MD*  digest;
+static char* out_begin( size_t max )
+{
+    char*  p;
 
-    //-----------------------------------------------------------------
-    // Allow reading shared SECRET from stdin in a secure manner...
-    //-----------------------------------------------------------------
+    if ((p = out_reserve( max )) == NULL)
+        p = (char*) mem_alloc( max );
+
+    return p;
+}
 
-    if (!disable_stdin_echo())
+static void out_end( char* p, size_t len )
+{
+    if (p == g_out + g_outlen)
+        out_commit( len );
+    else
     {
-        fprintf( stderr, "ERROR: disable_stdin_echo() FAILED!\n" );
-        return EXIT_FAILURE;
+        out_write( p, len );
+        free( p );
     }
+}
 
-    //-----------------------------------------------------------------
-    // Display version information and cmdline usage (i.e. help info)
-    //-----------------------------------------------------------------
+// A line (or chunk of lines) has been output...
 
-    if (g_bStdinKeyboard)
-    {
-        fprintf( stderr,
+static void out_done()
+{
+    if (g_flush == FLUSH_LINE)
+        out_flush();
+}
 
-            "\n  Fish's x64 Windows TOTP, version "TOTP_VERSION".\n\n"
+// We're about to wait for something...
 
-            "  There are no command line options. The only required input\n"
-            "  is your secret, always from stdin. You can either paste it\n"
-            "  directly into the program, or redirect it from a file.\n\n"
+static void out_idle()
+{
+    if (g_flush != FLUSH_END)
+        out_flush();
+}
 
-            "  If you choose to paste it, don't forget to press the enter\n"
-            "  key afterwards. The program is line oriented, so you must\n"
-            "  end each line with a newline.\n\n"
+// Hand-rolled decimal formatting (no printf format parsing)...
 
-            "  Refer to documentation for input format.\n\n"
+static size_t put_uint( char* p, uint64_t v )
+{
+    char    tmp[ 20 ];
+    size_t  n = 0, i;
 
-            "  If not redirecting input from a file (i.e. if pasting from\n"
-            "  the keyboard), use Ctrl+C to exit the program. Otherwise if\n"
-            "  input is from a file, the program will exit automatically\n"
-            "  once EOF is reached on stdin.\n\n"
-        );
-    }
+    do tmp[ n++ ] = (char) ('0' + v % 10);
+    while (v /= 10);
 
-    //-----------------------------------------------------------------
-    // Read input string (see documentation for format) from stdin,
-    // and calculate the corresponding TOTP value. Keep doing this
-    // until EOF is reached on stdin.
-    //-----------------------------------------------------------------
+    for (i=0; i < n; i++)
+        p[i] = tmp[ n - 1 - i ];
 
-    key   = NULL,  key_size  = 0;
-    line  = NULL,  linesize  = 0;
+    return n;
+}
 
-    while (my_getline( &line, &linesize, stdin ) >= 0)
-    {
-        linesize = my_rem_blanks( line );
-        secret = line;
+static size_t put_int( char* p, int64_t v )
+{
+    if (v >= 0)
+        return put_uint( p, (uint64_t) v );
 
-        if (is_comment_char( secret[0] ))
-            continue;
+    *p = '-';
+    return 1 + put_uint( p + 1, 0 - (uint64_t) v );
+}
+
+static size_t put_code( char* p, uint32_t code, int digits )
+{
+    int  i;
 
-        // Extract the TEST option, if specified...
+    for (i = digits; i > 0; i--, code /= 10)
+        p[ i-1 ] = (char) ('0' + code % 10);
 
-        if (!strncasecmp( secret, "test:", strlen( "test:" ))) {
-             test_mode = true,  secret +=  strlen( "test:" );  }
-        else test_mode = false;
+    return digits;
+}
 
-        // Extract the requested DIGEST function to be used...
+//---------------------------------------------------------------------
+//                            Statistics
+//---------------------------------------------------------------------
+//
+//  --stats: how long each phase took (reading the input, parsing it,
+//  the HMACs, and formatting and writing the output), measured using
+//  the CPU's time stamp counter (or where there isn't one, a monotonic
+//  clock), with a log2 histogram of each phase's measurements, along
+//  with counts of the lines skipped, rejected (and why), and of the
+//  secrets using each digest. Written to stderr (or the --stats=FILE)
+//  when we exit, and whenever we receive SIGUSR1 (e.g. during --watch).
+//
+//  Each chunk (see process_batch) collects its own, which are added
+//  to the totals by the main thread once the chunk has been written,
+//  so worker threads never share any. "make STATS=no" compiles all of
+//  it out, leaving no trace at all in the processing loops.
+//
+//---------------------------------------------------------------------
 
-             if (!strncasecmp( secret, "sha1:",   strlen( "sha1:"   ))) digest = EVP_sha1(),   secret += strlen( "sha1:"   );
-        else if (!strncasecmp( secret, "sha256:", strlen( "sha256:" ))) digest = EVP_sha256(), secret += strlen( "sha256:" );
-        else if (!strncasecmp( secret, "sha512:", strlen( "sha512:" ))) digest = EVP_sha512(), secret += strlen( "sha512:" );
-        else            /* use default "sha1:" */                       digest = EVP_sha1();
+#ifndef TOTP_NO_STATS
 
-        //-------------------------------------------------------------
-        // Now extract the SECRET string, and convert it from its base32
-        // character format to its 32-bit binary equivalent value in 'key'...
-        //-------------------------------------------------------------
+#if defined( _M_X64 ) || defined( _M_IX86 )
+  #include <intrin.h>
+  #define STAT_TSC      1
+#elif defined( __x86_64__ ) || defined( __i386__ )
+  #include <x86intrin.h>
+  #define STAT_TSC      1
+#else
+  #define STAT_TSC      0
+#endif
 
-        for (accum_bits=0, secret_num=0, key_len=0; *secret; secret++)
-        {
-            // Ensure the next character to be processed is still one
-            // of the SECRET value's base32 characters...
+#define STAT_INPUT      0           // (reading and finding lines)
+#define STAT_PARSE      1           // (parsing, i.e. base32 decoding)
+#define STAT_HASH       2           // (midstates and HMACs)
+#define STAT_OUTPUT     3           // (formatting and writing)
+#define STAT_PHASES     4
 
-            if (!(p = strchr( base32, *secret )))
-                break; // (either SEP_CHAR or end of SECRET string)
+#define STAT_BUCKETS    64          // (log2 histogram buckets)
+#define STAT_REASONS    8           // (distinct reasons lines are invalid)
 
-            // Convert this base32 character to its 5-bit binary eqivalent,
-            // and add it to our running total...
+struct stat_phase
+{
+    uint64_t  ticks;                // (total time)
+    uint64_t  samples;              // (number of measurements)
+    uint64_t  items;                // (lines or codes they covered)
+    uint64_t  hist[ STAT_BUCKETS ]; // (measurements by log2 of ticks)
+};
 
-            secret_num = (uint32_t) ((secret_num << BASE32_BITS) | (p - base32));
-            accum_bits += BASE32_BITS;
+struct stats
+{
+    stat_phase  phase[ STAT_PHASES ];
+    uint64_t    lines;              // (input lines or store records)
+    uint64_t    skipped;            // (blank or comment lines)
+    uint64_t    digests[ TOTP_NUM_DIGESTS ];    // (valid secrets by digest)
+};
 
-            // When we have enough bits, save another byte...
+static bool         g_stats_on   = false;   // (--stats)
+static const char*  g_stats_file = NULL;    // (--stats=FILE; NULL = stderr)
+static stats        g_stats;                // (totals)
 
-            while (accum_bits >= BITS_PER_BYTE)
-            {
-                // (make room for another byte...)
+static struct { const char* why; uint64_t count; } g_invalid[ STAT_REASONS ];
 
-                while (key_len >= key_size)
-                {
-                    key_size = key_size ? key_size << 1 : 64;
-
-                    if (!(key = (uint8_t*) realloc( key, key_size )))
-                    {
-                        fprintf( stderr, "ERROR: realloc( key, %d ) FAILED! - %s\n",
-                            (int) key_size, strerror( errno ));
-                        return EXIT_FAILURE;
-                    }
-                }
+static volatile sig_atomic_t  g_stats_signal = 0;   // (SIGUSR1 received)
 
-                // (save the next byte...)
+static uint64_t stat_clock()
+{
+#if STAT_TSC
+    return __rdtsc();
+#elif defined( _WIN32 )
+    LARGE_INTEGER  count;
 
-                accum_bits -= BITS_PER_BYTE;
-                key[ key_len++ ] = (uint8_t) (secret_num >> accum_bits);
-            }
-        }
+    QueryPerformanceCounter( &count );
+    return (uint64_t) count.QuadPart;
+#else
+    struct timespec  ts;
 
-        //-------------------------------------------------------------
-        // "key" array now contains our "SECRET" as a string of binary
-        // bytes. "key_len" holds how long "key" is in number of bytes.
-        //-------------------------------------------------------------
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
 
-        // Extract other i/p parameters: DIGITS, INTERVAL and OFFSET...
+// One measurement of a phase which began at 'start' and covered 'items'...
 
-        digits   = *secret == SEP_CHAR ? (uint8_t) strtoul(  secret + 1, &secret, 10 ) : DEF_DIGITS;
-        interval = *secret == SEP_CHAR ?           strtoull( secret + 1, &secret, 10 ) : DEF_INTERVAL;
-        offset   = *secret == SEP_CHAR ?           strtoll(  secret + 1, &secret, 10 ) : DEF_OFFSET;
+static void stat_add( stats* st, int phase, uint64_t start, size_t items )
+{
+    stat_phase*  p = &st->phase[ phase ];
+    uint64_t     ticks = stat_clock() - start;
+    int          b;
 
-        // Calculate and output the resulting "Time-based One-Time-
-        // Password" (TOTP) verification code... (but don't bother
-        // unless *ALL* of our parameters are valid!)
+    for (b=0; ticks >> (b+1); b++)
+        ;
 
-        if (1
-            && digits   > 0     // (valid?)
-            && interval > 0     // (valid?)
-            && key_len  > 0     // (valid?)
-        )
-        {
-            //---------------------------------------------------------
-            // Use time-based interval as message to be hashed...
-            //
-            // Note: We cannot directly use the 8-byte 64-bit 'clock'
-            // variable value itself since the value thus inputted to
-            // the hashing algorithm would then vary depending on the
-            // endianess of the system we were running on. Therefore
-            // to ensure consistency, we always convert the value to
-            // big-endian format in 'msg[8]'.
-            //---------------------------------------------------------
-
-            if (!test_mode)
-                clock = (time( NULL ) - offset) / interval;
-            else
-                clock = offset / interval;
+    p->ticks += ticks;
+    p->samples++;
+    p->items += items;
+    p->hist[b]++;
+}
+
+static void stat_line( stats* st, int rc, const totp_secret* s )
+{
+    st->lines++;
+
+    if (rc == TOTP_SKIP)
+        st->skipped++;
+    else if (rc == TOTP_OK)
+        st->digests[ s->digest ]++;
+}
+
+static void stat_invalid( const char* why )
+{
+    int  i;
+
+    for (i=0; i < STAT_REASONS-1 && g_invalid[i].why && g_invalid[i].why != why; i++)
+        ;
+
+    g_invalid[i].why = why;     // (the last one collects any others)
+    g_invalid[i].count++;
+}
 
-            for (i=0; i < (uint32_t) sizeof( msg ); i++)
-                msg[ (sizeof( msg )-1) - i ] = (uint8_t) (clock >> (8 * i));
+// Add a chunk's statistics to the totals (and reset them)...
 
-            // ("msg" is now clock value in big-endian format)
+static void stat_merge( stats* st )
+{
+    int  p, b, d;
 
-            //---------------------------------------------------------
-            // Calculate the HMAC (Hash-Based Message Authentication
-            // Code), which is the resulting verification code we're
-            // to produce, using our shared SECRET and current time-
-            // of-day value.
-            //---------------------------------------------------------
+    for (p=0; p < STAT_PHASES; p++)
+    {
+        g_stats.phase[p].ticks   += st->phase[p].ticks;
+        g_stats.phase[p].samples += st->phase[p].samples;
+        g_stats.phase[p].items   += st->phase[p].items;
 
-            hmac = HMAC
-            (
-                digest,         // (which hashing algorithm to use)
+        for (b=0; b < STAT_BUCKETS; b++)
+            g_stats.phase[p].hist[b] += st->phase[p].hist[b];
+    }
 
-                key,            // (shared SECRET to be used to hash with)
-                (int) key_len,
+    g_stats.lines   += st->lines;
+    g_stats.skipped += st->skipped;
 
-                msg,            // ("message" to be hashed = time interval number)
-                sizeof( msg ),
+    for (d=0; d < TOTP_NUM_DIGESTS; d++)
+        g_stats.digests[d] += st->digests[d];
 
-                NULL,           // (not used)
+    memset( st, 0, sizeof( *st ));
+}
 
-                &hmacsize       // (length of resulting hash value: 20
-                                //  if sha1, 32 if sha256, 64 if sha512)
-            );
+// The smallest power of 2 which at least 'pct' percent of the
+// phase's measurements were below...
 
-            //---------------------------------------------------------
-            //              OKAY, THIS IS WEIRD!
-            //---------------------------------------------------------
+static uint64_t stat_percentile( const stat_phase* p, int pct )
+{
+    uint64_t  n = 0;
+    int       b;
 
-            uint8_t   rrr;      // random 0-15 value from rightmost nibble of hmac
+    for (b=0; b < STAT_BUCKETS-1; b++)
+        if ((n += p->hist[b]) * 100 >= p->samples * pct)
+            break;
 
-            uint32_t  hbyte;    // one of the 4 consecutive right-to-left hmac bytes
+    return (uint64_t) 2 << b;
+}
 
-            uint32_t  index;    // (used to index into hmac)
+static void stats_print( FILE* f )
+{
+    static const char*  phases[ STAT_PHASES ] = { "input", "parse", "hash", "output" };
+    static const char*  units = STAT_TSC ? "cycles" : "ticks";
 
-            uint32_t  shift;    // (work; shifts hbyte into position
-                                //  to accumulate extracted hmac bytes
-                                //  into 4-byte 32-bit big-endian value)
+    const stat_phase*  p;
+    uint64_t           invalid = 0;
+    int                i, b, d;
 
-            // Extract verification code from the generated hash...
+    for (i=0; i < STAT_REASONS; i++)
+        invalid += g_invalid[i].count;
 
-            code = 0;
+    fprintf( f, "\ntotp statistics (%s):\n\n", units );
+    fprintf( f, "  %-8s %11s  %11s  %15s  %8s  %10s  %10s\n",
+        "phase", "samples", "items", units, "per item", "p50 <", "p99 <" );
 
-            rrr = hmac[ hmacsize - 1 ];  // (rightmost hmac byte)
-            rrr &= 0x0f;                 // (rightmost nibble)
+    for (i=0; i < STAT_PHASES; i++)
+    {
+        p = &g_stats.phase[i];
 
-            for (i=0; i < 4; i++)
-            {
-                index = (3 - i);                // 3, 2, 1, 0
-                shift = (BITS_PER_BYTE * i);    // 0, 8, 16, 24
+        fprintf( f, "  %-8s %11llu  %11llu  %15llu  %8.1f  %10llu  %10llu\n", phases[i],
+            (unsigned long long) p->samples, (unsigned long long) p->items,
+            (unsigned long long) p->ticks, p->items ? (double) p->ticks / p->items : 0.0,
+            (unsigned long long) (p->samples ? stat_percentile( p, 50 ) : 0),
+            (unsigned long long) (p->samples ? stat_percentile( p, 99 ) : 0) );
+    }
 
-                hbyte = hmac[ rrr + index ];    // (extract next byte)
-                hbyte <<= shift;                // (shift into position)
-                code += hbyte;                  // (accumulate here)
-            }
+    fprintf( f, "\n  lines    %11llu\n", (unsigned long long) g_stats.lines );
+    fprintf( f,   "  skipped  %11llu\n", (unsigned long long) g_stats.skipped );
+    fprintf( f,   "  invalid  %11llu\n", (unsigned long long) invalid );
 
-            code &= 0x7fffffff;     // (must always be signed >= 0;
-                                    // code value is now big-endian)
-
-            //---------------------------------------------------------
-            // Output the result, being the rightmost number of desired
-            // digits of the calculated verification code...
-            //
-            // Also note that that the variable "secret" still points
-            // to whatever text string data (if any) that happened to
-            // follow the input parameters portion of the input string.
-            // So if, for example, the input was:
-            //
-            //   "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567:8  adam@acme.org"
-            //
-            // then we would output:
-            //
-            //   "01360115  adam@acme.org"
-            //
-            // where "adam@acme.org" would be the extra string data the
-            // current "secret" variable value would be pointing to.
-            //---------------------------------------------------------
-
-            static bool did_this = false;
-
-            if (test_mode && !did_this)
-            {
-                printf(" Actual   Expected\n");
-                printf("--------  --------\n");
-                did_this = true;
-            }
+    for (i=0; i < STAT_REASONS && g_invalid[i].why; i++)
+        fprintf( f, "    %11llu  %s\n", (unsigned long long) g_invalid[i].count, g_invalid[i].why );
 
-            while (*secret == ' ') ++secret;  // (skip past preceding blanks)
+    for (d=0; d < TOTP_NUM_DIGESTS; d++)
+        fprintf( f, "  %-8s %11llu\n", totp_digest_name( d ), (unsigned long long) g_stats.digests[d] );
 
-                 if (digits == 6) printf( "%06u  %s\n", code %   1000000, secret );
-            else if (digits == 7) printf( "%07u  %s\n", code %  10000000, secret );
-            else if (digits == 8) printf( "%08u  %s\n", code % 100000000, secret );
+    fprintf( f, "\n  heap     %11llu  allocations\n", (unsigned long long) g_mem.heap );
+    fprintf( f,   "  secure   %11llu  allocations (%llu KB locked, %llu KB not)\n",
+        (unsigned long long) g_mem.secure, (unsigned long long) (g_mem.locked >> 10),
+        (unsigned long long) (g_mem.unlocked >> 10) );
 
-            fflush( stdout );   // (make sure they see our output!)
-        }
+    for (i=0; i < STAT_PHASES; i++)
+    {
+        if (!(p = &g_stats.phase[i])->samples)
+            continue;
+
+        fprintf( f, "\n  %s histogram (%s per sample):\n", phases[i], units );
+
+        for (b=0; b < STAT_BUCKETS; b++)
+            if (p->hist[b])
+                fprintf( f, "    >= %-20llu %11llu\n", (unsigned long long) 1 << b,
+                    (unsigned long long) p->hist[b] );
     }
 
-    // Cleanup and exit...
+    fprintf( f, "\n" );
+}
 
-    free( key  );
-    free( line );
+static void stats_dump()
+{
+    uint64_t  start = stat_clock();
+    FILE*     f;
 
-    return EXIT_SUCCESS;
+    out_flush();    // (whatever's still buffered is part of the output)
+    stat_add( &g_stats, STAT_OUTPUT, start, 0 );
+
+    if (!g_stats_file)
+        stats_print( stderr );
+    else if ((f = fopen( g_stats_file, "w" )) != NULL)
+    {
+        stats_print( f );
+        fclose( f );
+    }
+    else
+        fprintf( stderr, "ERROR: cannot write \"%s\" - %s\n", g_stats_file, strerror( errno ));
+}
+
+#ifdef SIGUSR1
+static void stats_signal( int sig )
+{
+    g_stats_signal = 1;     // (dumped by stats_poll, not here)
+    signal( sig, stats_signal );
+}
+#endif
+
+static void stats_poll()
+{
+    if (g_stats_signal)
+    {
+        g_stats_signal = 0;
+        stats_dump();
+    }
+}
+
+#define STAT_START( t )             uint64_t t = g_stats_on ? stat_clock() : 0
+#define STAT_STOP( st, ph, t, n )   do { if (g_stats_on) stat_add( st, ph, t, n ); } while (0)
+#define STAT_LINE( st, rc, s )      do { if (g_stats_on) stat_line( st, rc, s ); } while (0)
+#define STAT_INVALID( why )         do { if (g_stats_on) stat_invalid( why ); } while (0)
+#define STAT_MERGE( st )            do { if (g_stats_on) stat_merge( st ); } while (0)
+#define STAT_POLL()                 stats_poll()
+
+#else // TOTP_NO_STATS
+
+#define STAT_START( t )
+#define STAT_STOP( st, ph, t, n )
+#define STAT_LINE( st, rc, s )
+#define STAT_INVALID( why )
+#define STAT_MERGE( st )
+#define STAT_POLL()
+
+#endif // TOTP_NO_STATS
+
+//---------------------------------------------------------------------
+//                              Input
+//---------------------------------------------------------------------
+//
+//  When the input (stdin or --input FILE) is a regular file, the whole
+//  file is simply memory mapped, and each line is then just a pointer
+//  into it and a length; nothing is copied at all. Otherwise (pipe or
+//  keyboard) it's read INPUT_BLOCK bytes at a time, with lines being
+//  returned from the block, and only a partial line at the end of the
+//  block ever being moved (to the beginning of the block, before the
+//  next read). Lines are found using memchr, which the C runtime does
+//  a whole vector register at a time.
+//
+//  Lines are returned without their newline (and are NOT terminated),
+//  and blanks within them are left for totp_parse_line to skip.
+//
+//---------------------------------------------------------------------
+
+#define INPUT_BLOCK     (1024*1024) // (input block read size)
+
+struct input
+{
+    const char*  data;              // (mapped file, or 'buf')
+    size_t       len;               // (length of data)
+    size_t       pos;               // (offset of next line in data)
+    size_t       prev;              // (offset of the line last returned)
+    size_t       lineno;            // (number of lines returned so far)
+    bool         mapped;            // (data is a memory mapped file)
+    bool         eof;               // (no more to be read)
+    bool         opened;            // (--input FILE: we opened it)
+
+    char*        buf;               // (block read buffer)
+    size_t       bufsize;           // (size of block read buffer)
+
+#ifdef _WIN32
+    HANDLE       hFile;             // (input file/pipe/console)
+    HANDLE       hMap;              // (file mapping object)
+#else
+    int          fd;                // (input file descriptor)
+#endif
+};
+
+#ifdef _WIN32
+
+static bool input_map( input* in )
+{
+    LARGE_INTEGER  size;
+
+    if (0
+        || GetFileType( in->hFile ) != FILE_TYPE_DISK
+        || !GetFileSizeEx( in->hFile, &size )
+        || size.QuadPart == 0
+        || (uint64_t) size.QuadPart > (SIZE_MAX >> 1)
+        || !(in->hMap = CreateFileMapping( in->hFile, NULL, PAGE_READONLY, 0, 0, NULL ))
+    )
+    {
+        return false;
+    }
+
+    if (!(in->data = (const char*) MapViewOfFile( in->hMap, FILE_MAP_READ, 0, 0, 0 )))
+    {
+        CloseHandle( in->hMap );
+        in->hMap = NULL;
+        return false;
+    }
+
+    in->len = (size_t) size.QuadPart;
+    return true;
+}
+
+static ssize_t input_read( input* in, char* buf, size_t len )
+{
+    DWORD  n;
+
+    if (!ReadFile( in->hFile, buf, (DWORD) (len > 0x40000000 ? 0x40000000 : len), &n, NULL ))
+        return GetLastError() == ERROR_BROKEN_PIPE ? 0 : -1;
+
+    return (ssize_t) n;
+}
+
+static bool input_open( input* in, const char* path )
+{
+    memset( in, 0, sizeof( *in ));
+
+    if (!path)
+        in->hFile = GetStdHandle( STD_INPUT_HANDLE );
+    else if ((in->hFile = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL )) == INVALID_HANDLE_VALUE)
+        return false;
+    else
+        in->opened = true;
+
+    return (in->mapped = input_map( in ))
+        || (in->data = in->buf = (char*) secure_alloc( in->bufsize = INPUT_BLOCK )) != NULL;
+}
+
+static void input_close( input* in )
+{
+    if (in->mapped)
+    {
+        UnmapViewOfFile( in->data );
+        CloseHandle( in->hMap );
+    }
+    if (in->opened)
+        CloseHandle( in->hFile );
+
+    secure_free( in->buf );
+}
+
+#else // (POSIX)
+
+static bool input_map( input* in )
+{
+    struct stat  st;
+    void*        p;
+
+    if (0
+        || fstat( in->fd, &st ) != 0
+        || !S_ISREG( st.st_mode )
+        || st.st_size == 0
+        || (uint64_t) st.st_size > (SIZE_MAX >> 1)
+        || (p = mmap( NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0 )) == MAP_FAILED
+    )
+    {
+        return false;
+    }
+
+    madvise( p, (size_t) st.st_size, MADV_SEQUENTIAL );
+
+    in->data = (const char*) p;
+    in->len  = (size_t) st.st_size;
+    return true;
+}
+
+static ssize_t input_read( input* in, char* buf, size_t len )
+{
+    ssize_t  n;
+
+    while ((n = read( in->fd, buf, len )) < 0 && errno == EINTR)
+        ;
+
+    return n;
+}
+
+static bool input_open( input* in, const char* path )
+{
+    memset( in, 0, sizeof( *in ));
+
+    if (!path)
+        in->fd = STDIN_FILENO;
+    else if ((in->fd = open( path, O_RDONLY )) < 0)
+        return false;
+    else
+        in->opened = true;
+
+    return (in->mapped = input_map( in ))
+        || (in->data = in->buf = (char*) secure_alloc( in->bufsize = INPUT_BLOCK )) != NULL;
+}
+
+static void input_close( input* in )
+{
+    if (in->mapped)
+        munmap( (void*) in->data, in->len );
+    if (in->opened)
+        close( in->fd );
+
+    secure_free( in->buf );
+}
+
+#endif
+
+// Return the next line (without its newline). The line remains valid
+// until the next call, or, if the input is memory mapped, until the
+// input is closed. Returns false at EOF.
+
+static bool input_line( input* in, const char** line, size_t* len )
+{
+    const char*  nl;
+    size_t       keep;
+    ssize_t      n;
+
+    for (;;)
+    {
+        if ((nl = (const char*) memchr( in->data + in->pos, '\n', in->len - in->pos )))
+        {
+            in->prev = in->pos;
+            *line   = in->data + in->pos;
+            *len    = nl - *line;
+            in->pos = (nl + 1) - in->data;
+            in->lineno++;
+            return true;
+        }
+
+        if (in->mapped || in->eof)
+        {
+            if (in->pos >= in->len)
+                return false;
+
+            in->prev = in->pos;
+            *line   = in->data + in->pos;       // (last line has
+            *len    = in->len  - in->pos;       //  no newline)
+            in->pos = in->len;
+            in->lineno++;
+            return true;
+        }
+
+        // Move the partial line to the beginning of the buffer
+        // (making it bigger if it's already the entire buffer)
+        // and read some more...
+
+        keep = in->len - in->pos;
+        memmove( in->buf, in->buf + in->pos, keep );
+        in->len = keep,  in->pos = 0;
+
+        if (in->len == in->bufsize)
+        {
+            char*  buf;
+
+            if (!(buf = (char*) secure_realloc( in->buf, in->bufsize * 2 )))
+                return false;
+
+            in->data = in->buf = buf;
+            in->bufsize *= 2;
+        }
+
+        out_idle();     // (don't hold back output while we wait)
+
+        if ((n = input_read( in, in->buf + in->len, in->bufsize - in->len )) <= 0)
+            in->eof = true;
+        else
+            in->len += n;
+    }
+}
+
+// Push the line last returned back, so the next call returns it again
+// (only valid straight after input_line returned it)...
+
+static void input_unread( input* in )
+{
+    in->pos = in->prev;
+    in->lineno--;
+}
+
+//---------------------------------------------------------------------
+//                           format_code
+//---------------------------------------------------------------------
+//
+//  Format the result, being the rightmost number of desired digits
+//  of the calculated verification code, followed by the label...
+//
+//  Also note that the secret's label still points to whatever text
+//  string data (if any) that happened to follow the input parameters
+//  portion of the input string. So if, for example, the input was:
+//
+//    "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567:8  adam@acme.org"
+//
+//  then we would output:
+//
+//    "01360115  adam@acme.org"
+//
+//  where "adam@acme.org" would be the secret's label. As with the rest
+//  of the line, any blanks within the label are ignored.
+//
+//  'buf' must be at least CODE_MAXLEN + the label's length in size.
+//  Returns the formatted length (which is NOT NUL terminated).
+//
+//---------------------------------------------------------------------
+
+static size_t copy_label( char* dst, const totp_secret* secret )
+{
+    const char*  p    = secret->label;
+    const char*  end  = secret->label + secret->label_len;
+    char*        d    = dst;
+
+    for (; p < end; p++)
+        if (!isspace( (unsigned char) *p ))
+            *d++ = *p;
+
+    return d - dst;
+}
+
+static size_t format_code( char* buf, const totp_secret* secret, uint32_t code )
+{
+    char*  p = buf;
+
+    p += put_code( p, code, secret->digits );
+    *p++ = ' ';
+    *p++ = ' ';
+    p += copy_label( p, secret );
+    *p++ = '\n';
+
+    return p - buf;
+}
+
+//---------------------------------------------------------------------
+//                          format_record
+//---------------------------------------------------------------------
+//
+//  --format=tsv or json (and --range): format the code for the given
+//  counter as a line of tab separated values, or as a JSON object:
+//
+//    "adam@acme.org  59740220  1792206600  1792206630  01360115"
+//    {"name":"adam@acme.org","counter":59740220,"from":1792206600,
+//     "to":1792206630,"code":"01360115"}
+//
+//  where 'name' is the label without any leading comment character or
+//  blanks, and the code is valid from Unix time 'from' up to (but not
+//  including) 'to', i.e. 'to' is when it expires. (For "TEST:" secrets,
+//  counters count from time 0 rather than from OFFSET.)
+//
+//  'buf' must be at least line_maxlen() in size.
+//
+//---------------------------------------------------------------------
+
+static size_t line_maxlen( const totp_secret* s )
+{
+    if (g_format == FORMAT_TEXT && !g_ranges)
+        return CODE_MAXLEN + s->label_len;
+
+    return RECORD_MAXLEN + s->label_len * 6;    // (JSON: "\u00XX")
+}
+
+static size_t format_record( char* buf, const totp_secret* s, uint64_t counter, uint32_t code )
+{
+    static const char  hex[] = "0123456789abcdef";
+
+    const char*  name = s->label;
+    const char*  end  = s->label + s->label_len;
+    int64_t      from = ((s->flags & TOTP_F_TEST) ? 0 : s->offset)
+                      + (int64_t) (counter * s->interval);
+    bool         json = g_format == FORMAT_JSON;
+    char*        p    = buf;
+
+    while (name < end && strchr( " \t*#;", *name ))
+        name++;
+
+    if (json)
+        memcpy( p, "{\"name\":\"", 9 ), p += 9;
+
+    for (; name < end; name++)
+    {
+        unsigned char  c = (unsigned char) *name;
+
+        if (!json)
+            *p++ = (c == '\t' || c == '\r' || c == '\n') ? ' ' : (char) c;
+        else if (c == '"' || c == '\\')
+            *p++ = '\\', *p++ = (char) c;
+        else if (c < 0x20)
+        {
+            memcpy( p, "\\u00", 4 ), p += 4;
+            *p++ = hex[ c >> 4 ];
+            *p++ = hex[ c & 15 ];
+        }
+        else
+            *p++ = (char) c;
+    }
+
+    if (json)
+    {
+        memcpy( p, "\",\"counter\":", 12 ), p += 12;  p += put_uint( p, counter );
+        memcpy( p, ",\"from\":",       8 ), p +=  8;  p += put_int(  p, from );
+        memcpy( p, ",\"to\":",         6 ), p +=  6;  p += put_int(  p, from + (int64_t) s->interval );
+        memcpy( p, ",\"code\":\"",    9 ), p +=  9;  p += put_code( p, code, s->digits );
+        memcpy( p, "\"}\n",            3 ), p +=  3;
+    }
+    else
+    {
+        *p++ = '\t';  p += put_uint( p, counter );
+        *p++ = '\t';  p += put_int(  p, from );
+        *p++ = '\t';  p += put_int(  p, from + (int64_t) s->interval );
+        *p++ = '\t';  p += put_code( p, code, s->digits );
+        *p++ = '\n';
+    }
+
+    return p - buf;
+}
+
+// The code for the given time, in whichever --format...
+
+static size_t format_line( char* buf, const totp_secret* s, uint32_t code, int64_t at_time )
+{
+    if (g_format == FORMAT_TEXT)
+        return format_code( buf, s, code );
+
+    return format_record( buf, s, totp_counter( s, at_time ), code );
+}
+
+//---------------------------------------------------------------------
+//                          print_test_hdr
+//---------------------------------------------------------------------
+
+static void print_test_hdr()
+{
+    static bool did_this = false;
+
+    static const char  hdr[] =
+
+        " Actual   Expected\n"
+        "--------  --------\n";
+
+    if (!did_this)
+    {
+        out_write( hdr, sizeof( hdr ) - 1 );
+        did_this = true;
+    }
+}
+
+// (the heading line for tab separated values)
+
+static void print_tsv_hdr()
+{
+    static bool did_this = false;
+
+    static const char  hdr[] = "name\tcounter\tfrom\tto\tcode\n";
+
+    if (!did_this)
+    {
+        out_write( hdr, sizeof( hdr ) - 1 );
+        did_this = true;
+    }
+}
+
+//---------------------------------------------------------------------
+//                            print_code
+//---------------------------------------------------------------------
+
+static void print_code( const totp_secret* secret, uint32_t code, int64_t at_time )
+{
+    size_t  max = line_maxlen( secret );
+    char*   p;
+
+    if (g_format == FORMAT_TSV)
+        print_tsv_hdr();
+    else if (g_format == FORMAT_TEXT && (secret->flags & TOTP_F_TEST))
+        print_test_hdr();
+
+    if ((p = out_begin( max )) != NULL)
+        out_end( p, format_line( p, secret, code, at_time ));
+
+    out_done();
+}
+
+//---------------------------------------------------------------------
+//                          report_invalid
+//---------------------------------------------------------------------
+
+// Tell them why an input line that looked like a secret was rejected,
+// and where in the line (1-based columns) its SECRET stopped, which
+// is usually the giveaway (e.g. a mistyped '0' or '1' or '8')...
+
+static void report_invalid( size_t lineno, const char* line, size_t len )
+{
+    totp_secret  secret;
+    totp_diag    diag;
+
+    if (totp_parse_diag( &secret, line, len, &diag ) == TOTP_OK)
+    {
+        totp_wipe( &secret );
+        return;
+    }
+
+    STAT_INVALID( diag.error );
+
+    out_flush();    // (keep it in sequence with our output)
+
+    fprintf( stderr, "WARNING: line %lu: %s at column %lu (SECRET stops at column %lu)\n",
+        (unsigned long) lineno, diag.error ? diag.error : "invalid",
+        (unsigned long) diag.error_at + 1, (unsigned long) diag.secret_end + 1 );
+}
+
+//---------------------------------------------------------------------
+//                          HOTP counters
+//---------------------------------------------------------------------
+//
+//  --hotp FILE: event based HOTP (RFC 4226) rather than time based TOTP,
+//  each secret's counter (by name) being kept in the FILE counter log.
+//  Each code output uses up its counter, and --verify accepts any of the
+//  next HOTP_WINDOW counters' codes (the token may have been pressed
+//  without its code being used), the counter then moving past it. The
+//  counter advances are committed in groups, just before the output is
+//  written (see out_flush), so that one fsync covers a whole block.
+//
+//---------------------------------------------------------------------
+
+static bool hotp_next( const totp_secret* s, uint32_t* code )
+{
+    uint64_t  counter = totp_counters_get( g_counters, s->label, s->label_len );
+
+    if (totp_counters_advance( g_counters, s->label, s->label_len, counter + 1 ) != TOTP_OK)
+    {
+        out_flush();
+        fprintf( stderr, "WARNING: cannot advance counter of \"%.*s\"\n",
+            (int) s->label_len, s->label );
+        return false;
+    }
+
+    *code = totp_hotp( s, counter );
+    return true;
+}
+
+static bool hotp_verify( const totp_secret* s, uint32_t code, uint64_t* counter )
+{
+    uint32_t  codes[ HOTP_WINDOW ];
+    int       i;
+
+    *counter = totp_counters_get( g_counters, s->label, s->label_len );
+
+    totp_hotp_range( s, *counter, codes, HOTP_WINDOW );
+
+    for (i=0; i < HOTP_WINDOW; i++)
+    {
+        if (codes[i] == code)
+        {
+            *counter += i;
+
+            // (whoever advances it first wins: the code is then used up)
+
+            return 1
+                && totp_counters_advance( g_counters, s->label, s->label_len, *counter + 1 ) == TOTP_OK
+                && totp_counters_commit( g_counters ) == TOTP_OK;
+        }
+    }
+
+    return false;
+}
+
+//---------------------------------------------------------------------
+//                            resync
+//---------------------------------------------------------------------
+//
+//  --resync CODE[,CODE...]: RFC 4226 section 7.4 resynchronisation of a
+//  badly drifted token (or clock), the codes being consecutive codes it
+//  displayed, the last one being its current one. With --hotp, searches
+//  the next RESYNC_WINDOW counters and moves the counter past the last
+//  code. Otherwise searches RESYNC_WINDOW time steps either side of now
+//  and reports the drift, and the OFFSET which corrects it. The search
+//  uses --threads threads (default one per CPU).
+//
+//---------------------------------------------------------------------
+
+static bool parse_codes( const char* str, uint32_t* codes, size_t* n )
+{
+    char*  end;
+
+    for (*n = 0; *n < RESYNC_CODES; str = end + 1)
+    {
+        if (!isdigit( (unsigned char) *str ))
+            return false;
+
+        codes[ (*n)++ ] = (uint32_t) strtoul( str, &end, 10 );
+
+        if (*end != ',')
+            return !*end;
+    }
+
+    return false;
+}
+
+static int resync( const totp_secret* s, int64_t t )
+{
+    uint32_t  codes[ RESYNC_CODES ];
+    uint64_t  counter;
+    int64_t   drift;
+    size_t    n;
+
+    if (!parse_codes( g_resync, codes, &n ))
+    {
+        fprintf( stderr, "ERROR: invalid --resync \"%s\"\n", g_resync );
+        return EXIT_FAILURE;
+    }
+
+    if (g_counters)
+    {
+        counter = totp_counters_get( g_counters, s->label, s->label_len );
+
+        if (0
+            || totp_resync( s, counter, 0, RESYNC_WINDOW, codes, n, g_threads, &drift ) != TOTP_OK
+            || totp_counters_advance( g_counters, s->label, s->label_len, counter + drift + n ) != TOTP_OK
+            || totp_counters_commit( g_counters ) != TOTP_OK
+        )
+        {
+            printf( "FAILED\n" );
+            return EXIT_FAILURE;
+        }
+
+        printf( "OK (counter %llu, drift %+lld)\n",
+            (unsigned long long) (counter + drift + n - 1), (long long) drift );
+        return EXIT_SUCCESS;
+    }
+
+    counter = totp_counter( s, t );
+
+    if (totp_resync( s, counter, RESYNC_WINDOW, RESYNC_WINDOW, codes, n, g_threads, &drift ) != TOTP_OK)
+    {
+        printf( "FAILED\n" );
+        return EXIT_FAILURE;
+    }
+
+    drift += (int64_t) n - 1;       // (the last code is the current one)
+
+    if (s->flags & TOTP_F_TEST)
+        printf( "OK (drift %+lld)\n", (long long) drift );
+    else
+        printf( "OK (drift %+lld, OFFSET %lld)\n", (long long) drift,
+            (long long) (s->offset - drift * (int64_t) s->interval) );
+
+    return EXIT_SUCCESS;
+}
+
+//---------------------------------------------------------------------
+//                           print_range
+//---------------------------------------------------------------------
+//
+//  --range FROM:TO and --counters FIRST:LAST: rather than just the one
+//  code, output the code for every time step in the given range, as
+//  tab separated values (TSV) with a heading line (or with --format=json
+//  as JSON lines; see format_record). FROM and TO are Unix times, or if
+//  signed, seconds relative to now. Likewise FIRST and LAST are counters
+//  (time step numbers), or if signed, relative to the current time step.
+//  (For "TEST:" secrets, now is their exact test time.)
+//
+//---------------------------------------------------------------------
+
+static uint64_t span_counter( const totp_secret* s, int64_t t )
+{
+    // (the time step containing Unix time 't', or 0 if before them all)
+
+    int64_t  origin = (s->flags & TOTP_F_TEST) ? 0 : s->offset;
+
+    return t < origin ? 0 : (uint64_t) (t - origin) / s->interval;
+}
+
+static void print_range( const totp_secret* s, int64_t now )
+{
+    uint32_t     codes[ RANGE_BLOCK ];
+    uint64_t     first, last, counter;
+    int64_t      origin, base, t;
+    size_t       i, n, max;
+    char*        p;
+
+    if (s->flags & TOTP_F_TEST)
+        base = s->offset, origin = 0;
+    else
+        base = now, origin = s->offset;
+
+    if (g_span.counters)
+    {
+        counter = span_counter( s, base );
+
+        first = !g_span.from_rel ? (uint64_t) g_span.from
+              : g_span.from < 0 && (uint64_t) -g_span.from > counter ? 0
+              : counter + g_span.from;
+
+        if (!g_span.to_rel)
+            last = (uint64_t) g_span.to;
+        else if (g_span.to < 0 && (uint64_t) -g_span.to > counter)
+            return;
+        else
+            last = counter + g_span.to;
+    }
+    else
+    {
+        t = g_span.to_rel ? base + g_span.to : g_span.to;
+
+        if (t < origin)
+            return;
+
+        last  = span_counter( s, t );
+        first = span_counter( s, g_span.from_rel ? base + g_span.from : g_span.from );
+    }
+
+    if (last < first)
+        return;
+
+    if (g_format != FORMAT_JSON)
+        print_tsv_hdr();
+
+    max = line_maxlen( s );
+
+    for (counter = first;; counter += n)
+    {
+        n = (last - counter) < RANGE_BLOCK ? (size_t) (last - counter) + 1 : RANGE_BLOCK;
+
+        totp_hotp_range( s, counter, codes, n );
+
+        for (i=0; i < n; i++)
+        {
+            if ((p = out_begin( max )) != NULL)
+                out_end( p, format_record( p, s, counter + i, codes[i] ));
+        }
+
+        if (counter + n - 1 == last)
+            break;
+    }
+
+    out_done();
+}
+
+//---------------------------------------------------------------------
+//                          --import
+//---------------------------------------------------------------------
+//
+//  --import: the input is enrolment data, i.e. otpauth:// URIs and
+//  otpauth-migration:// export payloads (the latter usually holding
+//  many secrets each), as well as any ordinary secret lines. Each of
+//  their secrets is then processed exactly as if it had been a line of
+//  its own (see totp_import_line). HOTP ones are only accepted with
+//  --hotp, their counters then seeding the counter log (unless it's
+//  already further on), and are otherwise invalid.
+//
+//---------------------------------------------------------------------
+
+static totp_import*  g_importer = NULL;     // (--import)
+
+// The input's next secret: rc TOTP_OK, or TOTP_SKIP (a blank or comment
+// line), or TOTP_EINVAL (already reported). False at EOF...
+
+static bool next_secret( input* in, totp_secret* s, int* rc )
+{
+    const char*  line;
+    const char*  error = NULL;
+    size_t       len;
+    uint64_t     counter;
+
+    if (!g_importer)
+    {
+        if (!input_line( in, &line, &len ))
+            return false;
+
+        if ((*rc = totp_parse_line( s, line, len )) == TOTP_EINVAL)
+            report_invalid( in->lineno, line, len );
+
+        return true;
+    }
+
+    // (the rest of the current line's secrets, if any, then the next line)
+
+    if ((*rc = totp_import_next( g_importer, s )) == TOTP_SKIP)
+    {
+        if (!input_line( in, &line, &len ))
+            return false;
+
+        if ((*rc = totp_import_line( g_importer, line, len )) == TOTP_OK)
+            *rc = totp_import_next( g_importer, s );
+    }
+
+    if (*rc == TOTP_OK && totp_import_counter( g_importer, &counter ) == TOTP_OK)
+    {
+        if (!g_hotp)
+            error = "HOTP secret (needs --hotp)";
+        else if (1
+            && counter > totp_counters_get( g_counters, s->label, s->label_len )
+            && totp_counters_advance( g_counters, s->label, s->label_len, counter ) != TOTP_OK
+        )
+            error = "cannot seed its counter";
+
+        if (error)
+        {
+            totp_wipe( s );
+            *rc = TOTP_EINVAL;
+        }
+    }
+
+    if (*rc == TOTP_EINVAL)
+    {
+        if (!error)
+            error = totp_import_error( g_importer ) ? totp_import_error( g_importer ) : "invalid";
+
+        STAT_INVALID( error );
+
+        out_flush();    // (keep it in sequence with our output)
+
+        fprintf( stderr, "WARNING: line %lu: %s\n", (unsigned long) in->lineno, error );
+    }
+
+    return true;
+}
+
+//---------------------------------------------------------------------
+//                          process_lines
+//---------------------------------------------------------------------
+
+static int process_lines( input* in )
+{
+    const char*    line;
+    size_t         len;
+    totp_secret    secret;
+    uint32_t       code;
+    int64_t        t;
+    int            rc;
+
+    //-----------------------------------------------------------------
+    // Read input string (see documentation for format) from stdin,
+    // and calculate the corresponding TOTP value. Keep doing this
+    // until EOF is reached on stdin.
+    //-----------------------------------------------------------------
+
+    for (;;)
+    {
+        STAT_POLL();
+
+        if (g_importer)                 // (--import: lines are read as needed)
+        {
+            STAT_START( t_import );
+
+            if (!next_secret( in, &secret, &rc ))
+                break;
+
+            STAT_STOP( &g_stats, STAT_PARSE, t_import, 1 );
+        }
+        else
+        {
+            STAT_START( t_input );
+
+            if (!input_line( in, &line, &len ))
+                break;
+
+            STAT_STOP( &g_stats, STAT_INPUT, t_input, 1 );
+
+            // Parse the line, and calculate and output the resulting "Time-
+            // based One-Time-Password" (TOTP) verification code... (but don't
+            // bother unless it's a secret and *ALL* its parameters are valid!)
+
+            STAT_START( t_parse );
+
+            if ((rc = totp_parse_line( &secret, line, len )) == TOTP_EINVAL)
+                report_invalid( in->lineno, line, len );
+
+            STAT_STOP( &g_stats, STAT_PARSE, t_parse, 1 );
+        }
+
+        STAT_LINE( &g_stats, rc, &secret );
+
+        if (rc != TOTP_OK)
+            continue;
+
+        t = time( NULL );
+
+        if (g_ranges)
+        {
+            STAT_START( t_range );          // (calculated and output together)
+            print_range( &secret, t );
+            STAT_STOP( &g_stats, STAT_HASH, t_range, 1 );
+        }
+        else
+        {
+            STAT_START( t_hash );
+
+            if (!g_counters)
+                code = totp_generate( &secret, t );
+            else if (!hotp_next( &secret, &code ))
+            {
+                totp_wipe( &secret );
+                continue;
+            }
+
+            STAT_STOP( &g_stats, STAT_HASH, t_hash, 1 );
+
+            STAT_START( t_output );
+            print_code( &secret, code, t );
+            STAT_STOP( &g_stats, STAT_OUTPUT, t_output, 1 );
+        }
+
+        totp_wipe( &secret );
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//---------------------------------------------------------------------
+//                          Input chunks
+//---------------------------------------------------------------------
+//
+//  A chunk is up to BATCH_LINES input lines, along with everything
+//  needed to calculate all of their codes at once (see calc_chunk),
+//  and optionally, their formatted output (see format_chunk). Used by
+//  both --batch and --threads.
+//
+//---------------------------------------------------------------------
+
+struct chunk
+{
+    arena                mem;       // (all of the below arrays)
+    arena                text;      // (copy of lines if input not mapped)
+
+    const char**         lines;     // (input lines)
+    size_t*              lens;      // (their lengths)
+    size_t               n;         // (number of lines in chunk)
+    size_t               first_line;    // (line number of lines[0])
+    int64_t              at_time;   // (when the chunk was read)
+
+    totp_secret*         secrets;   // (parsed secrets, one per line)
+    int*                 rc;        // (totp_parse return code per line)
+    const totp_secret**  valid;     // (those which parsed OK)
+    uint32_t*            codes;     // (their calculated codes)
+    size_t               nvalid;    // (number of valid secrets)
+
+    char*                out;       // (formatted output)
+    size_t               outlen;    // (length of formatted output)
+    size_t               outsize;   // (size of output buffer)
+    ssize_t              test_at;   // (offset of first TEST: line or -1)
+
+    volatile int         state;     // (--threads: CHUNK_xxx)
+
+#ifndef TOTP_NO_STATS
+    stats                st;        // (--stats for this chunk)
+#endif
+};
+
+#define CHUNK_FREE      0           // (available to be read into)
+#define CHUNK_READY     1           // (read; waiting for a worker)
+#define CHUNK_BUSY      2           // (being calculated by a worker)
+#define CHUNK_DONE      3           // (calculated; waiting to be written)
+
+#define CHUNK_TEXT      (BATCH_LINES * 128)     // (text arena size)
+
+// Allocate a chunk's arrays, all from the one secure arena (its text
+// arena is only allocated once it's needed; see read_chunk)...
+
+static bool alloc_chunk( chunk* c )
+{
+    size_t  size = BATCH_LINES * (0
+        + sizeof( char* ) + sizeof( size_t ) + sizeof( totp_secret )
+        + sizeof( int ) + sizeof( totp_secret* ) + sizeof( uint32_t ))
+        + 6 * 8;                    // (each array 8 byte aligned)
+
+    memset( c, 0, sizeof( *c ));
+
+    if (!arena_init( &c->mem, size ))
+        return false;
+
+    c->lines     = (const char**)         arena_alloc( &c->mem, BATCH_LINES * sizeof( char* ));
+    c->lens      = (size_t*)              arena_alloc( &c->mem, BATCH_LINES * sizeof( size_t ));
+    c->secrets   = (totp_secret*)         arena_alloc( &c->mem, BATCH_LINES * sizeof( totp_secret ));
+    c->rc        = (int*)                 arena_alloc( &c->mem, BATCH_LINES * sizeof( int ));
+    c->valid     = (const totp_secret**)  arena_alloc( &c->mem, BATCH_LINES * sizeof( totp_secret* ));
+    c->codes     = (uint32_t*)            arena_alloc( &c->mem, BATCH_LINES * sizeof( uint32_t ));
+
+    return true;
+}
+
+static void free_chunk( chunk* c )
+{
+    arena_free( &c->mem );
+    arena_free( &c->text );
+    free( c->out );
+}
+
+// Read the next chunk of lines. Returns false once EOF is reached
+// (but the chunk may still contain lines which must be processed).
+// Unless the input is memory mapped (in which case the lines simply
+// point into it), the lines must be copied, since they need to stay
+// put until the chunk has been written: into the chunk's text arena,
+// which is zeroed and reused for each chunk. Should it fill up, the
+// chunk simply ends early (the line is left for the next chunk); only
+// a single line bigger than the whole arena makes it grow.
+
+static bool read_chunk( chunk* c, input* in )
+{
+    const char*  line;
+    char*        copy;
+    size_t       len;
+    bool         more = true;
+
+    STAT_START( t_input );
+
+    // (zero the previous chunk's secrets, even those which didn't parse)
+
+    totp_cleanse( c->secrets, c->n * sizeof( totp_secret ));
+
+    c->at_time    = time( NULL );
+    c->first_line = in->lineno + 1;
+
+    if (!in->mapped)
+    {
+        if (c->text.base)
+            arena_reset( &c->text );
+        else if (!arena_init( &c->text, CHUNK_TEXT ))
+        {
+            fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+            exit( EXIT_FAILURE );
+        }
+    }
+
+    for (c->n=0; c->n < BATCH_LINES; c->n++)
+    {
+        if (!(more = input_line( in, &line, &len )))
+            break;
+
+        if (!in->mapped)
+        {
+            if (!(copy = (char*) arena_alloc( &c->text, len )))
+            {
+                if (c->n)
+                {
+                    input_unread( in );     // (next chunk's first line)
+                    break;
+                }
+
+                arena_free( &c->text );
+
+                if (!arena_init( &c->text, len ) || !(copy = (char*) arena_alloc( &c->text, len )))
+                {
+                    fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+                    exit( EXIT_FAILURE );
+                }
+            }
+
+            line = (const char*) memcpy( copy, line, len );
+        }
+
+        c->lines[ c->n ] = line;
+        c->lens [ c->n ] = len;
+    }
+
+    STAT_STOP( &c->st, STAT_INPUT, t_input, c->n );
+
+    return more;
+}
+
+// Parse the chunk's lines and calculate all of their codes at once
+// via totp_generate_batch, which processes many secrets in parallel
+// (SIMD) using multi-buffer HMAC kernels.
+
+static void calc_chunk( chunk* c )
+{
+    size_t  i;
+
+    STAT_START( t_parse );
+
+    for (i=0, c->nvalid=0; i < c->n; i++)
+    {
+        if ((c->rc[i] = totp_parse_line( &c->secrets[i], c->lines[i], c->lens[i] )) == TOTP_OK)
+            c->valid[ c->nvalid++ ] = &c->secrets[i];
+
+        STAT_LINE( &c->st, c->rc[i], &c->secrets[i] );
+    }
+
+    STAT_STOP( &c->st, STAT_PARSE, t_parse, c->n );
+    STAT_START( t_hash );
+
+    for (i=0; i < c->nvalid; i++)
+        totp_precompute( (totp_secret*) c->valid[i] );
+
+    totp_generate_batch( c->valid, c->at_time, c->codes, c->nvalid );
+
+    STAT_STOP( &c->st, STAT_HASH, t_hash, c->nvalid );
+}
+
+// Format the chunk's codes into its output buffer in original input
+// order, wiping its secrets as we go. Returns false if out of memory.
+
+static bool format_chunk( chunk* c )
+{
+    const totp_secret*  s;
+    size_t              i, v, need;
+
+    STAT_START( t_output );
+
+    c->outlen  = 0;
+    c->test_at = -1;
+
+    for (i=0, v=0; i < c->n; i++)
+    {
+        if (c->rc[i] != TOTP_OK)
+            continue;
+
+        s = &c->secrets[i];
+
+        if ((need = c->outlen + line_maxlen( s )) > c->outsize)
+        {
+            char*  out;
+
+            need = need < 64*1024 ? 64*1024 : need * 2;
+
+            if (!(out = (char*) mem_realloc( c->out, need )))
+                return false;
+
+            c->out     = out;
+            c->outsize = need;
+        }
+
+        if ((s->flags & TOTP_F_TEST) && c->test_at < 0 && g_format == FORMAT_TEXT)
+            c->test_at = (ssize_t) c->outlen;
+
+        c->outlen += format_line( c->out + c->outlen, s, c->codes[ v++ ], c->at_time );
+        totp_wipe( &c->secrets[i] );
+    }
+
+    STAT_STOP( &c->st, STAT_OUTPUT, t_output, c->nvalid );
+
+    return true;
+}
+
+// Write a formatted chunk to stdout (with the "TEST:" header before
+// the first "TEST:" line's output, just like print_code), and then
+// report any of its lines which were rejected (in original order).
+
+static void write_chunk( chunk* c )
+{
+    size_t  hdr = c->test_at < 0 ? c->outlen : (size_t) c->test_at;
+    size_t  i;
+
+    STAT_START( t_output );
+
+    if (g_format == FORMAT_TSV && c->outlen)
+        print_tsv_hdr();
+
+    out_write( c->out, hdr );
+
+    if (c->test_at >= 0)
+    {
+        print_test_hdr();
+        out_write( c->out + hdr, c->outlen - hdr );
+    }
+
+    out_done();
+
+    STAT_STOP( &c->st, STAT_OUTPUT, t_output, 0 );
+    STAT_MERGE( &c->st );
+
+    for (i=0; i < c->n; i++)
+        if (c->rc[i] == TOTP_EINVAL)
+            report_invalid( c->first_line + i, c->lines[i], c->lens[i] );
+}
+
+//---------------------------------------------------------------------
+//                          process_batch
+//---------------------------------------------------------------------
+//
+//  Same as process_lines, but reads up to BATCH_LINES lines at a time
+//  and calculates all of their codes at once (see calc_chunk). The
+//  codes are then output in original input order.
+//
+//---------------------------------------------------------------------
+
+static int process_batch( input* in )
+{
+    chunk   c;
+    size_t  i, v;
+    bool    more;
+
+    if (!alloc_chunk( &c ))
+    {
+        fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+        free_chunk( &c );
+        return EXIT_FAILURE;
+    }
+
+    for (more = true; more;)
+    {
+        STAT_POLL();
+
+        more = read_chunk( &c, in );
+        calc_chunk( &c );
+
+        // Output them in original input order...
+
+        STAT_START( t_output );
+
+        for (i=0, v=0; i < c.n; i++)
+        {
+            if (c.rc[i] == TOTP_OK)
+            {
+                print_code( &c.secrets[i], c.codes[ v++ ], c.at_time );
+                totp_wipe( &c.secrets[i] );
+            }
+            else if (c.rc[i] == TOTP_EINVAL)
+                report_invalid( c.first_line + i, c.lines[i], c.lens[i] );
+        }
+
+        STAT_STOP( &c.st, STAT_OUTPUT, t_output, c.nvalid );
+        STAT_MERGE( &c.st );
+    }
+
+    // Cleanup and exit...
+
+    free_chunk( &c );
+
+    return EXIT_SUCCESS;
+}
+
+//---------------------------------------------------------------------
+//                         Threading helpers
+//---------------------------------------------------------------------
+
+#ifdef _WIN32
+
+typedef HANDLE              thread_t;
+typedef CRITICAL_SECTION    lock_t;
+typedef CONDITION_VARIABLE  cond_t;
+
+#define THREAD_PROC( name )         static DWORD WINAPI name( LPVOID arg )
+#define THREAD_RETURN               return 0
+
+#define lock_init( l )              InitializeCriticalSection( l )
+#define lock_destroy( l )           DeleteCriticalSection( l )
+#define lock_obtain( l )            EnterCriticalSection( l )
+#define lock_release( l )           LeaveCriticalSection( l )
+
+#define cond_init( c )              InitializeConditionVariable( c )
+#define cond_destroy( c )           /* (nothing to do) */
+#define cond_wait( c, l )           SleepConditionVariableCS( c, l, INFINITE )
+#define cond_broadcast( c )         WakeAllConditionVariable( c )
+
+static bool thread_create( thread_t* t, LPTHREAD_START_ROUTINE proc, void* arg )
+{
+    return (*t = CreateThread( NULL, 0, proc, arg, 0, NULL )) != NULL;
+}
+
+static void thread_join( thread_t t )
+{
+    WaitForSingleObject( t, INFINITE );
+    CloseHandle( t );
+}
+
+static int num_cpus()
+{
+    SYSTEM_INFO  si;
+
+    GetSystemInfo( &si );
+    return (int) si.dwNumberOfProcessors;
+}
+
+#else // (POSIX)
+
+typedef pthread_t           thread_t;
+typedef pthread_mutex_t     lock_t;
+typedef pthread_cond_t      cond_t;
+
+#define THREAD_PROC( name )         static void* name( void* arg )
+#define THREAD_RETURN               return NULL
+
+#define lock_init( l )              pthread_mutex_init( l, NULL )
+#define lock_destroy( l )           pthread_mutex_destroy( l )
+#define lock_obtain( l )            pthread_mutex_lock( l )
+#define lock_release( l )           pthread_mutex_unlock( l )
+
+#define cond_init( c )              pthread_cond_init( c, NULL )
+#define cond_destroy( c )           pthread_cond_destroy( c )
+#define cond_wait( c, l )           pthread_cond_wait( c, l )
+#define cond_broadcast( c )         pthread_cond_broadcast( c )
+
+static bool thread_create( thread_t* t, void* (*proc)( void* ), void* arg )
+{
+    return pthread_create( t, NULL, proc, arg ) == 0;
+}
+
+static void thread_join( thread_t t )
+{
+    pthread_join( t, NULL );
+}
+
+static int num_cpus()
+{
+    long  n = sysconf( _SC_NPROCESSORS_ONLN );
+    return n > 0 ? (int) n : 1;
+}
+
+#endif
+
+//---------------------------------------------------------------------
+//                          process_threads
+//---------------------------------------------------------------------
+//
+//  Same as process_batch, but with the chunks being calculated and
+//  formatted by a pool of worker threads, while the main thread reads
+//  the input and writes the output, in original input order:
+//
+//  The chunks form a ring (of twice as many chunks as threads, so
+//  each worker always has another chunk waiting for it). The main
+//  thread reads into the next FREE chunk, marking it READY. Whichever
+//  worker is free next claims the oldest READY chunk, calculates and
+//  formats it and marks it DONE. The main thread then writes the DONE
+//  chunks out strictly in the order they were read, making each one
+//  FREE once again. Chunks are small enough, and claimed dynamically
+//  enough, that every worker stays busy until the input runs out.
+//
+//---------------------------------------------------------------------
+
+struct pool
+{
+    chunk*    chunks;               // (ring of chunks)
+    size_t    nchunks;              // (number of chunks in ring)
+    size_t    next_claim;           // (sequence number of next to claim)
+    size_t    nread;                // (number of chunks read so far)
+    bool      eof;                  // (all input has been read)
+    bool      failed;               // (a worker ran out of memory)
+
+    lock_t    lock;
+    cond_t    ready;                // (a chunk became READY, or eof)
+    cond_t    done;                 // (a chunk became DONE)
+};
+
+THREAD_PROC( worker_thread )
+{
+    pool*   p = (pool*) arg;
+    chunk*  c;
+    bool    ok;
+
+    lock_obtain( &p->lock );
+
+    for (;;)
+    {
+        // Wait for the oldest unclaimed chunk to be READY...
+
+        while (p->next_claim >= p->nread && !p->eof)
+            cond_wait( &p->ready, &p->lock );
+
+        if (p->next_claim >= p->nread)
+            break;                          // (eof; no more work)
+
+        c = &p->chunks[ p->next_claim++ % p->nchunks ];
+        c->state = CHUNK_BUSY;
+
+        lock_release( &p->lock );
+        {
+            calc_chunk( c );
+            ok = format_chunk( c );
+        }
+        lock_obtain( &p->lock );
+
+        if (!ok)
+            p->failed = true;
+
+        c->state = CHUNK_DONE;
+        cond_broadcast( &p->done );
+    }
+
+    lock_release( &p->lock );
+
+    THREAD_RETURN;
+}
+
+static int process_threads( input* in )
+{
+    pool       p;
+    thread_t*  threads;
+    chunk*     c;
+    size_t     nwritten, i;
+    int        nthreads, t;
+    bool       more, ok;
+
+    nthreads = g_threads;
+
+    memset( &p, 0, sizeof( p ));
+    p.nchunks = 2 * nthreads;
+
+    threads  = (thread_t*) mem_calloc( nthreads, sizeof( thread_t ));
+    p.chunks = (chunk*)    mem_calloc( p.nchunks, sizeof( chunk ));
+
+    for (ok = threads && p.chunks, i=0; ok && i < p.nchunks; i++)
+        ok = alloc_chunk( &p.chunks[i] );
+
+    if (!ok)
+    {
+        fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    lock_init( &p.lock );
+    cond_init( &p.ready );
+    cond_init( &p.done );
+
+    for (t=0; t < nthreads; t++)
+    {
+        if (!thread_create( &threads[t], worker_thread, &p ))
+        {
+            fprintf( stderr, "ERROR: thread creation FAILED! - %s\n", strerror( errno ));
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Read chunks into the ring while writing completed ones out...
+
+    for (nwritten=0, more=true; more || nwritten < p.nread;)
+    {
+        STAT_POLL();
+
+        if (more && p.nread - nwritten < p.nchunks)
+        {
+            c = &p.chunks[ p.nread % p.nchunks ];     // (must be FREE)
+
+            more = read_chunk( c, in );
+
+            lock_obtain( &p.lock );
+            {
+                c->state = CHUNK_READY;
+                p.nread++;
+                p.eof = !more;
+            }
+            lock_release( &p.lock );
+
+            cond_broadcast( &p.ready );
+            continue;
+        }
+
+        // (the oldest chunk must be written before reading any more)
+
+        c = &p.chunks[ nwritten % p.nchunks ];
+
+        lock_obtain( &p.lock );
+        {
+            while (c->state != CHUNK_DONE)
+                cond_wait( &p.done, &p.lock );
+        }
+        lock_release( &p.lock );
+
+        write_chunk( c );
+        c->state = CHUNK_FREE;
+        nwritten++;
+    }
+
+    // Cleanup and exit...
+
+    for (t=0; t < nthreads; t++)
+        thread_join( threads[t] );
+
+    cond_destroy( &p.done );
+    cond_destroy( &p.ready );
+    lock_destroy( &p.lock );
+
+    for (i=0; i < p.nchunks; i++)
+        free_chunk( &p.chunks[i] );
+
+    free( p.chunks );
+    free( threads );
+
+    if (p.failed)
+    {
+        fprintf( stderr, "ERROR: malloc() FAILED!\n" );
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//---------------------------------------------------------------------
+//                              watch
+//---------------------------------------------------------------------
+//
+//  --watch: rather than exiting once all the secrets' codes have been
+//  output, keep the secrets resident and sleep until the next time any
+//  of their codes changes, then output just the codes which did change
+//  (and so on, until interrupted), each with how many seconds it will
+//  remain valid for:
+//
+//      "123456  30s  adam@acme.org"
+//
+//  Secrets are kept in a min-heap ordered by when their current codes
+//  expire, so each wakeup only ever looks at those which changed, no
+//  matter how many secrets there are or what their intervals are (e.g.
+//  Authy's 10 second intervals vs. the usual 30). "TEST:" secrets never
+//  change, so are only output the once.
+//
+//---------------------------------------------------------------------
+
+#define NEVER   INT64_MAX           // (code never expires)
+
+struct watched
+{
+    int64_t  expires;               // (when its code expires)
+    size_t   i;                     // (which secret)
+};
+
+static int64_t now_ms()
+{
+#ifdef _WIN32
+    FILETIME        ft;
+    ULARGE_INTEGER  u;
+
+    GetSystemTimeAsFileTime( &ft );
+    u.LowPart  = ft.dwLowDateTime;
+    u.HighPart = ft.dwHighDateTime;
+
+    return (int64_t) (u.QuadPart / 10000) - 11644473600000LL;  // (from 1601)
+#else
+    struct timespec  ts;
+
+    clock_gettime( CLOCK_REALTIME, &ts );
+
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+static void sleep_ms( int64_t ms )
+{
+#ifdef _WIN32
+    Sleep( (DWORD) ms );
+#else
+    struct timespec  ts;
+
+    ts.tv_sec  = (time_t) (ms / 1000);
+    ts.tv_nsec = (long)   (ms % 1000) * 1000000;
+
+    nanosleep( &ts, NULL );     // (woken early by a signal is fine)
+#endif
+}
+
+// When the secret's code for the given time expires...
+
+static int64_t code_expires( const totp_secret* s, int64_t at_time )
+{
+    uint64_t  next;
+    int64_t   origin = s->offset;
+
+    if (s->flags & TOTP_F_TEST)
+        return NEVER;
+
+    next = totp_counter( s, at_time ) + 1;
+
+    if (next > (uint64_t) (NEVER - (origin > 0 ? origin : 0)) / s->interval)
+        return NEVER;
+
+    return origin + (int64_t) (next * s->interval);
+}
+
+static void heap_push( watched* heap, size_t* n, watched w )
+{
+    size_t  i, parent;
+
+    for (i = (*n)++; i && heap[ parent = (i - 1) / 2 ].expires > w.expires; i = parent)
+        heap[i] = heap[ parent ];
+
+    heap[i] = w;
+}
+
+static watched heap_pop( watched* heap, size_t* n )
+{
+    watched  top  = heap[0];
+    watched  last = heap[ --*n ];
+    size_t   i, child;
+
+    for (i=0; (child = i*2 + 1) < *n; i = child)
+    {
+        if (child + 1 < *n && heap[ child + 1 ].expires < heap[ child ].expires)
+            child++;
+
+        if (last.expires <= heap[ child ].expires)
+            break;
+
+        heap[i] = heap[ child ];
+    }
+
+    if (*n)
+        heap[i] = last;
+
+    return top;
+}
+
+static int cmp_index( const void* a, const void* b )
+{
+    size_t  x = ((const watched*) a)->i;
+    size_t  y = ((const watched*) b)->i;
+
+    return x < y ? -1 : x > y;
+}
+
+static void print_watched( const totp_secret* s, uint32_t code, int64_t expires, int64_t t )
+{
+    char*  p;
+    char*  d;
+
+    if (g_format == FORMAT_TSV)
+        print_tsv_hdr();
+
+    if (!(p = out_begin( line_maxlen( s ) + 24 )))
+        return;
+
+    if (g_format != FORMAT_TEXT)
+    {
+        out_end( p, format_record( p, s, totp_counter( s, t ), code ));
+        return;
+    }
+
+    // (the same as format_code, but with the expiry before the label)
+
+    d  = p + put_code( p, code, s->digits );
+    *d++ = ' ', *d++ = ' ';
+
+    if (expires == NEVER)
+        *d++ = '-';
+    else
+        d += put_int( d, expires - t ), *d++ = 's';
+
+    *d++ = ' ', *d++ = ' ';
+    d += copy_label( d, s );
+    *d++ = '\n';
+
+    out_end( p, d - p );
+}
+
+static int watch( totp_secret* secrets, size_t n )
+{
+    const totp_secret**  valid;
+    watched*             heap;
+    watched*             changed;
+    uint32_t*            codes;
+    size_t               nheap, nchanged, i;
+    int64_t              t, ms;
+
+    valid   = (const totp_secret**) mem_alloc( (n + 1) * sizeof( totp_secret* ));
+    heap    = (watched*)            mem_alloc( (n + 1) * sizeof( watched ));
+    changed = (watched*)            mem_alloc( (n + 1) * sizeof( watched ));
+    codes   = (uint32_t*)           mem_alloc( (n + 1) * sizeof( uint32_t ));
+
+    if (!valid || !heap || !changed || !codes)
+    {
+        fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+        free( valid ), free( heap ), free( changed ), free( codes );
+        return EXIT_FAILURE;
+    }
+
+    // Output all of their current codes to begin with...
+
+    t = now_ms() / 1000;
+
+    STAT_START( t_hash );
+
+    for (i=0; i < n; i++)
+    {
+        if (!(secrets[i].flags & TOTP_F_MIDSTATE))
+            totp_precompute( &secrets[i] );
+
+        valid[i] = &secrets[i];
+    }
+
+    totp_generate_batch( valid, t, codes, n );
+
+    STAT_STOP( &g_stats, STAT_HASH, t_hash, n );
+    STAT_START( t_output );
+
+    for (i=0, nheap=0; i < n; i++)
+    {
+        watched  w = { code_expires( &secrets[i], t ), i };
+
+        print_watched( &secrets[i], codes[i], w.expires, t );
+
+        if (w.expires != NEVER)
+            heap_push( heap, &nheap, w );
+    }
+
+    out_done();
+
+    STAT_STOP( &g_stats, STAT_OUTPUT, t_output, n );
+
+    // Then, until interrupted, whichever ones change...
+
+    while (nheap)
+    {
+        STAT_POLL();
+
+        if ((ms = heap[0].expires * 1000 - now_ms()) > 0)
+        {
+            out_idle();
+            sleep_ms( ms < WATCH_MAX_SLEEP ? ms : WATCH_MAX_SLEEP );
+            continue;   // (make sure it really is time)
+        }
+
+        t = now_ms() / 1000;
+
+        for (nchanged=0; nheap && heap[0].expires <= t;)
+            changed[ nchanged++ ] = heap_pop( heap, &nheap );
+
+        qsort( changed, nchanged, sizeof( watched ), cmp_index );   // (input order)
+
+        for (i=0; i < nchanged; i++)
+            valid[i] = &secrets[ changed[i].i ];
+
+        STAT_START( t_hash );
+        totp_generate_batch( valid, t, codes, nchanged );
+        STAT_STOP( &g_stats, STAT_HASH, t_hash, nchanged );
+
+        STAT_START( t_output );
+
+        for (i=0; i < nchanged; i++)
+        {
+            changed[i].expires = code_expires( valid[i], t );
+            print_watched( valid[i], codes[i], changed[i].expires, t );
+            heap_push( heap, &nheap, changed[i] );
+        }
+
+        out_done();
+
+        STAT_STOP( &g_stats, STAT_OUTPUT, t_output, nchanged );
+    }
+
+    free( valid );
+    free( heap );
+    free( changed );
+    free( codes );
+
+    return EXIT_SUCCESS;
+}
+
+// --watch or --audit with input secrets: read and parse all of them
+// first (their labels being copied, since the input lines don't stay
+// put), then 'use' them...
+
+static int resident_input( input* in, int (*use)( totp_secret* secrets, size_t n ))
+{
+    totp_secret*  secrets = NULL;
+    char*         labels  = NULL;
+    size_t        n = 0, max = 0, used = 0, size = 0, i;
+    const char*   line;
+    size_t        len;
+    int           rc;
+
+    while (input_line( in, &line, &len ))
+    {
+        if (n >= max)
+        {
+            max = max ? max * 2 : 64;
+
+            if (!(secrets = (totp_secret*) secure_realloc( secrets, max * sizeof( totp_secret ))))
+            {
+                fprintf( stderr, "ERROR: realloc() FAILED! - %s\n", strerror( errno ));
+                return EXIT_FAILURE;
+            }
+        }
+
+        STAT_START( t_parse );
+
+        rc = totp_parse_line( &secrets[n], line, len );
+
+        STAT_STOP( &g_stats, STAT_PARSE, t_parse, 1 );
+        STAT_LINE( &g_stats, rc, &secrets[n] );
+
+        switch (rc)
+        {
+            case TOTP_OK:     break;
+            case TOTP_SKIP:   continue;
+            default:          report_invalid( in->lineno, line, len ); continue;
+        }
+
+        if (used + secrets[n].label_len > size)
+        {
+            size = (used + secrets[n].label_len) * 2 + 4096;
+
+            if (!(labels = (char*) mem_realloc( labels, size )))
+            {
+                fprintf( stderr, "ERROR: realloc() FAILED! - %s\n", strerror( errno ));
+                return EXIT_FAILURE;
+            }
+        }
+
+        memcpy( labels + used, secrets[n].label, secrets[n].label_len );
+        used += secrets[ n++ ].label_len;
+    }
+
+    // (the copies' addresses are only final once all have been copied)
+
+    for (i=0, used=0; i < n; used += secrets[ i++ ].label_len)
+        secrets[i].label = labels + used;
+
+    rc = use( secrets, n );
+
+    for (i=0; i < n; i++)
+        totp_wipe( &secrets[i] );
+
+    secure_free( secrets );
+    free( labels );
+
+    return rc;
+}
+
+//---------------------------------------------------------------------
+//                              audit
+//---------------------------------------------------------------------
+//
+//  --audit LOG: check a log of the codes which were entered (e.g. a
+//  month of logins) against the secrets, i.e. whether each one really
+//  was valid (to within --window time steps) when it was entered. Each
+//  line of the log is a record of the secret's name, when the code was
+//  entered (Unix time, or UTC as e.g. 2026-10-17T09:30:00Z) and the
+//  code, separated by blanks (the name being everything before them):
+//
+//      "adam@acme.org  1792206600  01360115"
+//
+//  Output (in log order) is each record whose code did NOT match, or
+//  whose name isn't any secret's, followed by a summary of the counts
+//  and of how far off (the drift, in time steps) the matches were:
+//
+//      "1234  1792206600  01360115  MISMATCH  adam@acme.org"
+//
+//  Rather than verifying each record on its own, the records are sorted
+//  by secret and then time step, so that each secret's records' windows
+//  are calculated together as ranges of consecutive codes (using the
+//  secret's precomputed HMAC midstates, and the multi-buffer kernels;
+//  see totp_hotp_range), nearby windows (e.g. retries) sharing codes.
+//  The sorted records are then split into many small units of work,
+//  claimed by a pool of --threads threads (default: one per CPU). The
+//  exit code is success only if every record was valid and matched.
+//
+//---------------------------------------------------------------------
+
+#define AUDIT_UNKNOWN   UINT32_MAX  // (record's name isn't any secret's)
+#define AUDIT_MISMATCH  INT32_MIN   // (record's code didn't match)
+#define AUDIT_GAP       16          // (most codes calculated to join two windows)
+#define AUDIT_UNITS     16          // (units of work per thread)
+
+struct audit_rec
+{
+    uint64_t  counter;              // (time step; if unknown, name's offset)
+    int64_t   at_time;              // (when the code was entered)
+    size_t    lineno;               // (log line number)
+    uint32_t  secret;               // (secret's index, or AUDIT_UNKNOWN)
+    uint32_t  code;                 // (code entered)
+    int32_t   drift;                // (time steps off, or AUDIT_MISMATCH)
+    uint8_t   digits;               // (number of digits entered)
+};
+
+struct audit_job
+{
+    const totp_secret*  secrets;    // (the secrets)
+    audit_rec*          recs;       // (the known records, sorted)
+    size_t              nrecs;      // (number of known records)
+    size_t              unit;       // (records per unit of work)
+    size_t              next;       // (first record of next unit)
+    uint64_t            drifts[ 2*MAX_WINDOW + 1 ];    // (-window to +window)
+
+    lock_t              lock;
+};
+
+// Parse the decimal digits of p[0] to p[n-1] (-1 if not all digits)...
+
+static int64_t parse_digits( const char* p, size_t n )
+{
+    int64_t  v = 0;
+
+    for (; n; n--, p++)
+    {
+        if (!isdigit( (unsigned char) *p ))
+            return -1;
+
+        v = v * 10 + (*p - '0');
+    }
+
+    return v;
+}
+
+// Unix time from Unix time, or from UTC as "YYYY-MM-DDThh:mm:ss[Z]"...
+
+static bool parse_time( const char* p, size_t len, int64_t* t )
+{
+    int64_t  y, mo, d, h, mi, s, days;
+
+    if (len && len <= 18 && (*t = parse_digits( p, len )) >= 0)
+        return true;
+
+    if (0
+        || (len != 19 && (len != 20 || (p[19] != 'Z' && p[19] != 'z')))
+        || p[4] != '-' || p[7] != '-' || (p[10] != 'T' && p[10] != 't') || p[13] != ':' || p[16] != ':'
+        || (y  = parse_digits( p +  0, 4 )) < 1970
+        || (mo = parse_digits( p +  5, 2 )) < 1 || mo > 12
+        || (d  = parse_digits( p +  8, 2 )) < 1 || d  > 31
+        || (h  = parse_digits( p + 11, 2 )) < 0 || h  > 23
+        || (mi = parse_digits( p + 14, 2 )) < 0 || mi > 59
+        || (s  = parse_digits( p + 17, 2 )) < 0 || s  > 60
+    )
+        return false;
+
+    // (days since 1970-01-01 of a March based year, so that February
+    // and its leap day come last)
+
+    y -= mo <= 2;
+    mo = mo > 2 ? mo - 3 : mo + 9;
+
+    days = y * 365 + y / 4 - y / 100 + y / 400 + (153 * mo + 2) / 5 + d - 1 - 719468;
+
+    *t = days * 86400 + h * 3600 + mi * 60 + s;
+    return true;
+}
+
+// The last blank separated token before 'end' (whose length is 'len'),
+// 'end' then being moved back to its start...
+
+static const char* last_token( const char* line, const char** end, size_t* len )
+{
+    const char*  e = *end;
+    const char*  p;
+
+    while (e > line && isspace( (unsigned char) e[-1] ))
+        e--;
+
+    for (p = e; p > line && !isspace( (unsigned char) p[-1] ); p--)
+        ;
+
+    *len = e - p;
+    *end = p;
+
+    return p;
+}
+
+// Parse a log record: "NAME TIME CODE"...
+
+static bool parse_record( const char* line, size_t len, const char** name, size_t* name_len,
+                          int64_t* at_time, uint32_t* code, uint8_t* digits )
+{
+    const char*  end = line + len;
+    const char*  p;
+    int64_t      v;
+    size_t       n;
+
+    p = last_token( line, &end, &n );
+
+    if (n < 1 || n > 10 || (v = parse_digits( p, n )) < 0 || v > UINT32_MAX)
+        return false;
+
+    *code   = (uint32_t) v;
+    *digits = (uint8_t)  n;
+
+    p = last_token( line, &end, &n );
+
+    if (!parse_time( p, n, at_time ))
+        return false;
+
+    while (line < end && strchr( " \t*#;", *line ))
+        line++;
+
+    while (end > line && isspace( (unsigned char) end[-1] ))
+        end--;
+
+    *name     = line;
+    *name_len = end - line;
+
+    return *name_len != 0;
+}
+
+static int cmp_audit_order( const void* a, const void* b )   // (by secret, then time step)
+{
+    const audit_rec*  x = (const audit_rec*) a;
+    const audit_rec*  y = (const audit_rec*) b;
+
+    if (x->secret  != y->secret)  return x->secret  < y->secret  ? -1 : 1;
+    if (x->counter != y->counter) return x->counter < y->counter ? -1 : 1;
+
+    return x->lineno < y->lineno ? -1 : x->lineno > y->lineno;
+}
+
+static int cmp_audit_line( const void* a, const void* b )    // (log order)
+{
+    size_t  x = (*(const audit_rec* const*) a)->lineno;
+    size_t  y = (*(const audit_rec* const*) b)->lineno;
+
+    return x < y ? -1 : x > y;
+}
+
+// Verify a unit of (sorted) records: each run of the same secret's
+// records whose windows (nearly) overlap is calculated as one range of
+// consecutive codes, then each record's code is looked for in its own
+// window of that range: the same time step first, then working outwards
+// (the same as totp_verify)...
+
+static void audit_unit( const totp_secret* secrets, audit_rec* r, audit_rec* end,
+                        uint32_t* codes, uint64_t* drifts )
+{
+    uint64_t    w = (uint64_t) g_window;
+    uint64_t    first, last, c, i;
+    audit_rec*  run;
+
+    while (r < end)
+    {
+        first = r->counter > w ? r->counter - w : 0;
+        last  = r->counter + w;
+
+        for (run = r + 1; 1
+            && run < end
+            && run->secret == r->secret
+            && run->counter <= last + w + AUDIT_GAP
+            && run->counter + w - first < RANGE_BLOCK;
+            run++
+        )
+            last = run->counter + w;
+
+        totp_hotp_range( &secrets[ r->secret ], first, codes, (size_t) (last - first + 1) );
+
+        for (; r < run; r++)
+        {
+            c = r->counter - first;
+            r->drift = AUDIT_MISMATCH;
+
+            for (i=0; i <= w; i++)
+            {
+                if (i <= c && codes[ c - i ] == r->code)
+                {
+                    r->drift = -(int32_t) i;
+                    break;
+                }
+
+                if (i && codes[ c + i ] == r->code)
+                {
+                    r->drift = (int32_t) i;
+                    break;
+                }
+            }
+
+            if (r->drift != AUDIT_MISMATCH)
+                drifts[ r->drift + g_window ]++;
+        }
+    }
+}
+
+THREAD_PROC( audit_thread )
+{
+    audit_job*  job = (audit_job*) arg;
+    uint32_t    codes[ RANGE_BLOCK ];
+    uint64_t    drifts[ 2*MAX_WINDOW + 1 ] = { 0 };
+    size_t      from, to;
+    int         i;
+
+    for (;;)
+    {
+        lock_obtain( &job->lock );
+        {
+            from = job->next;
+            job->next = to = from + job->unit < job->nrecs ? from + job->unit : job->nrecs;
+        }
+        lock_release( &job->lock );
+
+        if (from >= to)
+            break;
+
+        audit_unit( job->secrets, job->recs + from, job->recs + to, codes, drifts );
+    }
+
+    lock_obtain( &job->lock );
+    {
+        for (i=0; i <= 2*g_window; i++)
+            job->drifts[i] += drifts[i];
+    }
+    lock_release( &job->lock );
+
+    THREAD_RETURN;
+}
+
+// Output a record which didn't match, or whose name is unknown...
+
+static void print_audit( const audit_rec* r, const totp_secret* secrets, const char* names )
+{
+    const char*  name;
+    size_t       len;
+    char*        p;
+    char*        d;
+
+    if (r->secret != AUDIT_UNKNOWN)
+    {
+        name = secrets[ r->secret ].label;
+        len  = secrets[ r->secret ].label_len;
+        totp_name( &name, &len );
+    }
+    else
+        len = strlen( name = names + r->counter );
+
+    if (!(p = out_begin( len + 80 )))
+        return;
+
+    d  = p + put_uint( p, (uint64_t) r->lineno );
+    *d++ = ' ', *d++ = ' ';
+    d += put_int( d, r->at_time );
+    *d++ = ' ', *d++ = ' ';
+    d += put_code( d, r->code, r->digits );
+    *d++ = ' ', *d++ = ' ';
+
+    if (r->secret == AUDIT_UNKNOWN)
+        memcpy( d, "UNKNOWN", 7 ), d += 7;
+    else
+        memcpy( d, "MISMATCH", 8 ), d += 8;
+
+    *d++ = ' ', *d++ = ' ';
+    memcpy( d, name, len ), d += len;
+    *d++ = '\n';
+
+    out_end( p, d - p );
+}
+
+static int audit( totp_secret* secrets, size_t n )
+{
+    input         in;
+    audit_job     job;
+    audit_rec*    recs   = NULL;
+    audit_rec**   bad    = NULL;
+    uint32_t*     index  = NULL;
+    char*         names  = NULL;
+    thread_t*     threads;
+    const char*   line;
+    const char*   name;
+    const char*   other;
+    size_t        nrecs = 0, maxrecs = 0, nnames = 0, maxnames = 0, nbad = 0;
+    size_t        ninvalid = 0, nunknown = 0, nmatched, size, len, nlen, olen, i;
+    uint32_t      x;
+    int           nthreads, t;
+
+    memset( &job, 0, sizeof( job ));
+
+    // Precompute all of the secrets' midstates, and index them by name
+    // (the first of any with the same name wins)...
+
+    for (size = 1024; size < 2 * n; size <<= 1)
+        ;
+
+    if (!(index = (uint32_t*) mem_calloc( size, sizeof( uint32_t ))))
+    {
+        fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    for (i=0; i < n; i++)
+    {
+        if (!(secrets[i].flags & TOTP_F_MIDSTATE))
+            totp_precompute( &secrets[i] );
+
+        name = secrets[i].label;
+        len  = secrets[i].label_len;
+        totp_name( &name, &len );
+
+        for (x = totp_name_hash( name, len ) & (size - 1); index[x]; x = (x + 1) & (size - 1))
+        {
+            other = secrets[ index[x] - 1 ].label;
+            olen  = secrets[ index[x] - 1 ].label_len;
+            totp_name( &other, &olen );
+
+            if (olen == len && memcmp( other, name, len ) == 0)
+                break;
+        }
+
+        if (!index[x])
+            index[x] = (uint32_t) (i + 1);
+    }
+
+    // Read all of the log's records...
+
+    if (!input_open( &in, strcmp( g_audit, "-" ) == 0 ? NULL : g_audit ))
+    {
+        fprintf( stderr, "ERROR: cannot open \"%s\" - %s\n", g_audit, strerror( errno ));
+        free( index );
+        return EXIT_FAILURE;
+    }
+
+    while (input_line( &in, &line, &len ))
+    {
+        audit_rec  r;
+
+        for (i=0; i < len && isspace( (unsigned char) line[i] ); i++)
+            ;
+
+        if (i == len)
+            continue;               // (blank line)
+
+        STAT_START( t_parse );
+
+        if (!parse_record( line, len, &name, &nlen, &r.at_time, &r.code, &r.digits ))
+        {
+            fprintf( stderr, "WARNING: %s line %lu: invalid record\n", g_audit, (unsigned long) in.lineno );
+            STAT_STOP( &g_stats, STAT_PARSE, t_parse, 1 );
+            ninvalid++;
+            continue;
+        }
+
+        r.lineno = in.lineno;
+        r.drift  = AUDIT_MISMATCH;
+
+        for (x = totp_name_hash( name, nlen ) & (size - 1); index[x]; x = (x + 1) & (size - 1))
+        {
+            other = secrets[ index[x] - 1 ].label;
+            olen  = secrets[ index[x] - 1 ].label_len;
+            totp_name( &other, &olen );
+
+            if (olen == nlen && memcmp( other, name, nlen ) == 0)
+                break;
+        }
+
+        if (index[x])
+        {
+            r.secret  = index[x] - 1;
+            r.counter = totp_counter( &secrets[ r.secret ], r.at_time );
+
+            if (r.digits != secrets[ r.secret ].digits)
+            {
+                fprintf( stderr, "WARNING: %s line %lu: code has %d digits, but the secret's have %d\n",
+                    g_audit, (unsigned long) in.lineno, r.digits, secrets[ r.secret ].digits );
+                STAT_STOP( &g_stats, STAT_PARSE, t_parse, 1 );
+                ninvalid++;
+                continue;
+            }
+
+            if (!(secrets[ r.secret ].flags & TOTP_F_TEST) && r.at_time < secrets[ r.secret ].offset)
+            {
+                fprintf( stderr, "WARNING: %s line %lu: before the secret's OFFSET\n",
+                    g_audit, (unsigned long) in.lineno );
+                STAT_STOP( &g_stats, STAT_PARSE, t_parse, 1 );
+                ninvalid++;
+                continue;
+            }
+        }
+        else
+        {
+            // (keep a copy of the unknown name, since the line won't stay put)
+
+            if (nnames + nlen + 1 > maxnames)
+            {
+                maxnames = (nnames + nlen + 1) * 2 + 4096;
+
+                if (!(names = (char*) mem_realloc( names, maxnames )))
+                    break;
+            }
+
+            memcpy( names + nnames, name, nlen );
+            names[ nnames + nlen ] = 0;
+
+            r.secret  = AUDIT_UNKNOWN;
+            r.counter = nnames;
+            nnames   += nlen + 1;
+            nunknown++;
+        }
+
+        STAT_STOP( &g_stats, STAT_PARSE, t_parse, 1 );
+
+        if (nrecs >= maxrecs)
+        {
+            maxrecs = maxrecs ? maxrecs * 2 : 65536;
+
+            if (!(recs = (audit_rec*) mem_realloc( recs, maxrecs * sizeof( audit_rec ))))
+                break;
+        }
+
+        recs[ nrecs++ ] = r;
+    }
+
+    input_close( &in );
+    free( index );
+
+    if ((nnames && !names) || (maxrecs && !recs))
+    {
+        fprintf( stderr, "ERROR: realloc() FAILED! - %s\n", strerror( errno ));
+        free( recs ), free( names );
+        return EXIT_FAILURE;
+    }
+
+    // Sort them by secret and time step (the unknown ones last), and
+    // verify the known ones in parallel...
+
+    qsort( recs, nrecs, sizeof( audit_rec ), cmp_audit_order );
+
+    nthreads   = g_threads ? g_threads : num_cpus();
+    job.secrets = secrets;
+    job.recs    = recs;
+    job.nrecs   = nrecs - nunknown;
+    job.unit    = job.nrecs / (nthreads * AUDIT_UNITS) + 1;
+
+    if (!(threads = (thread_t*) mem_calloc( nthreads, sizeof( thread_t ))))
+    {
+        fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+        free( recs ), free( names );
+        return EXIT_FAILURE;
+    }
+
+    lock_init( &job.lock );
+
+    STAT_START( t_hash );
+
+    for (t=1; t < nthreads; t++)    // (the main thread being the first)
+    {
+        if (!thread_create( &threads[t], audit_thread, &job ))
+        {
+            fprintf( stderr, "ERROR: thread creation FAILED! - %s\n", strerror( errno ));
+            return EXIT_FAILURE;
+        }
+    }
+
+    audit_thread( &job );
+
+    for (t=1; t < nthreads; t++)
+        thread_join( threads[t] );
+
+    STAT_STOP( &g_stats, STAT_HASH, t_hash, job.nrecs );
+
+    lock_destroy( &job.lock );
+    free( threads );
+
+    // Report those which didn't match (in log order), and the totals...
+
+    STAT_START( t_output );
+
+    for (i=0, nmatched=0; i < job.nrecs; i++)
+        nmatched += recs[i].drift != AUDIT_MISMATCH;
+
+    if (nrecs - nmatched && !(bad = (audit_rec**) mem_alloc( (nrecs - nmatched) * sizeof( audit_rec* ))))
+    {
+        fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+        free( recs ), free( names );
+        return EXIT_FAILURE;
+    }
+
+    for (i=0; i < nrecs; i++)
+        if (recs[i].drift == AUDIT_MISMATCH)
+            bad[ nbad++ ] = &recs[i];
+
+    qsort( bad, nbad, sizeof( audit_rec* ), cmp_audit_line );
+
+    for (i=0; i < nbad; i++)
+        print_audit( bad[i], secrets, names );
+
+    out_flush();
+
+    printf( "audit: %lu records, %lu matched, %lu mismatched, %lu unknown, %lu invalid\n",
+        (unsigned long) (nrecs + ninvalid), (unsigned long) nmatched,
+        (unsigned long) (job.nrecs - nmatched), (unsigned long) nunknown, (unsigned long) ninvalid );
+
+    for (t=0; t <= 2*g_window; t++)
+        if (job.drifts[t])
+            printf( "  drift %+d: %llu\n", t - g_window, (unsigned long long) job.drifts[t] );
+
+    STAT_STOP( &g_stats, STAT_OUTPUT, t_output, nbad );
+
+    free( bad );
+    free( recs );
+    free( names );
+
+    return nbad || ninvalid ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+//---------------------------------------------------------------------
+//                             read_key
+//---------------------------------------------------------------------
+//
+//  --key FILE: the passphrase a sealed store is sealed (--compile) or
+//  unlocked (--store) with: the first line of FILE, read directly into
+//  secure memory (never via a stdio buffer).
+//
+//---------------------------------------------------------------------
+
+#define KEY_MAXLEN      1024        // (longest passphrase + newline)
+
+static bool read_key()
+{
+    FILE*  fp;
+    bool   ok;
+
+    if (0
+        || !(g_pass = (char*) secure_alloc( KEY_MAXLEN ))
+        || !(fp = fopen( g_key, "rb" ))
+    )
+        return false;
+
+    setvbuf( fp, NULL, _IONBF, 0 );
+
+    ok = fgets( g_pass, KEY_MAXLEN, fp ) != NULL;
+    fclose( fp );
+
+    if (!ok || !(g_pass_len = strcspn( g_pass, "\r\n" )))
+    {
+        errno = EINVAL;             // (no passphrase)
+        return false;
+    }
+
+    return true;
+}
+
+//---------------------------------------------------------------------
+//                          compile_store
+//---------------------------------------------------------------------
+//
+//  --compile FILE: parse the input's secrets just as usual, but rather
+//  than calculating their codes, save them (and their HMAC midstates)
+//  to a precompiled secret store, to be used via --store FILE instead.
+//
+//---------------------------------------------------------------------
+
+static int compile_store( input* in )
+{
+    totp_store_writer*  w;
+    size_t              n;
+    totp_secret         secret;
+    int                 rc, prc;
+
+    if (0
+        || !(w = totp_store_create( g_compile, TOTP_STORE_MIDSTATES ))
+        || (g_key && totp_store_seal( w, g_pass, g_pass_len ) != TOTP_OK)
+    )
+    {
+        fprintf( stderr, "ERROR: cannot create \"%s\" - %s\n", g_compile, strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    for (n=0, rc=TOTP_OK; rc == TOTP_OK && next_secret( in, &secret, &prc );)
+    {
+        if (prc != TOTP_OK)
+            continue;
+
+        if ((rc = totp_store_add( w, &secret )) == TOTP_OK)
+            n++;
+
+        totp_wipe( &secret );
+    }
+
+    if (totp_store_finish( w ) != TOTP_OK || rc != TOTP_OK)
+    {
+        fprintf( stderr, "ERROR: cannot write \"%s\" - %s\n", g_compile, strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    fprintf( stderr, "%lu secrets compiled into \"%s\"\n", (unsigned long) n, g_compile );
+
+    return EXIT_SUCCESS;
+}
+
+//---------------------------------------------------------------------
+//                          process_store
+//---------------------------------------------------------------------
+//
+//  --store FILE: the same as --batch, but for the secrets in a store
+//  (which needn't be parsed, nor have their midstates precomputed).
+//  Or with --name, just the named secret's code, or with --verify,
+//  whether the given code is that secret's code (within --window
+//  time steps), which is also the exit code (i.e. success or failure).
+//
+//---------------------------------------------------------------------
+
+static int process_store()
+{
+    totp_store*  st;
+    totp_secret  secret;
+    chunk        c;
+    size_t       i, n, count;
+    int64_t      t;
+    uint32_t     verify = 0;
+    int          drift, rc = EXIT_SUCCESS;
+
+    if (!(st = totp_store_open( g_store )))
+    {
+        fprintf( stderr, "ERROR: cannot open store \"%s\" - %s\n", g_store, strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    // (sealed: the key is derived just the once, here, and each secret
+    // is then only decrypted if and when it's actually needed)
+
+    if (totp_store_locked( st ))
+    {
+        if (!g_key)
+            fprintf( stderr, "ERROR: store \"%s\" is sealed (use --key FILE)\n", g_store );
+        else if ((rc = totp_store_unlock( st, g_pass, g_pass_len )) != TOTP_OK)
+            fprintf( stderr, "ERROR: cannot unlock store \"%s\" - %s\n", g_store,
+                rc == TOTP_EINVAL ? "wrong passphrase" : strerror( errno ));
+
+        if (totp_store_locked( st ))
+        {
+            totp_store_close( st );
+            return EXIT_FAILURE;
+        }
+
+        rc = EXIT_SUCCESS;
+    }
+
+    // Just the one secret?
+
+    if (g_name)
+    {
+        if (0
+            || (i = totp_store_find( st, g_name, strlen( g_name ))) == TOTP_STORE_NOTFOUND
+            || totp_store_get( st, i, &secret ) != TOTP_OK
+        )
+        {
+            fprintf( stderr, "ERROR: \"%s\" not found in store \"%s\"\n", g_name, g_store );
+            totp_store_close( st );
+            return EXIT_FAILURE;
+        }
+
+        // (a code is exactly the secret's DIGITS digits, leading zeros
+        //  and all: anything else can't be one, so mustn't be tried)
+
+        if (g_verify)
+        {
+            if (strlen( g_verify ) != secret.digits || strspn( g_verify, "0123456789" ) != secret.digits)
+            {
+                fprintf( stderr, "ERROR: invalid --verify \"%s\" (\"%s\" has %d digit codes)\n",
+                    g_verify, g_name, secret.digits );
+                totp_wipe( &secret );
+                totp_store_close( st );
+                return EXIT_FAILURE;
+            }
+
+            verify = (uint32_t) strtoul( g_verify, NULL, 10 );
+        }
+
+        t = time( NULL );
+
+        if (g_resync)
+            rc = resync( &secret, t );
+        else if (g_counters)
+        {
+            uint32_t  code;
+            uint64_t  counter;
+
+            if (!g_verify)
+            {
+                if (hotp_next( &secret, &code ))
+                    print_code( &secret, code, t );
+                else
+                    rc = EXIT_FAILURE;
+            }
+            else if (hotp_verify( &secret, verify, &counter ))
+                printf( "OK (counter %llu)\n", (unsigned long long) counter );
+            else
+            {
+                printf( "FAILED\n" );
+                rc = EXIT_FAILURE;
+            }
+        }
+        else if (g_ranges)
+            print_range( &secret, t );
+        else if (!g_verify)
+            print_code( &secret, totp_generate( &secret, t ), t );
+        else if (totp_verify( &secret, verify, t, (unsigned) g_window, &drift ))
+            printf( "OK (drift %+d)\n", drift );
+        else
+        {
+            printf( "FAILED\n" );
+            rc = EXIT_FAILURE;
+        }
+
+        totp_wipe( &secret );
+        totp_store_close( st );
+        return rc;
+    }
+
+    // Otherwise all of them: kept resident with --watch or --audit...
+
+    if (g_watch || g_audit)
+    {
+        totp_secret*  secrets;
+
+        count = totp_store_count( st );
+
+        if (!(secrets = (totp_secret*) secure_alloc( (count + 1) * sizeof( totp_secret ))))
+        {
+            fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+            totp_store_close( st );
+            return EXIT_FAILURE;
+        }
+
+        for (i=0, n=0; i < count; i++)
+        {
+            if (totp_store_get( st, i, &secrets[n] ) == TOTP_OK)
+                n++;
+            else
+                fprintf( stderr, "WARNING: store record %lu is invalid\n", (unsigned long) i );
+        }
+
+        rc = g_audit ? audit( secrets, n ) : watch( secrets, n );
+
+        for (i=0; i < n; i++)
+            totp_wipe( &secrets[i] );
+
+        secure_free( secrets );
+        totp_store_close( st );
+        return rc;
+    }
+
+    // ...or BATCH_LINES at a time (or with --range, one at a time,
+    // since each is many codes, and with --hotp, since each uses up
+    // its counter)...
+
+    if (g_counters)
+    {
+        for (i=0, count = totp_store_count( st ); i < count; i++)
+        {
+            uint32_t  code;
+
+            if (totp_store_get( st, i, &secret ) != TOTP_OK)
+            {
+                fprintf( stderr, "WARNING: store record %lu is invalid\n", (unsigned long) i );
+                continue;
+            }
+
+            if (hotp_next( &secret, &code ))
+                print_code( &secret, code, 0 );
+
+            totp_wipe( &secret );
+        }
+
+        totp_store_close( st );
+        return EXIT_SUCCESS;
+    }
+
+    if (g_ranges)
+    {
+        for (i=0, count = totp_store_count( st ); i < count; i++)
+        {
+            if (totp_store_get( st, i, &secret ) != TOTP_OK)
+            {
+                fprintf( stderr, "WARNING: store record %lu is invalid\n", (unsigned long) i );
+                continue;
+            }
+
+            print_range( &secret, time( NULL ));
+            totp_wipe( &secret );
+        }
+
+        totp_store_close( st );
+        return EXIT_SUCCESS;
+    }
+
+    if (!alloc_chunk( &c ))
+    {
+        fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+        free_chunk( &c );
+        totp_store_close( st );
+        return EXIT_FAILURE;
+    }
+
+    count = totp_store_count( st );
+
+    for (n=0; n < count && rc == EXIT_SUCCESS; n += c.n)
+    {
+        STAT_POLL();
+        STAT_START( t_input );
+
+        c.n       = count - n < BATCH_LINES ? count - n : BATCH_LINES;
+        c.at_time = time( NULL );
+
+        for (i=0, c.nvalid=0; i < c.n; i++)
+        {
+            if ((c.rc[i] = totp_store_get( st, n + i, &c.secrets[i] )) == TOTP_OK)
+                c.valid[ c.nvalid++ ] = &c.secrets[i];
+            else
+            {
+                fprintf( stderr, "WARNING: store record %lu is invalid\n", (unsigned long) (n + i));
+                c.rc[i] = TOTP_SKIP;
+            }
+
+            STAT_LINE( &c.st, c.rc[i], &c.secrets[i] );
+        }
+
+        STAT_STOP( &c.st, STAT_INPUT, t_input, c.n );
+        STAT_START( t_hash );
+
+        totp_generate_batch( c.valid, c.at_time, c.codes, c.nvalid );
+
+        STAT_STOP( &c.st, STAT_HASH, t_hash, c.nvalid );
+
+        if (!format_chunk( &c ))
+        {
+            fprintf( stderr, "ERROR: realloc() FAILED! - %s\n", strerror( errno ));
+            rc = EXIT_FAILURE;
+        }
+        else
+            write_chunk( &c );
+    }
+
+    free_chunk( &c );
+    totp_store_close( st );
+
+    return rc;
+}
+
+//---------------------------------------------------------------------
+//                          selftest_ref
+//---------------------------------------------------------------------
+//
+//  The reference code, calculated the old fashioned way: via OpenSSL's
+//  one-shot HMAC() function. The key used is the secret's 'k0' value,
+//  which is either the key itself or, if the key was longer than the
+//  digest's block size, its hash (which is what HMAC would use anyway).
+//
+//  When built with the built-in SHA digests (TOTP_BUILTIN_SHA) there is
+//  no OpenSSL, so the plain (non-precomputed) HMAC method is used as the
+//  reference instead, and the "TEST:" line expected results then serve
+//  as the independent check.
+//
+//---------------------------------------------------------------------
+
+#ifdef TOTP_BUILTIN_SHA
+
+#define SELFTEST_REF    "plain HMAC"
+
+static uint32_t selftest_ref( const totp_secret* secret, uint64_t counter )
+{
+    totp_secret  plain  = *secret;
+    uint32_t     code;
+
+    plain.flags &= ~TOTP_F_MIDSTATE;
+    code = totp_hotp( &plain, counter );
+    totp_wipe( &plain );
+
+    return code;
+}
+
+#else // (OpenSSL)
+
+#define SELFTEST_REF    "OpenSSL HMAC()"
+
+static uint32_t selftest_ref( const totp_secret* secret, uint64_t counter )
+{
+    static const uint64_t pow10[] = { 1, 10, 100, 1000, 10000, 100000,
+                                      1000000, 10000000, 100000000,
+                                      1000000000, 10000000000ULL };
+    const EVP_MD*  digest;
+    uint8_t*       hmac;
+    unsigned int   hmacsize;
+    size_t         keylen;
+    uint32_t       code;
+    uint8_t        msg[8];
+    uint8_t        rrr;
+    int            i;
+
+    digest = EVP_get_digestbyname( totp_digest_name( secret->digest ));
+
+    keylen = secret->key_len <= totp_block_size( secret->digest )
+           ? secret->key_len : totp_hash_size( secret->digest );
+
+    for (i=0; i < (int) sizeof( msg ); i++)
+        msg[ (sizeof( msg )-1) - i ] = (uint8_t) (counter >> (8 * i));
+
+    hmac = HMAC( digest, secret->k0, (int) keylen, msg, sizeof( msg ), NULL, &hmacsize );
+
+    rrr = hmac[ hmacsize - 1 ] & 0x0f;
+
+    for (code=0, i=0; i < 4; i++)
+        code += (uint32_t) hmac[ rrr + 3 - i ] << (8 * i);
+
+    return (uint32_t) ((code & 0x7fffffff) % pow10[ secret->digits ]);
+}
+
+#endif // TOTP_BUILTIN_SHA
+
+//---------------------------------------------------------------------
+//                             selftest
+//---------------------------------------------------------------------
+//
+//  Differential test of each of our code calculation methods against
+//  the reference method (see selftest_ref), using the secrets read from
+//  stdin (e.g. the RFC 6238 test vectors in file "stdin.txt"), at each
+//  of SELFTEST_STEPS counter values, so that every lane of every batch
+//  kernel gets exercised. Any "TEST:" lines whose trailing comment is
+//  the expected result (e.g. "*94287082") are also checked.
+//
+//---------------------------------------------------------------------
+
+static int selftest( input* in )
+{
+    const char*          line;
+    size_t               len;
+    char                 label[ 32 ];
+    totp_secret*         secrets;
+    totp_secret          plain;
+    const totp_secret**  ptrs;
+    uint64_t*            counters;
+    uint32_t*            expected;
+    uint32_t*            codes;
+    size_t               i, n, max, ncodes, bad;
+    size_t               ntests, badtests;
+    const char*          kernel;
+    const char*          saved_kernel;
+    int                  k, failures;
+
+    secrets = NULL, n = 0, max = 0;
+    ntests = 0, badtests = 0;
+
+    // Read and parse all secrets...
+
+    while (input_line( in, &line, &len ))
+    {
+        if (n >= max)
+        {
+            max = max ? max << 1 : 64;
+
+            if (!(secrets = (totp_secret*) secure_realloc( secrets, max * sizeof( totp_secret ))))
+            {
+                fprintf( stderr, "ERROR: realloc() FAILED! - %s\n", strerror( errno ));
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (totp_parse_line( &secrets[n], line, len ) != TOTP_OK)
+            continue;
+
+        // Check TEST: lines whose comment is their expected result
+        // (a '*' and then exactly the secret's number of digits)...
+
+        if (1
+            && (secrets[n].flags & TOTP_F_TEST)
+            && secrets[n].label_len < sizeof( label )
+            && copy_label( label, &secrets[n] ) == (size_t) secrets[n].digits + 1
+            && label[0] == '*'
+        )
+        {
+            label[ secrets[n].digits + 1 ] = 0;
+
+            if (strspn( label + 1, "0123456789" ) == secrets[n].digits)
+            {
+                ntests++;
+                if (strtoul( label + 1, NULL, 10 ) != totp_generate( &secrets[n], 0 ))
+                {
+                    printf( "  FAILED: %s\n", label );
+                    badtests++;
+                }
+            }
+        }
+
+        secrets[n].label = NULL, secrets[n].label_len = 0;  // (line is reused!)
+        n++;
+    }
+
+    ncodes   = n * SELFTEST_STEPS;
+    ptrs     = (const totp_secret**)  mem_alloc( (ncodes + 1) * sizeof( totp_secret* ));
+    counters = (uint64_t*)            mem_alloc( (ncodes + 1) * sizeof( uint64_t ));
+    expected = (uint32_t*)            mem_alloc( (ncodes + 1) * sizeof( uint32_t ));
+    codes    = (uint32_t*)            mem_alloc( (ncodes + 1) * sizeof( uint32_t ));
+
+    if (!ptrs || !counters || !expected || !codes)
+    {
+        fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    // Calculate the reference codes, interleaving the secrets so that
+    // the batch kernels see a mixture of digests...
+
+    for (i=0; i < ncodes; i++)
+    {
+        ptrs[i]     = &secrets[ i % n ];
+        counters[i] = totp_counter( ptrs[i], time( NULL )) + (i / n) * 7919;
+        expected[i] = selftest_ref( ptrs[i], counters[i] );
+    }
+
+    printf( "selftest: %d secrets, %d codes each, sha = %s, reference = " SELFTEST_REF "\n",
+        (int) n, SELFTEST_STEPS, totp_sha_backend() );
+
+    failures = 0;
+
+    // Plain (non-precomputed) method...
+
+    for (i=0, bad=0; i < ncodes; i++)
+    {
+        plain = *ptrs[i];
+        plain.flags &= ~TOTP_F_MIDSTATE;
+
+        if (totp_hotp( &plain, counters[i] ) != expected[i])
+            bad++;
+    }
+
+    printf( "  %-10s %s\n", "plain", bad ? "FAILED" : "OK" );
+    failures += bad != 0;
+
+    // Precomputed midstate method...
+
+    for (i=0; i < n; i++)
+        totp_precompute( &secrets[i] );
+
+    for (i=0, bad=0; i < ncodes; i++)
+        if (totp_hotp( ptrs[i], counters[i] ) != expected[i])
+            bad++;
+
+    printf( "  %-10s %s\n", "midstate", bad ? "FAILED" : "OK" );
+    failures += bad != 0;
+
+    // Each of the available batch kernels...
+
+    saved_kernel = totp_batch_kernel();
+
+    for (k=0; (kernel = totp_batch_kernels( k )) != NULL; k++)
+    {
+        totp_set_batch_kernel( kernel );
+        totp_hotp_batch( ptrs, counters, codes, ncodes );
+
+        for (i=0, bad=0; i < ncodes; i++)
+            if (codes[i] != expected[i])
+                bad++;
+
+        printf( "  %-10s %s\n", kernel, bad ? "FAILED" : "OK" );
+        failures += bad != 0;
+    }
+
+    // Consecutive counter ranges (with each kernel), starting just
+    // before a carry into the counter's high order bytes...
+
+    for (k=0, bad=0; (kernel = totp_batch_kernels( k )) != NULL; k++)
+    {
+        totp_set_batch_kernel( kernel );
+
+        for (i=0; i < n; i++)
+        {
+            uint64_t  first = 0xFFFFFFF0ull - i;
+            size_t    j;
+
+            totp_hotp_range( &secrets[i], first, codes, SELFTEST_STEPS );
+
+            for (j=0; j < SELFTEST_STEPS; j++)
+                if (codes[j] != selftest_ref( &secrets[i], first + j ))
+                    bad++;
+        }
+    }
+
+    printf( "  %-10s %s\n", "range", bad ? "FAILED" : "OK" );
+    failures += bad != 0;
+
+    totp_set_batch_kernel( saved_kernel );
+
+    if (ntests)
+    {
+        printf( "  %d TEST: expected results %s\n", (int) ntests, badtests ? "FAILED" : "OK" );
+        failures += badtests != 0;
+    }
+
+    // Cleanup and exit...
+
+    for (i=0; i < n; i++)
+        totp_wipe( &secrets[i] );
+
+    secure_free( secrets );
+    free( ptrs );
+    free( counters );
+    free( expected );
+    free( codes );
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+//---------------------------------------------------------------------
+//                              usage
+//---------------------------------------------------------------------
+
+static void usage()
+{
+    fprintf( stderr,
+
+        "\n  Fish's " TOTP_PLATFORM " TOTP, version " TOTP_VERSION ".\n\n"
+
+        "  Usage:  totp [options] < secrets\n\n"
+
+        "  Options:\n\n"
+
+        "    --batch       Calculate codes many lines at a time, using\n"
+        "                  SIMD (multi-buffer) HMAC kernels when available.\n"
+        "                  Output is identical, but much faster for very\n"
+        "                  large input files.\n\n"
+
+        "    --threads N   Same as --batch, but calculating the codes using\n"
+        "                  N worker threads (0 = one per CPU). Output is\n"
+        "                  still in original input order.\n\n"
+
+        "    --input FILE  Read the secrets from FILE instead of stdin.\n\n"
+        "    --import      The input is otpauth:// URIs and otpauth-migration://\n"
+        "                  (authenticator export) payloads, as well as\n"
+        "                  secret lines: calculate (or --compile) each\n"
+        "                  of their secrets, one at a time.\n\n"
+
+        "    --compile FILE  Save the secrets (already parsed) to the\n"
+        "                  precompiled secret store FILE instead.\n\n"
+
+        "    --key FILE    Seal (--compile) or unlock (--store) the store\n"
+        "                  with the passphrase on the first line of FILE:\n"
+        "                  its secrets are encrypted, and only decrypted\n"
+        "                  when (and if) they're used.\n\n"
+
+        "    --store FILE  Calculate the codes for the secrets in the\n"
+        "                  precompiled secret store FILE instead.\n\n"
+
+        "    --name NAME   With --store, only that of the secret whose\n"
+        "                  label is NAME (ignoring any comment character).\n\n"
+
+        "    --verify CODE  With --name, check CODE instead (+/- --window\n"
+        "                  time steps). Exit code is 0 if OK, else 1.\n\n"
+
+        "    --window N    Time steps either side of the current one that\n"
+        "                  --verify and --audit accept codes for (0 to 100).\n"
+        "                  Default: 1.\n\n"
+
+        "    --resync CODES  With --name, find CODES (the token's consecutive\n"
+        "                  codes, comma separated, its current one last)\n"
+        "                  within 10000 time steps (or with --hotp, the\n"
+        "                  next 10000 counters), and report the drift (or\n"
+        "                  with --hotp, move the counter past them).\n\n"
+
+        "    --hotp FILE   Event based HOTP: use (and advance) each secret's\n"
+        "                  counter, kept in the FILE counter log, instead of\n"
+        "                  the time. With --verify, accepts any of the next\n"
+        "                  10 counters' codes.\n\n"
+
+        "    --range FROM:TO  Output the codes for every time step from\n"
+        "                  Unix time FROM to TO (or if signed, relative to\n"
+        "                  now, e.g. -60:+3600) as tab separated values.\n\n"
+
+        "    --counters FIRST:LAST  Same, but for counters (time steps)\n"
+        "                  FIRST to LAST (or if signed, relative to the\n"
+        "                  current one, e.g. -1:+1).\n\n"
+
+        "    --watch       Keep running, outputting the codes again (and\n"
+        "                  for how many seconds each is valid) whenever\n"
+        "                  they change. Secrets are read until EOF.\n\n"
+
+        "    --audit LOG   Check each \"NAME TIME CODE\" record of the LOG\n"
+        "                  (- for stdin) against the secrets (TIME being Unix\n"
+        "                  time or UTC, e.g. 2026-10-17T09:30:00Z), listing\n"
+        "                  those which don't match, then a summary and the\n"
+        "                  drift of those which did. Exit code is 0 if all\n"
+        "                  matched, else 1. Uses all CPUs (or --threads N).\n\n"
+
+        "    --flush=WHEN  Write output after every line, whenever the\n"
+        "                  output buffer fills up (or before waiting for\n"
+        "                  more input), or only at the end: line, block\n"
+        "                  or end. Default: line for a terminal, else block.\n\n"
+
+        "    --format=FMT  Output format: text (default), tsv (tab separated\n"
+        "                  values) or json (JSON lines), the latter two with\n"
+        "                  each code's counter and validity (expiry) times.\n\n"
+
+        "    --stats[=FILE] When done (or sent SIGUSR1), write how long each\n"
+        "                  phase took (input, parse, hash and output), with\n"
+        "                  histograms, counts of skipped, invalid and each\n"
+        "                  digest's lines, and memory allocations, to\n"
+        "                  stderr or FILE.\n\n"
+
+        "    --selftest    Check every available code calculation method\n"
+        "                  (batch kernels, etc) against a reference HMAC\n"
+        "                  using the secrets read from stdin. e.g.:\n"
+        "                  \"totp --selftest < stdin.txt\"\n\n"
+
+        "    --help        Display this help information.\n\n"
+
+        "  Refer to documentation for input format.\n\n"
+    );
+}
+
+//---------------------------------------------------------------------
+//                            parse_span
+//---------------------------------------------------------------------
+
+// Parse --range FROM:TO or --counters FIRST:LAST (where a signed value
+// is relative to now, or to the current counter)...
+
+static bool parse_span_value( const char* p, char** end, int64_t* val, bool* rel )
+{
+    *rel = (*p == '+' || *p == '-');
+
+    if (!isdigit( (unsigned char) p[ *rel ? 1 : 0 ] ))
+        return false;
+
+    errno = 0;
+    *val = (int64_t) strtoll( p, end, 10 );
+
+    return errno == 0;
+}
+
+static bool parse_span( const char* arg, bool counters )
+{
+    span*  sp = &g_span;
+    char*  p;
+
+    if (0
+        || !parse_span_value( arg,   &p, &sp->from, &sp->from_rel ) || *p != ':'
+        || !parse_span_value( p + 1, &p, &sp->to,   &sp->to_rel   ) || *p
+    )
+        return false;
+
+    sp->counters = counters;
+    g_ranges = true;
+
+    return true;
+}
+
+//---------------------------------------------------------------------
+//                            parse_args
+//---------------------------------------------------------------------
+
+// The value of option 'name' given as either "name=value" or "name value"
+// (or NULL if argv[i] isn't that option)...
+
+static const char* opt_value( int argc, char* argv[], int* i, const char* name )
+{
+    size_t  len = strlen( name );
+
+    if (strncmp( argv[*i], name, len ) != 0)
+        return NULL;
+
+    if (argv[*i][ len ] == '=')
+        return argv[*i] + len + 1;
+
+    if (argv[*i][ len ] == 0 && *i+1 < argc)
+        return argv[ ++*i ];
+
+    return NULL;
+}
+
+// Which of the NULL terminated 'names' the value is (or -1 if none)...
+
+static int opt_keyword( const char* value, const char* const* names )
+{
+    int  i;
+
+    for (i=0; names[i]; i++)
+        if (strcasecmp( value, names[i] ) == 0)
+            return i;
+
+    return -1;
+}
+
+static bool parse_args( int argc, char* argv[] )
+{
+    static const char* const  flushes[] = { "line", "block", "end", NULL };  // (FLUSH_xxx)
+    static const char* const  formats[] = { "text", "tsv", "json", NULL };   // (FORMAT_xxx)
+
+    const char*  v;
+    int          i;
+
+    for (i=1; i < argc; i++)
+    {
+             if (strcmp( argv[i], "--batch"    ) == 0) g_batch    = true;
+        else if (strcmp( argv[i], "--selftest" ) == 0) g_selftest = true;
+        else if (strcmp( argv[i], "--watch"    ) == 0) g_watch    = true;
+        else if (strcmp( argv[i], "--import"   ) == 0) g_import   = true;
+        else if (strcmp( argv[i], "--stats" ) == 0 || strncmp( argv[i], "--stats=", 8 ) == 0)
+        {
+#ifndef TOTP_NO_STATS
+            g_stats_on   = true;
+            g_stats_file = argv[i][7] ? argv[i] + 8 : NULL;
+#else
+            fprintf( stderr, "ERROR: --stats not available (built with STATS=no)\n" );
+            return false;
+#endif
+        }
+        else if ((v = opt_value( argc, argv, &i, "--flush" )) != NULL)
+        {
+            if ((g_flush = opt_keyword( v, flushes )) < 0)
+            {
+                fprintf( stderr, "ERROR: invalid --flush \"%s\"\n", v );
+                return false;
+            }
+        }
+        else if ((v = opt_value( argc, argv, &i, "--format" )) != NULL)
+        {
+            if ((g_format = opt_keyword( v, formats )) < 0)
+            {
+                fprintf( stderr, "ERROR: invalid --format \"%s\"\n", v );
+                return false;
+            }
+        }
+        else if (strcmp( argv[i], "--input"    ) == 0 && i+1 < argc) g_input   = argv[++i];
+        else if (strcmp( argv[i], "--compile"  ) == 0 && i+1 < argc) g_compile = argv[++i];
+        else if (strcmp( argv[i], "--store"    ) == 0 && i+1 < argc) g_store   = argv[++i];
+        else if (strcmp( argv[i], "--name"     ) == 0 && i+1 < argc) g_name    = argv[++i];
+        else if (strcmp( argv[i], "--verify"   ) == 0 && i+1 < argc) g_verify  = argv[++i];
+        else if (strcmp( argv[i], "--resync"   ) == 0 && i+1 < argc) g_resync  = argv[++i];
+        else if (strcmp( argv[i], "--hotp"     ) == 0 && i+1 < argc) g_hotp    = argv[++i];
+        else if (strcmp( argv[i], "--audit"    ) == 0 && i+1 < argc) g_audit   = argv[++i];
+        else if (strcmp( argv[i], "--key"      ) == 0 && i+1 < argc) g_key     = argv[++i];
+        else if (strcmp( argv[i], "--window"   ) == 0 && i+1 < argc)
+        {
+            unsigned long  n;
+            char*          end;
+
+            if (0
+                || !isdigit( (unsigned char) argv[i+1][0] )
+                || (n = strtoul( argv[i+1], &end, 10 ), *end)
+                || n > MAX_WINDOW
+            )
+            {
+                fprintf( stderr, "ERROR: invalid --window \"%s\" (0 to %d)\n", argv[i+1], MAX_WINDOW );
+                return false;
+            }
+            g_window = (int) n;
+            i++;
+        }
+        else if ((strcmp( argv[i], "--range" ) == 0 || strcmp( argv[i], "--counters" ) == 0) && i+1 < argc)
+        {
+            if (!parse_span( argv[i+1], strcmp( argv[i], "--counters" ) == 0 ))
+            {
+                fprintf( stderr, "ERROR: invalid %s \"%s\"\n", argv[i], argv[i+1] );
+                return false;
+            }
+            i++;
+        }
+        else if (strcmp( argv[i], "--threads"  ) == 0 && i+1 < argc && isdigit( (unsigned char) argv[i+1][0] ))
+        {
+            if ((g_threads = atoi( argv[++i] )) <= 0)
+                g_threads = num_cpus();
+
+            if (g_threads > MAX_THREADS)
+                g_threads = MAX_THREADS;
+        }
+        else
+        {
+            if (strcmp( argv[i], "--help" ) != 0 && strcmp( argv[i], "-h" ) != 0)
+                fprintf( stderr, "ERROR: unknown option \"%s\"\n", argv[i] );
+            usage();
+            return false;
+        }
+    }
+
+    if ((g_name && !g_store) || ((g_verify || g_resync) && !g_name) || (g_store && (g_input || g_compile)))
+    {
+        fprintf( stderr, "ERROR: --name requires --store, --verify and --resync require --name,\n"
+                         "       and --store cannot be used with --input or --compile\n" );
+        return false;
+    }
+
+    if (g_verify && g_resync)
+    {
+        fprintf( stderr, "ERROR: --verify and --resync cannot be used together\n" );
+        return false;
+    }
+
+    if (g_ranges && (g_verify || g_resync || g_compile || g_selftest))
+    {
+        fprintf( stderr, "ERROR: --range and --counters cannot be used with\n"
+                         "       --verify, --resync, --compile or --selftest\n" );
+        return false;
+    }
+
+    if (g_hotp && (g_ranges || g_watch || g_compile || g_selftest || g_format != FORMAT_TEXT))
+    {
+        fprintf( stderr, "ERROR: --hotp cannot be used with --range, --counters,\n"
+                         "       --watch, --compile, --selftest or --format\n" );
+        return false;
+    }
+
+    if (g_watch && (g_ranges || g_name || g_compile || g_selftest))
+    {
+        fprintf( stderr, "ERROR: --watch cannot be used with --range, --counters,\n"
+                         "       --name, --compile or --selftest\n" );
+        return false;
+    }
+
+    if (g_audit && (g_ranges || g_hotp || g_watch || g_name || g_compile || g_selftest || g_format != FORMAT_TEXT))
+    {
+        fprintf( stderr, "ERROR: --audit cannot be used with --range, --counters, --hotp,\n"
+                         "       --watch, --name, --compile, --selftest or --format\n" );
+        return false;
+    }
+
+    // (--threads also splits --resync's search, --hotp's too)
+
+    if (0
+        || (g_batch   && (g_hotp || g_ranges || g_watch || g_compile))
+        || (g_threads && ((g_hotp && !g_resync) || g_ranges || g_watch || g_compile))
+    )
+    {
+        fprintf( stderr, "ERROR: --batch and --threads cannot be used with --hotp (except\n"
+                         "       --threads with --resync), --range, --counters, --watch or --compile\n" );
+        return false;
+    }
+
+    if (g_import && (g_batch || g_threads || g_watch || g_audit || g_store || g_selftest))
+    {
+        fprintf( stderr, "ERROR: --import cannot be used with --batch, --threads,\n"
+                         "       --watch, --audit, --store or --selftest\n" );
+        return false;
+    }
+
+    if (g_key && !g_store && !g_compile)
+    {
+        fprintf( stderr, "ERROR: --key requires --store or --compile\n" );
+        return false;
+    }
+
+    if (g_audit && strcmp( g_audit, "-" ) == 0 && !g_input && !g_store)
+    {
+        fprintf( stderr, "ERROR: --audit - (stdin) requires --input or --store\n" );
+        return false;
+    }
+
+    return true;
+}
+
+//---------------------------------------------------------------------
+//                           M A I N
+//---------------------------------------------------------------------
+
+int main( int argc, char* argv[] )
+{
+    input  in;
+    int    rc;
+
+    if (!parse_args( argc, argv ))
+        return EXIT_FAILURE;
+
+    if (g_flush < 0)
+        g_flush = is_terminal_stdout() ? FLUSH_LINE : FLUSH_BLOCK;
+
+    atexit( secure_exit );          // (last of all: zero secure memory)
+
+    if (g_hotp)
+    {
+        if (!(g_counters = totp_counters_open( g_hotp )))
+        {
+            fprintf( stderr, "ERROR: cannot open counter log \"%s\" - %s\n", g_hotp, strerror( errno ));
+            return EXIT_FAILURE;
+        }
+
+        atexit( close_counters );   // (after out_flush has committed)
+    }
+
+    atexit( out_flush );            // (whatever remains buffered)
+
+#ifndef TOTP_NO_STATS
+    if (g_stats_on)
+    {
+        atexit( stats_dump );       // (before out_flush; see stats_dump)
+#ifdef SIGUSR1
+        signal( SIGUSR1, stats_signal );
+#endif
+    }
+#endif
+
+    if (g_key && !read_key())
+    {
+        fprintf( stderr, "ERROR: cannot read passphrase from \"%s\" - %s\n", g_key, strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    if (g_store)                    // (no input to be read at all)
+        return process_store();
+
+    if (!input_open( &in, g_input ))
+    {
+        fprintf( stderr, "ERROR: cannot open \"%s\" - %s\n",
+            g_input ? g_input : "stdin", strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    //-----------------------------------------------------------------
+    // Allow reading shared SECRET from stdin in a secure manner...
+    //-----------------------------------------------------------------
+
+    if (g_input)
+        g_bStdinKeyboard = false;   // (not reading from stdin at all)
+    else if (!disable_stdin_echo())
+    {
+        fprintf( stderr, "ERROR: disable_stdin_echo() FAILED!\n" );
+        return EXIT_FAILURE;
+    }
+
+    //-----------------------------------------------------------------
+    // Display version information and cmdline usage (i.e. help info)
+    //-----------------------------------------------------------------
+
+    if (g_bStdinKeyboard)
+    {
+        fprintf( stderr,
+
+            "\n  Fish's " TOTP_PLATFORM " TOTP, version " TOTP_VERSION ".\n\n"
+
+            "  There are no secret related command line options. The only\n"
+            "  required input is your secret, always from stdin. You can\n"
+            "  either paste it directly into the program, or redirect it\n"
+            "  from a file. (Use --help for other command line options.)\n\n"
+
+            "  If you choose to paste it, don't forget to press the enter\n"
+            "  key afterwards. The program is line oriented, so you must\n"
+            "  end each line with a newline.\n\n"
+
+            "  Refer to documentation for input format.\n\n"
+
+            "  If not redirecting input from a file (i.e. if pasting from\n"
+            "  the keyboard), use Ctrl+C to exit the program. Otherwise if\n"
+            "  input is from a file, the program will exit automatically\n"
+            "  once EOF is reached on stdin.\n\n"
+        );
+    }
+
+    if (g_import && !(g_importer = totp_import_create()))
+    {
+        fprintf( stderr, "ERROR: --import - %s\n", strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    if (g_selftest)
+        rc = selftest( &in );
+    else if (g_compile)
+        rc = compile_store( &in );
+    else if (g_ranges || g_hotp)    // (many codes each, or one at a time)
+        rc = process_lines( &in );
+    else if (g_watch)
+        rc = resident_input( &in, watch );
+    else if (g_audit)
+        rc = resident_input( &in, audit );
+    else if (g_threads)
+        rc = process_threads( &in );
+    else if (g_batch)
+        rc = process_batch( &in );
+    else
+        rc = process_lines( &in );
+
+    input_close( &in );
+    totp_import_destroy( g_importer );
+
+    return rc;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,1457 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+#include "totpd.h"
+
+#include <sys/epoll.h>              // (need epoll_create1)
+#include <sys/eventfd.h>            // (need eventfd)
+#include <sys/signalfd.h>           // (need signalfd)
+#include <sys/socket.h>             // (need socket)
+#include <sys/un.h>                 // (need sockaddr_un)
+#include <sys/prctl.h>              // (need prctl)
+#include <sys/inotify.h>            // (need inotify_init1)
+#include <libgen.h>                 // (need dirname)
+
+//------------------------------------------------------------------------------
+//                                  TOTPD
+//------------------------------------------------------------------------------
+//
+//  The local TOTP daemon: loads the secrets once (parsed and precomputed,
+//  from a secrets file in totp's input format or from a precompiled store)
+//  and then serves generate and verify requests over a Unix domain socket
+//  (see totpd.h), rather than a program such as a PAM helper spawning
+//  totp for every login, which costs a process startup, OpenSSL's
+//  initialisation and parsing the secrets every time.
+//
+//  One thread runs an epoll event loop which does all of the socket I/O:
+//  it accepts connections, and reads whatever each one has sent. All of
+//  the complete requests read from a connection at once (a client may
+//  pipeline as many as it likes) are then handed, as one batch, to the
+//  pool of worker threads. Whichever worker is free next looks up each
+//  request's secret, and verifies its code (against a replay cache, so
+//  that each code is only ever accepted once) or calculates it (all of
+//  the batch's codes for now being calculated at once, by the same SIMD
+//  batch kernels totp --batch uses). The finished batch is then handed
+//  back to the event loop (woken by an eventfd), which writes out its
+//  responses. A connection may have up to CONN_BATCHES batches being
+//  processed at once; until one of them is finished, no more is read
+//  from it. Nor is any while more than CONN_OUT_MAX bytes of its
+//  responses are still waiting to be written (i.e. a client which keeps
+//  sending requests without reading the responses), so that it can't
+//  make totpd's memory grow without limit.
+//
+//  The secrets (and everything else) are locked into memory so they're
+//  never written to the swap file, and the process isn't dumpable (no
+//  core dumps, and no ptrace by other processes of the same user). The
+//  socket is only accessible by the user totpd runs as (see --mode).
+//
+//  The secrets are reloaded whenever the file is written or replaced,
+//  or on SIGHUP, without stopping (see Reload).
+//
+//  Stopped by SIGINT or SIGTERM. Linux only (epoll, eventfd, signalfd,
+//  inotify).
+//
+//------------------------------------------------------------------------------
+
+#define TOTPD_VERSION   VERSION_STR
+
+#define CONN_BUF        (64*1024)   // (read buffer per connection)
+#define CONN_BATCHES    4           // (batches in progress per connection)
+#define CONN_OUT_MAX    (4*CONN_BUF)    // (unwritten responses: stop reading)
+#define BATCH_MAX       (CONN_BUF / sizeof( totpd_request ))  // (most requests per batch)
+#define MAX_THREADS     256         // (--threads maximum)
+#define MAX_EVENTS      256         // (epoll events per wait)
+#define DEF_REPLAY      1000000     // (--replay default entries)
+#define REPLAY_LIFETIME 86400       // (longest code lifetime remembered)
+
+static const char*  g_socket  = TOTPD_SOCKET;   // (--socket PATH)
+static unsigned     g_mode    = 0600;           // (--mode MODE)
+static int          g_threads = 0;              // (--threads N; 0 = one per CPU)
+static size_t       g_entries = DEF_REPLAY;     // (--replay N)
+static const char*  g_input   = NULL;           // (--input FILE)
+static const char*  g_store   = NULL;           // (--store FILE)
+static const char*  g_key     = NULL;           // (--key FILE)
+static char         g_pass[ 1024 ];             // (its passphrase)
+
+static totp_replay* g_replay  = NULL;           // (codes already accepted)
+
+//---------------------------------------------------------------------
+//                            Secrets
+//---------------------------------------------------------------------
+//
+//  All of the secrets, parsed and precomputed, in a secret table (see
+//  totp_table_create: only their midstates, a small header and their
+//  labels, so even millions of them take little memory), which also
+//  finds them by name. Never modified once loaded, so the workers all
+//  use them without any lock, each getting the secrets it needs from
+//  the table as it needs them.
+//
+//  They're reloaded (see Reload) from scratch each time, but only lines
+//  which have changed are parsed again: each --input secret remembers
+//  its line's hash, and the new set's lines are first looked up in the
+//  old set by hash (and then compared), and if found, the old secret
+//  (already parsed and precomputed) is simply got from the old table.
+//
+//---------------------------------------------------------------------
+
+struct secret_set
+{
+    totp_table*   table;            // (all of them, precomputed)
+    size_t        count;            // (number of secrets)
+    char*         text;             // (--input: the file's contents)
+    size_t        text_len;         // (length of text)
+
+    uint64_t*     line_hash;        // (--input: each secret's line's hash,
+    size_t*       line_at;          //  where the line is in text,
+    size_t*       line_len;         //  and its length)
+    uint32_t*     by_line;          // (hash table: secret number + 1, by line)
+    size_t        mask;             // (size of hash table - 1)
+};
+
+static secret_set*  g_set = NULL;   // (the secrets; see Reload)
+
+static uint64_t hash_line( const char* p, size_t len )
+{
+    uint64_t  h = 0x9E3779B97F4A7C15ULL ^ len, w;
+
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        memcpy( &w, p, 8 );
+        h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 29;
+    }
+
+    while (len--)
+        h = (h ^ (uint8_t) *p++) * 0x100000001B3ULL;
+
+    return h ^ (h >> 32);
+}
+
+// The number (+ 1) of the secret parsed from exactly this line, or 0...
+
+static size_t find_line( const secret_set* set, uint64_t h, const char* line, size_t len )
+{
+    size_t    i;
+    uint32_t  x;
+
+    if (!set || !set->by_line)
+        return 0;
+
+    for (i = (size_t) h & set->mask; (x = set->by_line[i]) != 0; i = (i + 1) & set->mask)
+    {
+        if (1
+            && set->line_hash[ x - 1 ] == h
+            && set->line_len [ x - 1 ] == len
+            && memcmp( set->text + set->line_at[ x - 1 ], line, len ) == 0
+        )
+            return x;
+    }
+
+    return 0;
+}
+
+// Index the secrets by line...
+
+static bool index_lines( secret_set* set )
+{
+    size_t  size, i;
+
+    for (size = 1024; size < 2 * set->count; size <<= 1)
+        ;
+
+    if (!(set->by_line = (uint32_t*) calloc( size, sizeof( uint32_t ))))
+        return false;
+
+    set->mask = size - 1;
+
+    for (i=0; i < set->count; i++)
+    {
+        for (size = (size_t) set->line_hash[i] & set->mask; set->by_line[ size ]; size = (size + 1) & set->mask)
+            ;
+
+        set->by_line[ size ] = (uint32_t) (i + 1);
+    }
+
+    return true;
+}
+
+// Add a secret to the set's table (the first of any with the same name
+// wins). Returns false if it couldn't be (see errno)...
+
+static bool add_secret( secret_set* set, const totp_secret* s, bool* added )
+{
+    const char*  name = s->label;
+    size_t       len  = s->label_len;
+
+    switch (totp_table_add( set->table, s ))
+    {
+        case TOTP_OK:
+
+            set->count++;
+            *added = true;
+            return true;
+
+        case TOTP_SKIP:
+
+            totp_name( &name, &len );
+            fprintf( stderr, "WARNING: duplicate name \"%.*s\" ignored\n", (int) len, name );
+            *added = false;
+            return true;
+
+        default:
+
+            return false;
+    }
+}
+
+static void free_secrets( secret_set* set )
+{
+    if (!set)
+        return;
+
+    totp_table_destroy( set->table );
+    free( set->line_hash );
+    free( set->line_at );
+    free( set->line_len );
+    free( set->by_line );
+
+    if (set->text)
+    {
+        totp_cleanse( set->text, set->text_len );
+        free( set->text );
+    }
+
+    free( set );
+}
+
+// The memory the secrets take, per secret: in all, and for each part
+// of the table (see totp_table_memory)...
+
+static void report_memory( const secret_set* set )
+{
+    totp_table_mem  m;
+    double          n;
+
+    totp_table_memory( set->table, &m );
+    n = m.count ? (double) m.count : 1.0;
+
+    fprintf( stderr, "totpd: %lu secrets, %.1f bytes each (keys %.1f, headers %.1f, labels %.1f, index %.1f)\n",
+        (unsigned long) m.count, m.total / n, m.keys / n, m.headers / n, m.labels / n, m.index / n );
+}
+
+// --input FILE: read the whole file, and parse each line of it which
+// wasn't already in the 'old' set (if any). Returns the new set, and
+// how many of its secrets had to be parsed.
+
+static secret_set* load_input( const char* path, const secret_set* old, size_t* parsed )
+{
+    secret_set*   set;
+    totp_secret   s;
+    FILE*         f;
+    long          size;
+    size_t        max, len, x;
+    uint64_t      h;
+    char*         line;
+    char*         nl;
+    bool          ok = true, added;
+
+    if (!(set = (secret_set*) calloc( 1, sizeof( *set ))) || !(f = fopen( path, "rb" )))
+    {
+        free( set );
+        return NULL;
+    }
+
+    if (0
+        || fseek( f, 0, SEEK_END ) != 0
+        || (size = ftell( f )) < 0
+        || fseek( f, 0, SEEK_SET ) != 0
+        || !(set->text = (char*) malloc( (size_t) size + 1 ))
+        || fread( set->text, 1, (size_t) size, f ) != (size_t) size
+    )
+    {
+        fclose( f );
+        free_secrets( set );
+        return NULL;
+    }
+
+    fclose( f );
+    set->text[ set->text_len = (size_t) size ] = 0;
+
+    // (at most one secret per line)
+
+    for (max = 1, line = set->text; (nl = strchr( line, '\n' )); line = nl + 1)
+        max++;
+
+    if (0
+        || !(set->table     = totp_table_create( max ))
+        || !(set->line_hash = (uint64_t*)    malloc( max * sizeof( uint64_t )))
+        || !(set->line_at   = (size_t*)      malloc( max * sizeof( size_t )))
+        || !(set->line_len  = (size_t*)      malloc( max * sizeof( size_t )))
+    )
+    {
+        free_secrets( set );
+        return NULL;
+    }
+
+    for (*parsed = 0, line = set->text; *line; line += len + (line[ len ] == '\n'))
+    {
+        len = (nl = strchr( line, '\n' )) ? (size_t) (nl - line) : strlen( line );
+        h   = hash_line( line, len );
+
+        if ((x = find_line( old, h, line, len )) != 0)
+            totp_table_get( old->table, x - 1, &s );    // (unchanged)
+        else if (totp_parse_line( &s, line, len ) == TOTP_OK)
+            ++*parsed;
+        else
+            continue;
+
+        if (!(ok = add_secret( set, &s, &added )))
+            break;
+
+        if (!added)
+            continue;
+
+        set->line_hash[ set->count - 1 ] = h;
+        set->line_at  [ set->count - 1 ] = line - set->text;
+        set->line_len [ set->count - 1 ] = len;
+    }
+
+    totp_wipe( &s );
+
+    if (!ok || !index_lines( set ))
+    {
+        free_secrets( set );
+        return NULL;
+    }
+
+    totp_table_trim( set->table );
+
+    return set;
+}
+
+// --key FILE: the first line is the sealed store's passphrase...
+
+static bool read_key( const char* path )
+{
+    FILE*   f;
+    bool    ok;
+
+    if (!(f = fopen( path, "r" )))
+        return false;
+
+    setvbuf( f, NULL, _IONBF, 0 );      // (no stdio copy of the passphrase)
+
+    ok = fgets( g_pass, sizeof( g_pass ), f ) != NULL;
+    fclose( f );
+
+    g_pass[ strcspn( g_pass, "\r\n" ) ] = 0;
+
+    if (!ok || !g_pass[0])
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    return true;
+}
+
+// --store FILE: all of the store's secrets (copied into the table, so
+// the store is closed again once they have been)...
+
+static secret_set* load_store( const char* path )
+{
+    secret_set*  set;
+    totp_store*  store;
+    totp_secret  s;
+    size_t       count, i;
+    bool         ok = true, added;
+
+    if (!(set = (secret_set*) calloc( 1, sizeof( *set ))) || !(store = totp_store_open( path )))
+    {
+        free( set );
+        return NULL;
+    }
+
+    // (sealed: all of its secrets are decrypted right away, of course)
+
+    if (totp_store_locked( store ) && totp_store_unlock( store, g_pass, strlen( g_pass )) != TOTP_OK)
+    {
+        totp_store_close( store );
+        free_secrets( set );
+        errno = EACCES;             // (no --key, or wrong passphrase)
+        return NULL;
+    }
+
+    count = totp_store_count( store );
+
+    if (!(set->table = totp_table_create( count )))
+        ok = false;
+
+    for (i=0; ok && i < count; i++)
+        if (totp_store_get( store, i, &s ) == TOTP_OK)
+            ok = add_secret( set, &s, &added );
+
+    totp_wipe( &s );
+    totp_store_close( store );
+
+    if (!ok)
+    {
+        free_secrets( set );
+        return NULL;
+    }
+
+    totp_table_trim( set->table );
+    return set;
+}
+
+//---------------------------------------------------------------------
+//                            Batches
+//---------------------------------------------------------------------
+//
+//  A batch is a copy of all of the complete requests read from one
+//  connection at once, along with room for their responses. Finished
+//  batches are kept for reuse rather than freed, so once warmed up
+//  nothing is allocated per request.
+//
+//---------------------------------------------------------------------
+
+struct conn;
+
+struct batch
+{
+    batch*          next;           // (next in queue or free list)
+    conn*           c;              // (connection it was read from)
+    size_t          n;              // (number of requests)
+    size_t          len;            // (length of requests)
+    char            req[ CONN_BUF ];            // (the requests)
+    totpd_response  rsp[ BATCH_MAX ];           // (their responses)
+};
+
+struct batch_queue
+{
+    batch*          head;           // (first in queue)
+    batch*          tail;           // (last in queue)
+};
+
+static totp_lock_t  g_lock;         // (all of the below)
+static totp_cond_t  g_work;         // (a batch was queued, or stopping)
+static batch_queue  g_todo;         // (batches waiting for a worker)
+static batch_queue  g_done;         // (batches waiting to be written)
+static batch*       g_free = NULL;  // (batches for reuse)
+static bool         g_stop = false; // (workers must exit)
+static int          g_eventfd = -1; // (wakes the event loop: g_done)
+
+static void queue_put( batch_queue* q, batch* b )
+{
+    b->next = NULL;
+
+    if (q->tail)
+        q->tail->next = b;
+    else
+        q->head = b;
+
+    q->tail = b;
+}
+
+static batch* queue_get( batch_queue* q )
+{
+    batch*  b;
+
+    if ((b = q->head) && !(q->head = b->next))
+        q->tail = NULL;
+
+    return b;
+}
+
+static batch* alloc_batch()
+{
+    batch*  b;
+
+    lock_obtain( &g_lock );
+
+    if ((b = g_free))
+        g_free = b->next;
+
+    lock_release( &g_lock );
+
+    return b ? b : (batch*) malloc( sizeof( batch ));
+}
+
+static void free_batch( batch* b )
+{
+    totp_cleanse( b->req, b->len );     // (names and codes)
+
+    lock_obtain( &g_lock );
+    b->next = g_free;
+    g_free  = b;
+    lock_release( &g_lock );
+}
+
+//---------------------------------------------------------------------
+//                            Workers
+//---------------------------------------------------------------------
+
+struct worker
+{
+    totp_thread_t        thread;
+    volatile uint64_t    epoch;     // (g_epoch when it took g_set, or 0)
+    size_t*              gen;       // (now's generate requests' secrets)
+    size_t*              gen_at;    // (and which requests they are)
+    uint32_t*            codes;     // (and their codes)
+};
+
+static volatile uint64_t  g_epoch = 1;      // (moved on by each reload)
+
+// Take the current secrets (never waits), and let go of them again
+// (see Reload)...
+
+static const secret_set* set_enter( worker* w )
+{
+    __atomic_store_n( &w->epoch, __atomic_load_n( &g_epoch, __ATOMIC_SEQ_CST ), __ATOMIC_SEQ_CST );
+    return __atomic_load_n( &g_set, __ATOMIC_SEQ_CST );
+}
+
+static void set_leave( worker* w )
+{
+    __atomic_store_n( &w->epoch, 0, __ATOMIC_RELEASE );
+}
+
+static void process_batch( worker* w, batch* b )
+{
+    totpd_request   rq;
+    totpd_response* rs;
+    const char*     p = b->req;
+    totp_secret     s;
+    const secret_set*   set = set_enter( w );
+    int64_t         now = time( NULL );
+    size_t          i, x, ngen = 0;
+    int             drift;
+
+    for (i=0; i < b->n; i++, p += sizeof( rq ) + rq.name_len)
+    {
+        memcpy( &rq, p, sizeof( rq ));
+
+        rs = &b->rsp[i];
+        rs->id     = rq.id;
+        rs->status = TOTPD_OK;
+        rs->code   = 0;
+        rs->drift  = 0;
+
+        if ((x = totp_table_find( set->table, p + sizeof( rq ), rq.name_len )) == TOTP_TABLE_NOTFOUND)
+        {
+            rs->status = TOTPD_NOTFOUND;
+            continue;
+        }
+
+        switch (rq.op)
+        {
+            case TOTPD_GENERATE:
+
+                if (rq.at_time)
+                {
+                    totp_table_get( set->table, x, &s );
+                    rs->code = totp_generate( &s, rq.at_time );
+                }
+                else
+                {
+                    w->gen   [ ngen ]   = x;    // (all of these
+                    w->gen_at[ ngen++ ] = i;    //  at once, below)
+                }
+                break;
+
+            case TOTPD_VERIFY:
+
+                // (only ever now: a client mustn't be able to choose the
+                //  time, and so have any code it likes accepted, or make
+                //  the replay cache forget codes it's already accepted)
+
+                if (rq.window > TOTPD_MAX_WINDOW || rq.at_time)
+                {
+                    rs->status = TOTPD_EINVAL;
+                    break;
+                }
+
+                totp_table_get( set->table, x, &s );
+
+                // (nor may its code stay acceptable for longer than the
+                //  replay cache remembers: then it's the request that's
+                //  wrong, not the code)
+
+                if ((int64_t) (2 * rq.window + 1) * (int64_t) s.interval > REPLAY_LIFETIME)
+                {
+                    rs->status = TOTPD_EINVAL;
+                    break;
+                }
+
+                switch (totp_verify_once( &s, g_replay, rq.code, now, rq.window, &drift ))
+                {
+                    case TOTP_OK:    rs->drift  = drift;          break;
+                    case TOTP_SKIP:  rs->status = TOTPD_REPLAY;   break;
+                    case TOTP_EIO:   rs->status = TOTPD_EIO;      break;
+                    default:         rs->status = TOTPD_FAILED;   break;
+                }
+                break;
+
+            default:
+
+                rs->status = TOTPD_EINVAL;
+                break;
+        }
+    }
+
+    totp_cleanse( &s, sizeof( s ));
+
+    if (ngen)
+    {
+        totp_table_generate( set->table, w->gen, ngen, now, w->codes );
+
+        for (i=0; i < ngen; i++)
+            b->rsp[ w->gen_at[i] ].code = w->codes[i];
+    }
+
+    set_leave( w );
+}
+
+TOTP_THREAD_PROC( worker_thread )
+{
+    worker*   w = (worker*) arg;
+    batch*    b;
+    uint64_t  one = 1;
+
+    for (;;)
+    {
+        lock_obtain( &g_lock );
+
+        while (!(b = queue_get( &g_todo )) && !g_stop)
+            cond_wait( &g_work, &g_lock );
+
+        lock_release( &g_lock );
+
+        if (!b)
+            break;
+
+        process_batch( w, b );
+
+        lock_obtain( &g_lock );
+        queue_put( &g_done, b );
+        lock_release( &g_lock );
+
+        if (write( g_eventfd, &one, sizeof( one )) < 0)
+            ;   // (can only fail if the counter overflows: still woken)
+    }
+
+    TOTP_THREAD_RETURN;
+}
+
+//---------------------------------------------------------------------
+//                             Reload
+//---------------------------------------------------------------------
+//
+//  On SIGHUP, or whenever the secrets file is written or replaced (as
+//  seen by inotify), the reload thread loads the secrets again in the
+//  background (see load_input: only changed lines are parsed again),
+//  and then publishes them RCU style, by simply swapping the g_set
+//  pointer: workers never wait for a reload, and never see a partly
+//  loaded set. The swap moves g_epoch on, and since each worker notes
+//  the g_epoch in effect whenever it takes g_set (and 0 once it's done
+//  with it), the old set is freed as soon as no worker could still be
+//  using it, i.e. once each is either idle or has taken g_set since.
+//  If the secrets can't be loaded, the old ones simply remain in use.
+//
+//---------------------------------------------------------------------
+
+static worker*      g_workers = NULL;   // (all of the workers)
+static bool         g_reload  = false;  // (reload wanted; under g_lock)
+static totp_cond_t  g_reloads;          // (g_reload set, or stopping)
+
+static void reload_secrets()
+{
+    secret_set*      old = g_set;       // (only we ever change it)
+    secret_set*      set;
+    struct timespec  start, end;
+    size_t           parsed = 0;
+    uint64_t         epoch, e;
+    int              i;
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    if (!(set = g_input ? load_input( g_input, old, &parsed ) : load_store( g_store )))
+    {
+        fprintf( stderr, "WARNING: cannot reload \"%s\" - %s (previous secrets still used)\n",
+            g_input ? g_input : g_store, strerror( errno ));
+        return;
+    }
+
+    if (!g_input)
+        parsed = set->count;        // (nothing to parse, but all new)
+
+    __atomic_store_n( &g_set, set, __ATOMIC_SEQ_CST );
+    epoch = __atomic_add_fetch( &g_epoch, 1, __ATOMIC_SEQ_CST );
+
+    // (wait for any workers still using the old set)
+
+    for (i=0; i < g_threads; i++)
+        while ((e = __atomic_load_n( &g_workers[i].epoch, __ATOMIC_SEQ_CST )) != 0 && e < epoch)
+            sched_yield();
+
+    free_secrets( old );
+
+    clock_gettime( CLOCK_MONOTONIC, &end );
+
+    fprintf( stderr, "totpd: reloaded %lu secrets (%lu parsed) in %.1f ms\n",
+        (unsigned long) set->count, (unsigned long) parsed,
+        (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6 );
+
+    report_memory( set );
+}
+
+TOTP_THREAD_PROC( reload_thread )
+{
+    bool  stop;
+
+    (void) arg;
+
+    for (;;)
+    {
+        lock_obtain( &g_lock );
+
+        while (!g_reload && !g_stop)
+            cond_wait( &g_reloads, &g_lock );
+
+        stop     = g_stop;
+        g_reload = false;           // (any more requests meanwhile: again)
+
+        lock_release( &g_lock );
+
+        if (stop)
+            break;
+
+        reload_secrets();
+    }
+
+    TOTP_THREAD_RETURN;
+}
+
+static void request_reload()
+{
+    lock_obtain( &g_lock );
+    g_reload = true;
+    cond_broadcast( &g_reloads );
+    lock_release( &g_lock );
+}
+
+// Watch the secrets file's directory (so that it being replaced, e.g.
+// by an editor or "mv", is seen too). Returns the inotify descriptor
+// (or -1 if it can't be watched; SIGHUP still works).
+
+static char  g_watched[ 256 ];      // (the file's name within it)
+
+static int watch_secrets()
+{
+    char  dir[ 4096 ];
+    char  name[ 4096 ];
+    int   fd;
+
+    snprintf( dir,  sizeof( dir ),  "%s", g_input ? g_input : g_store );
+    snprintf( name, sizeof( name ), "%s", g_input ? g_input : g_store );
+    snprintf( g_watched, sizeof( g_watched ), "%s", basename( name ));
+
+    if ((fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC )) < 0)
+        return -1;
+
+    if (inotify_add_watch( fd, dirname( dir ), IN_CLOSE_WRITE | IN_MOVED_TO ) < 0)
+    {
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+static void secrets_changed( int fd )
+{
+    char                   buf[ 4096 ] __attribute__(( aligned( 8 )));
+    struct inotify_event*  ev;
+    ssize_t                n, i;
+
+    while ((n = read( fd, buf, sizeof( buf ))) > 0)
+    {
+        for (i=0; i < n; i += sizeof( *ev ) + ev->len)
+        {
+            ev = (struct inotify_event*) (buf + i);
+
+            if (ev->len && strcmp( ev->name, g_watched ) == 0)
+                request_reload();
+        }
+    }
+}
+
+//---------------------------------------------------------------------
+//                          Connections
+//---------------------------------------------------------------------
+
+struct conn
+{
+    conn*     next;                 // (next to be freed; see conn_free)
+    int       fd;                   // (socket, or -1 once closed)
+    uint32_t  events;               // (epoll events currently wanted)
+    int       batches;              // (batches in progress)
+    bool      eof;                  // (client has finished sending)
+
+    size_t    inlen;                // (bytes in 'in')
+    char*     out;                  // (responses not yet written)
+    size_t    outpos;               // (offset of first not yet written)
+    size_t    outlen;               // (length of out)
+    size_t    outsize;              // (size of out buffer)
+
+    char      in[ CONN_BUF ];       // (requests read, not yet batched)
+};
+
+static int   g_epoll = -1;          // (the event loop)
+static conn* g_dead  = NULL;        // (closed, to be freed)
+static char  g_listen_tag, g_event_tag, g_signal_tag, g_inotify_tag;  // (epoll tags)
+
+// (not actually freed until the event loop has handled all of the
+// events it was given, since some of them may still be for it)
+
+static void conn_free( conn* c )
+{
+    c->next = g_dead;
+    g_dead  = c;
+}
+
+static void free_dead_conns()
+{
+    conn*  c;
+
+    while ((c = g_dead))
+    {
+        g_dead = c->next;
+
+        totp_cleanse( c->in, c->inlen );
+        free( c->out );
+        free( c );
+    }
+}
+
+static void conn_close( conn* c )
+{
+    if (c->fd >= 0)
+    {
+        epoll_ctl( g_epoll, EPOLL_CTL_DEL, c->fd, NULL );
+        close( c->fd );
+        c->fd = -1;
+    }
+
+    if (!c->batches)            // (else once they're finished)
+        conn_free( c );
+}
+
+// Read if more batches may be started (and the client is keeping up
+// with their responses), write if there's output...
+
+static void conn_events( conn* c )
+{
+    struct epoll_event  ev;
+
+    ev.events   = (!c->eof && c->batches < CONN_BATCHES && c->outlen - c->outpos <= CONN_OUT_MAX ? EPOLLIN : 0)
+                | (c->outpos < c->outlen ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+
+    if (ev.events != c->events)
+    {
+        epoll_ctl( g_epoll, EPOLL_CTL_MOD, c->fd, &ev );
+        c->events = ev.events;
+    }
+}
+
+// Write as much as possible. Returns false if the connection failed.
+
+static bool conn_write( conn* c )
+{
+    ssize_t  n;
+
+    while (c->outpos < c->outlen)
+    {
+        if ((n = write( c->fd, c->out + c->outpos, c->outlen - c->outpos )) > 0)
+            c->outpos += n;
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0 && errno == EAGAIN)
+            break;
+        else
+            return false;
+    }
+
+    // (what's left to the start, so the buffer never needs to grow
+    //  beyond CONN_OUT_MAX plus the batches still in progress)
+
+    if (c->outpos)
+    {
+        memmove( c->out, c->out + c->outpos, c->outlen -= c->outpos );
+        c->outpos = 0;
+    }
+
+    return true;
+}
+
+// Hand all of the complete requests read so far to the workers as one
+// batch. Returns false if the connection sent an invalid request.
+
+static bool conn_submit( conn* c )
+{
+    totpd_request  rq;
+    size_t         len = 0, n = 0;
+    batch*         b;
+
+    while (c->inlen - len >= sizeof( rq ))
+    {
+        memcpy( &rq, c->in + len, sizeof( rq ));
+
+        if (rq.name_len > TOTPD_MAX_NAME)
+            return false;               // (can't be trusted any more)
+
+        if (c->inlen - len < sizeof( rq ) + rq.name_len)
+            break;
+
+        len += sizeof( rq ) + rq.name_len;
+        n++;
+    }
+
+    if (!n)
+        return true;
+
+    if (!(b = alloc_batch()))
+        return false;
+
+    b->c   = c;
+    b->n   = n;
+    b->len = len;
+
+    memcpy( b->req, c->in, len );
+    totp_cleanse( c->in, len );
+    memmove( c->in, c->in + len, c->inlen -= len );
+
+    c->batches++;
+
+    lock_obtain( &g_lock );
+    queue_put( &g_todo, b );
+    cond_broadcast( &g_work );
+    lock_release( &g_lock );
+
+    return true;
+}
+
+static void conn_read( conn* c )
+{
+    ssize_t  n;
+
+    while ((n = read( c->fd, c->in + c->inlen, CONN_BUF - c->inlen )) < 0 && errno == EINTR)
+        ;
+
+    if (n == 0)
+        c->eof = true;              // (but answer what it did send)
+    else if (n < 0)
+    {
+        if (errno != EAGAIN)
+        {
+            conn_close( c );
+            return;
+        }
+    }
+    else
+        c->inlen += n;
+
+    if (!conn_submit( c ))
+    {
+        conn_close( c );
+        return;
+    }
+
+    if (c->eof && !c->batches)
+        conn_close( c );
+    else
+        conn_events( c );
+}
+
+// A batch is finished: append its responses to its connection's output
+// and write them...
+
+static void conn_finished( batch* b )
+{
+    conn*   c = b->c;
+    size_t  len = b->n * sizeof( totpd_response );
+
+    c->batches--;
+
+    if (c->fd >= 0 && c->outlen + len > c->outsize)
+    {
+        size_t  size = (c->outlen + len) * 2;
+        char*   out;
+
+        if (!(out = (char*) realloc( c->out, size )))
+        {
+            free_batch( b );
+            conn_close( c );
+            return;
+        }
+
+        c->out     = out;
+        c->outsize = size;
+    }
+
+    if (c->fd >= 0)
+    {
+        memcpy( c->out + c->outlen, b->rsp, len );
+        c->outlen += len;
+    }
+
+    free_batch( b );
+
+    if (c->fd < 0)
+    {
+        if (!c->batches)
+            conn_free( c );
+    }
+    else if (!conn_write( c ) || (c->eof && !c->batches && c->outpos == c->outlen))
+        conn_close( c );
+    else
+        conn_events( c );
+}
+
+static void accept_conns( int lfd )
+{
+    struct epoll_event  ev;
+    conn*               c;
+    int                 fd;
+
+    while ((fd = accept4( lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC )) >= 0)
+    {
+        if (!(c = (conn*) calloc( 1, offsetof( conn, in ) + CONN_BUF )))
+        {
+            close( fd );
+            continue;
+        }
+
+        c->fd     = fd;
+        c->events = EPOLLIN;
+
+        ev.events   = EPOLLIN;
+        ev.data.ptr = c;
+
+        if (epoll_ctl( g_epoll, EPOLL_CTL_ADD, fd, &ev ) != 0)
+        {
+            close( fd );
+            free( c );
+        }
+    }
+}
+
+//---------------------------------------------------------------------
+//                           Event loop
+//---------------------------------------------------------------------
+
+static int open_socket()
+{
+    struct sockaddr_un  sa;
+    mode_t              mask;
+    bool                ok;
+    int                 fd;
+
+    if (strlen( g_socket ) >= sizeof( sa.sun_path ))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset( &sa, 0, sizeof( sa ));
+    sa.sun_family = AF_UNIX;
+    strcpy( sa.sun_path, g_socket );
+
+    unlink( g_socket );     // (left behind by a previous run)
+
+    if ((fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 )) < 0)
+        return -1;
+
+    // (nobody else may connect before its permissions have been set)
+
+    mask = umask( 0177 );
+    ok   = bind( fd, (struct sockaddr*) &sa, sizeof( sa )) == 0;
+    umask( mask );
+
+    if (0
+        || !ok
+        || chmod( g_socket, g_mode ) != 0
+        || listen( fd, SOMAXCONN ) != 0
+    )
+    {
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+static int event_loop( int lfd, int sfd, int ifd )
+{
+    struct signalfd_siginfo  si;
+    struct epoll_event  ev[ MAX_EVENTS ];
+    batch_queue         done;
+    batch*              b;
+    uint64_t            count;
+    int                 n, i;
+
+    for (;;)
+    {
+        if ((n = epoll_wait( g_epoll, ev, MAX_EVENTS, -1 )) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            fprintf( stderr, "ERROR: epoll_wait() FAILED! - %s\n", strerror( errno ));
+            return EXIT_FAILURE;
+        }
+
+        for (i=0; i < n; i++)
+        {
+            if (ev[i].data.ptr == &g_listen_tag)
+                accept_conns( lfd );
+
+            else if (ev[i].data.ptr == &g_signal_tag)
+            {
+                while (read( sfd, &si, sizeof( si )) == (ssize_t) sizeof( si ))
+                {
+                    if (si.ssi_signo != SIGHUP)
+                        return EXIT_SUCCESS;    // (SIGINT or SIGTERM)
+
+                    request_reload();
+                }
+            }
+            else if (ev[i].data.ptr == &g_inotify_tag)
+                secrets_changed( ifd );
+
+            else if (ev[i].data.ptr == &g_event_tag)
+            {
+                if (read( g_eventfd, &count, sizeof( count )) < 0)
+                    ;   // (nothing: spurious)
+
+                lock_obtain( &g_lock );
+                done = g_done;
+                g_done.head = g_done.tail = NULL;
+                lock_release( &g_lock );
+
+                while ((b = queue_get( &done )))
+                    conn_finished( b );
+            }
+            else
+            {
+                conn*  c = (conn*) ev[i].data.ptr;
+
+                if (c->fd < 0)
+                    continue;       // (already closed)
+
+                // (writing first, so a backlog that's drained lets
+                //  reading start again)
+
+                if (ev[i].events & (EPOLLERR | EPOLLHUP) && !(ev[i].events & EPOLLIN))
+                    conn_close( c );
+                else if ((ev[i].events & EPOLLOUT) && !conn_write( c ))
+                    conn_close( c );
+                else if (ev[i].events & EPOLLIN)
+                    conn_read( c );
+                else if (c->eof && !c->batches && c->outpos == c->outlen)
+                    conn_close( c );
+                else
+                    conn_events( c );
+            }
+        }
+
+        free_dead_conns();
+    }
+}
+
+//---------------------------------------------------------------------
+//                              usage
+//---------------------------------------------------------------------
+
+static void usage()
+{
+    fprintf( stderr,
+
+        "\n  Fish's TOTP daemon, version " TOTPD_VERSION ".\n\n"
+
+        "  Usage:  totpd [options] --input FILE | --store FILE\n\n"
+
+        "  Serves TOTP generate and verify requests (see totpd.h) for\n"
+        "  the secrets in FILE over a Unix domain socket.\n\n"
+
+        "  Options:\n\n"
+
+        "    --input FILE  The secrets, in the same format as totp's input.\n\n"
+
+        "    --store FILE  The secrets, in a precompiled secret store (see\n"
+        "                  totp --compile).\n\n"
+
+        "    --key FILE    The passphrase of a sealed store (see totp --key),\n"
+        "                  the first line of FILE.\n\n"
+
+        "    --socket PATH  The socket's path (default " TOTPD_SOCKET ").\n\n"
+
+        "    --mode MODE   The socket's (octal) permissions (default 600,\n"
+        "                  i.e. only the user totpd runs as may connect).\n\n"
+
+        "    --threads N   Number of worker threads (0 = one per CPU, the\n"
+        "                  default).\n\n"
+
+        "    --replay N    The most codes accepted within any one code's\n"
+        "                  lifetime which the replay cache can remember\n"
+        "                  (default 1000000).\n\n"
+    );
+}
+
+//---------------------------------------------------------------------
+//                            parse_args
+//---------------------------------------------------------------------
+
+// Is 'arg' wholly a number in 'base' (no sign, blanks or trailing junk)?
+
+static bool parse_number( const char* arg, int base, unsigned long* n )
+{
+    char*  end;
+
+    if (!isdigit( (unsigned char) *arg ))
+        return false;
+
+    errno = 0;
+    *n = strtoul( arg, &end, base );
+
+    return !*end && !errno;
+}
+
+static bool parse_args( int argc, char* argv[] )
+{
+    unsigned long  n;
+    int            i;
+
+    for (i=1; i < argc; i++)
+    {
+        if      (strcmp( argv[i], "--input"   ) == 0 && i+1 < argc) g_input  = argv[++i];
+        else if (strcmp( argv[i], "--store"   ) == 0 && i+1 < argc) g_store  = argv[++i];
+        else if (strcmp( argv[i], "--key"     ) == 0 && i+1 < argc) g_key    = argv[++i];
+        else if (strcmp( argv[i], "--socket"  ) == 0 && i+1 < argc) g_socket = argv[++i];
+        else if (strcmp( argv[i], "--mode"    ) == 0 && i+1 < argc)
+        {
+            if (!parse_number( argv[++i], 8, &n ) || n > 0777)
+            {
+                fprintf( stderr, "ERROR: invalid --mode \"%s\"\n", argv[i] );
+                return false;
+            }
+            g_mode = (unsigned) n;
+        }
+        else if (strcmp( argv[i], "--replay"  ) == 0 && i+1 < argc)
+        {
+            if (!parse_number( argv[++i], 10, &n ) || !n)
+            {
+                fprintf( stderr, "ERROR: invalid --replay \"%s\"\n", argv[i] );
+                return false;
+            }
+            g_entries = n;
+        }
+        else if (strcmp( argv[i], "--threads" ) == 0 && i+1 < argc)
+        {
+            if (!parse_number( argv[++i], 10, &n ))
+            {
+                fprintf( stderr, "ERROR: invalid --threads \"%s\"\n", argv[i] );
+                return false;
+            }
+            g_threads = n > MAX_THREADS ? MAX_THREADS : (int) n;
+        }
+        else
+        {
+            if (strcmp( argv[i], "--help" ) != 0 && strcmp( argv[i], "-h" ) != 0)
+                fprintf( stderr, "ERROR: unknown option \"%s\"\n", argv[i] );
+            usage();
+            return false;
+        }
+    }
+
+    if (!g_input == !g_store)
+    {
+        fprintf( stderr, "ERROR: exactly one of --input or --store is required\n" );
+        usage();
+        return false;
+    }
+
+    if (g_key && !g_store)
+    {
+        fprintf( stderr, "ERROR: --key requires --store\n" );
+        return false;
+    }
+
+    if (g_threads <= 0)
+        g_threads = (int) sysconf( _SC_NPROCESSORS_ONLN );
+
+    if (g_threads <= 0)
+        g_threads = 1;
+
+    return true;
+}
+
+//---------------------------------------------------------------------
+//                           M A I N
+//---------------------------------------------------------------------
+
+int main( int argc, char* argv[] )
+{
+    struct epoll_event  ev;
+    totp_thread_t       reloader;
+    sigset_t            sigs;
+    size_t              parsed;
+    int                 lfd, sfd, ifd, i, rc;
+
+    if (!parse_args( argc, argv ))
+        return EXIT_FAILURE;
+
+    // Keep the secrets out of swap and core dumps...
+
+    prctl( PR_SET_DUMPABLE, 0 );
+
+    if (mlockall( MCL_CURRENT | MCL_FUTURE ) != 0)
+        fprintf( stderr, "WARNING: mlockall() FAILED - %s (secrets may be swapped)\n", strerror( errno ));
+
+    // (the passphrase is kept, as every reload must unlock the store again)
+
+    if (g_key && !read_key( g_key ))
+    {
+        fprintf( stderr, "ERROR: cannot read --key \"%s\" - %s\n", g_key, strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    if (!(g_set = g_input ? load_input( g_input, NULL, &parsed ) : load_store( g_store )))
+    {
+        fprintf( stderr, "ERROR: cannot load \"%s\" - %s\n", g_input ? g_input : g_store, strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    if (!(g_replay = totp_replay_create( g_entries, REPLAY_LIFETIME )))
+    {
+        fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    // SIGINT/SIGTERM/SIGHUP are received by the event loop (via a signalfd)...
+
+    sigemptyset( &sigs );
+    sigaddset( &sigs, SIGINT );
+    sigaddset( &sigs, SIGTERM );
+    sigaddset( &sigs, SIGHUP );
+    sigprocmask( SIG_BLOCK, &sigs, NULL );      // (before any threads)
+    signal( SIGPIPE, SIG_IGN );
+
+    if (0
+        || (lfd = open_socket()) < 0
+        || (sfd = signalfd( -1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC )) < 0
+        || (g_eventfd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC )) < 0
+        || (g_epoll = epoll_create1( EPOLL_CLOEXEC )) < 0
+    )
+    {
+        fprintf( stderr, "ERROR: cannot open socket \"%s\" - %s\n", g_socket, strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &g_listen_tag;  epoll_ctl( g_epoll, EPOLL_CTL_ADD, lfd, &ev );
+    ev.data.ptr = &g_signal_tag;  epoll_ctl( g_epoll, EPOLL_CTL_ADD, sfd, &ev );
+    ev.data.ptr = &g_event_tag;   epoll_ctl( g_epoll, EPOLL_CTL_ADD, g_eventfd, &ev );
+
+    if ((ifd = watch_secrets()) >= 0)
+    {
+        ev.data.ptr = &g_inotify_tag;
+        epoll_ctl( g_epoll, EPOLL_CTL_ADD, ifd, &ev );
+    }
+    else
+        fprintf( stderr, "WARNING: cannot watch \"%s\" - %s (reload with SIGHUP)\n",
+            g_input ? g_input : g_store, strerror( errno ));
+
+    // Start the workers, and the reload thread...
+
+    lock_init( &g_lock );
+    cond_init( &g_work );
+    cond_init( &g_reloads );
+
+    if (!(g_workers = (worker*) calloc( g_threads, sizeof( worker ))))
+    {
+        fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    for (i=0; i < g_threads; i++)
+    {
+        g_workers[i].gen    = (size_t*)   malloc( BATCH_MAX * sizeof( size_t ));
+        g_workers[i].gen_at = (size_t*)   malloc( BATCH_MAX * sizeof( size_t ));
+        g_workers[i].codes  = (uint32_t*) malloc( BATCH_MAX * sizeof( uint32_t ));
+
+        if (0
+            || !g_workers[i].gen || !g_workers[i].gen_at || !g_workers[i].codes
+            || !thread_create( &g_workers[i].thread, worker_thread, &g_workers[i] )
+        )
+        {
+            fprintf( stderr, "ERROR: cannot start worker threads - %s\n", strerror( errno ));
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!thread_create( &reloader, reload_thread, NULL ))
+    {
+        fprintf( stderr, "ERROR: cannot start reload thread - %s\n", strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    fprintf( stderr, "totpd %s: %lu secrets, %d threads, listening on %s\n", TOTPD_VERSION,
+        (unsigned long) g_set->count, g_threads, g_socket );
+
+    report_memory( g_set );
+
+    rc = event_loop( lfd, sfd, ifd );
+
+    // Stop the workers and the reload thread, and cleanup...
+
+    lock_obtain( &g_lock );
+    g_stop = true;
+    cond_broadcast( &g_work );
+    cond_broadcast( &g_reloads );
+    lock_release( &g_lock );
+
+    thread_join( reloader );
+
+    for (i=0; i < g_threads; i++)
+        thread_join( g_workers[i].thread );
+
+    close( lfd );
+    unlink( g_socket );
+
+    free_secrets( g_set );
+    totp_replay_destroy( g_replay );
+
+    return rc;
+}
@@ -0,0 +1,85 @@
+///////////////////////////////////////////////////////////////////////
+// totpd.h: the request and response format of 'totpd', the local TOTP
+// generation/verification daemon, for programs which talk to it (e.g.
+// PAM helpers) over its Unix domain socket.
+///////////////////////////////////////////////////////////////////////
+//
+//  Usage:
+//
+//      totpd_request   rq = { 0 };
+//      totpd_response  rs;
+//
+//      rq.id       = 1;
+//      rq.op       = TOTPD_VERIFY;
+//      rq.window   = 1;
+//      rq.name_len = strlen( name );
+//      rq.code     = code;
+//
+//      write( fd, &rq, sizeof( rq ));      // (header, then
+//      write( fd, name, rq.name_len );     //  the name)
+//      read ( fd, &rs, sizeof( rs ));
+//
+//      ok = rs.status == TOTPD_OK;
+//
+//  A request is a fixed size header immediately followed by the name
+//  of the secret (its label without any leading comment characters or
+//  blanks, the same name totp --name uses), with no padding. Any number
+//  of requests may be sent without waiting for their responses (i.e.
+//  pipelined; e.g. a whole batch in one write), and each gets exactly
+//  one fixed size response, carrying the request's id. Responses are
+//  NOT necessarily in the order their requests were sent.
+//
+//  Codes are only ever verified as of totpd's own clock: a verify
+//  request's at_time must be 0 (otherwise it's TOTPD_EINVAL), as only
+//  generate requests may ask about some other time. It's TOTPD_EINVAL
+//  too if its window would keep the code acceptable for longer than
+//  totpd remembers the codes it has accepted (a day).
+//
+//  Both ends are always on the same machine, so all fields are in the
+//  machine's own (native) byte order.
+//
+///////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+
+#define TOTPD_SOCKET        "/tmp/totpd.sock"   // (default socket path)
+#define TOTPD_MAX_NAME      255     // (longest name in a request)
+#define TOTPD_MAX_WINDOW    10      // (largest verify window)
+
+// Operations...
+
+#define TOTPD_GENERATE      1       // (the secret's code at at_time)
+#define TOTPD_VERIFY        2       // (is 'code' valid now?)
+
+// Response status...
+
+#define TOTPD_OK            0       // (generated, or accepted)
+#define TOTPD_FAILED        1       // (wrong code)
+#define TOTPD_REPLAY        2       // (right code, but already accepted)
+#define TOTPD_NOTFOUND      3       // (no secret with that name)
+#define TOTPD_EINVAL        4       // (invalid request)
+#define TOTPD_EIO           5       // (replay cache full; try again)
+
+typedef struct totpd_request        // (followed by name_len bytes of name)
+{
+    uint32_t  id;                   // (anything; returned in the response)
+    uint8_t   op;                   // (TOTPD_GENERATE or TOTPD_VERIFY)
+    uint8_t   window;               // (verify: +/- time steps accepted)
+    uint16_t  name_len;             // (length of name; not terminated)
+    uint32_t  code;                 // (verify: code to be verified)
+    uint32_t  reserved;             // (must be zero)
+    int64_t   at_time;              // (generate: Unix time, or 0 for now;
+                                    //  verify: must be 0)
+}
+totpd_request;
+
+typedef struct totpd_response
+{
+    uint32_t  id;                   // (the request's id)
+    uint32_t  status;               // (TOTPD_xxx status)
+    uint32_t  code;                 // (generate: the code)
+    int32_t   drift;                // (verify: time steps the code was off)
+}
+totpd_response;
@@ -0,0 +1,982 @@
+// Copyright (C) "Fish" (David B. Trout) <fish@softdevlabs.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+
+#include "stdafx.h"
+#include "libtotp_int.h"
+#include "totpd.h"
+#include "bench.h"
+
+#include <sys/socket.h>             // (need socket)
+#include <sys/un.h>                 // (need sockaddr_un)
+
+//------------------------------------------------------------------------------
+//                                 TOTPLOAD
+//------------------------------------------------------------------------------
+//
+//  The load generator: verifies codes for the same synthetic secrets as
+//  bench (see bench.h) at a fixed target rate, either against a running
+//  totpd over its socket (which must have been given the same secrets:
+//  see --write), or in-process, doing exactly what totpd's workers do
+//  (find, get and totp_verify_once), so the difference between the two
+//  is the cost of the daemon itself.
+//
+//  Each request is one of four kinds, mixed in the given proportions:
+//  a valid code never tried before (which must be accepted), a stale
+//  one (the secret's code from just outside the window, which must be
+//  rejected), a replay of a valid code accepted a while earlier (which
+//  must be rejected as a replay) and garbage (a random code, but never
+//  one which is valid, which must be rejected). Every response is
+//  checked, so a daemon which gets faster by getting things wrong fails.
+//
+//  Codes are verified now, as totpd only ever verifies them as of its
+//  own clock, so a valid code is one from the window around now, with
+//  the widest window there is (TOTPD_MAX_WINDOW) for as many of them
+//  as possible: each connection works through its share of the secrets
+//  moving on one time step each time round, from the current step to
+//  the latest one in the window (never earlier ones, so that each stays
+//  in the window, and can be replayed, for minutes rather than until
+//  the step ends). So there must be enough secrets for each to be used
+//  at most window + 1 times (checked before starting). A stale code is
+//  from the step before the window, and a replay is of a valid code
+//  which has been answered, and is only sent while that code would
+//  still be in the window a step from now (otherwise a valid code is
+//  sent instead).
+//
+//  The load is "open loop": each connection's requests are due at fixed
+//  intervals from the start, whether or not earlier ones have been
+//  answered yet, and each one's latency is measured from when it was
+//  DUE rather than when it was actually sent. Otherwise a stall would
+//  only count against the few requests waiting on it while the requests
+//  which should have been sent meanwhile simply wouldn't be, hiding it
+//  (i.e. "coordinated omission"). A daemon which can't keep up shows up
+//  as a falling achieved rate and rapidly growing latencies.
+//
+//  Stopped once each connection's share of rate * duration requests have
+//  all been answered. Fails if any response was wrong, the achieved rate
+//  was under LOAD_MIN_RATE of the target, or the 99th percentile latency
+//  was over --max-p99. Linux only (as totpd).
+//
+//------------------------------------------------------------------------------
+
+#define LOAD_VERSION    VERSION_STR
+
+#define LOAD_SECRETS    100000      // (--secrets default)
+#define LOAD_RATE       100000      // (--rate default, requests/sec)
+#define LOAD_DURATION   10          // (--duration default, seconds)
+#define LOAD_CONNS      4           // (--connections default)
+#define LOAD_MAX_CONNS  256         // (--connections maximum)
+#define LOAD_WINDOW     TOTPD_MAX_WINDOW    // (verify window, +/- time steps)
+#define LOAD_MIN_RATE   0.95        // (least achieved/target rate passed)
+#define LOAD_MIN_MIX    0.5         // (least share of each kind's --mix passed)
+#define LOAD_FLIGHT     (1 << 20)   // (most requests in flight per connection)
+#define LOAD_SEND       256         // (most requests per write)
+#define LOAD_RECENT     4096        // (valid codes remembered for replays)
+#define LOAD_SPIN_NS    100000      // (sleep until this close, then spin)
+
+enum { KIND_VALID, KIND_STALE, KIND_REPLAYED, KIND_GARBAGE, NUM_KINDS };
+
+static const char* const  kind_names[ NUM_KINDS ] = { "valid", "stale", "replayed", "garbage" };
+static const uint32_t     kind_status[ NUM_KINDS ] = { TOTPD_OK, TOTPD_FAILED, TOTPD_REPLAY, TOTPD_FAILED };
+
+#define NUM_STATUS      (TOTPD_EIO + 1)
+
+static size_t       g_secrets = LOAD_SECRETS;   // (--secrets N)
+static double       g_rate    = LOAD_RATE;      // (--rate N)
+static double       g_secs    = LOAD_DURATION;  // (--duration SECS)
+static int          g_conns   = LOAD_CONNS;     // (--connections N)
+static const char*  g_socket  = NULL;           // (--socket PATH; NULL = in-process)
+static const char*  g_write   = NULL;           // (--write FILE)
+static double       g_max_p99 = 0;              // (--max-p99 MS; 0 = any)
+static unsigned     g_mix[ NUM_KINDS ] = { 70, 10, 10, 10 };   // (--mix V,S,R,G)
+
+static totp_table*  g_table  = NULL;            // (the synthetic secrets)
+static totp_replay* g_replay = NULL;            // (in-process: replay cache)
+static uint64_t     g_start  = 0;               // (when the first request is due)
+
+//---------------------------------------------------------------------
+//                              Clock
+//---------------------------------------------------------------------
+
+static uint64_t now_ns()            // (monotonic)
+{
+    struct timespec  ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+// Wait until 'due' (sleeping most of the way, then spinning, since the
+// scheduler wakes sleepers tens of microseconds late, but yielding, so
+// as not to starve totpd or the other connections of a CPU)...
+
+static void wait_until( uint64_t due )
+{
+    struct timespec  ts;
+    uint64_t         t;
+
+    if ((t = now_ns()) + LOAD_SPIN_NS < due)
+    {
+        t = due - LOAD_SPIN_NS;
+        ts.tv_sec  = (time_t) (t / 1000000000ULL);
+        ts.tv_nsec = (long)   (t % 1000000000ULL);
+
+        clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL );
+    }
+
+    while (now_ns() < due)
+        sched_yield();
+}
+
+//---------------------------------------------------------------------
+//                            Histogram
+//---------------------------------------------------------------------
+//
+//  Latencies in nanoseconds, counted in log-linear buckets: exact up to
+//  HIST_EXACT, then HIST_SUB buckets per power of two (i.e. within about
+//  3%), so that any latency from nanoseconds to minutes fits in a few
+//  thousand counters, and each connection's can simply be added up.
+//
+//---------------------------------------------------------------------
+
+#define HIST_SUB_BITS   5
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_EXACT      (2 * HIST_SUB)
+#define HIST_BUCKETS    (HIST_EXACT + (64 - HIST_SUB_BITS - 1) * HIST_SUB)
+
+struct histogram
+{
+    uint64_t  counts[ HIST_BUCKETS ];
+    uint64_t  max;                  // (largest latency)
+};
+
+static size_t hist_bucket( uint64_t ns )
+{
+    int  msb;
+
+    if (ns < HIST_EXACT)
+        return (size_t) ns;
+
+    msb = 63 - __builtin_clzll( ns );
+
+    return HIST_EXACT + (size_t) (msb - HIST_SUB_BITS - 1) * HIST_SUB
+        + (size_t) ((ns >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static uint64_t hist_value( size_t b )  // (bucket's highest latency)
+{
+    int  shift;
+
+    if (b < HIST_EXACT)
+        return b;
+
+    b    -= HIST_EXACT;
+    shift = (int) (b / HIST_SUB) + 1;
+
+    return (((uint64_t) (HIST_SUB + b % HIST_SUB) + 1) << shift) - 1;
+}
+
+static void hist_add( histogram* h, uint64_t ns )
+{
+    h->counts[ hist_bucket( ns ) ]++;
+
+    if (ns > h->max)
+        h->max = ns;
+}
+
+static uint64_t hist_percentile( const histogram* h, uint64_t total, double pct )
+{
+    uint64_t  want = (uint64_t) (total * pct / 100.0 + 0.5), seen = 0;
+    size_t    b;
+
+    if (!want)
+        want = 1;
+
+    for (b=0; b < HIST_BUCKETS; b++)
+        if ((seen += h->counts[b]) >= want)
+            return hist_value( b ) < h->max ? hist_value( b ) : h->max;
+
+    return h->max;
+}
+
+//---------------------------------------------------------------------
+//                           Connections
+//---------------------------------------------------------------------
+//
+//  Each connection (or in-process, thread) sends every LOAD_CONNS'th
+//  request, request 'seq' being due at g_start + (seq * conns + n) /
+//  rate, and generates them from its own share of the secrets, so that
+//  the connections never need to share anything while running.
+//
+//---------------------------------------------------------------------
+
+struct flight                       // (a request in flight)
+{
+    uint64_t        due;            // (when it was due)
+    uint8_t         kind;           // (KIND_xxx)
+    volatile bool   answered;       // (its response has been received)
+};
+
+struct recent                       // (a valid code sent earlier)
+{
+    uint32_t        secret;         // (its secret)
+    uint32_t        code;           // (the code)
+    int64_t         until;          // (replayable until: still in the window)
+    size_t          seq;            // (its request)
+};
+
+struct conn
+{
+    totp_thread_t   thread;         // (in-process, or sending)
+    totp_thread_t   reader;         // (receiving responses)
+    int             n;              // (connection number)
+    int             fd;             // (socket)
+    size_t          total;          // (requests to send)
+    uint64_t        rng;            // (its own random64_r state)
+
+    size_t          first, count;   // (its share of the secrets)
+    size_t          next;           // (next valid code's secret, ever growing)
+    int64_t         step;           // (time step of this round's valid codes)
+    recent          recents[ LOAD_RECENT ];     // (valid codes sent)
+
+    flight*         flights;        // (LOAD_FLIGHT requests in flight)
+    volatile size_t sent;           // (requests sent)
+    volatile size_t done;           // (responses received)
+    volatile bool   failed;         // (connection lost)
+    uint64_t        last;           // (when the last response arrived)
+
+    uint64_t        results[ NUM_KINDS ][ NUM_STATUS ];
+    histogram       hist;
+};
+
+static conn*        g_conn_list = NULL;         // (all of the connections)
+
+static uint64_t due_time( const conn* c, size_t seq )
+{
+    return g_start + (uint64_t) (((double) seq * g_conns + c->n) * 1e9 / g_rate);
+}
+
+// Get a secret from the table (with its name)...
+
+static void get_secret( size_t i, totp_secret* s, const char** name, size_t* len )
+{
+    totp_table_get( g_table, i, s );
+
+    *name = s->label;
+    *len  = s->label_len;
+
+    totp_name( name, len );
+}
+
+// Is 'code' valid now, or would it be a step from now?
+
+static bool in_window( const totp_secret* s, uint32_t code, int64_t now )
+{
+    return totp_verify( s, code, now, LOAD_WINDOW, NULL )
+        || totp_verify( s, code, now + s->interval, LOAD_WINDOW, NULL );
+}
+
+// Has request 'seq' been answered yet? (In-process, every earlier one
+// has; over a socket, only once its response has been received, since
+// totpd may answer a connection's requests out of order.)
+
+static bool answered( const conn* c, size_t seq, size_t next )
+{
+    if (!c->flights)
+        return seq < next;
+
+    return next - seq < LOAD_FLIGHT    // (its flight not reused since)
+        && __atomic_load_n( &c->flights[ seq % LOAD_FLIGHT ].answered, __ATOMIC_ACQUIRE );
+}
+
+// Make request 'seq': its kind (chosen at random as per --mix), and
+// then its secret and code...
+
+static int make_request( conn* c, size_t seq, totpd_request* rq, totp_secret* s, const char** name )
+{
+    recent*    r;
+    size_t     len, i;
+    uint64_t   pick = random64_r( &c->rng ) % 100;
+    int64_t    now = (int64_t) time( NULL ), step;
+    int        kind;
+
+    for (kind=0; kind < NUM_KINDS - 1 && pick >= g_mix[ kind ]; kind++)
+        pick -= g_mix[ kind ];
+
+    // (a replay is of one of the valid codes remembered, picked at random,
+    //  but only once it's been answered, i.e. accepted, and only while it's
+    //  still in the window: otherwise it's a new valid code instead)
+
+    r = &c->recents[ c->next % LOAD_RECENT ];
+
+    if (kind == KIND_REPLAYED)
+    {
+        if (c->next)
+            r = &c->recents[ random64_r( &c->rng ) % (c->next < LOAD_RECENT ? c->next : LOAD_RECENT) ];
+
+        if (!c->next || !answered( c, r->seq, seq ) || now >= r->until)
+        {
+            kind = KIND_VALID;
+            r    = &c->recents[ c->next % LOAD_RECENT ];
+        }
+    }
+
+    if (kind == KIND_VALID)
+        i = c->first + c->next % c->count;
+    else if (kind == KIND_REPLAYED)
+        i = r->secret;
+    else
+        i = c->first + (size_t) (random64_r( &c->rng ) % c->count);
+
+    get_secret( i, s, name, &len );
+
+    // (the current step; the synthetic secrets all have the same interval)
+
+    step = now / s->interval;
+
+    memset( rq, 0, sizeof( *rq ));
+
+    rq->op       = TOTPD_VERIFY;
+    rq->window   = LOAD_WINDOW;
+    rq->name_len = (uint16_t) len;
+
+    switch (kind)
+    {
+        case KIND_VALID:
+
+            if (!(c->next % c->count) && ++c->step < step)
+                c->step = step;     // (a new round: its step)
+
+            rq->code = totp_generate( s, c->step * s->interval );
+
+            r->secret = (uint32_t) i;
+            r->code   = rq->code;
+            r->until  = (c->step + LOAD_WINDOW) * s->interval;
+            r->seq    = seq;
+
+            c->next++;
+            break;
+
+        case KIND_REPLAYED:
+
+            rq->code = r->code;
+            break;
+
+        case KIND_STALE:
+
+            rq->code = totp_generate( s, (step - LOAD_WINDOW - 1) * s->interval );
+
+            if (!in_window( s, rq->code, now ))
+                break;
+
+            kind = KIND_GARBAGE;    // (same as a code in the window after all)
+
+            // Fall through...
+
+        default:
+
+            do
+                rq->code = (uint32_t) (random64_r( &c->rng ) % totp_pow10[ s->digits ]);
+            while (in_window( s, rq->code, now ));
+            break;
+    }
+
+    return kind;
+}
+
+static void record( conn* c, int kind, uint32_t status, uint64_t due, uint64_t end )
+{
+    c->results[ kind ][ status < NUM_STATUS ? status : TOTPD_EINVAL ]++;
+    hist_add( &c->hist, end > due ? end - due : 0 );
+    c->last = end;
+}
+
+//---------------------------------------------------------------------
+//                           In-process
+//---------------------------------------------------------------------
+//
+//  Exactly what a totpd worker does for each verify request, with each
+//  request verified as soon as it's due (or at once, if already late).
+//
+//---------------------------------------------------------------------
+
+TOTP_THREAD_PROC( inproc_thread )
+{
+    conn*          c = (conn*) arg;
+    totpd_request  rq;
+    totp_secret    s;
+    const char*    name;
+    uint64_t       due;
+    uint32_t       status;
+    size_t         seq, x;
+    int            kind, drift;
+
+    for (seq=0; seq < c->total; seq++)
+    {
+        wait_until( due = due_time( c, seq ));
+
+        kind = make_request( c, seq, &rq, &s, &name );
+
+        if ((x = totp_table_find( g_table, name, rq.name_len )) == TOTP_TABLE_NOTFOUND)
+            status = TOTPD_NOTFOUND;
+        else
+        {
+            totp_table_get( g_table, x, &s );
+
+            switch (totp_verify_once( &s, g_replay, rq.code, time( NULL ), rq.window, &drift ))
+            {
+                case TOTP_OK:    status = TOTPD_OK;       break;
+                case TOTP_SKIP:  status = TOTPD_REPLAY;   break;
+                case TOTP_EIO:   status = TOTPD_EIO;      break;
+                default:         status = TOTPD_FAILED;   break;
+            }
+        }
+
+        record( c, kind, status, due, now_ns() );
+        c->done = seq + 1;
+    }
+
+    totp_cleanse( &s, sizeof( s ));
+    TOTP_THREAD_RETURN;
+}
+
+//---------------------------------------------------------------------
+//                             Socket
+//---------------------------------------------------------------------
+//
+//  Each connection has a sending thread, which writes all of the
+//  requests which are due (pipelined, as many as LOAD_SEND per write)
+//  and then waits until the next one is, and a receiving thread, which
+//  matches each response to its request by id (its sequence number).
+//
+//---------------------------------------------------------------------
+
+static int open_socket( const char* path )
+{
+    struct sockaddr_un  sa;
+    int                 fd;
+
+    if (strlen( path ) >= sizeof( sa.sun_path ))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset( &sa, 0, sizeof( sa ));
+    sa.sun_family = AF_UNIX;
+    strcpy( sa.sun_path, path );
+
+    if ((fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 )) < 0)
+        return -1;
+
+    if (connect( fd, (struct sockaddr*) &sa, sizeof( sa )) != 0)
+    {
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool write_all( int fd, const char* p, size_t len )
+{
+    ssize_t  n;
+
+    for (; len; p += n, len -= (size_t) n)
+        if ((n = write( fd, p, len )) <= 0 && errno != EINTR)
+            return false;
+        else if (n < 0)
+            n = 0;
+
+    return true;
+}
+
+TOTP_THREAD_PROC( send_thread )
+{
+    static const size_t  maxreq = sizeof( totpd_request ) + TOTPD_MAX_NAME;
+
+    conn*          c = (conn*) arg;
+    char*          buf = (char*) malloc( LOAD_SEND * maxreq );
+    totpd_request  rq;
+    totp_secret    s;
+    const char*    name;
+    uint64_t       due;
+    size_t         seq = 0, len, n;
+    int            kind;
+
+    while (buf && seq < c->total && !c->failed)
+    {
+        wait_until( due_time( c, seq ));
+
+        // (everything due by now, as long as there's room in flight)
+
+        for (len = 0, n = 0; n < LOAD_SEND && seq < c->total; n++, seq++)
+        {
+            if ((due = due_time( c, seq )) > now_ns() || seq - c->done >= LOAD_FLIGHT)
+                break;
+
+            kind = make_request( c, seq, &rq, &s, &name );
+            rq.id = (uint32_t) seq;
+
+            c->flights[ seq % LOAD_FLIGHT ].due      = due;
+            c->flights[ seq % LOAD_FLIGHT ].kind     = (uint8_t) kind;
+            c->flights[ seq % LOAD_FLIGHT ].answered = false;
+
+            memcpy( buf + len, &rq, sizeof( rq ));
+            memcpy( buf + len + sizeof( rq ), name, rq.name_len );
+            len += sizeof( rq ) + rq.name_len;
+        }
+
+        if (!n)
+        {
+            sched_yield();          // (too many in flight: wait for some)
+            continue;
+        }
+
+        __atomic_store_n( &c->sent, seq, __ATOMIC_RELEASE );
+
+        if (!write_all( c->fd, buf, len ))
+            c->failed = true;
+    }
+
+    totp_cleanse( &s, sizeof( s ));
+    free( buf );
+
+    if (!buf)
+        c->failed = true;
+
+    TOTP_THREAD_RETURN;
+}
+
+TOTP_THREAD_PROC( recv_thread )
+{
+    conn*            c = (conn*) arg;
+    char             buf[ 64 * 1024 ];
+    totpd_response   rs;
+    flight*          f;
+    size_t           have = 0, at;
+    ssize_t          n;
+    uint64_t         end;
+
+    while (c->done < c->total)
+    {
+        if ((n = read( c->fd, buf + have, sizeof( buf ) - have )) <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            c->failed = true;       // (totpd went away)
+            break;
+        }
+
+        end   = now_ns();
+        have += (size_t) n;
+
+        for (at = 0; have - at >= sizeof( rs ); at += sizeof( rs ))
+        {
+            memcpy( &rs, buf + at, sizeof( rs ));
+
+            f = &c->flights[ rs.id % LOAD_FLIGHT ];
+            record( c, f->kind, rs.status, f->due, end );
+            __atomic_store_n( &f->answered, true, __ATOMIC_RELEASE );
+        }
+
+        memmove( buf, buf + at, have -= at );
+        __atomic_store_n( &c->done, c->done + at / sizeof( rs ), __ATOMIC_RELEASE );
+    }
+
+    TOTP_THREAD_RETURN;
+}
+
+//---------------------------------------------------------------------
+//                             Secrets
+//---------------------------------------------------------------------
+
+// --write FILE: just write the synthetic secrets, for totpd --input...
+
+static bool write_secrets( const char* path )
+{
+    char    line[ SYNTHETIC_MAX ];
+    FILE*   f;
+    size_t  i;
+    bool    ok;
+
+    if (!(f = fopen( path, "wb" )))
+        return false;
+
+    for (ok = true, i=0; ok && i < g_secrets; i++)
+        ok = fwrite( line, make_synthetic( line, i ), 1, f ) == 1;
+
+    return (fclose( f ) == 0) && ok;
+}
+
+static bool load_secrets()
+{
+    char         line[ SYNTHETIC_MAX ];
+    totp_secret  s;
+    size_t       i, len;
+    bool         ok = true;
+
+    if (!(g_table = totp_table_create( g_secrets )))
+        return false;
+
+    for (i=0; ok && i < g_secrets; i++)
+    {
+        len = make_synthetic( line, i );
+
+        ok = totp_parse_line( &s, line, len - 1 ) == TOTP_OK
+          && totp_table_add( g_table, &s ) == TOTP_OK;
+    }
+
+    totp_wipe( &s );
+    return ok;
+}
+
+//---------------------------------------------------------------------
+//                             Report
+//---------------------------------------------------------------------
+
+static int report( double secs )
+{
+    static const double  pcts[] = { 50, 90, 99, 99.9, 99.99 };
+
+    uint64_t    results[ NUM_KINDS ][ NUM_STATUS ] = {{ 0 }};
+    uint64_t    total = 0, wrong = 0, sent[ NUM_KINDS ];
+    histogram*  h;
+    double      rate, p99;
+    size_t      b;
+    int         i, k, st, failed = 0;
+
+    if (!(h = (histogram*) calloc( 1, sizeof( histogram ))))
+        return 1;
+
+    for (i=0; i < g_conns; i++)
+    {
+        for (k=0; k < NUM_KINDS; k++)
+            for (st=0; st < NUM_STATUS; st++)
+                results[k][st] += g_conn_list[i].results[k][st];
+
+        for (b=0; b < HIST_BUCKETS; b++)
+            h->counts[b] += g_conn_list[i].hist.counts[b];
+
+        if (g_conn_list[i].hist.max > h->max)
+            h->max = g_conn_list[i].hist.max;
+    }
+
+    printf( "  %-10s %10s %10s %10s %10s %10s\n", "", "sent", "accepted", "failed", "replay", "wrong" );
+
+    for (k=0; k < NUM_KINDS; k++)
+    {
+        for (sent[k] = 0, st=0; st < NUM_STATUS; st++)
+            sent[k] += results[k][st];
+
+        total += sent[k];
+        wrong += sent[k] - results[k][ kind_status[k] ];
+
+        printf( "  %-10s %10lu %10lu %10lu %10lu %10lu\n", kind_names[k], (unsigned long) sent[k],
+            (unsigned long) results[k][ TOTPD_OK ], (unsigned long) results[k][ TOTPD_FAILED ],
+            (unsigned long) results[k][ TOTPD_REPLAY ], (unsigned long) (sent[k] - results[k][ kind_status[k] ]));
+    }
+
+    rate = total / secs;
+
+    printf( "\n  %lu requests in %.2f seconds: %.0f /sec (target %.0f /sec)\n\n",
+        (unsigned long) total, secs, rate, g_rate );
+
+    printf( "  Latency (from when each request was due):\n\n" );
+
+    for (i=0; i < (int) (sizeof( pcts ) / sizeof( pcts[0] )); i++)
+        printf( "    p%-7g %10.1f us\n", pcts[i], hist_percentile( h, total, pcts[i] ) / 1e3 );
+
+    printf( "    %-8s %10.1f us\n\n", "max", h->max / 1e3 );
+
+    p99 = hist_percentile( h, total, 99 ) / 1e6;
+    free( h );
+
+    if (wrong)
+    {
+        printf( "ERROR: %lu wrong response(s)!\n", (unsigned long) wrong );
+        failed++;
+    }
+
+    // (e.g. too few valid codes answered yet for the replays asked for:
+    //  then those just weren't tested, which mustn't pass unnoticed)
+
+    for (k=0; k < NUM_KINDS; k++)
+    {
+        if (total && sent[k] < total * g_mix[k] / 100.0 * LOAD_MIN_MIX)
+        {
+            printf( "ERROR: only %.1f%% of the requests were %s, not the %u%% --mix asked for!\n",
+                sent[k] * 100.0 / total, kind_names[k], g_mix[k] );
+            failed++;
+        }
+    }
+
+    if (rate < g_rate * LOAD_MIN_RATE)
+    {
+        printf( "ERROR: achieved rate %.0f /sec is under %.0f%% of the target!\n", rate, LOAD_MIN_RATE * 100 );
+        failed++;
+    }
+
+    if (g_max_p99 && p99 > g_max_p99)
+    {
+        printf( "ERROR: 99th percentile latency %.3f ms is over --max-p99 %g ms!\n", p99, g_max_p99 );
+        failed++;
+    }
+
+    return failed;
+}
+
+//---------------------------------------------------------------------
+//                              usage
+//---------------------------------------------------------------------
+
+static void usage()
+{
+    fprintf( stderr,
+
+        "\n  Fish's TOTP load generator, version " LOAD_VERSION ".\n\n"
+
+        "  Usage:  totpload [options]\n"
+        "          totpload [--secrets N] --write FILE\n\n"
+
+        "  Verifies a mix of valid, stale, replayed and garbage codes for\n"
+        "  N synthetic secrets at a fixed rate, in-process or against a\n"
+        "  running totpd, and reports the throughput and the latencies\n"
+        "  (measured from when each request was due).\n\n"
+
+        "  Options:\n\n"
+
+        "    --secrets N   Number of synthetic secrets (default 100000).\n\n"
+
+        "    --write FILE  Just write the secrets to FILE (for totpd --input).\n\n"
+
+        "    --socket PATH  Send the requests to the totpd listening on PATH\n"
+        "                  (which must have the same secrets) instead of\n"
+        "                  verifying them in-process.\n\n"
+
+        "    --rate N      Target requests per second (default 100000).\n\n"
+
+        "    --duration SECS  How long to send requests for (default 10).\n\n"
+
+        "    --connections N  Number of connections (in-process, threads)\n"
+        "                  sharing the load (default 4).\n\n"
+
+        "    --mix V,S,R,G  Percentages of valid, stale, replayed and\n"
+        "                  garbage codes (default 70,10,10,10).\n\n"
+
+        "    --max-p99 MS  Fail if the 99th percentile latency is over MS\n"
+        "                  milliseconds.\n\n"
+    );
+}
+
+static bool parse_mix( const char* p )
+{
+    unsigned  sum = 0;
+    char*     end;
+    int       k;
+
+    for (k=0; k < NUM_KINDS; k++, p = end + 1)
+    {
+        g_mix[k] = (unsigned) strtoul( p, &end, 10 );
+        sum += g_mix[k];
+
+        if (end == p || *end != (k < NUM_KINDS - 1 ? ',' : 0))
+            return false;
+    }
+
+    return sum == 100;
+}
+
+static bool parse_args( int argc, char* argv[] )
+{
+    int  i;
+
+    for (i=1; i < argc; i++)
+    {
+        if      (strcmp( argv[i], "--secrets"  ) == 0 && i+1 < argc) g_secrets = strtoul( argv[++i], NULL, 10 );
+        else if (strcmp( argv[i], "--write"    ) == 0 && i+1 < argc) g_write   = argv[++i];
+        else if (strcmp( argv[i], "--socket"   ) == 0 && i+1 < argc) g_socket  = argv[++i];
+        else if (strcmp( argv[i], "--rate"     ) == 0 && i+1 < argc) g_rate    = atof( argv[++i] );
+        else if (strcmp( argv[i], "--duration" ) == 0 && i+1 < argc) g_secs    = atof( argv[++i] );
+        else if (strcmp( argv[i], "--connections" ) == 0 && i+1 < argc) g_conns = atoi( argv[++i] );
+        else if (strcmp( argv[i], "--max-p99"  ) == 0 && i+1 < argc) g_max_p99 = atof( argv[++i] );
+        else if (strcmp( argv[i], "--mix"      ) == 0 && i+1 < argc)
+        {
+            if (!parse_mix( argv[++i] ))
+            {
+                fprintf( stderr, "ERROR: --mix must be four percentages adding up to 100\n" );
+                return false;
+            }
+        }
+        else
+        {
+            if (strcmp( argv[i], "--help" ) != 0 && strcmp( argv[i], "-h" ) != 0)
+                fprintf( stderr, "ERROR: unknown option \"%s\"\n", argv[i] );
+            usage();
+            return false;
+        }
+    }
+
+    if (g_conns < 1 || g_conns > LOAD_MAX_CONNS)
+    {
+        fprintf( stderr, "ERROR: --connections must be 1 to %d\n", LOAD_MAX_CONNS );
+        return false;
+    }
+
+    if (g_secrets < (size_t) g_conns || g_secrets > UINT32_MAX || g_rate <= 0 || g_secs <= 0)
+    {
+        fprintf( stderr, "ERROR: invalid --secrets, --rate or --duration\n" );
+        return false;
+    }
+
+    return true;
+}
+
+//---------------------------------------------------------------------
+//                           M A I N
+//---------------------------------------------------------------------
+
+int main( int argc, char* argv[] )
+{
+    size_t    total, i;
+    uint64_t  end;
+    int       n, failed;
+    conn*     c;
+
+    if (!parse_args( argc, argv ))
+        return EXIT_FAILURE;
+
+    if (g_write)
+    {
+        if (!write_secrets( g_write ))
+        {
+            fprintf( stderr, "ERROR: cannot write \"%s\" - %s\n", g_write, strerror( errno ));
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    printf( "\nFish's TOTP load generator, version " LOAD_VERSION ", sha = %s\n\n", totp_sha_backend() );
+
+    signal( SIGPIPE, SIG_IGN );     // (totpd going away is reported instead)
+
+    if (0
+        || !load_secrets()
+        || !(g_conn_list = (conn*) calloc( g_conns, sizeof( conn )))
+        || (!g_socket && !(g_replay = totp_replay_create( 4 * g_secrets, 86400 )))
+    )
+    {
+        fprintf( stderr, "ERROR: malloc() FAILED! - %s\n", strerror( errno ));
+        return EXIT_FAILURE;
+    }
+
+    total = (size_t) (g_rate * g_secs);
+
+    printf( "  %lu secrets, %.0f verifications per second for %g seconds, %s (%d %s)\n\n",
+        (unsigned long) g_secrets, g_rate, g_secs, g_socket ? g_socket : "in-process",
+        g_conns, g_socket ? "connections" : "threads" );
+
+    // Each connection's share of the requests and of the secrets...
+
+    for (n=0; n < g_conns; n++)
+    {
+        c = &g_conn_list[n];
+
+        c->n     = n;
+        c->fd    = -1;
+        c->rng   = BENCH_SEED + n;
+        c->total = total / g_conns + ((size_t) n < total % g_conns);
+        c->first = g_secrets * n / g_conns;
+        c->count = g_secrets * (n + 1) / g_conns - c->first;
+
+        if (c->total > (size_t) (LOAD_WINDOW + 1) * c->count)
+        {
+            fprintf( stderr, "ERROR: too few secrets: at most %d codes per secret are valid at once, "
+                "so --rate * --duration must be at most %lu\n",
+                LOAD_WINDOW + 1, (unsigned long) ((LOAD_WINDOW + 1) * g_secrets));
+            return EXIT_FAILURE;
+        }
+
+        if (g_socket && (0
+            || !(c->flights = (flight*) malloc( LOAD_FLIGHT * sizeof( flight )))
+            || (c->fd = open_socket( g_socket )) < 0
+        ))
+        {
+            fprintf( stderr, "ERROR: cannot connect to \"%s\" - %s\n", g_socket, strerror( errno ));
+            return EXIT_FAILURE;
+        }
+    }
+
+    // (the first request is due a moment from now, once all have started)
+
+    g_start = now_ns() + 10000000;
+
+    for (n=0; n < g_conns; n++)
+    {
+        c = &g_conn_list[n];
+
+        if (g_socket
+            ? (!thread_create( &c->reader, recv_thread, c ) || !thread_create( &c->thread, send_thread, c ))
+            : !thread_create( &c->thread, inproc_thread, c ))
+        {
+            fprintf( stderr, "ERROR: cannot start threads - %s\n", strerror( errno ));
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (end = g_start, failed = 0, n=0; n < g_conns; n++)
+    {
+        c = &g_conn_list[n];
+
+        thread_join( c->thread );
+
+        if (g_socket)
+        {
+            if (c->failed)
+                shutdown( c->fd, SHUT_RDWR );   // (so the reader stops too)
+
+            thread_join( c->reader );
+            close( c->fd );
+            free( c->flights );
+        }
+
+        if (c->failed || c->done < c->total)
+            failed++;
+
+        if (c->last > end)
+            end = c->last;
+    }
+
+    if (failed)
+        printf( "ERROR: %d connection(s) lost!\n\n", failed );
+
+    failed += report( (end - g_start) / 1e9 );
+
+    for (i=0; i < (size_t) g_conns; i++)
+        totp_cleanse( g_conn_list[i].recents, sizeof( g_conn_list[i].recents ));
+
+    free( g_conn_list );
+    totp_replay_destroy( g_replay );
+    totp_table_destroy( g_table );
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
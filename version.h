@@ -10,8 +10,8 @@
 #define VERMAJOR_NUM  1         /* MAJOR Release (program radically changed) */
 #define VERMAJOR_STR "1"
 
-#define VERINTER_NUM  2         /* Minor Enhancements (new/modified feature, etc) */
-#define VERINTER_STR "2"
+#define VERINTER_NUM  3         /* Minor Enhancements (new/modified feature, etc) */
+#define VERINTER_STR "3"
 
 #define VERMINOR_NUM  0         /* Bug Fix */
 #define VERMINOR_STR "0"